@@ -0,0 +1,19 @@
+#!/bin/sh
+#
+# Run the octet string micro benchmarks.
+
+set -e
+
+case "$1" in
+--fast) times=100000; shift ;;
+*) times=5000000 ;;
+esac
+
+test/test_octstr_bench -r $times 2>/dev/null |
+awk '{ printf "<row><entry>%s</entry><entry>%s</entry></row>\n", $1, $2 }' \
+    > bench_octstr.rows
+
+sed "s/#TIMES#/$times/g" benchmarks/bench_octstr.txt |
+sed "/#ROWS#/r bench_octstr.rows" | sed "/#ROWS#/d"
+
+rm -f bench_octstr.rows
@@ -0,0 +1,48 @@
+#!/bin/sh
+#
+# Use `test/test_http' to hammer the sendsms interface of smsbox from
+# several clients at once, for a few sizes of the sendsms-threads pool.
+
+set -e
+
+case "$1" in
+--fast) times=200; shift ;;
+*) times=5000 ;;
+esac
+
+clients=16
+pools="1 2 4 8"
+url="http://127.0.0.1:13013/cgi-bin/sendsms?from=123&to=234&text=bench&username=tester&password=foobar"
+
+. benchmarks/functions.inc
+
+rm -f bench_sendsms.rows
+for threads in $pools
+do
+    rm -f bench_sendsms_*.log
+    sed "s/#THREADS#/$threads/" benchmarks/bench_sendsms.conf > bench_sendsms.conf
+
+    gw/bearerbox -v 4 bench_sendsms.conf &
+    sleep 1
+    test/fakesmsc -H 127.0.0.1 -r 13015 -m 0 '123 234 text nop' \
+        2> bench_sendsms_smsc.log &
+    sleep 1
+    gw/smsbox -v 4 bench_sendsms.conf &
+    sleep 2
+
+    test/test_http -q -v 0 -t $clients -r $times "$url" \
+        2> bench_sendsms_http.log
+    test/test_http -q -v 4 "http://127.0.0.1:13000/shutdown?password=bar"
+    wait
+
+    check_for_errors bench_sendsms_*.log
+    awk -v threads=$threads '/requests\/s/ {
+            printf "<row><entry>%s</entry><entry>%d</entry></row>\n",
+                threads, $(NF-1)
+        }' bench_sendsms_http.log >> bench_sendsms.rows
+done
+
+sed "s/#TIMES#/$times/g; s/#CLIENTS#/$clients/g" benchmarks/bench_sendsms.txt |
+sed "/#ROWS#/r bench_sendsms.rows" | sed "/#ROWS#/d"
+
+rm -f bench_sendsms*.log bench_sendsms.rows bench_sendsms.conf
@@ -0,0 +1,213 @@
+/* ==================================================================== 
+ * The Kannel Software License, Version 1.0 
+ * 
+ * Copyright (c) 2001-2010 Kannel Group  
+ * Copyright (c) 1998-2001 WapIT Ltd.   
+ * All rights reserved. 
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions 
+ * are met: 
+ * 
+ * 1. Redistributions of source code must retain the above copyright 
+ *    notice, this list of conditions and the following disclaimer. 
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in 
+ *    the documentation and/or other materials provided with the 
+ *    distribution. 
+ * 
+ * 3. The end-user documentation included with the redistribution, 
+ *    if any, must include the following acknowledgment: 
+ *       "This product includes software developed by the 
+ *        Kannel Group (http://www.kannel.org/)." 
+ *    Alternately, this acknowledgment may appear in the software itself, 
+ *    if and wherever such third-party acknowledgments normally appear. 
+ * 
+ * 4. The names "Kannel" and "Kannel Group" must not be used to 
+ *    endorse or promote products derived from this software without 
+ *    prior written permission. For written permission, please  
+ *    contact org@kannel.org. 
+ * 
+ * 5. Products derived from this software may not be called "Kannel", 
+ *    nor may "Kannel" appear in their name, without prior written 
+ *    permission of the Kannel Group. 
+ * 
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESSED OR IMPLIED 
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES 
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+ * DISCLAIMED.  IN NO EVENT SHALL THE KANNEL GROUP OR ITS CONTRIBUTORS 
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,  
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT  
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR  
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,  
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE  
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,  
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. 
+ * ==================================================================== 
+ * 
+ * This software consists of voluntary contributions made by many 
+ * individuals on behalf of the Kannel Group.  For more information on  
+ * the Kannel Group, please see <http://www.kannel.org/>. 
+ * 
+ * Portions of this software are based upon software originally written at  
+ * WapIT Ltd., Helsinki, Finland for the Kannel project.  
+ */ 
+
+/*
+ * check_affinity.c - Check the thread count and CPU affinity settings
+ *
+ * Reads box-dispatch-threads and box-dispatch-cpus from a few small
+ * configurations, good and bad, the way bearerbox does. Then pins the
+ * main thread and a gwthread to a CPU they may run on, and checks that
+ * CPUs out of range are refused. Without pthread_setaffinity_np every
+ * pinning must fail, and callers carry on unpinned.
+ */
+
+#define _GNU_SOURCE
+
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "gwlib/gwlib.h"
+
+static struct {
+	char *threads;
+	char *cpus;	/* NULL to leave it out */
+	long threads_expected;	/* -1 if not a number */
+	long len_expected;	/* -1 if invalid */
+	long cpus_expected[4];
+} tests[] = {
+	{ "4", "0; 1;3", 4, 3, { 0, 1, 3 } },
+	{ "1", "2", 1, 1, { 2 } },
+	{ "2", NULL, 2, 0, { 0 } },
+	{ "x", "0;x", -1, -1, { 0 } },
+	{ "3", "1;-2", 3, -1, { 0 } },
+	{ "3", "2a", 3, -1, { 0 } },
+};
+
+static Cfg *read_config(char *threads, char *cpus)
+{
+	char name[] = "/tmp/check_affinity.XXXXXX";
+	Octstr *conf, *filename;
+	Cfg *cfg;
+	int fd;
+
+	conf = octstr_format("group = core\nbox-dispatch-threads = %s\n", threads);
+	if (cpus != NULL)
+		octstr_format_append(conf, "box-dispatch-cpus = \"%s\"\n", cpus);
+	if ((fd = mkstemp(name)) == -1)
+		panic(errno, "cannot create a configuration file");
+	if (octstr_write_to_socket(fd, conf) == -1)
+		panic(errno, "cannot write the configuration file");
+	close(fd);
+
+	filename = octstr_create(name);
+	cfg = cfg_create(filename);
+	if (cfg_read(cfg) == -1)
+		panic(0, "cannot read the configuration <%s>", octstr_get_cstr(conf));
+	unlink(name);
+	octstr_destroy(filename);
+	octstr_destroy(conf);
+	return cfg;
+}
+
+
+static void check_config(void)
+{
+	CfgGroup *grp;
+	Cfg *cfg;
+	long n, len, *cpus;
+	int i, j;
+
+	for (i = 0; i < (int) (sizeof(tests) / sizeof(tests[0])); i++) {
+		cfg = read_config(tests[i].threads, tests[i].cpus);
+		grp = cfg_get_single_group(cfg, octstr_imm("core"));
+
+		if (cfg_get_integer(&n, grp, octstr_imm("box-dispatch-threads")) == -1)
+			n = -1;
+		if (n != tests[i].threads_expected)
+			panic(0, "box-dispatch-threads <%s> read as %ld",
+			      tests[i].threads, n);
+
+		cpus = cfg_get_cpu_list(grp, octstr_imm("box-dispatch-cpus"), &len);
+		if (len != tests[i].len_expected)
+			panic(0, "box-dispatch-cpus <%s> gave %ld CPUs, not %ld",
+			      tests[i].cpus ? tests[i].cpus : "", len,
+			      tests[i].len_expected);
+		if ((len > 0) != (cpus != NULL))
+			panic(0, "box-dispatch-cpus <%s> gave %ld CPUs in %p",
+			      tests[i].cpus ? tests[i].cpus : "", len, (void *) cpus);
+		for (j = 0; j < len; j++)
+			if (cpus[j] != tests[i].cpus_expected[j])
+				panic(0, "box-dispatch-cpus <%s>: CPU %d is %ld",
+				      tests[i].cpus, j, cpus[j]);
+		gw_free(cpus);
+		cfg_destroy(cfg);
+	}
+}
+
+
+/* Return a CPU the calling thread may run on. */
+static long allowed_cpu(void)
+{
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+	cpu_set_t set;
+	long cpu;
+
+	if (pthread_getaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+		panic(0, "cannot get the thread's CPUs");
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+		if (CPU_ISSET(cpu, &set))
+			return cpu;
+	panic(0, "the thread may not run on any CPU");
+#endif
+	return 0;
+}
+
+
+static void check_pinning(void *arg)
+{
+	volatile long *pinned = arg;
+	long cpu;
+
+	cpu = allowed_cpu();
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+	if (gwthread_set_cpu(cpu) != 0)
+		panic(0, "thread %ld not pinned to CPU %ld", gwthread_self(), cpu);
+#else
+	if (gwthread_set_cpu(cpu) != -1)
+		panic(0, "thread %ld pinned without pthread_setaffinity_np",
+		      gwthread_self());
+#endif
+	if (gwthread_set_cpu(-1) != -1)
+		panic(0, "thread %ld pinned to CPU -1", gwthread_self());
+	if (gwthread_set_cpu(1L << 20) != -1)
+		panic(0, "thread %ld pinned to CPU %ld", gwthread_self(), 1L << 20);
+	*pinned = 1;
+}
+
+
+int main(void)
+{
+	volatile long pinned = 0;
+	long thread;
+
+	gwlib_init();
+	log_set_output_level(GW_PANIC);
+
+	check_config();
+
+	check_pinning((void *) &pinned);
+	pinned = 0;
+	if ((thread = gwthread_create(check_pinning, (void *) &pinned)) == -1)
+		panic(0, "cannot start a thread");
+	gwthread_join(thread);
+	if (!pinned)
+		panic(0, "thread was not checked");
+
+	gwlib_shutdown();
+	return 0;
+}
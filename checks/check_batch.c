@@ -0,0 +1,414 @@
+/* ==================================================================== 
+ * The Kannel Software License, Version 1.0 
+ * 
+ * Copyright (c) 2001-2010 Kannel Group  
+ * Copyright (c) 1998-2001 WapIT Ltd.   
+ * All rights reserved. 
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions 
+ * are met: 
+ * 
+ * 1. Redistributions of source code must retain the above copyright 
+ *    notice, this list of conditions and the following disclaimer. 
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in 
+ *    the documentation and/or other materials provided with the 
+ *    distribution. 
+ * 
+ * 3. The end-user documentation included with the redistribution, 
+ *    if any, must include the following acknowledgment: 
+ *       "This product includes software developed by the 
+ *        Kannel Group (http://www.kannel.org/)." 
+ *    Alternately, this acknowledgment may appear in the software itself, 
+ *    if and wherever such third-party acknowledgments normally appear. 
+ * 
+ * 4. The names "Kannel" and "Kannel Group" must not be used to 
+ *    endorse or promote products derived from this software without 
+ *    prior written permission. For written permission, please  
+ *    contact org@kannel.org. 
+ * 
+ * 5. Products derived from this software may not be called "Kannel", 
+ *    nor may "Kannel" appear in their name, without prior written 
+ *    permission of the Kannel Group. 
+ * 
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESSED OR IMPLIED 
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES 
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+ * DISCLAIMED.  IN NO EVENT SHALL THE KANNEL GROUP OR ITS CONTRIBUTORS 
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,  
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT  
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR  
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,  
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE  
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,  
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. 
+ * ==================================================================== 
+ * 
+ * This software consists of voluntary contributions made by many 
+ * individuals on behalf of the Kannel Group.  For more information on  
+ * the Kannel Group, please see <http://www.kannel.org/>. 
+ * 
+ * Portions of this software are based upon software originally written at  
+ * WapIT Ltd., Helsinki, Finland for the Kannel project.  
+ */ 
+
+/*
+ * check_batch.c - Check the batch and ack frames of box connections
+ *
+ * Round-trips batch frames of random messages and checks that truncated
+ * frames and frames with trailing data are rejected, packs and unpacks ack
+ * bitmaps over sequence numbers around 2^32, checks that no ordinary
+ * packed Msg looks like one of these frames, and runs random puts and
+ * takes on the table of sequence numbers awaiting their ack.
+ */
+
+#include <limits.h>
+
+#include "gwlib/gwlib.h"
+#include "gw/msg.h"
+#include "gw/shared.h"
+
+#define WIRE(seq) ((seq) & 0xffffffffL)
+
+
+static Octstr *random_octstr(long max) {
+	Octstr *os;
+	long i, len;
+
+	len = gw_rand() % (max + 1);
+	os = octstr_create("");
+	for (i = 0; i < len; i++)
+		octstr_append_char(os, gw_rand() & 0xff);
+	return os;
+}
+
+
+static Msg *random_msg(void) {
+	Msg *msg;
+
+	switch (gw_rand() % 5) {
+	case 0:
+		msg = msg_create(heartbeat);
+		msg->heartbeat.load = gw_rand() % 100;
+		break;
+	case 1:
+		msg = msg_create(admin);
+		msg->admin.command = gw_rand() % (cmd_batch + 1);
+		msg->admin.boxc_id = random_octstr(8);
+		break;
+	case 2:
+		msg = msg_create(ack);
+		msg->ack.nack = gw_rand() % 4;
+		msg->ack.time = gw_rand();
+		uuid_generate(msg->ack.id);
+		break;
+	case 3:
+		msg = msg_create(wdp_datagram);
+		msg->wdp_datagram.source_address = random_octstr(16);
+		msg->wdp_datagram.source_port = gw_rand() % 65536;
+		msg->wdp_datagram.user_data = random_octstr(200);
+		break;
+	default:
+		msg = msg_create(sms);
+		msg->sms.sender = random_octstr(16);
+		msg->sms.receiver = random_octstr(16);
+		msg->sms.msgdata = random_octstr(300);
+		msg->sms.time = gw_rand();
+		uuid_generate(msg->sms.id);
+		break;
+	}
+	return msg;
+}
+
+
+static void check_frame_type(void) {
+	Octstr *pack;
+	Msg *msg;
+	long i;
+
+	for (i = 0; i < 2000; i++) {
+		msg = random_msg();
+		pack = msg_pack(msg);
+		if (msg_frame_type(pack) != 0)
+			panic(0, "packed Msg of type %d taken for a frame", msg_type(msg));
+		octstr_destroy(pack);
+		msg_destroy(msg);
+	}
+
+	pack = msg_batch_create(0);
+	if (msg_frame_type(pack) != MSG_FRAME_BATCH)
+		panic(0, "batch frame not recognized");
+	octstr_truncate(pack, 3);
+	if (msg_frame_type(pack) != 0)
+		panic(0, "3 bytes taken for a frame");
+	octstr_destroy(pack);
+}
+
+
+static void append_integer(Octstr *os, long i) {
+	unsigned char buf[4];
+
+	encode_network_long(buf, i);
+	octstr_append_data(os, (char *) buf, 4);
+}
+
+
+/* Unpack `frame', which must fail, and check that `msgs' was left alone. */
+static void expect_invalid(Octstr *frame, List *msgs, char *what) {
+	long seq;
+
+	if (msg_batch_unpack(frame, msgs, &seq) != -1)
+		panic(0, "batch frame %s accepted", what);
+	if (gwlist_len(msgs) != 1)
+		panic(0, "batch frame %s left %ld messages", what, gwlist_len(msgs) - 1);
+}
+
+
+static void check_batch(void) {
+	Octstr *frame, *copy, *pack, *packs[10];
+	List *msgs;
+	Msg *msg, *first;
+	long ends[11];
+	long i, j, k, n, sent, seq, got;
+
+	first = msg_create(heartbeat);
+	for (i = 0; i < 300; i++) {
+		switch (i % 3) {
+		case 0: sent = 0xffffffffL - gw_rand() % 4; break;
+		case 1: sent = gw_rand() % 4; break;
+#if LONG_MAX > 0x7fffffffL
+		default: sent = ((long) (1 + gw_rand() % 3) << 32) + gw_rand(); break;
+#else
+		default: sent = gw_rand(); break;
+#endif
+		}
+
+		/* the end of the frame after the header and each message */
+		n = gw_rand() % 11;
+		frame = msg_batch_create(sent);
+		ends[0] = octstr_len(frame);
+		for (j = 0; j < n; j++) {
+			msg = random_msg();
+			msg_batch_append(frame, msg);
+			packs[j] = msg_pack(msg);
+			msg_destroy(msg);
+			ends[j + 1] = octstr_len(frame);
+		}
+		if (msg_frame_type(frame) != MSG_FRAME_BATCH)
+			panic(0, "batch frame not recognized");
+
+		/* something already in the list stays there */
+		msgs = gwlist_create();
+		gwlist_append(msgs, first);
+		if ((got = msg_batch_unpack(frame, msgs, &seq)) != n)
+			panic(0, "%ld messages unpacked, %ld packed", got, n);
+		if (seq != WIRE(sent) || gwlist_get(msgs, 0) != first)
+			panic(0, "batch frame unpacked wrong");
+		for (j = 0; j < n; j++) {
+			msg = gwlist_get(msgs, j + 1);
+			pack = msg_pack(msg);
+			if (octstr_compare(pack, packs[j]) != 0)
+				panic(0, "message %ld of %ld changed in the batch frame", j, n);
+			octstr_destroy(pack);
+			msg_destroy(msg);
+		}
+		if (n > 0)
+			gwlist_delete(msgs, 1, n);
+
+		/* cut anywhere but after a message, a frame is invalid */
+		k = 0;
+		for (j = 0; j < octstr_len(frame); j++) {
+			copy = octstr_copy(frame, 0, j);
+			if (k <= n && ends[k] == j) {
+				if (msg_batch_unpack(copy, msgs, &seq) != k)
+					panic(0, "batch frame cut after %ld messages rejected", k);
+				while (gwlist_len(msgs) > 1) {
+					msg_destroy(gwlist_get(msgs, 1));
+					gwlist_delete(msgs, 1, 1);
+				}
+				k++;
+			} else
+				expect_invalid(copy, msgs, "cut short");
+			octstr_destroy(copy);
+		}
+
+		/* trailing data after the last message */
+		copy = octstr_duplicate(frame);
+		for (j = 0; j < 1 + gw_rand() % 7; j++)
+			octstr_append_char(copy, gw_rand() & 0xff);
+		expect_invalid(copy, msgs, "with trailing data");
+		octstr_destroy(copy);
+
+		/* trailing data within the last message */
+		if (n > 0) {
+			copy = octstr_copy(frame, 0, ends[n - 1]);
+			append_integer(copy, octstr_len(packs[n - 1]) + 1);
+			octstr_append(copy, packs[n - 1]);
+			octstr_append_char(copy, 0);
+			expect_invalid(copy, msgs, "with trailing data in a message");
+			octstr_destroy(copy);
+		}
+
+		for (j = 0; j < n; j++)
+			octstr_destroy(packs[j]);
+		gwlist_destroy(msgs, NULL);
+		octstr_destroy(frame);
+	}
+	msg_destroy(first);
+}
+
+
+/*
+ * Ack `n' random sequence numbers out of `window' following `start', the
+ * full sequence number, and check that the frame brings back just these.
+ */
+static void check_acks_around(long start, long window, long n) {
+	Octstr *frame, *bitmap;
+	char *acked;
+	long *seqs;
+	long i, j, t, base, min;
+
+	acked = gw_malloc(window);
+	memset(acked, 0, window);
+	seqs = gw_malloc(n * sizeof(*seqs));
+	min = window;
+	for (i = 0; i < n; i++) {
+		/* not in order, so the first one isn't the lowest */
+		do
+			j = gw_rand() % window;
+		while (acked[j]);
+		acked[j] = 1;
+		seqs[i] = WIRE(start + j);
+		if (j < min)
+			min = j;
+	}
+	for (i = n - 1; i > 0; i--) {
+		j = gw_rand() % (i + 1);
+		t = seqs[i];
+		seqs[i] = seqs[j];
+		seqs[j] = t;
+	}
+
+	frame = msg_acks_pack(seqs, n);
+	if (msg_frame_type(frame) != MSG_FRAME_ACKS)
+		panic(0, "ack frame not recognized");
+	if (msg_acks_unpack(frame, &base, &bitmap) == -1)
+		panic(0, "ack frame rejected");
+	if (base != WIRE(start + min))
+		panic(0, "ack frame based at %ld, expected %ld", base, WIRE(start + min));
+
+	/* the box sent the ack for messages up to start + window */
+	base = msg_seq_widen(base, start + window + gw_rand() % 1000);
+	if (base != start + min)
+		panic(0, "ack base widened to %ld, expected %ld", base, start + min);
+	for (i = 0; i < octstr_len(bitmap) * 8; i++) {
+		j = base + i - start;
+		if (((octstr_get_char(bitmap, i / 8) >> (i % 8)) & 1) !=
+		    (j < window && acked[j]))
+			panic(0, "sequence number %ld acked wrong", start + j);
+		if (j < window)
+			acked[j] = 0;
+	}
+	for (j = 0; j < window; j++)
+		if (acked[j])
+			panic(0, "sequence number %ld not in the ack frame", start + j);
+
+	octstr_destroy(bitmap);
+	octstr_destroy(frame);
+	gw_free(seqs);
+	gw_free(acked);
+}
+
+
+static void check_acks(void) {
+	Octstr *frame, *bitmap;
+	long i, base, window, seq;
+
+	for (i = 0; i < 500; i++) {
+		window = 1 + gw_rand() % 2000;
+#if LONG_MAX > 0x7fffffffL
+		/* sequence numbers across one of the first wraps of the wire's */
+		check_acks_around(((long) (1 + gw_rand() % 3) << 32) - gw_rand() % (window + 8),
+		                  window, 1 + gw_rand() % window);
+#endif
+		check_acks_around(gw_rand() % 1000, window, 1 + gw_rand() % window);
+	}
+
+	seq = 7;
+	frame = msg_acks_pack(&seq, 1);
+	octstr_append_char(frame, 0);
+	if (msg_acks_unpack(frame, &base, &bitmap) != -1)
+		panic(0, "ack frame with trailing data accepted");
+	for (i = octstr_len(frame) - 2; i >= 0; i--) {
+		octstr_truncate(frame, i);
+		if (msg_acks_unpack(frame, &base, &bitmap) != -1)
+			panic(0, "ack frame cut to %ld bytes accepted", i);
+	}
+	octstr_destroy(frame);
+	frame = msg_batch_create(0);
+	if (msg_acks_unpack(frame, &base, &bitmap) != -1)
+		panic(0, "batch frame taken for an ack frame");
+	octstr_destroy(frame);
+}
+
+
+#define IDS 3000
+
+static void check_seqs(void) {
+	BatchSeqs *table;
+	uuid_t ids[IDS];
+	long seqs[IDS];     /* -1 if not in the table */
+	long i, j, len, seq;
+
+	table = batch_seqs_create();
+	for (i = 0; i < IDS; i++) {
+		uuid_generate(ids[i]);
+		seqs[i] = -1;
+	}
+
+	/* grow to most of the ids, shrink, and so on, in random order */
+	len = 0;
+	for (i = 0; i < 200000; i++) {
+		j = gw_rand() % IDS;
+		if (seqs[j] == -1 && (i / 20000) % 2 == 0) {
+			seqs[j] = WIRE(gw_rand());
+			batch_seq_put(table, ids[j], seqs[j]);
+			len++;
+		} else if ((seq = batch_seq_take(table, ids[j])) != seqs[j])
+			panic(0, "took sequence number %ld, expected %ld", seq, seqs[j]);
+		else if (seq != -1) {
+			seqs[j] = -1;
+			len--;
+		}
+		if (batch_seqs_len(table) != len)
+			panic(0, "table has %ld entries, expected %ld",
+			      batch_seqs_len(table), len);
+	}
+
+	for (j = 0; j < IDS; j++) {
+		if (batch_seq_take(table, ids[j]) != seqs[j])
+			panic(0, "sequence number of id %ld lost", j);
+		if (batch_seq_take(table, ids[j]) != -1)
+			panic(0, "id %ld taken twice", j);
+	}
+	if (batch_seqs_len(table) != 0)
+		panic(0, "table not empty");
+	batch_seqs_destroy(table);
+}
+
+
+int main(void) {
+	gwlib_init();
+	log_set_output_level(GW_PANIC);
+
+	check_frame_type();
+	check_batch();
+	check_acks();
+	check_seqs();
+
+	gwlib_shutdown();
+
+	return 0;
+}
@@ -0,0 +1,166 @@
+/* ==================================================================== 
+ * The Kannel Software License, Version 1.0 
+ * 
+ * Copyright (c) 2001-2010 Kannel Group  
+ * Copyright (c) 1998-2001 WapIT Ltd.   
+ * All rights reserved. 
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions 
+ * are met: 
+ * 
+ * 1. Redistributions of source code must retain the above copyright 
+ *    notice, this list of conditions and the following disclaimer. 
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in 
+ *    the documentation and/or other materials provided with the 
+ *    distribution. 
+ * 
+ * 3. The end-user documentation included with the redistribution, 
+ *    if any, must include the following acknowledgment: 
+ *       "This product includes software developed by the 
+ *        Kannel Group (http://www.kannel.org/)." 
+ *    Alternately, this acknowledgment may appear in the software itself, 
+ *    if and wherever such third-party acknowledgments normally appear. 
+ * 
+ * 4. The names "Kannel" and "Kannel Group" must not be used to 
+ *    endorse or promote products derived from this software without 
+ *    prior written permission. For written permission, please  
+ *    contact org@kannel.org. 
+ * 
+ * 5. Products derived from this software may not be called "Kannel", 
+ *    nor may "Kannel" appear in their name, without prior written 
+ *    permission of the Kannel Group. 
+ * 
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESSED OR IMPLIED 
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES 
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+ * DISCLAIMED.  IN NO EVENT SHALL THE KANNEL GROUP OR ITS CONTRIBUTORS 
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,  
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT  
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR  
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,  
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE  
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,  
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. 
+ * ==================================================================== 
+ * 
+ * This software consists of voluntary contributions made by many 
+ * individuals on behalf of the Kannel Group.  For more information on  
+ * the Kannel Group, please see <http://www.kannel.org/>. 
+ * 
+ * Portions of this software are based upon software originally written at  
+ * WapIT Ltd., Helsinki, Finland for the Kannel project.  
+ */ 
+
+/*
+ * check_dns.c - Check the DNS cache
+ *
+ * Resolves localhost, which every system has in its hosts file, and a
+ * name in the reserved .invalid domain, which never resolves, and checks
+ * that the second lookups are answered from the cache. Then turns the
+ * negative cache off and checks that the failure still reaches the
+ * callback, but isn't remembered. Finally resolves more distinct names
+ * than the cache holds, and checks that it stays bounded and keeps the
+ * latest answers.
+ */
+
+#include "gwlib/gwlib.h"
+
+#define BAD_NAME "no-such-host.invalid"
+#define UNCACHED_NAME "not-remembered.invalid"
+#define MANY_NAMES 10000
+#define CACHE_MAX 4096
+
+static Counter *callbacks;
+static volatile long resolved_ok = -1;
+
+static void resolved(Octstr *name, int ok, void *data) {
+	resolved_ok = ok;
+	counter_increase(callbacks);
+}
+
+
+int main(void) {
+	struct in_addr *addrs;
+	Octstr *bad;
+	DNSStats stats;
+	unsigned long hits;
+	char name[64];
+	int i, n;
+
+	gwlib_init();
+	log_set_output_level(GW_PANIC);
+	callbacks = counter_create();
+	bad = octstr_create(BAD_NAME);
+
+	if (gw_dns_resolve("127.0.0.1", &addrs) != 1 ||
+	    addrs[0].s_addr != htonl(INADDR_LOOPBACK))
+		panic(0, "numeric address not parsed");
+	gw_free(addrs);
+
+	if ((n = gw_dns_resolve("localhost", &addrs)) < 1)
+		panic(0, "localhost did not resolve");
+	gw_free(addrs);
+	if (gw_dns_resolve("localhost", &addrs) != n)
+		panic(0, "localhost resolved differently from the cache");
+	gw_free(addrs);
+	if (gw_dns_resolve_async(octstr_imm("localhost"), resolved, NULL) != 1)
+		panic(0, "cached localhost looked up again");
+
+	if (gw_dns_resolve_async(bad, resolved, NULL) == 0) {
+		while (counter_value(callbacks) == 0)
+			gwthread_sleep(0.01);
+		if (resolved_ok != 0)
+			panic(0, BAD_NAME " resolved");
+	}
+	if (gw_dns_resolve(BAD_NAME, &addrs) != -1 || addrs != NULL)
+		panic(0, BAD_NAME " resolved");
+
+	gw_dns_stats(&stats);
+	if (stats.entries != 2 || stats.pending != 0 || stats.misses != 2 ||
+	    stats.hits != 2 || stats.negative_hits != 1)
+		panic(0, "wrong stats: %ld entries, %ld pending, %lu misses, "
+		      "%lu hits, %lu negative", stats.entries, stats.pending,
+		      stats.misses, stats.hits, stats.negative_hits);
+
+	gw_dns_set_ttl(300, 0);
+	octstr_destroy(bad);
+	bad = octstr_create(UNCACHED_NAME);
+	resolved_ok = -1;
+	if (gw_dns_resolve_async(bad, resolved, NULL) == 1)
+		panic(0, UNCACHED_NAME " found in the cache");
+	while (counter_value(callbacks) < 2)
+		gwthread_sleep(0.01);
+	if (resolved_ok != 0)
+		panic(0, UNCACHED_NAME " resolved");
+	if (gw_dns_resolve_async(bad, resolved, NULL) == 1)
+		panic(0, UNCACHED_NAME " cached with dns-negative-cache-ttl 0");
+	while (counter_value(callbacks) < 3)
+		gwthread_sleep(0.01);
+
+	gw_dns_set_ttl(300, 300);
+	for (i = 0; i < MANY_NAMES; i++) {
+		sprintf(name, "host%d.invalid", i);
+		if (gw_dns_resolve(name, &addrs) != -1)
+			panic(0, "%s resolved", name);
+		gw_dns_stats(&stats);
+		if (stats.entries > CACHE_MAX)
+			panic(0, "%ld names in the cache", stats.entries);
+	}
+	hits = stats.negative_hits;
+	for (i = MANY_NAMES - 100; i < MANY_NAMES; i++) {
+		sprintf(name, "host%d.invalid", i);
+		gw_dns_resolve(name, &addrs);
+	}
+	gw_dns_stats(&stats);
+	if (stats.negative_hits != hits + 100)
+		panic(0, "latest names not kept in the cache");
+
+	octstr_destroy(bad);
+	counter_destroy(callbacks);
+	gwlib_shutdown();
+
+	return 0;
+}
@@ -0,0 +1,191 @@
+/* ==================================================================== 
+ * The Kannel Software License, Version 1.0 
+ * 
+ * Copyright (c) 2001-2010 Kannel Group  
+ * Copyright (c) 1998-2001 WapIT Ltd.   
+ * All rights reserved. 
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions 
+ * are met: 
+ * 
+ * 1. Redistributions of source code must retain the above copyright 
+ *    notice, this list of conditions and the following disclaimer. 
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in 
+ *    the documentation and/or other materials provided with the 
+ *    distribution. 
+ * 
+ * 3. The end-user documentation included with the redistribution, 
+ *    if any, must include the following acknowledgment: 
+ *       "This product includes software developed by the 
+ *        Kannel Group (http://www.kannel.org/)." 
+ *    Alternately, this acknowledgment may appear in the software itself, 
+ *    if and wherever such third-party acknowledgments normally appear. 
+ * 
+ * 4. The names "Kannel" and "Kannel Group" must not be used to 
+ *    endorse or promote products derived from this software without 
+ *    prior written permission. For written permission, please  
+ *    contact org@kannel.org. 
+ * 
+ * 5. Products derived from this software may not be called "Kannel", 
+ *    nor may "Kannel" appear in their name, without prior written 
+ *    permission of the Kannel Group. 
+ * 
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESSED OR IMPLIED 
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES 
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+ * DISCLAIMED.  IN NO EVENT SHALL THE KANNEL GROUP OR ITS CONTRIBUTORS 
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,  
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT  
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR  
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,  
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE  
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,  
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. 
+ * ==================================================================== 
+ * 
+ * This software consists of voluntary contributions made by many 
+ * individuals on behalf of the Kannel Group.  For more information on  
+ * the Kannel Group, please see <http://www.kannel.org/>. 
+ * 
+ * Portions of this software are based upon software originally written at  
+ * WapIT Ltd., Helsinki, Finland for the Kannel project.  
+ */ 
+
+/*
+ * check_numhash.c - Check the number sets used for white and black lists
+ *
+ * Loads a list with comments, duplicates and numbers written in various
+ * ways from a local file, checks which numbers are found, then reloads
+ * a different list while other threads keep searching.
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "gwlib/gwlib.h"
+#include "gw/numhash.h"
+
+#define SEARCHERS 4
+
+static char *list1 =
+	"# test list\n"
+	"+358 40 1234\n"
+	"040-5678 : comment\n"
+	"\n"
+	"12345678901234567890123\n"
+	"358401234\n"
+	"99999999999\n"
+	"4294967296\n"
+	"4294967295";	/* no linefeed at the end */
+
+static struct {
+	char *number;
+	int found;
+} tests[] = {
+	{ "358401234", 1 },
+	{ "+358401234", 1 },
+	{ "0405678", 1 },
+	{ "405678", 1 },
+	{ "0405679", 0 },
+	{ "99999999999", 1 },
+	{ "9999999999", 0 },
+	{ "4294967296", 1 },
+	{ "4294967295", 1 },
+	{ "4294967297", 0 },
+	{ "0", 0 },
+	{ "99912345678901234567890123", 1 },	/* the same last 19 digits */
+	{ NULL, 0 }
+};
+
+static Numhash *table;
+static volatile long reloaded;
+static volatile long errors;
+
+
+static void write_list(char *filename, char *list) {
+	FILE *f;
+
+	if ((f = fopen(filename, "w")) == NULL)
+		panic(errno, "cannot write %s", filename);
+	fputs(list, f);
+	fclose(f);
+}
+
+
+static void searcher(void *arg) {
+	Octstr *both, *new;
+
+	both = octstr_create("358401234");
+	new = octstr_create("1000");
+	/* a number on both lists is found all the time */
+	while (!gw_atomic_get(&reloaded)) {
+		if (numhash_find_number(table, both) != 1)
+			gw_atomic_inc(&errors);
+	}
+	if (numhash_find_number(table, new) != 1)
+		gw_atomic_inc(&errors);
+	octstr_destroy(both);
+	octstr_destroy(new);
+}
+
+
+int main(void) {
+	char filename[] = "/tmp/check_numhash.XXXXXX";
+	Octstr *os, *url;
+	long i, threads[SEARCHERS];
+	int fd;
+
+	gwlib_init();
+	log_set_output_level(GW_PANIC);
+
+	if ((fd = mkstemp(filename)) == -1)
+		panic(errno, "cannot create a temporary file");
+	close(fd);
+	write_list(filename, list1);
+
+	if (numhash_create("/nonexistent/check_numhash") != NULL)
+		panic(0, "created a table from a missing file");
+
+	url = octstr_format("file://%s", filename);
+	if ((table = numhash_create(octstr_get_cstr(url))) == NULL)
+		panic(0, "cannot load %s", octstr_get_cstr(url));
+	octstr_destroy(url);
+	if (numhash_size(table) != 6)
+		panic(0, "table has %d numbers, expected 6", numhash_size(table));
+
+	for (i = 0; tests[i].number != NULL; i++) {
+		os = octstr_create(tests[i].number);
+		if (numhash_find_number(table, os) != tests[i].found)
+			panic(0, "number %s found %d, expected %d", tests[i].number,
+			      numhash_find_number(table, os), tests[i].found);
+		octstr_destroy(os);
+	}
+
+	for (i = 0; i < SEARCHERS; i++)
+		threads[i] = gwthread_create(searcher, NULL);
+	gwthread_sleep(0.1);
+
+	/* a failed reload keeps the old numbers */
+	unlink(filename);
+	if (numhash_reload(table) != -1 || numhash_size(table) != 6)
+		panic(0, "failed reload changed the table");
+
+	write_list(filename, "1000\n358401234\n");
+	if (numhash_reload(table) != 0 || numhash_size(table) != 2)
+		panic(0, "reload did not replace the numbers");
+	gw_atomic_set(&reloaded, 1);
+	for (i = 0; i < SEARCHERS; i++)
+		gwthread_join(threads[i]);
+	if (errors > 0)
+		panic(0, "%ld searches saw a wrong list during the reload", errors);
+
+	numhash_destroy(table);
+	unlink(filename);
+	gwlib_shutdown();
+
+	return 0;
+}
@@ -58,6 +58,7 @@
  * check_octstr.c - checking of octet string functions
  */
 
+#include <stdio.h>
 #include <string.h>
 
 #include "gwlib/gwlib.h"
@@ -111,11 +112,42 @@ static void check_comparisons(void)
 }
 
 
+OCTSTR_STATIC(static_os, "static immutable");
+
+static void check_immutables(void)
+{
+    /* more than fit into the initial table, to force it to grow */
+    static char names[5000][16];
+    static Octstr *imms[5000];
+    int i;
+
+    for (i = 0; i < 5000; ++i) {
+        sprintf(names[i], "imm-%d", i);
+        imms[i] = octstr_imm(names[i]);
+    }
+    for (i = 0; i < 5000; ++i) {
+        if (octstr_imm(names[i]) != imms[i])
+            panic(0, "octstr_imm returned a new object for `%s'", names[i]);
+        if (octstr_str_compare(imms[i], names[i]) != 0)
+            panic(0, "octstr_imm mangled `%s'", names[i]);
+    }
+
+    if (octstr_len(static_os) != 16 ||
+        octstr_str_compare(static_os, "static immutable") != 0)
+        panic(0, "OCTSTR_STATIC produced a broken octet string");
+    if (octstr_hash_key(static_os) !=
+        octstr_hash_key(octstr_imm("static immutable")))
+        panic(0, "hash keys of static and interned immutables differ");
+    octstr_destroy(static_os);
+}
+
+
 int main(void)
 {
     gwlib_init();
     log_set_output_level(GW_INFO);
     check_comparisons();
+    check_immutables();
     gwlib_shutdown();
     return 0;
 }
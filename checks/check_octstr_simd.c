@@ -0,0 +1,173 @@
+/* ==================================================================== 
+ * The Kannel Software License, Version 1.0 
+ * 
+ * Copyright (c) 2001-2010 Kannel Group  
+ * Copyright (c) 1998-2001 WapIT Ltd.   
+ * All rights reserved. 
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions 
+ * are met: 
+ * 
+ * 1. Redistributions of source code must retain the above copyright 
+ *    notice, this list of conditions and the following disclaimer. 
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in 
+ *    the documentation and/or other materials provided with the 
+ *    distribution. 
+ * 
+ * 3. The end-user documentation included with the redistribution, 
+ *    if any, must include the following acknowledgment: 
+ *       "This product includes software developed by the 
+ *        Kannel Group (http://www.kannel.org/)." 
+ *    Alternately, this acknowledgment may appear in the software itself, 
+ *    if and wherever such third-party acknowledgments normally appear. 
+ * 
+ * 4. The names "Kannel" and "Kannel Group" must not be used to 
+ *    endorse or promote products derived from this software without 
+ *    prior written permission. For written permission, please  
+ *    contact org@kannel.org. 
+ * 
+ * 5. Products derived from this software may not be called "Kannel", 
+ *    nor may "Kannel" appear in their name, without prior written 
+ *    permission of the Kannel Group. 
+ * 
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESSED OR IMPLIED 
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES 
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+ * DISCLAIMED.  IN NO EVENT SHALL THE KANNEL GROUP OR ITS CONTRIBUTORS 
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,  
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT  
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR  
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,  
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE  
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,  
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. 
+ * ==================================================================== 
+ * 
+ * This software consists of voluntary contributions made by many 
+ * individuals on behalf of the Kannel Group.  For more information on  
+ * the Kannel Group, please see <http://www.kannel.org/>. 
+ * 
+ * Portions of this software are based upon software originally written at  
+ * WapIT Ltd., Helsinki, Finland for the Kannel project.  
+ */ 
+
+/*
+ * check_octstr_simd.c - check that all octstr kernel sets agree
+ *
+ * Runs every kernel set the CPU supports on pseudo-random inputs and
+ * compares the results with those of the plain C set. Lengths and
+ * alignments are varied so that the vector loops and their tails all
+ * get exercised.
+ */
+
+#include <string.h>
+
+#include "gwlib/gwlib.h"
+#include "gwlib/octstr-simd.h"
+
+#define ROUNDS 20000
+#define MAXLEN 300
+
+static unsigned long seed = 1;
+
+static int rnd(void)
+{
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 16) & 0x7fff;
+}
+
+
+/* Fill `buf' with octets biased towards the interesting ones. */
+static void fill(unsigned char *buf, long len)
+{
+    static const char alpha[] = "aAbBzZ%+ 09fFgG-_.!~*'()/\001\377";
+    long i;
+    int kind;
+
+    kind = rnd() % 3;
+    for (i = 0; i < len; ++i) {
+        if (kind == 0)
+            buf[i] = rnd() & 0xff;
+        else if (kind == 1)
+            buf[i] = alpha[rnd() % (sizeof(alpha) - 1)];
+        else
+            buf[i] = "0123456789abcdefABCDEF"[rnd() % 22];
+    }
+}
+
+
+static void check_set(const OctstrKernels *c, const OctstrKernels *k)
+{
+    unsigned char hay[MAXLEN + 64], needle[16];
+    unsigned char out1[MAXLEN * 2 + 64], out2[MAXLEN * 2 + 64];
+    long n, len, nlen, off, r1, r2, s1, s2;
+
+    for (n = 0; n < ROUNDS; ++n) {
+        len = rnd() % MAXLEN;
+        off = rnd() % 32;
+        fill(hay + off, len);
+
+        /* needles taken from the haystack are found at least once */
+        nlen = rnd() % 8 + 2;
+        if (len >= nlen && rnd() % 2)
+            memcpy(needle, hay + off + rnd() % (len - nlen + 1), nlen);
+        else
+            fill(needle, nlen);
+
+        r1 = c->search(hay + off, len, needle, nlen);
+        r2 = k->search(hay + off, len, needle, nlen);
+        if (r1 != r2)
+            panic(0, "%s search: %ld != %ld", k->name, r2, r1);
+
+        r1 = c->case_search(hay + off, len, needle, nlen - 1);
+        r2 = k->case_search(hay + off, len, needle, nlen - 1);
+        if (r1 != r2)
+            panic(0, "%s case_search: %ld != %ld", k->name, r2, r1);
+
+        r1 = c->url_unsafe(hay + off, len, &s1);
+        r2 = k->url_unsafe(hay + off, len, &s2);
+        if (r1 != r2 || s1 != s2)
+            panic(0, "%s url_unsafe: %ld/%ld != %ld/%ld", k->name,
+                  r2, s2, r1, s1);
+
+        r1 = c->url_special(hay + off, len);
+        r2 = k->url_special(hay + off, len);
+        if (r1 != r2)
+            panic(0, "%s url_special: %ld != %ld", k->name, r2, r1);
+
+        memset(out1, 0, sizeof(out1));
+        memset(out2, 0, sizeof(out2));
+        r1 = c->hex_decode(out1, hay + off, len);
+        r2 = k->hex_decode(out2, hay + off, len);
+        if (r1 != r2 || memcmp(out1, out2, sizeof(out1)) != 0)
+            panic(0, "%s hex_decode differs for length %ld", k->name, len);
+
+        memset(out1, 0, sizeof(out1));
+        memset(out2, 0, sizeof(out2));
+        c->base64_encode(out1, hay + off, len / 3, len);
+        k->base64_encode(out2, hay + off, len / 3, len);
+        if (memcmp(out1, out2, sizeof(out1)) != 0)
+            panic(0, "%s base64_encode differs for length %ld", k->name, len);
+    }
+}
+
+
+int main(void)
+{
+    const OctstrKernels *k;
+    int i;
+
+    gwlib_init();
+    log_set_output_level(GW_INFO);
+
+    for (i = 1; (k = octstr_kernels_get(i)) != NULL; ++i) {
+        debug("check", 0, "Checking octstr kernels <%s>.", k->name);
+        check_set(octstr_kernels_get(0), k);
+    }
+
+    gwlib_shutdown();
+    return 0;
+}
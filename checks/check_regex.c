@@ -0,0 +1,154 @@
+/* ==================================================================== 
+ * The Kannel Software License, Version 1.0 
+ * 
+ * Copyright (c) 2001-2010 Kannel Group  
+ * Copyright (c) 1998-2001 WapIT Ltd.   
+ * All rights reserved. 
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions 
+ * are met: 
+ * 
+ * 1. Redistributions of source code must retain the above copyright 
+ *    notice, this list of conditions and the following disclaimer. 
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in 
+ *    the documentation and/or other materials provided with the 
+ *    distribution. 
+ * 
+ * 3. The end-user documentation included with the redistribution, 
+ *    if any, must include the following acknowledgment: 
+ *       "This product includes software developed by the 
+ *        Kannel Group (http://www.kannel.org/)." 
+ *    Alternately, this acknowledgment may appear in the software itself, 
+ *    if and wherever such third-party acknowledgments normally appear. 
+ * 
+ * 4. The names "Kannel" and "Kannel Group" must not be used to 
+ *    endorse or promote products derived from this software without 
+ *    prior written permission. For written permission, please  
+ *    contact org@kannel.org. 
+ * 
+ * 5. Products derived from this software may not be called "Kannel", 
+ *    nor may "Kannel" appear in their name, without prior written 
+ *    permission of the Kannel Group. 
+ * 
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESSED OR IMPLIED 
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES 
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+ * DISCLAIMED.  IN NO EVENT SHALL THE KANNEL GROUP OR ITS CONTRIBUTORS 
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,  
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT  
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR  
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,  
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE  
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,  
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. 
+ * ==================================================================== 
+ * 
+ * This software consists of voluntary contributions made by many 
+ * individuals on behalf of the Kannel Group.  For more information on  
+ * the Kannel Group, please see <http://www.kannel.org/>. 
+ * 
+ * Portions of this software are based upon software originally written at  
+ * WapIT Ltd., Helsinki, Finland for the Kannel project.  
+ */ 
+
+/*
+ * check_regex.c - Check matching of pre-compiled regular expressions
+ *
+ * Several threads match a set of subjects, short ones that are
+ * remembered and long ones that are not, against a few expressions,
+ * and check that the results stay right while the memos fill up and
+ * entries get replaced. Then checks the counters.
+ */
+
+#include "gwlib/gwlib.h"
+#include "gwlib/regex.h"
+
+#define THREADS 4
+#define ROUNDS 200
+#define SUBJECTS 200
+#define PATTERNS 3
+
+static char *patterns[PATTERNS] = { "^358", "^(smsc|SMSC)[0-9]+$", "[13579]$" };
+
+static regex_t *regexes[PATTERNS];
+static Octstr *subjects[SUBJECTS];
+static int expected[PATTERNS][SUBJECTS];
+static volatile long errors;
+
+
+static int slow_match(char *pattern, Octstr *subject) {
+	return gw_regex_match(octstr_imm(pattern), subject);
+}
+
+
+static void matcher(void *arg) {
+	long round, i, j;
+
+	for (round = 0; round < ROUNDS; round++) {
+		for (i = 0; i < SUBJECTS; i++) {
+			for (j = 0; j < PATTERNS; j++) {
+				if (gw_regex_match_pre(regexes[j], subjects[i]) != expected[j][i])
+					gw_atomic_inc(&errors);
+			}
+		}
+	}
+}
+
+
+int main(void) {
+	long i, j, threads[THREADS];
+	RegexStats stats;
+
+	gwlib_init();
+	log_set_output_level(GW_INFO);
+
+	for (i = 0; i < SUBJECTS; i++) {
+		switch (i % 4) {
+		case 0:
+			subjects[i] = octstr_format("358%07ld", i * 7919);
+			break;
+		case 1:
+			subjects[i] = octstr_format("smsc%ld", i);
+			break;
+		case 2:
+			subjects[i] = octstr_format("SMSC%ldx", i);
+			break;
+		default:
+			/* too long to be remembered */
+			subjects[i] = octstr_format("358%060ld", i);
+			break;
+		}
+	}
+	for (j = 0; j < PATTERNS; j++) {
+		if ((regexes[j] = gw_regex_comp(octstr_imm(patterns[j]), REG_EXTENDED)) == NULL)
+			panic(0, "cannot compile %s", patterns[j]);
+		for (i = 0; i < SUBJECTS; i++)
+			expected[j][i] = slow_match(patterns[j], subjects[i]);
+	}
+
+	for (i = 0; i < THREADS; i++)
+		threads[i] = gwthread_create(matcher, NULL);
+	for (i = 0; i < THREADS; i++)
+		gwthread_join(threads[i]);
+	if (errors > 0)
+		panic(0, "%ld matches gave a wrong result", errors);
+
+	gw_regex_stats(&stats);
+	if (stats.evaluations != (unsigned long) THREADS * ROUNDS * SUBJECTS * PATTERNS)
+		panic(0, "counted %lu evaluations, expected %ld", stats.evaluations,
+		      (long) THREADS * ROUNDS * SUBJECTS * PATTERNS);
+	if (stats.memo_hits == 0 || stats.memo_hits >= stats.evaluations)
+		panic(0, "%lu memo hits of %lu evaluations", stats.memo_hits,
+		      stats.evaluations);
+
+	for (j = 0; j < PATTERNS; j++)
+		gw_regex_destroy(regexes[j]);
+	for (i = 0; i < SUBJECTS; i++)
+		octstr_destroy(subjects[i]);
+	gwlib_shutdown();
+
+	return 0;
+}
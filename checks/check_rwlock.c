@@ -0,0 +1,135 @@
+/* ==================================================================== 
+ * The Kannel Software License, Version 1.0 
+ * 
+ * Copyright (c) 2001-2010 Kannel Group  
+ * Copyright (c) 1998-2001 WapIT Ltd.   
+ * All rights reserved. 
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions 
+ * are met: 
+ * 
+ * 1. Redistributions of source code must retain the above copyright 
+ *    notice, this list of conditions and the following disclaimer. 
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in 
+ *    the documentation and/or other materials provided with the 
+ *    distribution. 
+ * 
+ * 3. The end-user documentation included with the redistribution, 
+ *    if any, must include the following acknowledgment: 
+ *       "This product includes software developed by the 
+ *        Kannel Group (http://www.kannel.org/)." 
+ *    Alternately, this acknowledgment may appear in the software itself, 
+ *    if and wherever such third-party acknowledgments normally appear. 
+ * 
+ * 4. The names "Kannel" and "Kannel Group" must not be used to 
+ *    endorse or promote products derived from this software without 
+ *    prior written permission. For written permission, please  
+ *    contact org@kannel.org. 
+ * 
+ * 5. Products derived from this software may not be called "Kannel", 
+ *    nor may "Kannel" appear in their name, without prior written 
+ *    permission of the Kannel Group. 
+ * 
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESSED OR IMPLIED 
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES 
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+ * DISCLAIMED.  IN NO EVENT SHALL THE KANNEL GROUP OR ITS CONTRIBUTORS 
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,  
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT  
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR  
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,  
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE  
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,  
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. 
+ * ==================================================================== 
+ * 
+ * This software consists of voluntary contributions made by many 
+ * individuals on behalf of the Kannel Group.  For more information on  
+ * the Kannel Group, please see <http://www.kannel.org/>. 
+ * 
+ * Portions of this software are based upon software originally written at  
+ * WapIT Ltd., Helsinki, Finland for the Kannel project.  
+ */ 
+
+/*
+ * check_rwlock.c - Check that reader biased RWLocks exclude writers
+ *
+ * Some threads read two values under a read lock and check that they
+ * are equal, while other threads change both values under the write
+ * lock, with a sleep in between to give readers a chance to see a half
+ * done update. Every other read takes the read lock a second time while
+ * holding it, which must not wait for a writer that waits for us.
+ */
+
+#ifndef READERS
+#define READERS 16
+#endif
+
+#ifndef WRITERS
+#define WRITERS 2
+#endif
+
+#ifndef PER_THREAD
+#define PER_THREAD (200000)
+#endif
+
+#include "gwlib/gwlib.h"
+
+static RWLock *lock;
+static volatile long first, second;
+
+static void reader(void *arg) {
+	long i, a, b;
+
+	for (i = 0; i < PER_THREAD; ++i) {
+		gw_rwlock_rdlock(lock);
+		a = first;
+		if (i % 2) {
+			gw_rwlock_rdlock(lock);
+			b = second;
+			gw_rwlock_unlock(lock);
+		} else
+			b = second;
+		gw_rwlock_unlock(lock);
+		if (a != b)
+			panic(0, "reader saw %ld and %ld", a, b);
+	}
+}
+
+
+static void writer(void *arg) {
+	long i;
+
+	for (i = 0; i < PER_THREAD / 5000; ++i) {
+		gw_rwlock_wrlock(lock);
+		first++;
+		gwthread_sleep(0.001);
+		second++;
+		gw_rwlock_unlock(lock);
+	}
+}
+
+
+int main(void) {
+	long threads[READERS + WRITERS];
+	long i;
+	
+	gwlib_init();
+	log_set_output_level(GW_INFO);
+	lock = gw_rwlock_create_biased();
+	for (i = 0; i < READERS; ++i)
+		threads[i] = gwthread_create(reader, NULL);
+	for (i = READERS; i < READERS + WRITERS; ++i)
+		threads[i] = gwthread_create(writer, NULL);
+	for (i = 0; i < READERS + WRITERS; ++i)
+		gwthread_join(threads[i]);
+	if (first != WRITERS * (PER_THREAD / 5000) || second != first)
+		panic(0, "writers lost updates: %ld, %ld", first, second);
+	gw_rwlock_destroy(lock);
+	gwlib_shutdown();
+	
+	return 0;
+}
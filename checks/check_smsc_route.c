@@ -0,0 +1,290 @@
+/* ==================================================================== 
+ * The Kannel Software License, Version 1.0 
+ * 
+ * Copyright (c) 2001-2010 Kannel Group  
+ * Copyright (c) 1998-2001 WapIT Ltd.   
+ * All rights reserved. 
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions 
+ * are met: 
+ * 
+ * 1. Redistributions of source code must retain the above copyright 
+ *    notice, this list of conditions and the following disclaimer. 
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in 
+ *    the documentation and/or other materials provided with the 
+ *    distribution. 
+ * 
+ * 3. The end-user documentation included with the redistribution, 
+ *    if any, must include the following acknowledgment: 
+ *       "This product includes software developed by the 
+ *        Kannel Group (http://www.kannel.org/)." 
+ *    Alternately, this acknowledgment may appear in the software itself, 
+ *    if and wherever such third-party acknowledgments normally appear. 
+ * 
+ * 4. The names "Kannel" and "Kannel Group" must not be used to 
+ *    endorse or promote products derived from this software without 
+ *    prior written permission. For written permission, please  
+ *    contact org@kannel.org. 
+ * 
+ * 5. Products derived from this software may not be called "Kannel", 
+ *    nor may "Kannel" appear in their name, without prior written 
+ *    permission of the Kannel Group. 
+ * 
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESSED OR IMPLIED 
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES 
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+ * DISCLAIMED.  IN NO EVENT SHALL THE KANNEL GROUP OR ITS CONTRIBUTORS 
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,  
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT  
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR  
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,  
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE  
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,  
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. 
+ * ==================================================================== 
+ * 
+ * This software consists of voluntary contributions made by many 
+ * individuals on behalf of the Kannel Group.  For more information on  
+ * the Kannel Group, please see <http://www.kannel.org/>. 
+ * 
+ * Portions of this software are based upon software originally written at  
+ * WapIT Ltd., Helsinki, Finland for the Kannel project.  
+ */ 
+
+/*
+ * check_smsc_route.c - Check the SMSC routing index against smscconn_usable
+ *
+ * Builds lists of connections with random allowed, denied and preferred
+ * prefixes and smsc-ids, a few of them dead or using regular expressions,
+ * and checks that smscconn_route_find() finds the same connections, in
+ * the same order from the round-robin start, as calling smscconn_usable()
+ * on each of them does.
+ */
+
+#include "gwlib/gwlib.h"
+#include "gw/smscconn_p.h"
+
+/*
+ * smscconn.c brings in the SMSC drivers and, through their callbacks,
+ * bb_smscconn.c, which use these of the bearerbox. Nothing here starts
+ * a connection, so they are never used.
+ */
+List *incoming_sms;
+List *outgoing_sms;
+List *incoming_wdp;
+List *outgoing_wdp;
+List *flow_threads;
+List *suspended;
+Counter *incoming_sms_counter;
+Counter *outgoing_sms_counter;
+Counter *incoming_dlr_counter;
+Counter *outgoing_dlr_counter;
+Load *incoming_sms_load;
+Load *outgoing_sms_load;
+Load *incoming_dlr_load;
+Load *outgoing_dlr_load;
+long max_incoming_sms_qlength;
+long max_outgoing_sms_qlength;
+Octstr *cfg_filename;
+volatile sig_atomic_t bb_status;
+volatile sig_atomic_t restart;
+
+char *bb_status_linebreak(int status_type) {
+	return NULL;
+}
+
+static char *ids[] = { NULL, "A", "B", "C", "D" };
+
+
+static char *random_string(char *buf, long max, char *chars) {
+	long i, len;
+
+	len = gw_rand() % (max + 1);
+	for (i = 0; i < len; i++)
+		buf[i] = chars[gw_rand() % strlen(chars)];
+	buf[len] = '\0';
+	return buf;
+}
+
+
+/* a list as the configuration gives it, or NULL for one time in three */
+static Octstr *random_list(char *chars) {
+	char buf[16];
+
+	if (gw_rand() % 3 != 0)
+		return NULL;
+	return octstr_create(random_string(buf, 8, chars));
+}
+
+
+static List *random_ids(void) {
+	Octstr *os;
+	List *list;
+
+	if ((os = random_list("ABCD;")) == NULL)
+		return NULL;
+	list = octstr_split(os, octstr_imm(";"));
+	octstr_destroy(os);
+	return list;
+}
+
+
+static SMSCConn *random_conn(void) {
+	SMSCConn *conn;
+
+	conn = gw_malloc(sizeof(*conn));
+	memset(conn, 0, sizeof(*conn));
+	conn->status = gw_rand() % 10 == 0 ? SMSCCONN_DEAD : SMSCCONN_ACTIVE;
+	conn->why_killed = gw_rand() % 10 == 0 ? SMSCCONN_KILLED_SHUTDOWN : SMSCCONN_ALIVE;
+
+	conn->allowed_smsc_id = random_ids();
+	conn->denied_smsc_id = random_ids();
+	conn->preferred_smsc_id = random_ids();
+	conn->allowed_prefix = random_list("0123;");
+	conn->denied_prefix = random_list("0123;");
+	conn->preferred_prefix = random_list("0123;");
+	conn->allowed_prefix_trie = gw_trie_create_prefixes(conn->allowed_prefix);
+	conn->denied_prefix_trie = gw_trie_create_prefixes(conn->denied_prefix);
+	conn->preferred_prefix_trie = gw_trie_create_prefixes(conn->preferred_prefix);
+
+	/* a few are left to smscconn_usable */
+	if (gw_rand() % 20 == 0)
+		conn->allowed_prefix_regex = gw_regex_comp(octstr_imm("^[01]"), REG_EXTENDED);
+	if (gw_rand() % 20 == 0)
+		conn->denied_smsc_id_regex = gw_regex_comp(octstr_imm("^[AB]$"), REG_EXTENDED);
+	return conn;
+}
+
+
+static void random_conn_destroy(void *p) {
+	SMSCConn *conn = p;
+
+	gwlist_destroy(conn->allowed_smsc_id, octstr_destroy_item);
+	gwlist_destroy(conn->denied_smsc_id, octstr_destroy_item);
+	gwlist_destroy(conn->preferred_smsc_id, octstr_destroy_item);
+	octstr_destroy(conn->allowed_prefix);
+	octstr_destroy(conn->denied_prefix);
+	octstr_destroy(conn->preferred_prefix);
+	gw_trie_destroy(conn->allowed_prefix_trie, NULL);
+	gw_trie_destroy(conn->denied_prefix_trie, NULL);
+	gw_trie_destroy(conn->preferred_prefix_trie, NULL);
+	if (conn->allowed_prefix_regex)
+		gw_regex_destroy(conn->allowed_prefix_regex);
+	if (conn->denied_smsc_id_regex)
+		gw_regex_destroy(conn->denied_smsc_id_regex);
+	gw_free(conn);
+}
+
+
+static char *list_cstr(List *list) {
+	static char buf[64];
+	long i;
+
+	if (list == NULL)
+		return "-";
+	buf[0] = '\0';
+	for (i = 0; i < gwlist_len(list) && strlen(buf) < sizeof(buf) - 8; i++) {
+		if (i > 0)
+			strcat(buf, ";");
+		strcat(buf, octstr_get_cstr(gwlist_get(list, i)));
+	}
+	return buf;
+}
+
+
+static void report(List *conns, Msg *msg, long start, SMSCConn *conn, char *what) {
+	long i;
+
+	for (i = 0; gwlist_get(conns, i) != conn; i++)
+		;
+
+	error(0, "receiver <%s> smsc-id <%s> start %ld: connection %ld %s",
+	      octstr_get_cstr(msg->sms.receiver),
+	      msg->sms.smsc_id ? octstr_get_cstr(msg->sms.smsc_id) : "-",
+	      start, i, what);
+	error(0, "allowed-smsc-id <%s>", list_cstr(conn->allowed_smsc_id));
+	error(0, "denied-smsc-id <%s>", list_cstr(conn->denied_smsc_id));
+	error(0, "preferred-smsc-id <%s>", list_cstr(conn->preferred_smsc_id));
+	error(0, "status %d, killed %d, regex: allowed-prefix %s, denied-smsc-id %s",
+	      conn->status, conn->why_killed, conn->allowed_prefix_regex ? "yes" : "no",
+	      conn->denied_smsc_id_regex ? "yes" : "no");
+	panic(0, "allowed-prefix <%s> denied-prefix <%s> preferred-prefix <%s>",
+	      conn->allowed_prefix ? octstr_get_cstr(conn->allowed_prefix) : "-",
+	      conn->denied_prefix ? octstr_get_cstr(conn->denied_prefix) : "-",
+	      conn->preferred_prefix ? octstr_get_cstr(conn->preferred_prefix) : "-");
+}
+
+
+static void check_route(long len) {
+	List *conns;
+	SMSCRoute *route;
+	SMSCConn **found, **expected, *conn;
+	Msg *msg;
+	char buf[16], *id;
+	int *preferred, *expected_preferred;
+	long i, j, k, n, start, max;
+
+	conns = gwlist_create();
+	for (i = 0; i < len; i++)
+		gwlist_append(conns, random_conn());
+	route = smscconn_route_create(conns);
+	found = gw_malloc(len * sizeof(*found));
+	preferred = gw_malloc(len * sizeof(*preferred));
+	expected = gw_malloc(len * sizeof(*expected));
+	expected_preferred = gw_malloc(len * sizeof(*expected_preferred));
+
+	for (j = 0; j < 200; j++) {
+		msg = msg_create(sms);
+		msg->sms.receiver = octstr_create(random_string(buf, 6, "0123"));
+		id = ids[gw_rand() % (sizeof(ids) / sizeof(ids[0]))];
+		msg->sms.smsc_id = id ? octstr_create(id) : NULL;
+		start = gw_rand() % len;
+		max = j % 4 == 0 ? 1 + gw_rand() % len : len;
+
+		/* what the router did before the index */
+		k = 0;
+		for (i = 0; i < len && k < max; i++) {
+			conn = gwlist_get(conns, (start + i) % len);
+			if ((expected_preferred[k] = smscconn_usable(conn, msg)) != -1)
+				expected[k++] = conn;
+		}
+
+		n = smscconn_route_find(route, msg, start, found, preferred, max);
+		for (i = 0; i < k || i < n; i++) {
+			if (i < n && smscconn_usable(found[i], msg) == -1)
+				report(conns, msg, start, found[i], "found, but not usable");
+			if (i >= n || found[i] != expected[i])
+				report(conns, msg, start, expected[i], "not found");
+			if (preferred[i] != expected_preferred[i])
+				report(conns, msg, start, found[i], preferred[i] ?
+				       "should not be preferred" : "should be preferred");
+		}
+		msg_destroy(msg);
+	}
+
+	gw_free(found);
+	gw_free(preferred);
+	gw_free(expected);
+	gw_free(expected_preferred);
+	smscconn_route_destroy(route);
+	gwlist_destroy(conns, random_conn_destroy);
+}
+
+
+int main(void) {
+	long i;
+
+	gwlib_init();
+	log_set_output_level(GW_INFO);
+
+	/* one to a few words of connections */
+	for (i = 0; i < 300; i++)
+		check_route(1 + gw_rand() % 150);
+
+	gwlib_shutdown();
+
+	return 0;
+}
@@ -0,0 +1,234 @@
+/* ==================================================================== 
+ * The Kannel Software License, Version 1.0 
+ * 
+ * Copyright (c) 2001-2010 Kannel Group  
+ * Copyright (c) 1998-2001 WapIT Ltd.   
+ * All rights reserved. 
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions 
+ * are met: 
+ * 
+ * 1. Redistributions of source code must retain the above copyright 
+ *    notice, this list of conditions and the following disclaimer. 
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in 
+ *    the documentation and/or other materials provided with the 
+ *    distribution. 
+ * 
+ * 3. The end-user documentation included with the redistribution, 
+ *    if any, must include the following acknowledgment: 
+ *       "This product includes software developed by the 
+ *        Kannel Group (http://www.kannel.org/)." 
+ *    Alternately, this acknowledgment may appear in the software itself, 
+ *    if and wherever such third-party acknowledgments normally appear. 
+ * 
+ * 4. The names "Kannel" and "Kannel Group" must not be used to 
+ *    endorse or promote products derived from this software without 
+ *    prior written permission. For written permission, please  
+ *    contact org@kannel.org. 
+ * 
+ * 5. Products derived from this software may not be called "Kannel", 
+ *    nor may "Kannel" appear in their name, without prior written 
+ *    permission of the Kannel Group. 
+ * 
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESSED OR IMPLIED 
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES 
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+ * DISCLAIMED.  IN NO EVENT SHALL THE KANNEL GROUP OR ITS CONTRIBUTORS 
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,  
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT  
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR  
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,  
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE  
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,  
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. 
+ * ==================================================================== 
+ * 
+ * This software consists of voluntary contributions made by many 
+ * individuals on behalf of the Kannel Group.  For more information on  
+ * the Kannel Group, please see <http://www.kannel.org/>. 
+ * 
+ * Portions of this software are based upon software originally written at  
+ * WapIT Ltd., Helsinki, Finland for the Kannel project.  
+ */ 
+
+/*
+ * check_timerwheel.c - Check the hashed timer wheel
+ *
+ * Starts timers of lengths up to several turns of a small wheel and
+ * checks that each fires once, not early and in order, that stopped
+ * timers don't fire, that a timer may destroy itself from its callback
+ * and be stopped while its callback runs, and that the wheel knows when
+ * its next timer is due.
+ *
+ * All bounds are taken from the times actually measured around the calls,
+ * on the clock the wheel uses, so a busy machine can make the check slow
+ * but not fail.
+ */
+
+#include <sys/time.h>
+#include <time.h>
+
+#include "gwlib/gwlib.h"
+
+#define TICK 0.01
+#define SLOTS 8
+#define TIMERS 20
+
+static double started_at[TIMERS];
+static double fired_at[TIMERS];
+static long fired[TIMERS];
+static long order[TIMERS], nfired;
+static Mutex *lock;
+static WheelTimer *self;
+
+static double now(void) {
+	struct timeval tv;
+#ifdef CLOCK_MONOTONIC
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+		return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void fire(void *data) {
+	long i = (long) data;
+
+	mutex_lock(lock);
+	fired[i]++;
+	fired_at[i] = now();
+	order[nfired++] = i;
+	mutex_unlock(lock);
+}
+
+static void self_destroy(void *data) {
+	gw_wheel_timer_destroy(self);
+	fire((void *) 0);
+}
+
+static void slow(void *data) {
+	gwthread_sleep(0.2);
+	fire((void *) 0);
+}
+
+static void reset(void) {
+	long i;
+
+	for (i = 0; i < TIMERS; i++)
+		fired[i] = 0;
+	nfired = 0;
+}
+
+
+int main(void) {
+	TimerWheel *wheel;
+	WheelTimer *timers[TIMERS], *t;
+	long i, a, b;
+	double added, elapsed, next;
+
+	gwlib_init();
+	log_set_output_level(GW_INFO);
+	lock = mutex_create();
+	wheel = gw_timerwheel_create(TICK, SLOTS);
+
+	/* 0.02 s apart, so the later ones go around the wheel a few times */
+	reset();
+	for (i = TIMERS - 1; i >= 0; i--) {
+		timers[i] = gw_wheel_timer_create(wheel, fire, (void *) i);
+		started_at[i] = now();
+		gw_wheel_timer_start(timers[i], (i + 1) * 2 * TICK);
+	}
+	if (gw_wheel_timer_stop(timers[5]) != 1 || gw_wheel_timer_pending(timers[5]))
+		panic(0, "pending timer not stopped");
+	while (gw_timerwheel_len(wheel) > 0)
+		gwthread_sleep(TICK);
+	gwthread_sleep(2 * TICK);
+	if (nfired != TIMERS - 1)
+		panic(0, "%ld timers fired, expected %d", nfired, TIMERS - 1);
+	for (i = 0; i < TIMERS; i++) {
+		if (fired[i] != (i != 5))
+			panic(0, "timer %ld fired %ld times", i, fired[i]);
+		if (i != 5 && fired_at[i] - started_at[i] < (i + 1) * 2 * TICK)
+			panic(0, "timer %ld fired early after %f s", i,
+			      fired_at[i] - started_at[i]);
+		/* timers due within a tick of each other may fire either way */
+		if (i > 0 && i < nfired) {
+			a = order[i - 1];
+			b = order[i];
+			if (started_at[b] + (b + 1) * 2 * TICK + TICK <
+			    started_at[a] + (a + 1) * 2 * TICK)
+				panic(0, "timer %ld fired before timer %ld", b, a);
+		}
+		if (gw_wheel_timer_stop(timers[i]) != 0)
+			panic(0, "fired timer %ld was still pending", i);
+	}
+
+	/* restarting moves a timer instead of adding it again */
+	reset();
+	gw_wheel_timer_start(timers[0], 100);
+	gw_wheel_timer_start(timers[0], TICK);
+	gw_timerwheel_add(wheel, TICK, fire, (void *) 1);
+	while (gw_timerwheel_len(wheel) > 0)
+		gwthread_sleep(TICK);
+	gwthread_sleep(2 * TICK);
+	if (fired[0] != 1 || fired[1] != 1)
+		panic(0, "restarted or one-shot timer fired %ld and %ld times",
+		      fired[0], fired[1]);
+	for (i = 0; i < TIMERS; i++)
+		gw_wheel_timer_destroy(timers[i]);
+
+	/* destroying a timer from its callback */
+	reset();
+	self = gw_wheel_timer_create(wheel, self_destroy, NULL);
+	gw_wheel_timer_start(self, TICK);
+	while (nfired == 0)
+		gwthread_sleep(TICK);
+
+	/* stopping a running timer waits for its callback */
+	reset();
+	t = gw_wheel_timer_create(wheel, slow, NULL);
+	gw_wheel_timer_start(t, TICK);
+	while (gw_timerwheel_len(wheel) > 0)
+		gwthread_sleep(TICK / 10);
+	gwthread_sleep(TICK);
+	if (gw_wheel_timer_stop(t) != 0 || nfired != 1)
+		panic(0, "stop returned before the callback");
+	gw_wheel_timer_destroy(t);
+
+	/* the next deadline is that of the shortest timer, rounds or not */
+	if (gw_timerwheel_next(wheel) != -1)
+		panic(0, "empty wheel has a next deadline");
+	reset();
+	added = now();
+	for (i = 0; i < TIMERS; i++)
+		gw_timerwheel_add(wheel, 1000 + i, fire, (void *) i);
+	elapsed = now();
+	gw_timerwheel_add(wheel, 3 * SLOTS * TICK + 0.5 * TICK, fire, (void *) 0);
+	next = gw_timerwheel_next(wheel);
+	elapsed = now() - elapsed;
+	if (next < 3 * SLOTS * TICK + 0.5 * TICK - elapsed - TICK ||
+	    next > 3 * SLOTS * TICK + 2 * TICK)
+		panic(0, "next deadline in %f s after %f s", next, elapsed);
+	while (gw_timerwheel_len(wheel) > TIMERS)
+		gwthread_sleep(TICK);
+	next = gw_timerwheel_next(wheel);
+	if (next < 1000 - (now() - added) - TICK || next > 1000 + 2 * TICK)
+		panic(0, "next deadline in %f s", next);
+
+	/* flushing fires everything at once */
+	reset();
+	gw_timerwheel_flush(wheel);
+	if (nfired != TIMERS || gw_timerwheel_len(wheel) != 0)
+		panic(0, "flush fired %ld timers", nfired);
+
+	gw_timerwheel_destroy(wheel);
+	mutex_destroy(lock);
+	gwlib_shutdown();
+
+	return 0;
+}
@@ -0,0 +1,187 @@
+/* ==================================================================== 
+ * The Kannel Software License, Version 1.0 
+ * 
+ * Copyright (c) 2001-2010 Kannel Group  
+ * Copyright (c) 1998-2001 WapIT Ltd.   
+ * All rights reserved. 
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions 
+ * are met: 
+ * 
+ * 1. Redistributions of source code must retain the above copyright 
+ *    notice, this list of conditions and the following disclaimer. 
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in 
+ *    the documentation and/or other materials provided with the 
+ *    distribution. 
+ * 
+ * 3. The end-user documentation included with the redistribution, 
+ *    if any, must include the following acknowledgment: 
+ *       "This product includes software developed by the 
+ *        Kannel Group (http://www.kannel.org/)." 
+ *    Alternately, this acknowledgment may appear in the software itself, 
+ *    if and wherever such third-party acknowledgments normally appear. 
+ * 
+ * 4. The names "Kannel" and "Kannel Group" must not be used to 
+ *    endorse or promote products derived from this software without 
+ *    prior written permission. For written permission, please  
+ *    contact org@kannel.org. 
+ * 
+ * 5. Products derived from this software may not be called "Kannel", 
+ *    nor may "Kannel" appear in their name, without prior written 
+ *    permission of the Kannel Group. 
+ * 
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESSED OR IMPLIED 
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES 
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+ * DISCLAIMED.  IN NO EVENT SHALL THE KANNEL GROUP OR ITS CONTRIBUTORS 
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,  
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT  
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR  
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,  
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE  
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,  
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. 
+ * ==================================================================== 
+ * 
+ * This software consists of voluntary contributions made by many 
+ * individuals on behalf of the Kannel Group.  For more information on  
+ * the Kannel Group, please see <http://www.kannel.org/>. 
+ * 
+ * Portions of this software are based upon software originally written at  
+ * WapIT Ltd., Helsinki, Finland for the Kannel project.  
+ */ 
+
+/*
+ * check_trie.c - Check the telephone number prefix trie
+ *
+ * Adds a few overlapping prefixes, some with characters other than
+ * digits, and checks which of them are found for a set of numbers.
+ * Then checks that compiled prefix lists give the same results as
+ * does_prefix_match() on random lists and numbers.
+ */
+
+#include "gwlib/gwlib.h"
+
+static char *prefixes[] = {
+	"358", "35840", "3584050", "+358", "+35850", "1", "12a", NULL
+};
+
+static struct {
+	char *number;
+	char *expected;	/* the matching prefixes, shortest first */
+} tests[] = {
+	{ "358405012", "358 35840 3584050" },
+	{ "35840", "358 35840" },
+	{ "35", "" },
+	{ "+358501", "+358 +35850" },
+	{ "+35940", "" },
+	{ "12a", "1 12a" },
+	{ "12b", "1" },
+	{ "", "" },
+	{ NULL, NULL }
+};
+
+
+static Octstr *matches(DigitTrie *trie, char *number) {
+	void *values[8];
+	Octstr *os;
+	long i, n;
+
+	n = gw_trie_match(trie, number, values, 8);
+	if (n > 8)
+		panic(0, "%ld matches for %s", n, number);
+	os = octstr_create("");
+	for (i = 0; i < n; i++) {
+		if (i > 0)
+			octstr_append_char(os, ' ');
+		octstr_append_cstr(os, values[i]);
+	}
+	return os;
+}
+
+
+static char *random_string(char *buf, long max, char *chars) {
+	long i, len;
+
+	len = gw_rand() % (max + 1);
+	for (i = 0; i < len; i++)
+		buf[i] = chars[gw_rand() % strlen(chars)];
+	buf[len] = '\0';
+	return buf;
+}
+
+
+static void check_prefix_lists(void) {
+	DigitTrie *trie;
+	Octstr *list, *number;
+	char buf[16];
+	long i, j;
+
+	for (i = 0; i < 2000; i++) {
+		/* short lists of few characters, so that numbers do match */
+		list = octstr_create(random_string(buf, 12, "0123;;+"));
+		trie = gw_trie_create_prefixes(list);
+		for (j = 0; j < 50; j++) {
+			number = octstr_create(random_string(buf, 6, "0123+"));
+			if (gw_trie_prefix_match(trie, number) !=
+			    does_prefix_match(list, number))
+				panic(0, "prefix list <%s> and number <%s> match "
+				      "differently", octstr_get_cstr(list),
+				      octstr_get_cstr(number));
+			octstr_destroy(number);
+		}
+		gw_trie_destroy(trie, NULL);
+		octstr_destroy(list);
+	}
+
+	if (gw_trie_create_prefixes(NULL) != NULL)
+		panic(0, "compiled a NULL prefix list");
+}
+
+
+int main(void) {
+	DigitTrie *trie;
+	Octstr *os;
+	void **value;
+	long i;
+
+	gwlib_init();
+	log_set_output_level(GW_INFO);
+
+	trie = gw_trie_create();
+	for (i = 0; prefixes[i] != NULL; i++) {
+		value = gw_trie_add(trie, prefixes[i], strlen(prefixes[i]));
+		if (*value != NULL)
+			panic(0, "new prefix %s has a value", prefixes[i]);
+		*value = prefixes[i];
+	}
+	if (*gw_trie_add(trie, "358", 3) != prefixes[0])
+		panic(0, "existing prefix 358 lost its value");
+	if (gw_trie_len(trie) != i)
+		panic(0, "trie has %ld prefixes, expected %ld", gw_trie_len(trie), i);
+
+	for (i = 0; tests[i].number != NULL; i++) {
+		os = matches(trie, tests[i].number);
+		if (octstr_str_compare(os, tests[i].expected) != 0)
+			panic(0, "%s matched <%s>, expected <%s>", tests[i].number,
+			      octstr_get_cstr(os), tests[i].expected);
+		octstr_destroy(os);
+	}
+
+	/* the empty prefix matches everything */
+	*gw_trie_add(trie, "", 0) = "";
+	if (gw_trie_match(trie, "", NULL, 0) != 1 ||
+	    gw_trie_match(trie, "35840", NULL, 0) != 3)
+		panic(0, "empty prefix not matched");
+
+	gw_trie_destroy(trie, NULL);
+
+	check_prefix_lists();
+
+	gwlib_shutdown();
+
+	return 0;
+}
@@ -82,6 +82,10 @@
 
 #define SMSBOX_MAX_PENDING 100
 
+/* limits of one batch frame to an smsbox */
+#define SMSBOX_BATCH_MAX 64
+#define SMSBOX_BATCH_BYTES 65536
+
 /* passed from bearerbox core */
 
 extern volatile sig_atomic_t bb_status;
@@ -106,12 +110,6 @@ static List	*wapbox_list;
 static List	*smsbox_list;
 static RWLock   *smsbox_list_rwlock;
 
-/* dictionaries for holding the smsbox routing information */
-static Dict *smsbox_by_id;
-static Dict *smsbox_by_smsc;
-static Dict *smsbox_by_receiver;
-static Dict *smsbox_by_smsc_receiver;
-
 static long	smsbox_port;
 static int smsbox_port_ssl;
 static Octstr *smsbox_interface = NULL;
@@ -121,18 +119,46 @@ static int wapbox_port_ssl;
 /* max pending messages on the line to smsbox */
 static long smsbox_max_pending;
 
+/* offer batch frames to smsboxes */
+static int smsbox_batch;
+
 static Octstr *box_allow_ip;
 static Octstr *box_deny_ip;
 
 
 static Counter *boxid;
 
-/* sms_to_smsboxes thread-id */
-static long sms_dequeue_thread;
+/* a thread of sms_to_smsboxes() or wdp_to_wapboxes() */
+typedef struct {
+    long thread;
+    long cpu;                   /* pinned to, -1 if not */
+    List *queue;                /* its own input, NULL if it shares the stage's */
+    volatile long dispatched;   /* messages handed to a box */
+} Dispatcher;
+
+/*
+ * Each dispatch stage runs box-dispatch-threads threads. With more than
+ * one WDP dispatcher, wdp_to_dispatchers() deals the datagrams to them by
+ * client address, and each dispatcher alone keeps the routes of its
+ * clients, so one client's datagrams are routed in order.
+ */
+static long box_dispatchers;
+static Dispatcher *sms_dispatch;
+static volatile long sms_dispatch_running;
+static Dispatcher *wdp_dispatch;
+static volatile long wdp_dispatch_running;
+
+/* the routes of each WDP dispatcher's clients */
+static List **wdp_routes;
+
+/* box-dispatch-cpus, the CPUs to pin dispatchers and box threads to */
+static long *box_cpus;
+static long box_cpus_len;
 
 
 typedef struct _boxc {
     Connection	*conn;
+    List            *packs;     /* frames read but not yet unpacked */
     int               is_wap;
     long            id;
     int               load;
@@ -143,18 +169,67 @@ typedef struct _boxc {
     List            *outgoing;
     Dict           *sent;
     Semaphore *pending;
+    volatile long queued;   /* messages routed to us still in incoming */
+    volatile long unacked;  /* messages sent to us and not acked yet */
+    /*
+     * With batch frames, the messages sent in them until acked, at their
+     * sequence number modulo smsbox_max_pending. The pending semaphore
+     * keeps next_seq - oldest_seq within that.
+     */
+    volatile int batch;     /* box accepted batch frames */
+    Mutex *window_lock;
+    Msg **window;
+    long next_seq;
+    long oldest_seq;
     volatile sig_atomic_t alive;
     Octstr        *boxc_id; /* identifies the connected smsbox instance */
     /* used to mark connection usable or still waiting for ident. msg */
     volatile int routable;
 } Boxc;
 
+/*
+ * The smsbox connections sharing one smsbox-id. The array only changes
+ * with smsbox_list_rwlock held for writing, so the MO router can walk it
+ * under the read lock.
+ */
+typedef struct {
+    Octstr *id;
+    Boxc **boxes;
+    long len;
+    long size;
+} SmsboxGroup;
+
+/* smsbox-route rules for one receiver number */
+typedef struct {
+    SmsboxGroup *group; /* shortcode only rule, or NULL */
+    Dict *by_smsc;      /* smsc-id -> SmsboxGroup for shortcode and smsc-id rules */
+} ReceiverRoute;
+
+/*
+ * The smsbox routing information: the groups by smsbox-id and the
+ * smsbox-route rules resolved to their groups, so routing an MO message
+ * neither builds a key nor looks up the smsbox-id of a rule.
+ */
+static Dict *smsbox_by_id;
+static Dict *smsbox_by_smsc;
+static Dict *smsbox_by_receiver;
+static long smsbox_routes;
+
+/* connected smsboxes without smsbox-id, the default route */
+static SmsboxGroup smsbox_unnamed;
+
 /* forward declaration */
 static void sms_to_smsboxes(void *arg);
+static void sms_dispatch_wakeup(void);
+static void boxc_pin(long n);
 static int send_msg(Boxc *boxconn, Msg *pmsg);
 static void boxc_sent_push(Boxc*, Msg*);
 static void boxc_sent_pop(Boxc*, Msg*, Msg**);
-static void boxc_gwlist_destroy(List *list);
+static void boxc_window_acks(Boxc *conn, Octstr *frame);
+static Msg *boxc_window_remove(Boxc *conn, uuid_t id);
+static SmsboxGroup *smsbox_group(Octstr *id);
+static void smsbox_group_add(SmsboxGroup *group, Boxc *conn);
+static void smsbox_group_remove(SmsboxGroup *group, Boxc *conn);
 
 
 /*-------------------------------------------------
@@ -167,13 +242,22 @@ static Msg *read_from_box(Boxc *boxconn)
     Octstr *pack;
     Msg *msg;
 
-    pack = NULL;
-    while (bb_status != BB_DEAD && boxconn->alive) {
+    /* drain a burst of frames from the connection in one go */
+    pack = gwlist_extract_first(boxconn->packs);
+    while (pack != NULL || (bb_status != BB_DEAD && boxconn->alive)) {
+        if (pack != NULL) {
+            if (boxconn->window == NULL || msg_frame_type(pack) != MSG_FRAME_ACKS)
+                break;
+            boxc_window_acks(boxconn, pack);
+            octstr_destroy(pack);
+            pack = gwlist_extract_first(boxconn->packs);
+            continue;
+        }
             /* XXX: if box doesn't send (just keep conn open) we block here while shutdown */
-	    pack = conn_read_withlen(boxconn->conn);
-	    gw_claim_area(pack);
-	    if (pack != NULL)
-	        break;
+	    if (conn_read_withlen_many(boxconn->conn, boxconn->packs) > 0) {
+	        pack = gwlist_extract_first(boxconn->packs);
+	        continue;
+	    }
 	    if (conn_error(boxconn->conn)) {
 	        info(0, "Read error when reading from box <%s>, disconnecting",
 		         octstr_get_cstr(boxconn->client_ip));
@@ -279,6 +363,8 @@ static void boxc_receiver(void *arg)
     Boxc *conn = arg;
     Msg *msg, *mack;
 
+    boxc_pin(conn->id);
+
     /* remove messages from socket until it is closed */
     while (bb_status != BB_DEAD && conn->alive) {
 
@@ -311,8 +397,8 @@ static void boxc_receiver(void *arg)
 
             if (conn->routable == 0) {
                 conn->routable = 1;
-                /* wakeup the dequeue thread */
-                gwthread_wakeup(sms_dequeue_thread);
+                /* wakeup the dequeue threads */
+                sms_dispatch_wakeup();
             }
         } else if (msg_type(msg) == wdp_datagram && conn->is_wap) {
             debug("bb.boxc", 0, "boxc_receiver: got wdp from wapbox");
@@ -329,8 +415,8 @@ static void boxc_receiver(void *arg)
 
             if (conn->routable == 0) {
                 conn->routable = 1;
-                /* wakeup the dequeue thread */
-                gwthread_wakeup(sms_dequeue_thread);
+                /* wakeup the dequeue threads */
+                sms_dispatch_wakeup();
             }
         } else {
             if (msg_type(msg) == heartbeat) {
@@ -363,42 +449,28 @@ static void boxc_receiver(void *arg)
                     /* Only interested if the connection is not named, or its a different name */
                     if (conn->boxc_id == NULL || 
                         octstr_compare(conn->boxc_id, msg->admin.boxc_id)) {
-                        List *boxc_id_list = NULL;
+
+                        gw_rwlock_wrlock(smsbox_list_rwlock);
 
                         /*
-                         * Different name, need to remove it from the old list.
+                         * Different name, need to remove it from the old group.
                          *
                          * I Don't think this case should ever arise, but might as well
                          * be safe.
                          */
                         if (conn->boxc_id != NULL) {
-
-                            /* Get the list for this box id */
-                            boxc_id_list = dict_get(smsbox_by_id, conn->boxc_id);
-
-                            /* Delete the connection from the list */
-                            if (boxc_id_list != NULL) {
-                                gwlist_delete_equal(boxc_id_list, conn);
-                            }
-
+                            smsbox_group_remove(dict_get(smsbox_by_id, conn->boxc_id), conn);
                             octstr_destroy(conn->boxc_id);
+                        } else {
+                            smsbox_group_remove(&smsbox_unnamed, conn);
                         }
 
-                        /* Get the list for this box id */
-                        boxc_id_list = dict_get(smsbox_by_id, msg->admin.boxc_id);
-
-                        /* No list yet, so create it */
-                        if (boxc_id_list == NULL) {
-                            boxc_id_list = gwlist_create();
-                            if (!dict_put_once(smsbox_by_id, msg->admin.boxc_id, boxc_id_list))
-                                /* list already added */
-                                boxc_id_list = dict_get(smsbox_by_id, msg->admin.boxc_id); 
-                        }
-
-                        /* Add the connection into the list */
-                        gwlist_append(boxc_id_list, conn);
+                        /* Add the connection into the group for this box id */
+                        smsbox_group_add(smsbox_group(msg->admin.boxc_id), conn);
 
                         conn->boxc_id = msg->admin.boxc_id;
+
+                        gw_rwlock_unlock(smsbox_list_rwlock);
                     }
                     else {
                         octstr_destroy(msg->admin.boxc_id);
@@ -412,8 +484,22 @@ static void boxc_receiver(void *arg)
                 }
 
                 conn->routable = 1;
-                /* wakeup the dequeue thread */
-                gwthread_wakeup(sms_dequeue_thread);
+                /* wakeup the dequeue threads */
+                sms_dispatch_wakeup();
+
+                /* boxes that do not know cmd_batch just ignore it */
+                if (conn->window != NULL && !conn->batch) {
+                    Msg *offer = msg_create(admin);
+                    offer->admin.command = cmd_batch;
+                    send_msg(conn, offer);
+                    msg_destroy(offer);
+                }
+            }
+            else if (msg_type(msg) == admin && msg->admin.command == cmd_batch &&
+                     conn->window != NULL) {
+                debug("bb.boxc", 0, "boxc_receiver: box <%s> accepted batch frames",
+                      octstr_get_cstr(conn->client_ip));
+                conn->batch = 1;
             }
             else
                 warning(0, "boxc_receiver: unknown msg received from <%s>, "
@@ -444,14 +530,12 @@ static int send_msg(Boxc *boxconn, Msg *pmsg)
         debug("bb.boxc", 0, "send_msg: sending msg to box: <%s>",
           octstr_get_cstr(boxconn->client_ip));
 
-    if (conn_write_withlen(boxconn->conn, pack) == -1) {
+    if (conn_write_withlen_owned(boxconn->conn, pack) == -1) {
     	error(0, "Couldn't write Msg to box <%s>, disconnecting",
 	      octstr_get_cstr(boxconn->client_ip));
-        octstr_destroy(pack);
         return -1;
     }
 
-    octstr_destroy(pack);
     return 0;
 }
 
@@ -467,6 +551,7 @@ static void boxc_sent_push(Boxc *conn, Msg *m)
     uuid_unparse(m->sms.id, id);
     os = octstr_create(id);
     dict_put(conn->sent, os, msg_duplicate(m));
+    gw_atomic_add(&conn->unacked, 1);
     semaphore_down(conn->pending);
     octstr_destroy(os);
 }
@@ -492,12 +577,18 @@ static void boxc_sent_pop(Boxc *conn, Msg *m, Msg **orig)
     os = octstr_create(id);
     msg = dict_remove(conn->sent, os);
     octstr_destroy(os);
+    if (msg != NULL) {
+        gw_atomic_add(&conn->unacked, -1);
+        semaphore_up(conn->pending);
+    } else if (conn->window != NULL) {
+        /* a nack for a message of a batch frame */
+        msg = boxc_window_remove(conn, (msg_type(m) == sms ? m->sms.id : m->ack.id));
+    }
     if (!msg) {
         error(0, "BOXC: Got ack for nonexistend message!");
         msg_dump(m, 0);
         return;
     }
-    semaphore_up(conn->pending);
     if (orig == NULL)
         msg_destroy(msg);
     else
@@ -505,12 +596,139 @@ static void boxc_sent_pop(Boxc *conn, Msg *m, Msg **orig)
 }
 
 
+/*
+ * Take the message with sequence number `seq' out of the window, if it is
+ * still there, and give the slots before the oldest message left back to
+ * the sender. Called with window_lock held.
+ */
+static Msg *boxc_window_take(Boxc *conn, long seq)
+{
+    Msg *msg = NULL;
+
+    if (seq >= conn->oldest_seq && seq < conn->next_seq) {
+        msg = conn->window[seq % smsbox_max_pending];
+        conn->window[seq % smsbox_max_pending] = NULL;
+        if (msg != NULL)
+            gw_atomic_add(&conn->unacked, -1);
+    }
+    while (conn->oldest_seq < conn->next_seq &&
+           conn->window[conn->oldest_seq % smsbox_max_pending] == NULL) {
+        conn->oldest_seq++;
+        semaphore_up(conn->pending);
+    }
+
+    return msg;
+}
+
+
+/* Remove the message with id `id' from the window and return it, or NULL. */
+static Msg *boxc_window_remove(Boxc *conn, uuid_t id)
+{
+    Msg *msg;
+    long seq;
+
+    mutex_lock(conn->window_lock);
+    for (seq = conn->oldest_seq; seq < conn->next_seq; seq++) {
+        msg = conn->window[seq % smsbox_max_pending];
+        if (msg != NULL && uuid_compare(msg->sms.id, id) == 0)
+            break;
+    }
+    msg = boxc_window_take(conn, seq);
+    mutex_unlock(conn->window_lock);
+
+    return msg;
+}
+
+
+/* Handle an ack frame: the acked messages are delivered. */
+static void boxc_window_acks(Boxc *conn, Octstr *frame)
+{
+    Octstr *bitmap;
+    List *acked;
+    Msg *msg;
+    long base, i;
+
+    if (msg_acks_unpack(frame, &base, &bitmap) == -1) {
+        error(0, "BOXC: Invalid ack frame from <%s>!",
+              octstr_get_cstr(conn->client_ip));
+        return;
+    }
+
+    acked = gwlist_create();
+    mutex_lock(conn->window_lock);
+    base = msg_seq_widen(base, conn->next_seq);
+    for (i = 0; i < octstr_len(bitmap) * 8; i++) {
+        if ((octstr_get_char(bitmap, i / 8) & (1 << (i % 8))) &&
+            (msg = boxc_window_take(conn, base + i)) != NULL)
+            gwlist_append(acked, msg);
+    }
+    mutex_unlock(conn->window_lock);
+    octstr_destroy(bitmap);
+
+    debug("bb.boxc", 0, "boxc_receiver: got %ld acks from <%s>",
+          gwlist_len(acked), octstr_get_cstr(conn->client_ip));
+
+    while ((msg = gwlist_extract_first(acked)) != NULL) {
+        store_save_ack(msg, ack_success);
+        msg_destroy(msg);
+    }
+    gwlist_destroy(acked, NULL);
+}
+
+
+/*
+ * Send `msg' and the messages queued behind it in one batch frame, as many
+ * as the window takes without waiting. They stay in the window until the
+ * box acks them. Return -1 if the frame could not be written.
+ */
+static int boxc_send_batch(Boxc *conn, Msg *msg)
+{
+    Octstr *frame;
+    long n;
+
+    /* only we move next_seq */
+    frame = msg_batch_create(conn->next_seq);
+    for (n = 1; ; n++) {
+        msg_batch_append(frame, msg);
+        semaphore_down(conn->pending);
+        mutex_lock(conn->window_lock);
+        conn->window[conn->next_seq++ % smsbox_max_pending] = msg;
+        mutex_unlock(conn->window_lock);
+        gw_atomic_add(&conn->unacked, 1);
+
+        if (n == SMSBOX_BATCH_MAX || octstr_len(frame) >= SMSBOX_BATCH_BYTES ||
+            semaphore_getvalue(conn->pending) <= 0)
+            break;
+        if ((msg = gwlist_extract_first(conn->incoming)) == NULL)
+            break;
+        gw_atomic_add(&conn->queued, -1);
+        if (msg_type(msg) != sms) {
+            gwlist_insert(conn->incoming, 0, msg);
+            gw_atomic_add(&conn->queued, 1);
+            break;
+        }
+    }
+
+    debug("bb.boxc", 0, "boxc_sender: sending %ld messages to <%s> in one frame",
+          n, octstr_get_cstr(conn->client_ip));
+
+    if (conn_write_withlen_owned(conn->conn, frame) == -1) {
+        error(0, "Couldn't write Msg to box <%s>, disconnecting",
+              octstr_get_cstr(conn->client_ip));
+        return -1;
+    }
+
+    return 0;
+}
+
+
 static void boxc_sender(void *arg)
 {
     Msg *msg;
     Boxc *conn = arg;
 
     gwlist_add_producer(flow_threads);
+    boxc_pin(conn->id);
 
     while (bb_status != BB_DEAD && conn->alive) {
 
@@ -530,11 +748,22 @@ static void boxc_sender(void *arg)
             msg_destroy(msg);
             break;
         }
+        if (!conn->is_wap)
+            gw_atomic_add(&conn->queued, -1);
         if (msg_type(msg) == heartbeat) {
             debug("bb.boxc", 0, "boxc_sender: catch an heartbeat - we are alive");
             msg_destroy(msg);
             continue;
         }
+        if (conn->batch && msg_type(msg) == sms) {
+            if (!conn->alive) {
+                gwlist_produce(conn->retry, msg);
+                break;
+            }
+            if (boxc_send_batch(conn, msg) == -1)
+                break;
+            continue;
+        }
         boxc_sent_push(conn, msg);
         if (!conn->alive || send_msg(conn, msg) == -1) {
             /* we got message here */
@@ -568,12 +797,19 @@ static Boxc *boxc_create(int fd, Octstr *ip, int ssl)
     boxc->is_wap = 0;
     boxc->load = 0;
     boxc->conn = conn_wrap_fd(fd, ssl);
+    boxc->packs = gwlist_create();
     boxc->id = counter_increase(boxid);
     boxc->client_ip = ip;
     boxc->alive = 1;
     boxc->connect_time = time(NULL);
     boxc->boxc_id = NULL;
     boxc->routable = 0;
+    boxc->queued = 0;
+    boxc->unacked = 0;
+    boxc->batch = 0;
+    boxc->window_lock = NULL;
+    boxc->window = NULL;
+    boxc->next_seq = boxc->oldest_seq = 0;
     return boxc;
 }
 
@@ -586,6 +822,7 @@ static void boxc_destroy(Boxc *boxc)
 
     if (boxc->conn)
 	    conn_destroy(boxc->conn);
+    gwlist_destroy(boxc->packs, octstr_destroy_item);
     octstr_destroy(boxc->client_ip);
     octstr_destroy(boxc->boxc_id);
     gw_free(boxc);
@@ -653,6 +890,11 @@ static void run_smsbox(void *arg)
     newconn->outgoing = outgoing_sms;
     newconn->sent = dict_create(smsbox_max_pending, NULL);
     newconn->pending = semaphore_create(smsbox_max_pending);
+    if (smsbox_batch) {
+        newconn->window_lock = mutex_create();
+        newconn->window = gw_malloc(smsbox_max_pending * sizeof(*newconn->window));
+        memset(newconn->window, 0, smsbox_max_pending * sizeof(*newconn->window));
+    }
 
     sender = gwthread_create(boxc_sender, newconn);
     if (sender == -1) {
@@ -668,6 +910,7 @@ static void run_smsbox(void *arg)
      */
     gw_rwlock_wrlock(smsbox_list_rwlock);
     gwlist_append(smsbox_list, newconn);
+    smsbox_group_add(&smsbox_unnamed, newconn);
     gw_rwlock_unlock(smsbox_list_rwlock);
 
     gwlist_add_producer(newconn->outgoing);
@@ -677,16 +920,10 @@ static void run_smsbox(void *arg)
     /* remove us from smsbox routing list */
     gw_rwlock_wrlock(smsbox_list_rwlock);
     gwlist_delete_equal(smsbox_list, newconn);
-    if (newconn->boxc_id) {
-
-        /* Get the list, and remove the connection from it */
-        List *boxc_id_list = dict_get(smsbox_by_id, newconn->boxc_id);
-
-        if(boxc_id_list != NULL) {
-            gwlist_delete_equal(boxc_id_list, newconn);
-        }
-    }
-
+    if (newconn->boxc_id)
+        smsbox_group_remove(dict_get(smsbox_by_id, newconn->boxc_id), newconn);
+    else
+        smsbox_group_remove(&smsbox_unnamed, newconn);
     gw_rwlock_unlock(smsbox_list_rwlock);
 
     /*
@@ -697,7 +934,7 @@ static void run_smsbox(void *arg)
         gwlist_remove_producer(newconn->incoming);
 
     /* check if we are still waiting for ack's and semaphore locked */
-    if (dict_key_count(newconn->sent) >= smsbox_max_pending)
+    if (semaphore_getvalue(newconn->pending) <= 0)
         semaphore_up(newconn->pending); /* allow sender to go down */
 
     gwthread_join(sender);
@@ -712,6 +949,16 @@ static void run_smsbox(void *arg)
     gw_assert(gwlist_len(keys) == 0);
     gwlist_destroy(keys, octstr_destroy_item);
 
+    /* and those sent in batch frames */
+    if (newconn->window != NULL) {
+        mutex_lock(newconn->window_lock);
+        while (newconn->oldest_seq < newconn->next_seq) {
+            if ((msg = boxc_window_take(newconn, newconn->oldest_seq)) != NULL)
+                gwlist_produce(incoming_sms, msg);
+        }
+        mutex_unlock(newconn->window_lock);
+    }
+
     /* clear our send queue */
     while((msg = gwlist_extract_first(newconn->incoming)) != NULL) {
         gwlist_produce(incoming_sms, msg);
@@ -723,10 +970,14 @@ cleanup:
     gw_assert(dict_key_count(newconn->sent) == 0);
     dict_destroy(newconn->sent);
     semaphore_destroy(newconn->pending);
+    if (newconn->window != NULL) {
+        mutex_destroy(newconn->window_lock);
+        gw_free(newconn->window);
+    }
     boxc_destroy(newconn);
 
-    /* wakeup the dequeueing thread */
-    gwthread_wakeup(sms_dequeue_thread);
+    /* wakeup the dequeueing threads */
+    sms_dispatch_wakeup();
 
     gwlist_remove_producer(flow_threads);
 }
@@ -841,10 +1092,11 @@ static Boxc *route_msg(List *route_info, Msg *msg)
 	    	  "generating new");
 route:
 
-	    if (gwlist_len(wapbox_list) == 0)
-	        return NULL;
-
 	    gwlist_lock(wapbox_list);
+	    if (gwlist_len(wapbox_list) == 0) {
+	        gwlist_unlock(wapbox_list);
+	        return NULL;
+	    }
 
 	/* take random wapbox from list, and then check all wapboxes
 	 * and select the one with lowest load level - if tied, the first
@@ -893,54 +1145,116 @@ route:
 
 
 /*
- * this thread listens to incoming_wdp list
- * and then routs messages to proper wapbox
+ * Called by each thread of the WDP dispatch stage on its way out; the
+ * last one out cleans up after all of us.
  */
-static void wdp_to_wapboxes(void *arg)
+static void wdp_dispatch_leave(void)
 {
-    List *route_info;
     AddrPar *ap;
     Boxc *conn;
-    Msg *msg;
     int i;
 
+    if (gw_atomic_add(&wdp_dispatch_running, -1) > 0)
+        return;
+
+    debug("bb", 0, "wdp_to_wapboxes: destroying lists");
+    for (i = 0; i < box_dispatchers; i++) {
+        while((ap = gwlist_extract_first(wdp_routes[i])) != NULL)
+	    ap_destroy(ap);
+        gwlist_destroy(wdp_routes[i], NULL);
+        if (wdp_dispatch[i].queue != NULL) {
+            gwlist_destroy(wdp_dispatch[i].queue, msg_destroy_item);
+            wdp_dispatch[i].queue = NULL;
+        }
+    }
+    gw_free(wdp_routes);
+    wdp_routes = NULL;
+
+    gwlist_lock(wapbox_list);
+    for(i=0; i < gwlist_len(wapbox_list); i++) {
+	    conn = gwlist_get(wapbox_list, i);
+	    gwlist_remove_producer(conn->incoming);
+	    conn->alive = 0;
+    }
+    gwlist_unlock(wapbox_list);
+}
+
+
+/*
+ * With several WDP dispatchers, this thread listens to incoming_wdp and
+ * hands each datagram to the dispatcher of its client, so that all
+ * datagrams of one client go through one dispatcher, in order.
+ */
+static void wdp_to_dispatchers(void *arg)
+{
+    Msg *msg;
+    unsigned long h;
+    long i;
+
+    gwlist_add_producer(flow_threads);
+
+    while(bb_status != BB_DEAD) {
+
+	    gwlist_consume(suspended);	/* block here if suspended */
+
+	    if ((msg = gwlist_consume(incoming_wdp)) == NULL)
+	         break;
+
+	    gw_assert(msg_type(msg) == wdp_datagram);
+
+	    h = octstr_hash_key(msg->wdp_datagram.source_address) +
+	        msg->wdp_datagram.source_port;
+	    gwlist_produce(wdp_dispatch[h % box_dispatchers].queue, msg);
+    }
+
+    for (i = 0; i < box_dispatchers; i++)
+        gwlist_remove_producer(wdp_dispatch[i].queue);
+
+    wdp_dispatch_leave();
+    gwlist_remove_producer(flow_threads);
+}
+
+
+/*
+ * these threads listen to incoming_wdp list, or to their own share of
+ * it, and then rout messages to proper wapbox
+ */
+static void wdp_to_wapboxes(void *arg)
+{
+    Dispatcher *self = arg;
+    List *queue, *routes;
+    Boxc *conn;
+    Msg *msg;
+
     gwlist_add_producer(flow_threads);
     gwlist_add_producer(wapbox_list);
 
-    route_info = gwlist_create();
+    if (self->cpu >= 0 && gwthread_set_cpu(self->cpu) == -1)
+        self->cpu = -1;
 
+    queue = (self->queue != NULL ? self->queue : incoming_wdp);
+    routes = wdp_routes[self - wdp_dispatch];
 
     while(bb_status != BB_DEAD) {
 
 	    gwlist_consume(suspended);	/* block here if suspended */
 
-	    if ((msg = gwlist_consume(incoming_wdp)) == NULL)
+	    if ((msg = gwlist_consume(queue)) == NULL)
 	         break;
 
 	    gw_assert(msg_type(msg) == wdp_datagram);
 
-	    conn = route_msg(route_info, msg);
+	    conn = route_msg(routes, msg);
 	    if (conn == NULL) {
 	        warning(0, "Cannot route message, discard it");
 	        msg_destroy(msg);
 	        continue;
 	    }
 	    gwlist_produce(conn->incoming, msg);
+	    gw_atomic_add(&self->dispatched, 1);
     }
-    debug("bb", 0, "wdp_to_wapboxes: destroying lists");
-    while((ap = gwlist_extract_first(route_info)) != NULL)
-	ap_destroy(ap);
 
-    gw_assert(gwlist_len(route_info) == 0);
-    gwlist_destroy(route_info, NULL);
-
-    gwlist_lock(wapbox_list);
-    for(i=0; i < gwlist_len(wapbox_list); i++) {
-	    conn = gwlist_get(wapbox_list, i);
-	    gwlist_remove_producer(conn->incoming);
-	    conn->alive = 0;
-    }
-    gwlist_unlock(wapbox_list);
+    wdp_dispatch_leave();
 
     gwlist_remove_producer(wapbox_list);
     gwlist_remove_producer(flow_threads);
@@ -993,6 +1307,7 @@ static void wait_for_connections(int fd, void (*function) (void *arg),
 static void smsboxc_run(void *arg)
 {
     int fd;
+    long i;
 
     gwlist_add_producer(flow_threads);
     gwthread_wakeup(MAIN_THREAD_ID);
@@ -1024,8 +1339,9 @@ static void smsboxc_run(void *arg)
     /* close listen socket */
     close(fd);
 
-    gwthread_wakeup(sms_dequeue_thread);
-    gwthread_join(sms_dequeue_thread);
+    sms_dispatch_wakeup();
+    for (i = 0; i < box_dispatchers; i++)
+        gwthread_join(sms_dispatch[i].thread);
 
     gwlist_destroy(smsbox_list, NULL);
     smsbox_list = NULL;
@@ -1039,8 +1355,10 @@ static void smsboxc_run(void *arg)
     smsbox_by_smsc = NULL;
     dict_destroy(smsbox_by_receiver);
     smsbox_by_receiver = NULL;
-    dict_destroy(smsbox_by_smsc_receiver);
-    smsbox_by_smsc_receiver = NULL;
+    smsbox_routes = 0;
+    gw_free(smsbox_unnamed.boxes);
+    smsbox_unnamed.boxes = NULL;
+    smsbox_unnamed.len = smsbox_unnamed.size = 0;
 
     gwlist_remove_producer(flow_threads);
 }
@@ -1088,6 +1406,121 @@ static void wapboxc_run(void *arg)
 }
 
 
+/*
+ * Return the group of smsbox-id `id', creating it if there is none yet.
+ * Called with smsbox_list_rwlock held for writing, or at start-up.
+ */
+static SmsboxGroup *smsbox_group(Octstr *id)
+{
+    SmsboxGroup *group;
+
+    if ((group = dict_get(smsbox_by_id, id)) == NULL) {
+        group = gw_malloc(sizeof(*group));
+        group->id = octstr_duplicate(id);
+        group->boxes = NULL;
+        group->len = group->size = 0;
+        dict_put(smsbox_by_id, id, group);
+    }
+    return group;
+}
+
+
+static void smsbox_group_destroy(void *p)
+{
+    SmsboxGroup *group = p;
+
+    octstr_destroy(group->id);
+    gw_free(group->boxes);
+    gw_free(group);
+}
+
+
+static void smsbox_group_add(SmsboxGroup *group, Boxc *conn)
+{
+    if (group->len == group->size) {
+        group->size = group->size * 2 + 4;
+        group->boxes = gw_realloc(group->boxes, group->size * sizeof(*group->boxes));
+    }
+    group->boxes[group->len++] = conn;
+}
+
+
+static void smsbox_group_remove(SmsboxGroup *group, Boxc *conn)
+{
+    long i;
+
+    if (group == NULL)
+        return;
+    for (i = 0; i < group->len; i++) {
+        if (group->boxes[i] == conn) {
+            group->boxes[i] = group->boxes[--group->len];
+            return;
+        }
+    }
+}
+
+
+/*
+ * Return the routable smsbox of the group with the least messages queued
+ * for it or waiting for its ack, or NULL if there is none. Boxes with more
+ * than max-incoming-sms-qlength messages queued are full and skipped,
+ * which sets `full_found'. Ties go to the first box from a random start.
+ * Called with smsbox_list_rwlock held.
+ */
+static Boxc *smsbox_group_pick(SmsboxGroup *group, int *full_found)
+{
+    Boxc *bc, *best = NULL;
+    long i, b, queued, load, best_load = 0;
+
+    if (group->len == 0)
+        return NULL;
+
+    b = gw_rand() % group->len;
+    for (i = 0; i < group->len; i++) {
+        bc = group->boxes[(i + b) % group->len];
+        if (bc->routable == 0)
+            continue;
+
+        queued = gw_atomic_get(&bc->queued);
+        if (max_incoming_sms_qlength > 0 && queued > max_incoming_sms_qlength) {
+            *full_found = 1;
+            continue;
+        }
+
+        load = queued + gw_atomic_get(&bc->unacked);
+        if (best == NULL || load < best_load) {
+            best = bc;
+            best_load = load;
+        }
+    }
+
+    return best;
+}
+
+
+static ReceiverRoute *receiver_route(Octstr *receiver)
+{
+    ReceiverRoute *route;
+
+    if ((route = dict_get(smsbox_by_receiver, receiver)) == NULL) {
+        route = gw_malloc(sizeof(*route));
+        route->group = NULL;
+        route->by_smsc = NULL;
+        dict_put(smsbox_by_receiver, receiver, route);
+    }
+    return route;
+}
+
+
+static void receiver_route_destroy(void *p)
+{
+    ReceiverRoute *route = p;
+
+    dict_destroy(route->by_smsc);
+    gw_free(route);
+}
+
+
 /*
  * Populates the corresponding smsbox_by_foobar dictionary hash tables
  */
@@ -1096,6 +1529,8 @@ static void init_smsbox_routes(Cfg *cfg)
     CfgGroup *grp;
     List *list, *items;
     Octstr *boxc_id, *smsc_ids, *shortcuts;
+    SmsboxGroup *group;
+    ReceiverRoute *route;
     int i, j;
 
     boxc_id = smsc_ids = shortcuts = NULL;
@@ -1109,6 +1544,7 @@ static void init_smsbox_routes(Cfg *cfg)
             grp_dump(grp);
             panic(0,"'smsbox-route' group without valid 'smsbox-id' directive!");
         }
+        group = smsbox_group(boxc_id);
 
         /*
          * If smsc-id is given, then any message comming from the specified
@@ -1133,12 +1569,12 @@ static void init_smsbox_routes(Cfg *cfg)
                 debug("bb.boxc",0,"Adding smsbox routing to id <%s> for smsc id <%s>",
                       octstr_get_cstr(boxc_id), octstr_get_cstr(item));
 
-                if (!dict_put_once(smsbox_by_smsc, item, octstr_duplicate(boxc_id)))
+                if (!dict_put_once(smsbox_by_smsc, item, group))
                     panic(0, "Routing for smsc-id <%s> already exists!",
                           octstr_get_cstr(item));
+                smsbox_routes++;
             }
             gwlist_destroy(items, octstr_destroy_item);
-            octstr_destroy(smsc_ids);
         }
         else if (!smsc_ids && shortcuts) {
             /* shortcode only, so these MOs from all smscs */
@@ -1150,12 +1586,14 @@ static void init_smsbox_routes(Cfg *cfg)
                 debug("bb.boxc",0,"Adding smsbox routing to id <%s> for receiver no <%s>",
                       octstr_get_cstr(boxc_id), octstr_get_cstr(item));
 
-                if (!dict_put_once(smsbox_by_receiver, item, octstr_duplicate(boxc_id)))
+                route = receiver_route(item);
+                if (route->group != NULL)
                     panic(0, "Routing for receiver no <%s> already exists!",
                           octstr_get_cstr(item));
+                route->group = group;
+                smsbox_routes++;
             }
             gwlist_destroy(items, octstr_destroy_item);
-            octstr_destroy(shortcuts);
         }
         else if (smsc_ids && shortcuts) {
             /* both, so only specified MOs from specified smscs */
@@ -1164,6 +1602,9 @@ static void init_smsbox_routes(Cfg *cfg)
                 List *subitems;
                 Octstr *item = gwlist_get(items, i);
                 octstr_strip_blanks(item);
+                route = receiver_route(item);
+                if (route->by_smsc == NULL)
+                    route->by_smsc = dict_create(8, NULL);
                 subitems = octstr_split(smsc_ids, octstr_imm(";"));
                 for (j = 0; j < gwlist_len(subitems); j++) {
                     Octstr *subitem = gwlist_get(subitems, j);
@@ -1174,18 +1615,17 @@ static void init_smsbox_routes(Cfg *cfg)
                           octstr_get_cstr(boxc_id), octstr_get_cstr(item),
                           octstr_get_cstr(subitem));
 
-                    /* construct the dict key '<shortcode>:<smsc-id>' */
-                    octstr_insert(subitem, item, 0);
-                    octstr_insert_char(subitem, octstr_len(item), ':');
-                    if (!dict_put_once(smsbox_by_smsc_receiver, subitem, octstr_duplicate(boxc_id)))
-                        panic(0, "Routing for receiver:smsc <%s> already exists!",
-                              octstr_get_cstr(subitem));
+                    if (!dict_put_once(route->by_smsc, subitem, group))
+                        panic(0, "Routing for receiver:smsc <%s:%s> already exists!",
+                              octstr_get_cstr(item), octstr_get_cstr(subitem));
+                    smsbox_routes++;
                 }
                 gwlist_destroy(subitems, octstr_destroy_item);
             }
             gwlist_destroy(items, octstr_destroy_item);
-            octstr_destroy(shortcuts);
         }
+        octstr_destroy(smsc_ids);
+        octstr_destroy(shortcuts);
         octstr_destroy(boxc_id);
     }
 
@@ -1193,6 +1633,55 @@ static void init_smsbox_routes(Cfg *cfg)
 }
 
 
+/*
+ * Read the dispatch settings, shared by smsboxes and wapboxes, from the
+ * core group, unless the other box module did already.
+ */
+static void init_box_dispatch(CfgGroup *grp)
+{
+    if (box_dispatchers > 0)
+        return;
+
+    if (cfg_get_integer(&box_dispatchers, grp, octstr_imm("box-dispatch-threads")) == -1 ||
+            box_dispatchers <= 0)
+        box_dispatchers = 1;
+
+    box_cpus = cfg_get_cpu_list(grp, octstr_imm("box-dispatch-cpus"), &box_cpus_len);
+    if (box_cpus_len == -1)
+        panic(0, "Invalid 'box-dispatch-cpus' in core group!");
+
+#ifndef HAVE_PTHREAD_SETAFFINITY_NP
+    if (box_cpus_len > 0)
+        warning(0, "BOXC: 'box-dispatch-cpus' set, but threads can't be pinned "
+                "to CPUs on this platform.");
+#endif
+}
+
+
+/* Pin the calling thread to the n-th CPU, round robin, of box-dispatch-cpus. */
+static void boxc_pin(long n)
+{
+    if (box_cpus_len > 0)
+        gwthread_set_cpu(box_cpus[n % box_cpus_len]);
+}
+
+
+static Dispatcher *dispatchers_create(void)
+{
+    Dispatcher *d;
+    long i;
+
+    d = gw_malloc(box_dispatchers * sizeof(*d));
+    for (i = 0; i < box_dispatchers; i++) {
+        d[i].thread = -1;
+        d[i].cpu = (box_cpus_len > 0 ? box_cpus[i % box_cpus_len] : -1);
+        d[i].queue = NULL;
+        d[i].dispatched = 0;
+    }
+    return d;
+}
+
+
 /*-------------------------------------------------------------
  * public functions
  *
@@ -1202,6 +1691,7 @@ static void init_smsbox_routes(Cfg *cfg)
 int smsbox_start(Cfg *cfg)
 {
     CfgGroup *grp;
+    long i;
 
     if (smsbox_running) return -1;
 
@@ -1225,6 +1715,10 @@ int smsbox_start(Cfg *cfg)
         smsbox_max_pending = SMSBOX_MAX_PENDING;
         info(0, "BOXC: 'smsbox-max-pending' not set, using default (%ld).", smsbox_max_pending);
     }
+    smsbox_batch = 0;
+    cfg_get_bool(&smsbox_batch, grp, octstr_imm("smsbox-batch"));
+
+    init_box_dispatch(grp);
 
     box_allow_ip = cfg_get(grp, octstr_imm("box-allow-ip"));
     if (box_allow_ip == NULL)
@@ -1241,10 +1735,9 @@ int smsbox_start(Cfg *cfg)
         boxid = counter_create();
 
     /* the smsbox routing specific inits */
-    smsbox_by_id = dict_create(10, (void(*)(void *)) boxc_gwlist_destroy);
-    smsbox_by_smsc = dict_create(30, (void(*)(void *)) octstr_destroy);
-    smsbox_by_receiver = dict_create(50, (void(*)(void *)) octstr_destroy);
-    smsbox_by_smsc_receiver = dict_create(50, (void(*)(void *)) octstr_destroy);
+    smsbox_by_id = dict_create(10, smsbox_group_destroy);
+    smsbox_by_smsc = dict_create(30, NULL);
+    smsbox_by_receiver = dict_create(50, receiver_route_destroy);
 
     /* load the defined smsbox routing rules */
     init_smsbox_routes(cfg);
@@ -1254,8 +1747,12 @@ int smsbox_start(Cfg *cfg)
 
     smsbox_running = 1;
 
-    if ((sms_dequeue_thread = gwthread_create(sms_to_smsboxes, NULL)) == -1)
- 	    panic(0, "Failed to start a new thread for smsbox routing");
+    sms_dispatch = dispatchers_create();
+    sms_dispatch_running = box_dispatchers;
+    for (i = 0; i < box_dispatchers; i++) {
+        if ((sms_dispatch[i].thread = gwthread_create(sms_to_smsboxes, &sms_dispatch[i])) == -1)
+ 	        panic(0, "Failed to start a new thread for smsbox routing");
+    }
 
     if (gwthread_create(smsboxc_run, NULL) == -1)
 	    panic(0, "Failed to start a new thread for smsbox connections");
@@ -1280,6 +1777,7 @@ int smsbox_restart(Cfg *cfg)
 int wapbox_start(Cfg *cfg)
 {
     CfgGroup *grp;
+    long i;
 
     if (wapbox_running) return -1;
 
@@ -1304,13 +1802,29 @@ int wapbox_start(Cfg *cfg)
     if (box_allow_ip != NULL && box_deny_ip == NULL)
 	    info(0, "Box connection allowed IPs defined without any denied...");
 
+    init_box_dispatch(grp);
+
     wapbox_list = gwlist_create();	/* have a list of connections */
     gwlist_add_producer(outgoing_wdp);
     if (!boxid)
         boxid = counter_create();
 
-    if (gwthread_create(wdp_to_wapboxes, NULL) == -1)
- 	    panic(0, "Failed to start a new thread for wapbox routing");
+    wdp_routes = gw_malloc(box_dispatchers * sizeof(*wdp_routes));
+    wdp_dispatch = dispatchers_create();
+    for (i = 0; i < box_dispatchers; i++) {
+        wdp_routes[i] = gwlist_create();
+        if (box_dispatchers > 1) {
+            wdp_dispatch[i].queue = gwlist_create();
+            gwlist_add_producer(wdp_dispatch[i].queue);
+        }
+    }
+    wdp_dispatch_running = box_dispatchers + (box_dispatchers > 1);
+    for (i = 0; i < box_dispatchers; i++) {
+        if ((wdp_dispatch[i].thread = gwthread_create(wdp_to_wapboxes, &wdp_dispatch[i])) == -1)
+ 	        panic(0, "Failed to start a new thread for wapbox routing");
+    }
+    if (box_dispatchers > 1 && gwthread_create(wdp_to_dispatchers, NULL) == -1)
+        panic(0, "Failed to start a new thread for wapbox routing");
 
     if (gwthread_create(wapboxc_run, &wapbox_port) == -1)
 	    panic(0, "Failed to start a new thread for wapbox connections");
@@ -1320,6 +1834,50 @@ int wapbox_start(Cfg *cfg)
 }
 
 
+/*
+ * Append the status of one dispatch stage: its queue, and for each of
+ * its threads its own queue, if it has one, and what it dispatched.
+ */
+static void dispatch_status(Octstr *out, int status_type, char *type,
+                            Dispatcher *d, List *queue, char *ws, char *lb)
+{
+    long i;
+
+    if (d == NULL)
+        return;
+
+    if (status_type == BBSTATUS_XML) {
+        octstr_format_append(out, "<dispatch>\n\t\t<type>%s</type>\n"
+                             "\t\t<queue>%ld</queue>\n", type, gwlist_len(queue));
+        for (i = 0; i < box_dispatchers; i++) {
+            octstr_format_append(out, "\t\t<thread>\n\t\t\t<id>%ld</id>\n", d[i].thread);
+            if (d[i].cpu >= 0)
+                octstr_format_append(out, "\t\t\t<cpu>%ld</cpu>\n", d[i].cpu);
+            if (d[i].queue != NULL)
+                octstr_format_append(out, "\t\t\t<queue>%ld</queue>\n", gwlist_len(d[i].queue));
+            octstr_format_append(out, "\t\t\t<dispatched>%ld</dispatched>\n\t\t</thread>\n",
+                                 gw_atomic_get(&d[i].dispatched));
+        }
+        octstr_append_cstr(out, "\t</dispatch>\n");
+        return;
+    }
+
+    octstr_format_append(out, "%s%s dispatch: %ld queued, %ld threads (",
+                         ws, type, gwlist_len(queue), box_dispatchers);
+    for (i = 0; i < box_dispatchers; i++) {
+        octstr_format_append(out, "%s#%ld", i > 0 ? ", " : "", d[i].thread);
+        if (d[i].cpu >= 0)
+            octstr_format_append(out, " on CPU %ld", d[i].cpu);
+        if (d[i].queue != NULL)
+            octstr_format_append(out, ": %ld queued,", gwlist_len(d[i].queue));
+        else
+            octstr_append_cstr(out, ":");
+        octstr_format_append(out, " %ld dispatched", gw_atomic_get(&d[i].dispatched));
+    }
+    octstr_format_append(out, ")%s", lb);
+}
+
+
 Octstr *boxc_status(int status_type)
 {
     Octstr *tmp;
@@ -1367,9 +1925,11 @@ Octstr *boxc_status(int status_type)
             if (status_type == BBSTATUS_XML)
 	            octstr_format_append(tmp,
 		        "<box>\n\t\t<type>wapbox</type>\n\t\t<IP>%s</IP>\n"
+                "\t\t<queue>%ld</queue>\n"
                 "\t\t<status>on-line %ldd %ldh %ldm %lds</status>\n"
                 "\t\t<ssl>%s</ssl>\n\t</box>\n",
 				octstr_get_cstr(bi->client_ip),
+				gwlist_len(bi->incoming),
 				t/3600/24, t/3600%24, t/60%60, t%60,
 #ifdef HAVE_LIBSSL
                 conn_get_ssl(bi->conn) != NULL ? "yes" : "no"
@@ -1379,8 +1939,9 @@ Octstr *boxc_status(int status_type)
                 );
             else
 	            octstr_format_append(tmp,
-		        "%swapbox, IP %s (on-line %ldd %ldh %ldm %lds) %s %s",
+		        "%swapbox, IP %s (%ld queued), (on-line %ldd %ldh %ldm %lds) %s %s",
 				ws, octstr_get_cstr(bi->client_ip),
+				gwlist_len(bi->incoming),
 				t/3600/24, t/3600%24, t/60%60, t%60,
 #ifdef HAVE_LIBSSL
                 conn_get_ssl(bi->conn) != NULL ? "using SSL" : "",
@@ -1407,7 +1968,7 @@ Octstr *boxc_status(int status_type)
                     "\t\t<ssl>%s</ssl>\n\t</box>",
                     (bi->boxc_id ? octstr_get_cstr(bi->boxc_id) : ""),
 		            octstr_get_cstr(bi->client_ip),
-		            gwlist_len(bi->incoming) + dict_key_count(bi->sent),
+		            gw_atomic_get(&bi->queued) + gw_atomic_get(&bi->unacked),
 		            t/3600/24, t/3600%24, t/60%60, t%60,
 #ifdef HAVE_LIBSSL
                     conn_get_ssl(bi->conn) != NULL ? "yes" : "no"
@@ -1418,7 +1979,8 @@ Octstr *boxc_status(int status_type)
             else
                 octstr_format_append(tmp, "%ssmsbox:%s, IP %s (%ld queued), (on-line %ldd %ldh %ldm %lds) %s %s",
                     ws, (bi->boxc_id ? octstr_get_cstr(bi->boxc_id) : "(none)"),
-                    octstr_get_cstr(bi->client_ip), gwlist_len(bi->incoming) + dict_key_count(bi->sent),
+                    octstr_get_cstr(bi->client_ip),
+                    gw_atomic_get(&bi->queued) + gw_atomic_get(&bi->unacked),
 		            t/3600/24, t/3600%24, t/60%60, t%60,
 #ifdef HAVE_LIBSSL
                     conn_get_ssl(bi->conn) != NULL ? "using SSL" : "",
@@ -1433,7 +1995,11 @@ Octstr *boxc_status(int status_type)
     if (boxes == 0 && status_type != BBSTATUS_XML) {
 	    octstr_destroy(tmp);
 	    tmp = octstr_format("%sNo boxes connected", para ? "<p>" : "");
+	    if (sms_dispatch != NULL || wdp_dispatch != NULL)
+	        octstr_append_cstr(tmp, lb);
     }
+    dispatch_status(tmp, status_type, "smsbox", sms_dispatch, incoming_sms, ws, lb);
+    dispatch_status(tmp, status_type, "wapbox", wdp_dispatch, incoming_wdp, ws, lb);
     if (para)
 	    octstr_append_cstr(tmp, "</p>");
     if (status_type == BBSTATUS_XML)
@@ -1471,13 +2037,22 @@ void boxc_cleanup(void)
     boxid = NULL;
     octstr_destroy(smsbox_interface);
     smsbox_interface = NULL;
+    gw_free(sms_dispatch);
+    sms_dispatch = NULL;
+    gw_free(wdp_dispatch);
+    wdp_dispatch = NULL;
+    gw_free(box_cpus);
+    box_cpus = NULL;
+    box_cpus_len = 0;
+    box_dispatchers = 0;
 }
 
 
 /*
  * Route the incoming message to one of the following input queues:
  *   a specific smsbox conn
- *   a random smsbox conn if no shortcut routing and msg->sms.boxc_id match
+ *   the least busy smsbox conn without smsbox-id if no shortcut routing
+ *   and msg->sms.boxc_id match
  *
  * BEWARE: All logic inside here should be fast, hence speed processing
  * optimized, because every single MO message passes this function and we
@@ -1485,9 +2060,9 @@ void boxc_cleanup(void)
  */
 int route_incoming_to_boxc(Msg *msg)
 {
+    SmsboxGroup *group = NULL;
+    ReceiverRoute *route;
     Boxc *bc = NULL;
-    Octstr *s, *r, *rs, *boxc_id = NULL;
-    long len, b, i;
     int full_found = 0;
 
     gw_assert(msg_type(msg) == sms);
@@ -1511,119 +2086,67 @@ int route_incoming_to_boxc(Msg *msg)
      * Do we have a specific smsbox-id route to pass this msg to?
      */
     if (octstr_len(msg->sms.boxc_id) > 0) {
-        boxc_id = msg->sms.boxc_id;
-    } else {
+        group = dict_get(smsbox_by_id, msg->sms.boxc_id);
+    } else if (smsbox_routes > 0) {
         /*
          * Check if we have a "smsbox-route" for this msg.
          * Where the shortcode route has a higher priority then the smsc-id rule.
          * Highest priority has the combined <shortcode>:<smsc-id> route.
          */
-        Octstr *os = octstr_format("%s:%s",
-                                   octstr_get_cstr(msg->sms.receiver),
-                                   octstr_get_cstr(msg->sms.smsc_id));
-        s = (msg->sms.smsc_id ? dict_get(smsbox_by_smsc, msg->sms.smsc_id) : NULL);
-        r = (msg->sms.receiver ? dict_get(smsbox_by_receiver, msg->sms.receiver) : NULL);
-        rs = (os ? dict_get(smsbox_by_smsc_receiver, os) : NULL);
-        octstr_destroy(os);
-
-        if (rs)
-            boxc_id = rs;
-        else if (r)
-            boxc_id = r;
-        else if (s)
-            boxc_id = s;
+        route = (msg->sms.receiver ? dict_get(smsbox_by_receiver, msg->sms.receiver) : NULL);
+        if (route != NULL && route->by_smsc != NULL && msg->sms.smsc_id != NULL)
+            group = dict_get(route->by_smsc, msg->sms.smsc_id);
+        if (group == NULL && route != NULL)
+            group = route->group;
+        if (group == NULL && msg->sms.smsc_id != NULL)
+            group = dict_get(smsbox_by_smsc, msg->sms.smsc_id);
     }
 
     /* We have a specific smsbox-id to use */
-    if (boxc_id != NULL) {
+    if (group != NULL || octstr_len(msg->sms.boxc_id) > 0) {
 
-        List *boxc_id_list = dict_get(smsbox_by_id, boxc_id);
-        if (gwlist_len(boxc_id_list) == 0) {
+        if (group == NULL || group->len == 0) {
             /*
              * something is wrong, this was the smsbox connection we used
              * for sending, so it seems this smsbox is gone
              */
             warning(0, "Could not route message to smsbox id <%s>, smsbox is gone!",
-                    octstr_get_cstr(boxc_id));
-            gw_rwlock_unlock(smsbox_list_rwlock);
-            if (max_incoming_sms_qlength < 0 || max_incoming_sms_qlength > gwlist_len(incoming_sms)) {
-                gwlist_produce(incoming_sms, msg);
-                return 0;
-            } else {
-                return -1;
-            }
-        }
-        
-        /* 
-         * Take random smsbox from list, as long as it has space we will use it,
-         * otherwise check the next one.
-         */
-        len = gwlist_len(boxc_id_list);
-        b = gw_rand() % len;
-
-        for (i = 0; i < len; i++) {
-            bc = gwlist_get(boxc_id_list, (i+b) % len);
-
-            if (bc != NULL && max_incoming_sms_qlength > 0 &&
-                    gwlist_len(bc->incoming) > max_incoming_sms_qlength) {
-                bc = NULL;
-            }
-
-            if (bc != NULL) {
-                break;
-            }
+                    octstr_get_cstr(group != NULL ? group->id : msg->sms.boxc_id));
+        } else {
+            bc = smsbox_group_pick(group, &full_found);
         }
 
         if (bc != NULL) {
             bc->load++;
+            gw_atomic_add(&bc->queued, 1);
             gwlist_produce(bc->incoming, msg);
             gw_rwlock_unlock(smsbox_list_rwlock);
             return 1; /* we are done */
         }
-        else {
-            /*
-             * we have routing defined, but no smsbox connected at the moment.
-             * put msg into global incoming queue and wait until smsbox with
-             * such boxc_id connected.
-             */
-            gw_rwlock_unlock(smsbox_list_rwlock);
-            if (max_incoming_sms_qlength < 0 || max_incoming_sms_qlength > gwlist_len(incoming_sms)) {
-                gwlist_produce(incoming_sms, msg);
-                return 0;
-            } else {
-                return -1;
-            }
+
+        /*
+         * we have routing defined, but no smsbox connected at the moment.
+         * put msg into global incoming queue and wait until smsbox with
+         * such boxc_id connected.
+         */
+        gw_rwlock_unlock(smsbox_list_rwlock);
+        if (max_incoming_sms_qlength < 0 || max_incoming_sms_qlength > gwlist_len(incoming_sms)) {
+            gwlist_produce(incoming_sms, msg);
+            return 0;
+        } else {
+            return -1;
         }
     }
 
     /*
      * Ok, none of the specific routing things applied previously, 
-     * so route it to a random smsbox.
-     * Take random smsbox from list, as long as it has space we will 
-     * use it, therwise check the next one.
+     * so route it to the least busy smsbox without smsbox-id that
+     * still has space.
      */
-    len = gwlist_len(smsbox_list);
-    b = gw_rand() % len;
-
-    for (i = 0; i < len; i++) {
-        bc = gwlist_get(smsbox_list, (i+b) % len);
-
-        if (bc->boxc_id != NULL || bc->routable == 0)
-            bc = NULL;
-
-        if (bc != NULL && max_incoming_sms_qlength > 0 &&
-            gwlist_len(bc->incoming) > max_incoming_sms_qlength) {
-            full_found = 1;
-            bc = NULL;
-        }
-
-        if (bc != NULL) {
-            break;
-        }
-    }
-
+    bc = smsbox_group_pick(&smsbox_unnamed, &full_found);
     if (bc != NULL) {
         bc->load++;
+        gw_atomic_add(&bc->queued, 1);
         gwlist_produce(bc->incoming, msg);
     }
 
@@ -1645,81 +2168,86 @@ int route_incoming_to_boxc(Msg *msg)
 }
 
 
+/*
+ * Route the messages waiting in incoming_sms, that no smsbox could take
+ * when they came in, to the smsboxes. There are box-dispatch-threads of
+ * these sharing the queue, so instead of looking for the message it
+ * started with, a thread counts its failures: once it failed as many
+ * times in a row as there are messages queued, it waits until a box
+ * connects or a minute has passed. It waits like that to begin with, too.
+ */
 static void sms_to_smsboxes(void *arg)
 {
-    Msg *newmsg, *startmsg, *msg;
-    long i, len;
-    int ret = -1;
+    Dispatcher *self = arg;
+    Msg *msg;
+    long i, len, failed = 0;
+    int ret, wait = 1;
     Boxc *boxc;
 
     gwlist_add_producer(flow_threads);
 
-    newmsg = startmsg = msg = NULL;
+    if (self->cpu >= 0 && gwthread_set_cpu(self->cpu) == -1)
+        self->cpu = -1;
 
     while(bb_status != BB_DEAD) {
 
-        if (newmsg == startmsg) {
-            /* check if we are in shutdown phase */
-            if (gwlist_producer_count(smsbox_list) == 0)
-                break;
-
-            if (ret == 0 || ret == -1) {
-                /* debug("", 0, "time to sleep"); */
-                gwthread_sleep(60.0);
-                /* debug("", 0, "wake up list len %ld", gwlist_len(incoming_sms)); */
-                /* shutdown ? */
-                if (gwlist_producer_count(smsbox_list) == 0 && gwlist_len(smsbox_list) == 0)
-                    break;
-            }
-            startmsg = msg = gwlist_consume(incoming_sms);
-            /* debug("", 0, "gwlist_consume done 1"); */
-            newmsg = NULL;
-        }
-        else {
-            newmsg = msg = gwlist_consume(incoming_sms);
+        /* check if we are in shutdown phase */
+        if (gwlist_producer_count(smsbox_list) == 0)
+            break;
 
-            /* Back at the first message? */
-            if (newmsg == startmsg) {
-                gwlist_insert(incoming_sms, 0, msg);
-                continue;
-            }
+        len = gwlist_len(incoming_sms);
+        if (len == 0)
+            failed = 0;
+        else if (failed >= len)
+            wait = 1;
+        if (wait) {
+            gwthread_sleep(60.0);
+            wait = 0;
+            failed = 0;
+            /* shutdown ? */
+            if (gwlist_producer_count(smsbox_list) == 0 && gwlist_len(smsbox_list) == 0)
+                break;
         }
 
-        if (msg == NULL)
+        if ((msg = gwlist_consume(incoming_sms)) == NULL)
             break;
 
         gw_assert(msg_type(msg) == sms);
 
-        /* debug("bb.sms", 0, "sms_boxc_router: handling message (%p vs %p)",
-	          msg, startmsg); */
-
         ret = route_incoming_to_boxc(msg);
-        if (ret == 1)
-            startmsg = newmsg = NULL;
-        else if (ret == -1) {
-            gwlist_produce(incoming_sms, msg);
+        if (ret == 1) {
+            failed = 0;
+            gw_atomic_add(&self->dispatched, 1);
+        } else {
+            failed++;
+            if (ret == -1)
+                gwlist_produce(incoming_sms, msg);
         }
     }
 
-    gw_rwlock_rdlock(smsbox_list_rwlock);
-    len = gwlist_len(smsbox_list);
-    for (i=0; i < len; i++) {
-        boxc = gwlist_get(smsbox_list, i);
-        gwlist_remove_producer(boxc->incoming);
+    /* the last one out stops the boxes */
+    if (gw_atomic_add(&sms_dispatch_running, -1) == 0) {
+        gw_rwlock_rdlock(smsbox_list_rwlock);
+        len = gwlist_len(smsbox_list);
+        for (i=0; i < len; i++) {
+            boxc = gwlist_get(smsbox_list, i);
+            gwlist_remove_producer(boxc->incoming);
+        }
+        gw_rwlock_unlock(smsbox_list_rwlock);
     }
-    gw_rwlock_unlock(smsbox_list_rwlock);
 
     gwlist_remove_producer(flow_threads);
 }
 
 
-/*
- * Simple wrapper to allow the named smsbox Lists to be
- * destroyed when the smsbox_by_id Dict is destroyed
- *
- */
-static void boxc_gwlist_destroy(List *list)
+static void sms_dispatch_wakeup(void)
 {
-    gwlist_destroy(list, NULL);
-}
+    long i;
 
+    if (sms_dispatch == NULL)
+        return;
+    for (i = 0; i < box_dispatchers; i++) {
+        if (sms_dispatch[i].thread >= 0)
+            gwthread_wakeup(sms_dispatch[i].thread);
+    }
+}
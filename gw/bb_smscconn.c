@@ -127,10 +127,10 @@ extern Octstr *cfg_filename;
 static volatile sig_atomic_t smsc_running;
 static List *smsc_list;
 static RWLock smsc_list_lock;
+static SMSCRoute *smsc_route;   /* index of smsc_list, see smsc2_rebuild_route */
 static List *smsc_groups;
 static Octstr *unified_prefix;
 
-static RWLock white_black_list_lock;
 static Octstr *black_list_url;
 static Octstr *white_list_url;
 static Numhash *black_list;
@@ -139,12 +139,23 @@ static Numhash *white_list;
 static regex_t *white_list_regex;
 static regex_t *black_list_regex;
 
-static long router_thread = -1;
+static long router_thread_count;
+static long resender_thread = -1;
 
 /* message resend */
 static long sms_resend_frequency;
 static long sms_resend_retry;
 
+/* Messages waiting for their resend time, see sms_delay(). */
+static TimerWheel *resend_wheel;
+
+/*
+ * Number of messages parked on the pending queues of full or offline
+ * SMSCes, and a request for the resender to release all of them.
+ */
+static Counter *parked_sms;
+static volatile sig_atomic_t release_parked;
+
 /*
  * Counter for catenated SMS messages. The counter that can be put into
  * the catenated SMS message's UDH headers is actually the lowest 8 bits.
@@ -166,7 +177,10 @@ static long route_incoming_to_smsc(SMSCConn *conn, Msg *msg);
 static void init_concat_handler(void);
 static void shutdown_concat_handler(void);
 static int check_concatenation(Msg **msg, Octstr *smscid);
-static void clear_old_concat_parts(void);
+
+static void sms_delay(Msg *msg, double seconds);
+static void sms_resend(Msg *msg);
+static long smsc2_release(SMSCConn *conn, long max);
 
 /*---------------------------------------------------------------------------
  * CALLBACK FUNCTIONS
@@ -183,8 +197,14 @@ void bb_smscconn_ready(SMSCConn *conn)
 
 void bb_smscconn_connected(SMSCConn *conn)
 {
-    if (router_thread >= 0)
-	gwthread_wakeup(router_thread);
+    /*
+     * Messages parked on this SMSC can go now, and those parked on other
+     * offline SMSCes may find their way here.
+     */
+    smsc2_release(conn, -1);
+    release_parked = 1;
+    if (resender_thread >= 0)
+        gwthread_wakeup(resender_thread);
 }
 
 
@@ -228,7 +248,7 @@ static void handle_split(SMSCConn *conn, Msg *msg, long reason)
             msg->sms.resend_try = (msg->sms.resend_try > 0 ? msg->sms.resend_try + 1 : 1);
             time(&msg->sms.resend_time);
         }
-        gwlist_produce(outgoing_sms, msg);
+        sms_resend(msg);
         return;
     case SMSCCONN_FAILED_DISCARDED:
     case SMSCCONN_FAILED_REJECTED:
@@ -270,6 +290,10 @@ static void handle_split(SMSCConn *conn, Msg *msg, long reason)
 
 void bb_smscconn_sent(SMSCConn *conn, Msg *sms, Octstr *reply)
 {
+    /* a place in the queue of conn is free, give it to a parked message */
+    if (conn != NULL && gwlist_len(conn->pending) > 0)
+        smsc2_release(conn, 1);
+
     if (sms->sms.split_parts != NULL) {
         handle_split(conn, sms, SMSCCONN_SUCCESS);
         octstr_destroy(reply);
@@ -319,6 +343,9 @@ void bb_smscconn_sent(SMSCConn *conn, Msg *sms, Octstr *reply)
 
 void bb_smscconn_send_failed(SMSCConn *conn, Msg *sms, int reason, Octstr *reply)
 {
+    if (conn != NULL && gwlist_len(conn->pending) > 0)
+        smsc2_release(conn, 1);
+
     if (sms->sms.split_parts != NULL) {
         handle_split(conn, sms, reason);
         octstr_destroy(reply);
@@ -346,7 +373,7 @@ void bb_smscconn_send_failed(SMSCConn *conn, Msg *sms, int reason, Octstr *reply
            sms->sms.resend_try = (sms->sms.resend_try > 0 ? sms->sms.resend_try + 1 : 1);
            time(&sms->sms.resend_time);
        }
-       gwlist_produce(outgoing_sms, sms);
+       sms_resend(sms);
        break;
        
     case SMSCCONN_FAILED_SHUTDOWN:
@@ -415,9 +442,7 @@ long bb_smscconn_receive(SMSCConn *conn, Msg *sms)
     uf = unified_prefix ? octstr_get_cstr(unified_prefix) : NULL;
     normalize_number(uf, &(sms->sms.sender));
 
-    gw_rwlock_rdlock(&white_black_list_lock);
     if (white_list && numhash_find_number(white_list, sms->sms.sender) < 1) {
-        gw_rwlock_unlock(&white_black_list_lock);
 	info(0, "Number <%s> is not in white-list, message discarded",
 	     octstr_get_cstr(sms->sms.sender));
 	bb_alog_sms(conn, sms, "REJECTED - not white-listed SMS");
@@ -426,7 +451,6 @@ long bb_smscconn_receive(SMSCConn *conn, Msg *sms)
     }
 
     if (white_list_regex && gw_regex_match_pre(white_list_regex, sms->sms.sender) == 0) {
-        gw_rwlock_unlock(&white_black_list_lock);
         info(0, "Number <%s> is not in white-list, message discarded",
              octstr_get_cstr(sms->sms.sender));
         bb_alog_sms(conn, sms, "REJECTED - not white-regex-listed SMS");
@@ -435,7 +459,6 @@ long bb_smscconn_receive(SMSCConn *conn, Msg *sms)
     }
     
     if (black_list && numhash_find_number(black_list, sms->sms.sender) == 1) {
-        gw_rwlock_unlock(&white_black_list_lock);
 	info(0, "Number <%s> is in black-list, message discarded",
 	     octstr_get_cstr(sms->sms.sender));
 	bb_alog_sms(conn, sms, "REJECTED - black-listed SMS");
@@ -444,14 +467,12 @@ long bb_smscconn_receive(SMSCConn *conn, Msg *sms)
     }
 
     if (black_list_regex && gw_regex_match_pre(black_list_regex, sms->sms.sender) == 0) {
-        gw_rwlock_unlock(&white_black_list_lock);
         info(0, "Number <%s> is not in black-list, message discarded",
              octstr_get_cstr(sms->sms.sender));
         bb_alog_sms(conn, sms, "REJECTED - black-regex-listed SMS");
         msg_destroy(sms);
         return SMSCCONN_FAILED_REJECTED;
     }
-    gw_rwlock_unlock(&white_black_list_lock);
 
     /* fix sms type if not set already */
     if (sms->sms.sms_type != report_mo)
@@ -575,58 +596,108 @@ int bb_reload_smsc_groups()
 
 
 
-/* function to route outgoing SMS'es from delay-list
- * use some nice magics to route them to proper SMSC
+static void sms_delay_due(void *data)
+{
+    gwlist_produce(outgoing_sms, data);
+}
+
+
+/*
+ * Hand `msg' to the routers in `seconds' seconds, or now if we are
+ * shutting down. Until then it sits on the resend wheel, out of the way
+ * of the routers, and the wheel thread puts it into outgoing_sms when it
+ * is due.
+ */
+static void sms_delay(Msg *msg, double seconds)
+{
+    if (seconds <= 0 || bb_status == BB_SHUTDOWN || bb_status == BB_DEAD)
+        gwlist_produce(outgoing_sms, msg);
+    else
+        gw_timerwheel_add(resend_wheel, seconds, sms_delay_due, msg);
+}
+
+
+/* Route a temporarily failed message again when its resend time is due. */
+static void sms_resend(Msg *msg)
+{
+    if (msg->sms.resend_try > 0)
+        sms_delay(msg, difftime(msg->sms.resend_time + sms_resend_frequency, time(NULL)));
+    else
+        gwlist_produce(outgoing_sms, msg);
+}
+
+
+/*
+ * Park `msg' on the pending queue of `conn', which is full or offline,
+ * until conn drains or connects. Parked messages are routed again then,
+ * so they may still go to another SMSC.
+ * NOTE: Caller must hold smsc_list_lock, so that conn stays on the list!
+ */
+static void smsc2_park(SMSCConn *conn, Msg *msg)
+{
+    counter_increase(parked_sms);
+    gwlist_produce(conn->pending, msg);
+}
+
+
+/*
+ * Give at most `max' messages parked on `conn', or all of them if `max'
+ * is -1, back to the routers. Returns the number of messages released.
+ */
+static long smsc2_release(SMSCConn *conn, long max)
+{
+    Msg *msg;
+    long n;
+
+    for (n = 0; n != max && (msg = gwlist_extract_first(conn->pending)) != NULL; n++) {
+        counter_decrease(parked_sms);
+        gwlist_produce(outgoing_sms, msg);
+    }
+
+    return n;
+}
+
+
+static void smsc2_release_all(void)
+{
+    long i;
+
+    gw_rwlock_rdlock(&smsc_list_lock);
+    for (i = 0; i < gwlist_len(smsc_list); i++)
+        smsc2_release(gwlist_get(smsc_list, i), -1);
+    gw_rwlock_unlock(&smsc_list_lock);
+}
+
+
+/*
+ * Route outgoing SMS'es to the proper SMSC. There are sms-router-threads
+ * of these. A message that can't be placed right now is not put back
+ * into outgoing_sms: smsc2_rout parks it on an SMSC, or it is delayed, so
+ * the routers only see messages that may be routable.
  */
 static void sms_router(void *arg)
 {
-    Msg *msg, *startmsg, *newmsg;
+    Msg *msg;
     long ret;
-    time_t concat_mo_check;
+    long qfull_delay;
 
     gwlist_add_producer(flow_threads);
     gwthread_wakeup(MAIN_THREAD_ID);
 
-    startmsg = newmsg = NULL;
-    ret = SMSCCONN_SUCCESS;
-    concat_mo_check = time(NULL);
+    qfull_delay = (sms_resend_frequency / 2 > 1 ? sms_resend_frequency / 2 : sms_resend_frequency);
 
-    while(bb_status != BB_SHUTDOWN && bb_status != BB_DEAD) {
+    while (bb_status != BB_SHUTDOWN && bb_status != BB_DEAD) {
 
-	if (newmsg == startmsg) {
-            if (ret == SMSCCONN_QUEUED || ret == SMSCCONN_FAILED_QFULL) {
-                /* sleep: sms_resend_frequency / 2 , so we reduce amount of msgs to send */
-                double sleep_time = (sms_resend_frequency / 2 > 1 ? sms_resend_frequency / 2 : sms_resend_frequency);
-                debug("bb.sms", 0, "sms_router: time to sleep %.2f secs.", sleep_time);
-                gwthread_sleep(sleep_time);
-                debug("bb.sms", 0, "sms_router: gwlist_len = %ld", gwlist_len(outgoing_sms));
-            }
-            startmsg = msg = gwlist_timed_consume(outgoing_sms, concatenated_mo_timeout);
-            newmsg = NULL;
-        } else {
-            newmsg = msg = gwlist_timed_consume(outgoing_sms, concatenated_mo_timeout);
-        }
-
-        if (difftime(time(NULL), concat_mo_check) > concatenated_mo_timeout) {
-            concat_mo_check = time(NULL);
-            clear_old_concat_parts();
-        }
-
-        /* shutdown or timeout */
-        if (msg == NULL) {
-            newmsg = startmsg = NULL;
-            continue;
-        }
+        /* outgoing_sms has no producers anymore, shutdown */
+        if ((msg = gwlist_consume(outgoing_sms)) == NULL)
+            break;
 
-        debug("bb.sms", 0, "sms_router: handling message (%p vs %p)",
-                  msg, startmsg);
+        debug("bb.sms", 0, "sms_router: handling message (%p)", msg);
 
-        /* handle delayed msgs */
-        if (msg->sms.resend_try > 0 && difftime(time(NULL), msg->sms.resend_time) < sms_resend_frequency &&
-            bb_status != BB_SHUTDOWN && bb_status != BB_DEAD) {
-            debug("bb.sms", 0, "re-queing SMS not-yet-to-be resent");
-            gwlist_produce(outgoing_sms, msg);
-            ret = SMSCCONN_QUEUED;
+        /* handle delayed msgs, like those from the store */
+        if (msg->sms.resend_try > 0 && difftime(time(NULL), msg->sms.resend_time) < sms_resend_frequency) {
+            debug("bb.sms", 0, "delaying SMS not-yet-to-be resent");
+            sms_resend(msg);
             continue;
         }
 
@@ -634,18 +705,16 @@ static void sms_router(void *arg)
         switch(ret) {
         case SMSCCONN_SUCCESS:
             debug("bb.sms", 0, "Message routed successfully.");
-            newmsg = startmsg = NULL;
             break;
         case SMSCCONN_QUEUED:
-            debug("bb.sms", 0, "Routing failed, re-queued.");
+            debug("bb.sms", 0, "Routing failed, parked.");
             break;
 	case SMSCCONN_FAILED_DISCARDED:
             msg_destroy(msg);
-            newmsg = startmsg = NULL;
             break;
         case SMSCCONN_FAILED_QFULL:
-            debug("bb.sms", 0, "Routing failed, re-queuing.");
-            gwlist_produce(outgoing_sms, msg);
+            debug("bb.sms", 0, "Routing failed, re-queuing in %ld secs.", qfull_delay);
+            sms_delay(msg, qfull_delay);
             break;
         }
     }
@@ -653,6 +722,52 @@ static void sms_router(void *arg)
 }
 
 
+/*
+ * Release the messages parked on SMSCes every sms-resend-freq seconds, in
+ * case an SMSC went away without draining. At shutdown, hand the delayed
+ * messages back to outgoing_sms.
+ */
+static void sms_resender(void *arg)
+{
+    time_t now, last_release;
+
+    gwlist_add_producer(flow_threads);
+    gwthread_wakeup(MAIN_THREAD_ID);
+
+    last_release = time(NULL);
+
+    while (bb_status != BB_SHUTDOWN && bb_status != BB_DEAD) {
+        now = time(NULL);
+
+        if (release_parked || difftime(now, last_release) >= sms_resend_frequency) {
+            release_parked = 0;
+            last_release = now;
+            smsc2_release_all();
+        }
+
+        if (difftime(last_release + sms_resend_frequency, time(NULL)) > 0)
+            gwthread_sleep(difftime(last_release + sms_resend_frequency, time(NULL)));
+    }
+
+    /* hand everything back, so that it is accounted for at shutdown */
+    gw_timerwheel_flush(resend_wheel);
+    smsc2_release_all();
+
+    /* let the routers see the end of outgoing_sms */
+    gwlist_remove_producer(outgoing_sms);
+    gwlist_remove_producer(flow_threads);
+}
+
+
+/*
+ * Rebuild the routing index of smsc2_rout after smsc_list changed.
+ * NOTE: Caller must hold smsc_list_lock for writing!
+ */
+static void smsc2_rebuild_route(void)
+{
+    smscconn_route_destroy(smsc_route);
+    smsc_route = smscconn_route_create(smsc_list);
+}
 
 
 /*-------------------------------------------------------------
@@ -674,12 +789,11 @@ int smsc2_start(Cfg *cfg)
     
     /* create smsc list and rwlock for it */
     smsc_list = gwlist_create();
-    gw_rwlock_init_static(&smsc_list_lock);
+    gw_rwlock_init_static_biased(&smsc_list_lock);
 
     grp = cfg_get_single_group(cfg, octstr_imm("core"));
     unified_prefix = cfg_get(grp, octstr_imm("unified-prefix"));
 
-    gw_rwlock_init_static(&white_black_list_lock);
     white_list = black_list = NULL;
     white_list_url = black_list_url = NULL;
     white_list_url = cfg_get(grp, octstr_imm("white-list"));
@@ -719,6 +833,10 @@ int smsc2_start(Cfg *cfg)
     else
         info(0, "SMS resend retry set to %ld.", sms_resend_retry);
 
+    if (cfg_get_integer(&router_thread_count, grp, octstr_imm("sms-router-threads")) == -1 ||
+            router_thread_count <= 0)
+        router_thread_count = 1;
+
     if (cfg_get_bool(&handle_concatenated_mo, grp, octstr_imm("sms-combine-concatenated-mo")) == -1)
         handle_concatenated_mo = 1; /* default is TRUE. */
 
@@ -742,9 +860,22 @@ int smsc2_start(Cfg *cfg)
         gwlist_append(smsc_list, conn);
     }
     gwlist_remove_producer(smsc_list);
+    smsc2_rebuild_route();
     
-    if ((router_thread = gwthread_create(sms_router, NULL)) == -1)
-	panic(0, "Failed to start a new thread for SMS routing");
+    /* tenths of seconds, one turn covers the default sms-resend-freq */
+    resend_wheel = gw_timerwheel_create(0.1, 1024);
+    parked_sms = counter_create();
+    release_parked = 0;
+
+    /* the resender is a producer of outgoing_sms while it runs */
+    gwlist_add_producer(outgoing_sms);
+    if ((resender_thread = gwthread_create(sms_resender, NULL)) == -1)
+	panic(0, "Failed to start a new thread for SMS resending");
+
+    for (i = 0; i < router_thread_count; i++) {
+        if (gwthread_create(sms_router, NULL) == -1)
+	    panic(0, "Failed to start a new thread for SMS routing");
+    }
     
     gwlist_add_producer(incoming_sms);
     smsc_running = 1;
@@ -869,13 +1000,16 @@ int smsc2_restart_smsc(Octstr *id)
         
         /* drop old connection from the active smsc list */
         gwlist_delete(smsc_list, i, 1);
-        /* destroy the connection */
+        /* route its parked messages again and destroy the connection */
+        smsc2_release(conn, -1);
         smscconn_destroy(conn);
         gwlist_insert(smsc_list, i, new_conn);
         smscconn_start(new_conn);
         success = 1;
         num++;
     }
+    if (success)
+        smsc2_rebuild_route();
 
     gw_rwlock_unlock(&smsc_list_lock);
     
@@ -883,9 +1017,6 @@ int smsc2_restart_smsc(Octstr *id)
         error(0, "SMSC %s not found", octstr_get_cstr(id));
         return -1;
     }
-    /* wake-up the router */
-    if (router_thread >= 0)
-        gwthread_wakeup(router_thread);
     return 0;
 }
 
@@ -905,10 +1036,13 @@ int smsc2_remove_smsc(Octstr *id)
         conn = gwlist_get(smsc_list, i);
         gwlist_delete(smsc_list, i, 1);
         smscconn_shutdown(conn, 0);
+        smsc2_release(conn, -1);
         smscconn_destroy(conn);
         success = 1;
     }
     gwlist_remove_producer(smsc_list);
+    if (success)
+        smsc2_rebuild_route();
 
     gw_rwlock_unlock(&smsc_list_lock);
     if (success == 0) {
@@ -959,6 +1093,8 @@ int smsc2_add_smsc(Octstr *id)
         }
     }
     gwlist_remove_producer(smsc_list);
+    if (success)
+        smsc2_rebuild_route();
     gw_rwlock_unlock(&smsc_list_lock);
     if (success == 0) {
         error(0, "SMSC %s not found", octstr_get_cstr(id));
@@ -969,33 +1105,16 @@ int smsc2_add_smsc(Octstr *id)
 
 int smsc2_reload_lists(void)
 {
-    Numhash *tmp;
     int rc = 1;
 
-    if (white_list_url != NULL) {
-        tmp = numhash_create(octstr_get_cstr(white_list_url));
-        if (white_list == NULL) {
-            error(0, "Unable to reload white_list."),
-            rc = -1;
-        } else {
-        	gw_rwlock_wrlock(&white_black_list_lock);
-        	numhash_destroy(white_list);
-        	white_list = tmp;
-        	gw_rwlock_unlock(&white_black_list_lock);
-        }
+    if (white_list != NULL && numhash_reload(white_list) == -1) {
+        error(0, "Unable to reload white_list.");
+        rc = -1;
     }
 
-    if (black_list_url != NULL) {
-        tmp = numhash_create(octstr_get_cstr(black_list_url));
-        if (black_list == NULL) {
-            error(0, "Unable to reload black_list");
-            rc = -1;
-        } else {
-        	gw_rwlock_wrlock(&white_black_list_lock);
-        	numhash_destroy(black_list);
-        	black_list = tmp;
-        	gw_rwlock_unlock(&white_black_list_lock);
-        }
+    if (black_list != NULL && numhash_reload(black_list) == -1) {
+        error(0, "Unable to reload black_list");
+        rc = -1;
     }
 
     return rc;
@@ -1015,9 +1134,11 @@ void smsc2_resume(void)
         smscconn_start(conn);
     }
     gw_rwlock_unlock(&smsc_list_lock);
-    
-    if (router_thread >= 0)
-        gwthread_wakeup(router_thread);
+
+    /* route the parked messages again */
+    release_parked = 1;
+    if (resender_thread >= 0)
+        gwthread_wakeup(resender_thread);
 }
 
 
@@ -1055,8 +1176,8 @@ int smsc2_shutdown(void)
 	smscconn_shutdown(conn, 1);
     }
     gw_rwlock_unlock(&smsc_list_lock);
-    if (router_thread >= 0)
-	gwthread_wakeup(router_thread);
+    if (resender_thread >= 0)
+	gwthread_wakeup(resender_thread);
 
     /* start avalanche by calling shutdown */
 
@@ -1090,6 +1211,8 @@ void smsc2_cleanup(void)
     }
     gwlist_destroy(smsc_list, NULL);
     smsc_list = NULL;
+    smscconn_route_destroy(smsc_route);
+    smsc_route = NULL;
     gw_rwlock_unlock(&smsc_list_lock);
     gwlist_destroy(smsc_groups, NULL);
     octstr_destroy(unified_prefix);    
@@ -1103,8 +1226,12 @@ void smsc2_cleanup(void)
         gw_regex_destroy(black_list_regex);
     /* destroy msg split counter */
     counter_destroy(split_msg_counter);
+    gw_timerwheel_flush(resend_wheel);
+    gw_timerwheel_destroy(resend_wheel);
+    resend_wheel = NULL;
+    counter_destroy(parked_sms);
+    resender_thread = -1;
     gw_rwlock_destroy(&smsc_list_lock);
-    gw_rwlock_destroy(&white_black_list_lock);
 
     /* Stop concat handling */
     shutdown_concat_handler();
@@ -1113,6 +1240,15 @@ void smsc2_cleanup(void)
 }
 
 
+long smsc2_waiting(void)
+{
+    if (!smsc_running)
+        return 0;
+
+    return gw_timerwheel_len(resend_wheel) + counter_value(parked_sms);
+}
+
+
 Octstr *smsc2_status(int status_type)
 {
     Octstr *tmp;
@@ -1129,6 +1265,8 @@ Octstr *smsc2_status(int status_type)
     float outgoing_sms_load_0, outgoing_sms_load_1, outgoing_sms_load_2;
     float incoming_dlr_load_0, incoming_dlr_load_1, incoming_dlr_load_2;
     float outgoing_dlr_load_0, outgoing_dlr_load_1, outgoing_dlr_load_2;
+    long delayed;
+    double first_due;
 
     if ((lb = bb_status_linebreak(status_type)) == NULL)
         return octstr_create("Un-supported format");
@@ -1268,16 +1406,28 @@ Octstr *smsc2_status(int status_type)
                 lb);
     }
 
-
-
-
     gw_rwlock_unlock(&smsc_list_lock);
 
+    /* messages the routers are not looking at right now */
+    delayed = gw_timerwheel_len(resend_wheel);
+    first_due = gw_timerwheel_next(resend_wheel);
+    if (status_type == BBSTATUS_XML) {
+        octstr_format_append(tmp, "</smscs>\n\t<delayed>\n\t\t<count>%ld</count>\n",
+            delayed);
+        if (first_due >= 0)
+            octstr_format_append(tmp, "\t\t<first-due>%.1f</first-due>\n", first_due);
+        octstr_format_append(tmp, "\t</delayed>\n\t<parked>%ld</parked>\n",
+            counter_value(parked_sms));
+    } else if (first_due >= 0)
+        octstr_format_append(tmp, "%sDelayed: %ld msgs, first due in %.1fs, parked: %ld msgs%s",
+            lb, delayed, first_due, counter_value(parked_sms), lb);
+    else
+        octstr_format_append(tmp, "%sDelayed: %ld msgs, parked: %ld msgs%s",
+            lb, delayed, counter_value(parked_sms), lb);
+
     if (para)
         octstr_append_cstr(tmp, "</p>");
-    if (status_type == BBSTATUS_XML)
-        octstr_append_cstr(tmp, "</smscs>\n");
-    else
+    if (status_type != BBSTATUS_XML)
         octstr_append_cstr(tmp, "\n\n");
     return tmp;
 }
@@ -1286,20 +1436,52 @@ Octstr *smsc2_status(int status_type)
 /* function to route outgoing SMS'es
  *
  * If finds a good one, puts into it and returns SMSCCONN_SUCCESS
- * If finds only bad ones, but acceptable, queues and
- * returns SMSCCONN_QUEUED  (like all acceptable currently disconnected)
- * if message acceptable but queues full returns SMSCCONN_FAILED_QFULL and
- * message is not destroyed.
+ * If finds only bad ones, but acceptable, parks it on the pending queue of
+ * one of them and returns SMSCCONN_QUEUED  (like all acceptable currently
+ * disconnected)
+ * if message acceptable but queues full, parks it on the least full SMSC
+ * and returns SMSCCONN_QUEUED if `resend' is set, else returns
+ * SMSCCONN_FAILED_QFULL and message is not destroyed.
  * If cannot find nothing at all, returns SMSCCONN_FAILED_DISCARDED and
  * message is NOT destroyed (otherwise it is)
  */
+/*
+ * Sum of the queues of all SMSCes, for the sum(#queues) limit. Looking at
+ * every connection for every message would undo the routing index, so
+ * the sum is taken at most once a second.
+ * NOTE: Caller must hold smsc_list_lock!
+ */
+static long smsc2_queued(void)
+{
+    static volatile long queued = 0;
+    static volatile time_t queued_time = 0;
+    StatusInfo info;
+    long i, sum;
+
+    if (queued_time == time(NULL))
+        return queued;
+
+    sum = 0;
+    for (i = 0; i < gwlist_len(smsc_list); i++) {
+        smscconn_info(gwlist_get(smsc_list, i), &info);
+        sum += (info.queued > 0 ? info.queued : 0);
+    }
+    queued = sum;
+    queued_time = time(NULL);
+
+    return sum;
+}
+
+
 long smsc2_rout(Msg *msg, int resend)
 {
     StatusInfo info;
-    SMSCConn *conn, *best_preferred, *best_ok;
-    long bp_load, bo_load;
-    int i, s, ret, bad_found, full_found;
-    long max_queue, queue_length;
+    SMSCConn *conn, *best_preferred, *best_ok, *bad_found, *full_found;
+    SMSCConn **usable;
+    int *preferred;
+    long bp_load, bo_load, full_queued;
+    int i, s, ret;
+    long max_queue, queue_length, n;
     char *uf;
 
     /* XXX handle ack here? */
@@ -1325,8 +1507,8 @@ long smsc2_rout(Msg *msg, int resend)
     }
 
     best_preferred = best_ok = NULL;
-    bad_found = full_found = 0;
-    bp_load = bo_load = queue_length = 0;
+    bad_found = full_found = NULL;
+    bp_load = bo_load = queue_length = full_queued = 0;
 
     if (msg->sms.split_parts == NULL) {
     	/*
@@ -1342,29 +1524,34 @@ long smsc2_rout(Msg *msg, int resend)
 
     	s = gw_rand() % gwlist_len(smsc_list);
 
-    	conn = NULL;
-    	for (i = 0; i < gwlist_len(smsc_list); i++) {
-    		conn = gwlist_get(smsc_list,  (i+s) % gwlist_len(smsc_list));
+    	/* the usable ones, in the order smscconn_usable would find them */
+    	usable = gw_malloc(gwlist_len(smsc_list) * sizeof(*usable));
+    	preferred = gw_malloc(gwlist_len(smsc_list) * sizeof(*preferred));
+    	n = smscconn_route_find(smsc_route, msg, s, usable, preferred,
+    	                        gwlist_len(smsc_list));
 
-    		smscconn_info(conn, &info);
-    		queue_length += (info.queued > 0 ? info.queued : 0);
-
-    		ret = smscconn_usable(conn,msg);
-    		if (ret == -1)
-    			continue;
+    	for (i = 0; i < n; i++) {
+    		conn = usable[i];
+    		ret = preferred[i];
 
     		/* if we already have a preferred one, skip non-preferred */
     		if (ret != 1 && best_preferred)
     			continue;
 
+    		smscconn_info(conn, &info);
+
     		/* If connection is not currently answering ... */
     		if (info.status != SMSCCONN_ACTIVE) {
-    			bad_found = 1;
+    			if (bad_found == NULL)
+    				bad_found = conn;
     			continue;
     		}
-    		/* check queue length */
+    		/* check queue length, remember the least full one */
     		if (info.queued > max_queue) {
-    			full_found = 1;
+    			if (full_found == NULL || info.queued < full_queued) {
+    				full_found = conn;
+    				full_queued = info.queued;
+    			}
     			continue;
     		}
     		if (ret == 1) {          /* preferred */
@@ -1379,7 +1566,12 @@ long smsc2_rout(Msg *msg, int resend)
     			bo_load = info.load;
     		}
     	}
-    	queue_length += gwlist_len(outgoing_sms);
+    	gw_free(usable);
+    	gw_free(preferred);
+
+    	if (max_outgoing_sms_qlength > 0 && !resend)
+    		queue_length = smsc2_queued();
+    	queue_length += gwlist_len(outgoing_sms) + counter_value(parked_sms);
     	if (max_outgoing_sms_qlength > 0 && !resend &&
     	    queue_length > gwlist_len(smsc_list) * max_outgoing_sms_qlength) {
     		gw_rwlock_unlock(&smsc_list_lock);
@@ -1398,14 +1590,26 @@ long smsc2_rout(Msg *msg, int resend)
     else if (best_ok)
         ret = smscconn_send(best_ok, msg);
     else if (bad_found) {
-        gw_rwlock_unlock(&smsc_list_lock);
-        if (max_outgoing_sms_qlength < 0 || gwlist_len(outgoing_sms) < max_outgoing_sms_qlength) {
-            gwlist_produce(outgoing_sms, msg);
+        /* wait on the pending queue until the SMSC connects */
+        if (max_outgoing_sms_qlength < 0 ||
+            gwlist_len(outgoing_sms) + counter_value(parked_sms) < max_outgoing_sms_qlength) {
+            smsc2_park(bad_found, msg);
+            gw_rwlock_unlock(&smsc_list_lock);
             return SMSCCONN_QUEUED;
         }
+        gw_rwlock_unlock(&smsc_list_lock);
         debug("bb.sms", 0, "bad_found queue full");
         return SMSCCONN_FAILED_QFULL; /* queue full */
     } else if (full_found) {
+        /*
+         * New messages are refused, so the sender backs off. Those we
+         * have already accepted wait until the SMSC drains.
+         */
+        if (resend) {
+            smsc2_park(full_found, msg);
+            gw_rwlock_unlock(&smsc_list_lock);
+            return SMSCCONN_QUEUED;
+        }
         gw_rwlock_unlock(&smsc_list_lock);
         debug("bb.sms", 0, "full_found queue full");
         return SMSCCONN_FAILED_QFULL;
@@ -1490,29 +1694,57 @@ static long route_incoming_to_smsc(SMSCConn *conn, Msg *msg)
 
 /*--------------------------------
  * incoming concatenated messages handling
+ *
+ * Pending messages are kept in a hash table cut in shards, each with its
+ * own lock, so that receiver threads of different SMSCes seldom meet.
+ * The key is made of the fields that identify a message, compared as
+ * they are. Every pending message has a timer on concat_wheel, restarted
+ * by each part, that sends the parts as they are if the message doesn't
+ * complete in time.
  */
 
+#define CONCAT_SHARDS 64    /* a power of two */
+
+typedef struct ConcatShard ConcatShard;
+
 typedef struct ConcatMsg {
+    struct ConcatMsg *next; /* in the bucket */
+    unsigned long hash;
+    ConcatShard *shard;
+    int in_table;
+    /* the key */
+    Octstr *sender;
+    Octstr *receiver;
+    Octstr *smscid;
     int refnum;
     int total_parts;
-    int num_parts;
     Octstr *udh; /* normalized UDH */
-    time_t trecv;
-    Octstr *key; /* in dict. */
+    int num_parts;
+    WheelTimer *timer;
     int ack;     /* set to the type of ack to send when deleting. */
     /* array of parts */
     Msg **parts;
 } ConcatMsg;
 
-static Dict *incoming_concat_msgs;
-static Mutex *concat_lock;
+struct ConcatShard {
+    Mutex *lock;
+    ConcatMsg **buckets;
+    long nbuckets;  /* a power of two */
+    long len;
+};
+
+static ConcatShard *concat_shards;
+static TimerWheel *concat_wheel;
+
+static void concat_timeout(void *data);
+
 
-static void destroy_concatMsg(void *x)
+static void destroy_concatMsg(ConcatMsg *msg)
 {
     int i;
-    ConcatMsg *msg = x;
 
     gw_assert(msg);
+    gw_wheel_timer_destroy(msg->timer);
     for (i = 0; i < msg->total_parts; i++) {
         if (msg->parts[i]) {
             store_save_ack(msg->parts[i], msg->ack);
@@ -1520,116 +1752,242 @@ static void destroy_concatMsg(void *x)
         }
     }
     gw_free(msg->parts);
-    octstr_destroy(msg->key);
+    octstr_destroy(msg->sender);
+    octstr_destroy(msg->receiver);
+    octstr_destroy(msg->smscid);
     octstr_destroy(msg->udh);
     gw_free(msg);
 }
 
+
+static unsigned long concat_hash_data(unsigned long hash, const unsigned char *data, long len)
+{
+    long i;
+
+    /* FNV-1a */
+    for (i = 0; i < len; i++)
+        hash = (hash ^ data[i]) * 16777619UL;
+    return (hash ^ 0xff) * 16777619UL;    /* end of field */
+}
+
+
+static unsigned long concat_hash(Octstr *sender, Octstr *receiver, Octstr *smscid,
+                                 int refnum, int total_parts,
+                                 const unsigned char *udh, long udh_len)
+{
+    unsigned long hash = 2166136261UL;
+    unsigned char ints[3];
+
+    hash = concat_hash_data(hash, (unsigned char *) octstr_get_cstr(sender), octstr_len(sender));
+    hash = concat_hash_data(hash, (unsigned char *) octstr_get_cstr(receiver), octstr_len(receiver));
+    hash = concat_hash_data(hash, (unsigned char *) octstr_get_cstr(smscid), octstr_len(smscid));
+    ints[0] = refnum >> 8;
+    ints[1] = refnum;
+    ints[2] = total_parts;
+    hash = concat_hash_data(hash, ints, sizeof(ints));
+
+    return concat_hash_data(hash, udh, udh_len);
+}
+
+
+/* Find a pending message by its key. NOTE: Caller must hold shard->lock! */
+static ConcatMsg *concat_find(ConcatShard *shard, unsigned long hash,
+                              Octstr *sender, Octstr *receiver, Octstr *smscid,
+                              int refnum, int total_parts,
+                              const unsigned char *udh, long udh_len)
+{
+    ConcatMsg *x;
+
+    for (x = shard->buckets[(hash / CONCAT_SHARDS) & (shard->nbuckets - 1)];
+         x != NULL; x = x->next) {
+        if (x->hash == hash && x->refnum == refnum && x->total_parts == total_parts &&
+            octstr_len(x->udh) == udh_len &&
+            memcmp(octstr_get_cstr(x->udh), udh, udh_len) == 0 &&
+            octstr_compare(x->sender, sender) == 0 &&
+            octstr_compare(x->receiver, receiver) == 0 &&
+            octstr_compare(x->smscid, smscid) == 0)
+            return x;
+    }
+
+    return NULL;
+}
+
+
+/* NOTE: Caller must hold shard->lock! */
+static void concat_insert(ConcatShard *shard, ConcatMsg *cmsg)
+{
+    ConcatMsg **buckets, *x, *next;
+    long i, n;
+
+    if (shard->len >= 2 * shard->nbuckets) {
+        n = shard->nbuckets * 2;
+        buckets = gw_malloc(n * sizeof(*buckets));
+        memset(buckets, 0, n * sizeof(*buckets));
+        for (i = 0; i < shard->nbuckets; i++) {
+            for (x = shard->buckets[i]; x != NULL; x = next) {
+                next = x->next;
+                x->next = buckets[(x->hash / CONCAT_SHARDS) & (n - 1)];
+                buckets[(x->hash / CONCAT_SHARDS) & (n - 1)] = x;
+            }
+        }
+        gw_free(shard->buckets);
+        shard->buckets = buckets;
+        shard->nbuckets = n;
+    }
+
+    i = (cmsg->hash / CONCAT_SHARDS) & (shard->nbuckets - 1);
+    cmsg->next = shard->buckets[i];
+    shard->buckets[i] = cmsg;
+    cmsg->in_table = 1;
+    shard->len++;
+}
+
+
+/* NOTE: Caller must hold shard->lock! */
+static void concat_unlink(ConcatShard *shard, ConcatMsg *cmsg)
+{
+    ConcatMsg **p;
+
+    for (p = &shard->buckets[(cmsg->hash / CONCAT_SHARDS) & (shard->nbuckets - 1)];
+         *p != NULL; p = &(*p)->next) {
+        if (*p == cmsg) {
+            *p = cmsg->next;
+            cmsg->next = NULL;
+            cmsg->in_table = 0;
+            shard->len--;
+            return;
+        }
+    }
+}
+
+
 static void init_concat_handler(void)
 {
-    if (incoming_concat_msgs != NULL) /* already initialised? */
+    long i;
+
+    if (concat_shards != NULL) /* already initialised? */
         return;
-    incoming_concat_msgs = dict_create(max_incoming_sms_qlength > 0 ? max_incoming_sms_qlength : 1024, 
-                                       destroy_concatMsg);
-    concat_lock = mutex_create();
+    concat_shards = gw_malloc(CONCAT_SHARDS * sizeof(*concat_shards));
+    for (i = 0; i < CONCAT_SHARDS; i++) {
+        concat_shards[i].lock = mutex_create();
+        concat_shards[i].nbuckets = 16;
+        concat_shards[i].buckets = gw_malloc(16 * sizeof(ConcatMsg *));
+        memset(concat_shards[i].buckets, 0, 16 * sizeof(ConcatMsg *));
+        concat_shards[i].len = 0;
+    }
+    /* seconds, one turn is a bit more than the default timeout */
+    concat_wheel = gw_timerwheel_create(1, 2048);
     debug("bb.sms",0,"MO concatenated message handling enabled");
 }
 
 static void shutdown_concat_handler(void)
 {
-    if (incoming_concat_msgs == NULL)
+    ConcatMsg *x, *next, *all;
+    long i, j;
+
+    if (concat_shards == NULL)
         return;
-    dict_destroy(incoming_concat_msgs);
-    mutex_destroy(concat_lock);
 
-    incoming_concat_msgs = NULL;
-    concat_lock = NULL;
+    /* take them out first, destroying a timer may wait for its callback */
+    all = NULL;
+    for (i = 0; i < CONCAT_SHARDS; i++) {
+        mutex_lock(concat_shards[i].lock);
+        for (j = 0; j < concat_shards[i].nbuckets; j++) {
+            for (x = concat_shards[i].buckets[j]; x != NULL; x = next) {
+                next = x->next;
+                x->in_table = 0;
+                x->next = all;
+                all = x;
+            }
+            concat_shards[i].buckets[j] = NULL;
+        }
+        concat_shards[i].len = 0;
+        mutex_unlock(concat_shards[i].lock);
+    }
+    for (x = all; x != NULL; x = next) {
+        next = x->next;
+        destroy_concatMsg(x);
+    }
+
+    gw_timerwheel_destroy(concat_wheel);
+    concat_wheel = NULL;
+    for (i = 0; i < CONCAT_SHARDS; i++) {
+        mutex_destroy(concat_shards[i].lock);
+        gw_free(concat_shards[i].buckets);
+    }
+    gw_free(concat_shards);
+    concat_shards = NULL;
     debug("bb.sms",0,"MO concatenated message handling cleaned up");
 }
 
-static void clear_old_concat_parts(void)
-{
-    List *keys;
-    Octstr *key;
 
-    /* not initialised, go away */
-    if (incoming_concat_msgs == NULL)
+/*
+ * Called from concat_wheel when no part of `data' arrived for
+ * sms-combine-concatenated-mo-timeout seconds.
+ */
+static void concat_timeout(void *data)
+{
+    ConcatMsg *x = data, *x1;
+    ConcatShard *shard = x->shard;
+    Msg *msg;
+    int i, destroy = 1;
+
+    mutex_lock(shard->lock);
+    /* completed, or a new part came and restarted the timer meanwhile */
+    if (!x->in_table || gw_wheel_timer_pending(x->timer)) {
+        mutex_unlock(shard->lock);
         return;
+    }
+    concat_unlink(shard, x);
+    mutex_unlock(shard->lock);
 
-    debug("bb.sms.splits", 0, "clear_old_concat_parts called");
-
-    /* Remove any pending messages that are too old. */
-    keys = dict_keys(incoming_concat_msgs);
-    while((key = gwlist_extract_first(keys)) != NULL) {
-        ConcatMsg *x;
-        Msg *msg;
-        int i, destroy = 1;
-
-        mutex_lock(concat_lock);
-        x = dict_get(incoming_concat_msgs, key);
-        octstr_destroy(key);
-        if (x == NULL || difftime(time(NULL), x->trecv) < concatenated_mo_timeout) {
-            mutex_unlock(concat_lock);
+    warning(0, "Time-out waiting for concatenated message from %s to %s [ref %d]. Send message parts as is.",
+            octstr_get_cstr(x->sender), octstr_get_cstr(x->receiver), x->refnum);
+    for (i = 0; i < x->total_parts && destroy == 1; i++) {
+        if (x->parts[i] == NULL)
             continue;
+        msg = msg_duplicate(x->parts[i]);
+        store_save_ack(x->parts[i], ack_success);
+        switch(bb_smscconn_receive(NULL, msg)) {
+        case SMSCCONN_FAILED_REJECTED:
+        case SMSCCONN_SUCCESS:
+            msg_destroy(x->parts[i]);
+            x->parts[i] = NULL;
+            x->num_parts--;
+            break;
+        case SMSCCONN_FAILED_TEMPORARILY:
+        case SMSCCONN_FAILED_QFULL:
+        default:
+            /* oops put it back into the table and retry later */
+            store_save(x->parts[i]);
+            destroy = 0;
+            break;
         }
-        dict_remove(incoming_concat_msgs, x->key);
-        mutex_unlock(concat_lock);
-        warning(0, "Time-out waiting for concatenated message '%s'. Send message parts as is.",
-                octstr_get_cstr(x->key));
-        for (i = 0; i < x->total_parts && destroy == 1; i++) {
-            if (x->parts[i] == NULL)
-                continue;
-            msg = msg_duplicate(x->parts[i]);
-            store_save_ack(x->parts[i], ack_success);
-            switch(bb_smscconn_receive(NULL, msg)) {
-            case SMSCCONN_FAILED_REJECTED:
-            case SMSCCONN_SUCCESS:
-                msg_destroy(x->parts[i]);
+    }
+    if (destroy) {
+        destroy_concatMsg(x);
+        return;
+    }
+
+    mutex_lock(shard->lock);
+    x1 = concat_find(shard, x->hash, x->sender, x->receiver, x->smscid, x->refnum,
+                     x->total_parts, (unsigned char *) octstr_get_cstr(x->udh),
+                     octstr_len(x->udh));
+    if (x1 != NULL) { /* oops we have new part */
+        for (i = 0; i < x->total_parts; i++) {
+            if (x->parts[i] != NULL && x1->parts[i] == NULL) {
+                x1->parts[i] = x->parts[i];
                 x->parts[i] = NULL;
-                x->num_parts--;
-                break;
-            case SMSCCONN_FAILED_TEMPORARILY:
-            case SMSCCONN_FAILED_QFULL:
-            default:
-                /* oops put it back into dict and retry on next run */
-                store_save(x->parts[i]);
-                destroy = 0;
-                break;
+                x1->num_parts++;
             }
         }
-        if (destroy) {
-            destroy_concatMsg(x);
-        } else {
-            ConcatMsg *x1;
-            mutex_lock(concat_lock);
-            x1 = dict_get(incoming_concat_msgs, x->key);
-            if (x1 != NULL) { /* oops we have new part */
-                int i;
-                if (x->total_parts != x1->total_parts) {
-                    /* broken handset, don't know what todo here??
-                     * for now just put old concatMsg into dict with
-                     * another key and it will be cleaned up on next run.
-                     */
-                    octstr_format_append(x->key, " %d", x->total_parts);
-                    dict_put(incoming_concat_msgs, x->key, x);
-                } else {
-                    for (i = 0; i < x->total_parts; i++) {
-                        if (x->parts[i] == NULL)
-                            continue;
-                        if (x1->parts[i] == NULL) {
-                            x1->parts[i] = x->parts[i];
-                            x->parts[i] = NULL;
-                        }
-                    }
-                    destroy_concatMsg(x);
-                }
-            } else {
-                dict_put(incoming_concat_msgs, x->key, x);
-            }
-            mutex_unlock(concat_lock);
-        }
+        mutex_unlock(shard->lock);
+        destroy_concatMsg(x);
+    } else {
+        concat_insert(shard, x);
+        gw_wheel_timer_start(x->timer, concatenated_mo_timeout);
+        mutex_unlock(shard->lock);
     }
-    gwlist_destroy(keys, octstr_destroy_item);
 }
 
 /* Checks if message is concatenated. Returns:
@@ -1640,18 +1998,21 @@ static void clear_old_concat_parts(void)
 static int check_concatenation(Msg **pmsg, Octstr *smscid)
 {
     Msg *msg = *pmsg;
-    int l, iel = 0, refnum, pos, c, part, totalparts, i, sixteenbit;
-    Octstr *udh = msg->sms.udhdata, *key;
+    int l, iel = 0, refnum, pos, end, c, part, totalparts, i, sixteenbit;
+    unsigned char udh[256];
+    long udh_len;
+    unsigned long hash;
+    ConcatShard *shard;
     ConcatMsg *cmsg;
     int ret = concat_complete;
 
     /* ... module not initialised or there is no UDH or smscid is NULL. */
-    if (incoming_concat_msgs == NULL || (l = octstr_len(udh)) == 0 || smscid == NULL)
+    if (concat_shards == NULL || (l = octstr_len(msg->sms.udhdata)) == 0 || smscid == NULL)
         return concat_none;
 
     for (pos = 1, c = -1; pos < l - 1; pos += iel + 2) {
-        iel = octstr_get_char(udh, pos + 1);
-        if ((c = octstr_get_char(udh, pos)) == 0 || c == 8)
+        iel = octstr_get_char(msg->sms.udhdata, pos + 1);
+        if ((c = octstr_get_char(msg->sms.udhdata, pos)) == 0 || c == 8)
             break;
     }
     if (pos >= l)  /* no concat UDH found. */
@@ -1659,10 +2020,10 @@ static int check_concatenation(Msg **pmsg, Octstr *smscid)
 
     /* c = 0 means 8 bit, c = 8 means 16 bit concat info */
     sixteenbit = (c == 8);
-    refnum = (!sixteenbit) ? octstr_get_char(udh, pos + 2) :
-    		(octstr_get_char(udh, pos + 2) << 8) | octstr_get_char(udh, pos + 3);
-    totalparts = octstr_get_char(udh, pos + 3 + sixteenbit);
-    part = octstr_get_char(udh, pos + 4 + sixteenbit);
+    refnum = (!sixteenbit) ? octstr_get_char(msg->sms.udhdata, pos + 2) :
+    		(octstr_get_char(msg->sms.udhdata, pos + 2) << 8) | octstr_get_char(msg->sms.udhdata, pos + 3);
+    totalparts = octstr_get_char(msg->sms.udhdata, pos + 3 + sixteenbit);
+    part = octstr_get_char(msg->sms.udhdata, pos + 4 + sixteenbit);
 
     if (part < 1 || part > totalparts) {
         warning(0, "Invalid concatenation UDH [ref = %d] in message from %s!",
@@ -1670,37 +2031,47 @@ static int check_concatenation(Msg **pmsg, Octstr *smscid)
         return concat_none;
     }
 
-    /* extract UDH */
-    udh = octstr_duplicate(msg->sms.udhdata);
-    octstr_delete(udh, pos, iel + 2);
-    if (octstr_len(udh) <= 1) /* no other UDH elements. */
-    	octstr_delete(udh, 0, octstr_len(udh));
-    else
-    	octstr_set_char(udh, 0, octstr_len(udh) - 1);
+    /* the UDH without the concatenation element, the same for all parts */
+    if (l > sizeof(udh))
+        return concat_none;
+    end = (pos + iel + 2 < l ? pos + iel + 2 : l);
+    udh_len = l - (end - pos);
+    if (udh_len <= 1) { /* no other UDH elements. */
+        udh_len = 0;
+    } else {
+        octstr_get_many_chars((char *) udh, msg->sms.udhdata, 0, pos);
+        octstr_get_many_chars((char *) udh + pos, msg->sms.udhdata, end, l - end);
+        udh[0] = udh_len - 1;
+    }
 
     debug("bb.sms.splits", 0, "Got part %d [ref %d, total parts %d] of message from %s. Dump follows:",
           part, refnum, totalparts, octstr_get_cstr(msg->sms.sender));
      
     msg_dump(msg, 0);
-     
-    key = octstr_format("'%S' '%S' '%S' '%d' '%d' '%H'", msg->sms.sender, msg->sms.receiver, smscid, refnum, totalparts, udh);
-    mutex_lock(concat_lock);
-    if ((cmsg = dict_get(incoming_concat_msgs, key)) == NULL) {
+
+    hash = concat_hash(msg->sms.sender, msg->sms.receiver, smscid, refnum, totalparts, udh, udh_len);
+    shard = &concat_shards[hash & (CONCAT_SHARDS - 1)];
+    mutex_lock(shard->lock);
+    cmsg = concat_find(shard, hash, msg->sms.sender, msg->sms.receiver, smscid,
+                       refnum, totalparts, udh, udh_len);
+    if (cmsg == NULL) {
         cmsg = gw_malloc(sizeof(*cmsg));
+        cmsg->hash = hash;
+        cmsg->shard = shard;
+        cmsg->sender = octstr_duplicate(msg->sms.sender);
+        cmsg->receiver = octstr_duplicate(msg->sms.receiver);
+        cmsg->smscid = octstr_duplicate(smscid);
         cmsg->refnum = refnum;
         cmsg->total_parts = totalparts;
-        cmsg->udh = udh;
-        udh = NULL;
+        cmsg->udh = octstr_create_from_data((char *) udh, udh_len);
         cmsg->num_parts = 0;
-        cmsg->key = octstr_duplicate(key);
+        cmsg->timer = gw_wheel_timer_create(concat_wheel, concat_timeout, cmsg);
         cmsg->ack = ack_success;
         cmsg->parts = gw_malloc(totalparts * sizeof(*cmsg->parts));
         memset(cmsg->parts, 0, cmsg->total_parts * sizeof(*cmsg->parts)); /* clear it. */
 
-        dict_put(incoming_concat_msgs, key, cmsg);
+        concat_insert(shard, cmsg);
     }
-    octstr_destroy(key);
-    octstr_destroy(udh);
 
     /* check if we have seen message part before... */
     if (cmsg->parts[part - 1] != NULL) {	  
@@ -1712,13 +2083,13 @@ static int check_concatenation(Msg **pmsg, Octstr *smscid)
     } else {
         cmsg->parts[part -1] = msg;
         cmsg->num_parts++;
-        /* always update receive time so we have it from last part and don't timeout */
-        cmsg->trecv = time(NULL);
+        /* always time out from the last part */
+        gw_wheel_timer_start(cmsg->timer, concatenated_mo_timeout);
     }
 
     if (cmsg->num_parts < cmsg->total_parts) {  /* wait for more parts. */
         *pmsg = msg = NULL;
-        mutex_unlock(concat_lock);
+        mutex_unlock(shard->lock);
         return concat_pending;
     }
 
@@ -1734,7 +2105,7 @@ static int check_concatenation(Msg **pmsg, Octstr *smscid)
 
     /* Attempt to save the new one, if that fails, then reply with fail. */
     if (store_save(msg) == -1) {	  
-        mutex_unlock(concat_lock);
+        mutex_unlock(shard->lock);
         msg_destroy(msg);
         *pmsg = msg = NULL;
         return concat_error;
@@ -1746,10 +2117,10 @@ static int check_concatenation(Msg **pmsg, Octstr *smscid)
     msg->sms.udhdata = cmsg->udh;
     cmsg->udh = NULL;
 
-    /* Delete it from the queue and from the Dict. */
-    /* Note: dict_put with NULL value delete and destroy value */
-    dict_put(incoming_concat_msgs, cmsg->key, NULL);
-    mutex_unlock(concat_lock);
+    /* Delete it from the table, the parts are acked with it. */
+    concat_unlink(shard, cmsg);
+    mutex_unlock(shard->lock);
+    destroy_concatMsg(cmsg);
 
     debug("bb.sms.splits", 0, "Got full message [ref %d] of message from %s to %s. Dumping: ",
           refnum, octstr_get_cstr(msg->sms.sender), octstr_get_cstr(msg->sms.receiver));
@@ -1757,4 +2128,3 @@ static int check_concatenation(Msg **pmsg, Octstr *smscid)
 
     return ret;
 }
-
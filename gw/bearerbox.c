@@ -73,6 +73,7 @@
 #include <unistd.h>
 
 #include "gwlib/gwlib.h"
+#include "gwlib/regex.h"
 #include "msg.h"
 #include "bearerbox.h"
 #include "shared.h"
@@ -561,6 +562,20 @@ static Cfg *init_bearerbox(Cfg *cfg)
 
     if (cfg_get_integer(&value, grp, octstr_imm("http-timeout")) == 0)
         http_set_client_timeout(value);
+    if (cfg_get_integer(&value, grp, octstr_imm("http-client-threads")) == 0)
+        http_set_client_threads(value);
+    if (cfg_get_integer(&value, grp, octstr_imm("http-max-host-connections")) == 0)
+        http_set_client_max_host_connections(value);
+    if (cfg_get_integer(&value, grp, octstr_imm("http-pipeline-depth")) == 0)
+        http_set_client_pipeline_depth(value);
+    if (cfg_get_integer(&value, grp, octstr_imm("dns-resolver-threads")) == 0)
+        gw_dns_set_resolver_threads(value);
+    {
+        long ttl = 300, negative_ttl = 30;
+        cfg_get_integer(&ttl, grp, octstr_imm("dns-cache-ttl"));
+        cfg_get_integer(&negative_ttl, grp, octstr_imm("dns-negative-cache-ttl"));
+        gw_dns_set_ttl(ttl, negative_ttl);
+    }
 #ifndef NO_SMS    
     {
         List *list;
@@ -941,6 +956,8 @@ Octstr *bb_print_status(int status_type)
     char *s, *lb;
     char *frmt, *footer;
     Octstr *ret, *str, *version;
+    DNSStats dns;
+    RegexStats regex;
     time_t t;
 
     if ((lb = bb_status_linebreak(status_type)) == NULL)
@@ -960,6 +977,8 @@ Octstr *bb_print_status(int status_type)
         s = "going down";
 
     version = version_report_string("bearerbox");
+    gw_dns_stats(&dns);
+    gw_regex_stats(&regex);
 
     if (status_type == BBSTATUS_HTML) {
         frmt = "%s</p>\n\n"
@@ -972,7 +991,10 @@ Octstr *bb_print_status(int status_type)
                "outbound (%.2f,%.2f,%.2f) msg/sec</p>\n\n"
                " <p>DLR: received %ld, sent %ld<br>\n"
                " DLR: inbound (%.2f,%.2f,%.2f) msg/sec, outbound (%.2f,%.2f,%.2f) msg/sec<br>\n"
-               " DLR: %ld queued, using %s storage</p>\n\n";
+               " DLR: %ld queued, using %s storage</p>\n\n"
+               " <p>DNS: %ld cached, %ld resolving, %lu hits "
+               "(%lu negative), %lu misses</p>\n\n"
+               " <p>Regex: %lu evaluations (%lu/sec), %lu memo hits</p>\n\n";
         footer = "<p>";
     } else if (status_type == BBSTATUS_WML) {
         frmt = "%s</p>\n\n"
@@ -989,7 +1011,11 @@ Octstr *bb_print_status(int status_type)
                "      DLR: inbound (%.2f,%.2f,%.2f) msg/sec<br/>\n"
                "      DLR: outbound (%.2f,%.2f,%.2f) msg/sec<br/>\n"
                "      DLR: %ld queued<br/>\n"
-               "      DLR: using %s storage</p>\n\n";
+               "      DLR: using %s storage</p>\n\n"
+               "   <p>DNS: %ld cached, %ld resolving<br/>\n"
+               "      DNS: %lu hits (%lu negative), %lu misses</p>\n\n"
+               "   <p>Regex: %lu evaluations (%lu/sec)<br/>\n"
+               "      Regex: %lu memo hits</p>\n\n";
         footer = "<p>";
     } else if (status_type == BBSTATUS_XML) {
         frmt = "<version>%s</version>\n"
@@ -1007,7 +1033,12 @@ Octstr *bb_print_status(int status_type)
                "<sent><total>%ld</total></sent>\n\t\t"
                "<inbound>%.2f,%.2f,%.2f</inbound>\n\t\t"
                "<outbound>%.2f,%.2f,%.2f</outbound>\n\t\t"
-               "<queued>%ld</queued>\n\t\t<storage>%s</storage>\n\t</dlr>\n";
+               "<queued>%ld</queued>\n\t\t<storage>%s</storage>\n\t</dlr>\n"
+               "\t<dns>\n\t\t<cached>%ld</cached>\n\t\t<resolving>%ld</resolving>\n\t\t"
+               "<hits>%lu</hits>\n\t\t<negative>%lu</negative>\n\t\t"
+               "<misses>%lu</misses>\n\t</dns>\n"
+               "\t<regex>\n\t\t<evaluations>%lu</evaluations>\n\t\t"
+               "<persecond>%lu</persecond>\n\t\t<memohits>%lu</memohits>\n\t</regex>\n";
         footer = "";
     } else {
         frmt = "%s\n\nStatus: %s, uptime %ldd %ldh %ldm %lds\n\n"
@@ -1017,7 +1048,10 @@ Octstr *bb_print_status(int status_type)
                "outbound (%.2f,%.2f,%.2f) msg/sec\n\n"
                "DLR: received %ld, sent %ld\n"
                "DLR: inbound (%.2f,%.2f,%.2f) msg/sec, outbound (%.2f,%.2f,%.2f) msg/sec\n"
-               "DLR: %ld queued, using %s storage\n\n";
+               "DLR: %ld queued, using %s storage\n\n"
+               "DNS: %ld cached, %ld resolving, %lu hits (%lu negative), "
+               "%lu misses\n\n"
+               "Regex: %lu evaluations (%lu/sec), %lu memo hits\n\n";
         footer = "";
     }
     
@@ -1028,14 +1062,16 @@ Octstr *bb_print_status(int status_type)
         gwlist_len(incoming_wdp) + boxc_incoming_wdp_queue(),
         counter_value(outgoing_wdp_counter), gwlist_len(outgoing_wdp) + udp_outgoing_queue(),
         counter_value(incoming_sms_counter), gwlist_len(incoming_sms),
-        counter_value(outgoing_sms_counter), gwlist_len(outgoing_sms),
+        counter_value(outgoing_sms_counter), gwlist_len(outgoing_sms) + smsc2_waiting(),
         store_messages(),
         load_get(incoming_sms_load,0), load_get(incoming_sms_load,1), load_get(incoming_sms_load,2),
         load_get(outgoing_sms_load,0), load_get(outgoing_sms_load,1), load_get(outgoing_sms_load,2),
         counter_value(incoming_dlr_counter), counter_value(outgoing_dlr_counter),
         load_get(incoming_dlr_load,0), load_get(incoming_dlr_load,1), load_get(incoming_dlr_load,2),
         load_get(outgoing_dlr_load,0), load_get(outgoing_dlr_load,1), load_get(outgoing_dlr_load,2),
-        dlr_messages(), dlr_type());
+        dlr_messages(), dlr_type(),
+        dns.entries, dns.pending, dns.hits, dns.negative_hits, dns.misses,
+        regex.evaluations, regex.per_second, regex.memo_hits);
 
     octstr_destroy(version);
     
@@ -121,7 +121,7 @@ void boxc_cleanup(void);
 /*
  * Route the incoming message to one of the following input queues:
  *   a specific smsbox conn
- *   a random smsbox conn if no shortcut routing and msg->sms.boxc_id match.
+ *   the least busy smsbox conn if no shortcut routing and msg->sms.boxc_id match.
  * @return -1 if incoming queue full; 0 otherwise.
  */
 int route_incoming_to_boxc(Msg *msg);
@@ -158,12 +158,16 @@ void smsc2_cleanup(void); /* final clean-up */
 
 Octstr *smsc2_status(int status_type);
 
+/* number of MT messages waiting for their resend time or parked on SMSCes */
+long smsc2_waiting(void);
+
 /* function to route outgoing SMS'es
  *
  * If finds a good one, puts into it and returns SMSCCONN_SUCCESS
- * If finds only bad ones, but acceptable, queues and
+ * If finds only bad ones, but acceptable, parks it on one of them and
  *  returns SMSCCONN_QUEUED  (like all acceptable currently disconnected)
- * if message acceptable but queues full returns SMSCCONN_FAILED_QFULL and
+ * if message acceptable but queues full, parks it if resend is set and
+ * returns SMSCCONN_QUEUED, else returns SMSCCONN_FAILED_QFULL and
  * message is not destroyed.
  * If cannot find nothing at all, returns SMSCCONN_FAILED_DISCARDED and
  * message is NOT destroyed (otherwise it is)
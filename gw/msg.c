@@ -153,6 +153,10 @@ void msg_dump(Msg *msg, int level)
 {
     char buf[UUID_STR_LEN + 1];
 
+    /* don't dump every field just to throw it away */
+    if (!log_debug_enabled("gw.msg"))
+        return;
+
     debug("gw.msg", 0, "%*sMsg object at %p:", level, "", (void *) msg);
     debug("gw.msg", 0, "%*s type: %s", level, "", type_as_str(msg));
 #define INTEGER(name) \
@@ -203,7 +207,9 @@ Octstr *msg_pack(Msg *msg)
 }
 
 
-Msg *msg_unpack_real(Octstr *os, const char *file, long line, const char *func)
+/* Unpack the Msg packed at `*off' in `os' and move `*off' past it. */
+static Msg *unpack_at(Octstr *os, int *offp, const char *file, long line,
+                      const char *func)
 {
     Msg *msg;
     int off;
@@ -213,7 +219,7 @@ Msg *msg_unpack_real(Octstr *os, const char *file, long line, const char *func)
     if (msg == NULL)
         goto error;
 
-    off = 0;
+    off = *offp;
 
     if (parse_integer(&i, os, &off) == -1)
         goto error;
@@ -239,6 +245,7 @@ Msg *msg_unpack_real(Octstr *os, const char *file, long line, const char *func)
         return NULL;
     }
 
+    *offp = off;
     return msg;
 
 error:
@@ -248,6 +255,14 @@ error:
 }
 
 
+Msg *msg_unpack_real(Octstr *os, const char *file, long line, const char *func)
+{
+    int off = 0;
+
+    return unpack_at(os, &off, file, line, func);
+}
+
+
 /*
  * Wrapper function needed for function pointer forwarding to storage
  * subsystem. We can't pass the msg_unpack() pre-processor macro, so we
@@ -259,6 +274,145 @@ inline Msg *msg_unpack_wrapper(Octstr *os)
 }
 
 
+long msg_frame_type(Octstr *frame)
+{
+    unsigned char buf[4];
+    long type;
+
+    if (octstr_len(frame) < 4)
+        return 0;
+    octstr_get_many_chars((char *)buf, frame, 0, 4);
+    type = decode_network_long(buf);
+
+    return (type == MSG_FRAME_BATCH || type == MSG_FRAME_ACKS) ? type : 0;
+}
+
+
+Octstr *msg_batch_create(long seq)
+{
+    Octstr *os;
+
+    os = octstr_create("");
+    append_integer(os, MSG_FRAME_BATCH);
+    append_integer(os, seq);
+
+    return os;
+}
+
+
+void msg_batch_append(Octstr *batch, Msg *msg)
+{
+    Octstr *pack;
+
+    /* a batch entry is a packed Msg with its length in front */
+    pack = msg_pack(msg);
+    append_string(batch, pack);
+    octstr_destroy(pack);
+}
+
+
+long msg_batch_unpack(Octstr *batch, List *msgs, long *seq)
+{
+    Msg *msg;
+    long type, len, n;
+    int off, end;
+
+    off = 0;
+    if (parse_integer(&type, batch, &off) == -1 || type != MSG_FRAME_BATCH ||
+        parse_integer(seq, batch, &off) == -1)
+        return -1;
+    *seq &= 0xffffffffL;
+
+    for (n = 0; off < octstr_len(batch); n++) {
+        if (parse_integer(&len, batch, &off) == -1 || len < 0 ||
+            len > octstr_len(batch) - off)
+            goto error;
+        end = off + len;
+        msg = unpack_at(batch, &off, __FILE__, __LINE__, __func__);
+        if (msg == NULL)
+            goto error;
+        gwlist_append(msgs, msg);
+        if (off != end) {
+            error(0, "Msg in batch frame has trailing data.");
+            n++;
+            goto error;
+        }
+    }
+
+    return n;
+
+error:
+    while (n-- > 0) {
+        msg_destroy(gwlist_get(msgs, gwlist_len(msgs) - 1));
+        gwlist_delete(msgs, gwlist_len(msgs) - 1, 1);
+    }
+    return -1;
+}
+
+
+Octstr *msg_acks_pack(long *seqs, long n)
+{
+    Octstr *os;
+    long i, d, min, max;
+    int32_t diff;
+
+    gw_assert(n > 0);
+
+    /* the offsets from the first one are small, even across a wrap */
+    min = max = 0;
+    for (i = 1; i < n; i++) {
+        diff = (int32_t) (uint32_t) (seqs[i] - seqs[0]);
+        if (diff < min)
+            min = diff;
+        if (diff > max)
+            max = diff;
+    }
+
+    os = octstr_create("");
+    append_integer(os, MSG_FRAME_ACKS);
+    append_integer(os, seqs[0] + min);
+    append_integer(os, (max - min) / 8 + 1);
+    for (i = 0; i <= (max - min) / 8; i++)
+        octstr_append_char(os, 0);
+    for (i = 0; i < n; i++) {
+        d = (int32_t) (uint32_t) (seqs[i] - seqs[0]) - min;
+        octstr_set_char(os, 12 + d / 8,
+                        octstr_get_char(os, 12 + d / 8) | (1 << (d % 8)));
+    }
+
+    return os;
+}
+
+
+int msg_acks_unpack(Octstr *frame, long *base, Octstr **bitmap)
+{
+    long type;
+    int off;
+
+    off = 0;
+    if (parse_integer(&type, frame, &off) == -1 || type != MSG_FRAME_ACKS ||
+        parse_integer(base, frame, &off) == -1 ||
+        parse_string(bitmap, frame, &off) == -1 || *bitmap == NULL)
+        return -1;
+    /* parse_string() does not check the length against the frame */
+    if (off != octstr_len(frame)) {
+        error(0, "Ack frame has the wrong length.");
+        octstr_destroy(*bitmap);
+        *bitmap = NULL;
+        return -1;
+    }
+    *base &= 0xffffffffL;
+
+    return 0;
+}
+
+
+long msg_seq_widen(long seq, long next)
+{
+    return next - ((next - seq) & 0xffffffffL);
+}
+
+
 /**********************************************************************
  * Implementations of private functions.
  */
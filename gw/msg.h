@@ -116,7 +116,8 @@ enum {
     cmd_suspend = 1,
     cmd_resume = 2,
     cmd_identify = 3,
-    cmd_restart = 4
+    cmd_restart = 4,
+    cmd_batch = 5       /* offer or accept batch frames, see below */
 };
 
 /* ack message status */
@@ -183,4 +184,55 @@ Msg *msg_unpack_real(Octstr *os, const char *file, long line, const char *func);
     gw_claim_area(msg_unpack_real((os), __FILE__, __LINE__, __func__))
 Msg *msg_unpack_wrapper(Octstr *os);
 
+
+/*
+ * Frames on a box connection that negotiated cmd_batch. Bearerbox offers
+ * the batch mode to an identifying smsbox and, once the box accepted it,
+ * sends sms messages several per frame, numbered consecutively from the
+ * sequence number in the frame. The box acks the successful ones with a
+ * bitmap over these sequence numbers instead of one ack Msg each. The
+ * first word of these frames is no message type, so a reader can tell
+ * them from a single packed Msg.
+ */
+#define MSG_FRAME_BATCH 0x7f4b0001
+#define MSG_FRAME_ACKS  0x7f4b0002
+
+/*
+ * Return MSG_FRAME_BATCH or MSG_FRAME_ACKS for such a frame, 0 for
+ * anything else, like a single packed Msg.
+ */
+long msg_frame_type(Octstr *frame);
+
+/* Start a batch frame whose first message gets sequence number `seq'. */
+Octstr *msg_batch_create(long seq);
+
+/* Pack an Msg at the end of a batch frame. */
+void msg_batch_append(Octstr *batch, Msg *msg);
+
+/*
+ * Unpack the messages of a batch frame to the end of `msgs' and set
+ * `seq' to the sequence number of the first one. Return the number of
+ * messages or -1, leaving `msgs' as it was, if the frame is invalid.
+ */
+long msg_batch_unpack(Octstr *batch, List *msgs, long *seq);
+
+/*
+ * Pack an ack frame for the `n' sequence numbers in `seqs', which must
+ * lie within 2^31 of each other. Sequence numbers are 32 bit on the wire.
+ */
+Octstr *msg_acks_pack(long *seqs, long n);
+
+/*
+ * Unpack an ack frame. Sets `base' to the lowest sequence number and
+ * `bitmap' to a new Octstr with bit i % 8 of byte i / 8 set if base + i
+ * (modulo 2^32) is acked. Return -1 if the frame is invalid, else 0.
+ */
+int msg_acks_unpack(Octstr *frame, long *base, Octstr **bitmap);
+
+/*
+ * Return the sequence number whose low 32 bits, as on the wire, are `seq'
+ * and which is less than 2^32 behind `next'.
+ */
+long msg_seq_widen(long seq, long next);
+
 #endif
@@ -71,142 +71,320 @@
 #include <string.h>
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "gwlib/gwlib.h"
 #include "numhash.h"
 
 
-#define NUMHASH_AUTO_HASH -1
-
-/* set of pre-calculated prime numbers for hash generation... */
-
-static int primes[] = {
-  101, 503, 1009, 2003, 3001, 5003, 7001,
-  10007, 20011, 30011, 40009, 50021, 60013, 70001, 80021, 90001,
-  100003, 150001, 200003, 300007, 400009, 500009, 600011, 700001,
-  800011, 900001, 1000003, 1100009, 1200007, 1300021, 1400017, 1500007,
-  1600033, 1700021, 1800017, 1900009, 2000003, 3000017, 4000037, 5000111,
-  6000101, 7000127, 8000051, -1
+/*
+ * One set of numbers, never changed after it is built. The keys are
+ * sorted and grouped by their upper 32 bits: the lower halves of the
+ * keys with upper half high[i] are low[start[i]] to low[start[i+1]-1].
+ */
+struct numhash_numbers {
+    long		total;
+    long		nhigh;
+    unsigned long long	*high;
+    long		*start;
+    unsigned int	*low;
 };
 
 struct numhash_table {
-  struct numhash_number *numbers;
-  long			number_total;
-  long			table_size;
-  struct numhash_number	**hash;
-  long			hash_size;
+    Octstr		*url;
+    void *volatile	numbers;	/* struct numhash_numbers */
+    Mutex		*lock;		/* see find_key() */
 }; /* Numhash */
 
-struct numhash_number {
-  long long		key;	/* (hopefully) unique key */
-  struct numhash_number	*next;	/* next in hash table, if any */
-};
-
 
-struct nh_entry {
-    Numhash		*hash;
-    struct nh_entry	*next;
-};
-    
-struct numhashes {
-    struct nh_entry	*first;
-    struct nh_entry 	*last;
-}; /* Multitable */
+/*
+ * The set each thread is searching, indexed by thread number, so that
+ * numhash_reload() knows when nobody uses a replaced set any more.
+ */
+static struct {
+    void *volatile	numbers;
+    char		pad[64 - sizeof(void *)];
+} readers[GWTHREAD_TABLE_SIZE];
 
 
 static int	precision = 19;		/* the precision (last numbers) used */
 
+
+static int compare_keys(const void *a, const void *b)
+{
+    long long x = *(const long long *) a, y = *(const long long *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+
+static void numbers_destroy(struct numhash_numbers *numbers)
+{
+    if (numbers == NULL)
+	return;
+    gw_free(numbers->high);
+    gw_free(numbers->start);
+    gw_free(numbers->low);
+    gw_free(numbers);
+}
+
+
 /*
- * add new item (number) to hash table
+ * Parse the `len' bytes of number list at `data' into a new set. The
+ * data need not be NUL terminated and is not changed.
  */
-static int add_item(Numhash *table, struct numhash_number *nro)
+static struct numhash_numbers *numbers_parse(const char *data, long len,
+					     const char *url)
 {
-    if (table->hash[nro->key % table->hash_size]) {    /* conflict */
-	struct numhash_number *ptr = table->hash[nro->key % table->hash_size];
+    struct numhash_numbers *numbers;
+    const char *ptr, *end, *eol;
+    char numbuf[100];
+    long long *keys;
+    long lines, n, i, dups;
+    int loc;
+
+    end = data + len;
+    lines = 1;
+    for (ptr = data; (ptr = memchr(ptr, '\n', end - ptr)) != NULL; ptr++)
+	lines++;
+    debug("numhash", 0, "Total %ld lines in %s", lines, url);
+
+    /* set our accuracy according to the size of long int */
+    if (sizeof(long long) >= 16)
+        precision = 38;
+    else if (sizeof(long long) >= 8)
+        precision = 19;
+
+    keys = gw_malloc(lines * sizeof(*keys));
+    n = 0;
+    for (ptr = data; ptr < end; ptr = eol < end ? eol + 1 : end) {
+	if ((eol = memchr(ptr, '\n', end - ptr)) == NULL) {
+	    eol = end;
+	}
+	while (ptr < eol && isspace((unsigned char) *ptr))
+	    ptr++;
+	if (ptr < eol && *ptr == '#')
+	    continue;
+	if (eol == end && ptr == eol)	/* nothing after the last linefeed */
+	    break;
+	loc = 0;
+	for (; ptr < eol; ptr++) {
+	    if (isdigit((unsigned char) *ptr)) {
+		if (loc < (int) sizeof(numbuf) - 1)
+		    numbuf[loc++] = *ptr;
+	    } else if (*ptr != ' ' && *ptr != '+' && *ptr != '-')
+		break;
+	}
+	if (loc) {
+	    numbuf[loc] = '\0';
+	    keys[n++] = numhash_get_char_key(numbuf);
+	} else
+	    warning(0, "Corrupted line '%.*s'", (int) (eol - ptr), ptr);
+    }
 
-	if (ptr->key == nro->key)
-	    goto duplicate;
+    qsort(keys, n, sizeof(*keys), compare_keys);
 
-	while(ptr->next) {
-	    ptr = ptr->next;
-	    if (ptr->key == nro->key)
-		goto duplicate;
+    numbers = gw_malloc(sizeof(*numbers));
+    numbers->total = numbers->nhigh = 0;
+    dups = 0;
+    for (i = 0; i < n; i++) {
+	if (i > 0 && keys[i] == keys[numbers->total - 1]) {
+	    dups++;
+	    continue;
+	}
+	if (numbers->total == 0 ||
+	    keys[i] >> 32 != keys[numbers->total - 1] >> 32)
+	    numbers->nhigh++;
+	keys[numbers->total++] = keys[i];
+    }
+    if (dups > 0)
+	warning(0, "%ld duplicate numbers in <%s>", dups, url);
+
+    numbers->high = gw_malloc((numbers->nhigh + 1) * sizeof(*numbers->high));
+    numbers->start = gw_malloc((numbers->nhigh + 1) * sizeof(*numbers->start));
+    numbers->low = gw_malloc((numbers->total + 1) * sizeof(*numbers->low));
+    for (i = 0, n = 0; i < numbers->total; i++) {
+	if (i == 0 || keys[i] >> 32 != keys[i - 1] >> 32) {
+	    numbers->high[n] = (unsigned long long) keys[i] >> 32;
+	    numbers->start[n++] = i;
 	}
-	ptr->next = nro;				/* put as last of the linkage */
-    } else
-	table->hash[nro->key % table->hash_size] = nro;
+	numbers->low[i] = (unsigned int) keys[i];
+    }
+    numbers->start[n] = numbers->total;
+    gw_free(keys);
 
-    return 0;
+    return numbers;
+}
+
+
+static struct numhash_numbers *numbers_load_file(const char *path)
+{
+    struct numhash_numbers *numbers;
+    struct stat st;
+    void *data;
+    int fd;
 
-duplicate:
-    warning(0, "Duplicate number %lld!", nro->key);
-    return -1;
+    if ((fd = open(path, O_RDONLY)) == -1) {
+	error(errno, "Cannot open number list <%s>", path);
+	return NULL;
+    }
+    if (fstat(fd, &st) == -1) {
+	error(errno, "Cannot stat number list <%s>", path);
+	close(fd);
+	return NULL;
+    }
+    if (st.st_size == 0) {
+	close(fd);
+	return numbers_parse("", 0, path);
+    }
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+	error(errno, "Cannot map number list <%s>", path);
+	return NULL;
+    }
+#ifdef MADV_SEQUENTIAL
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+#endif
+    numbers = numbers_parse(data, st.st_size, path);
+    munmap(data, st.st_size);
+
+    return numbers;
 }
 
-/* Add a new number to number list and hash
- * Return 0 if all went ok, -1 if out of room
- */
-static int numhash_add_number(Numhash *table, char *nro)
+
+static struct numhash_numbers *numbers_load_url(Octstr *url)
 {
-    struct numhash_number *newnro;
+    struct numhash_numbers *numbers;
+    List	*request_headers, *reply_headers;
+    Octstr	*final_url, *reply_body;
+    Octstr	*type, *charset;
+    int		status;
 
-    if (table->number_total == table->table_size) {
-	error(0, "Table limit %ld reached, cannot add %s!",
-	      table->table_size, nro);
-	return -1;
+    request_headers = http_create_empty_headers();
+    status = http_get_real(HTTP_METHOD_GET, url, request_headers, &final_url,
+			    &reply_headers, &reply_body);
+    octstr_destroy(final_url);
+    http_destroy_headers(request_headers);
+
+    if (status != HTTP_OK) {
+	http_destroy_headers(reply_headers);
+	octstr_destroy(reply_body);
+	error(0, "Cannot load numhash!");
+	return NULL;
     }
-    newnro =  &table->numbers[table->number_total++]; /* take the next free */
+    http_header_get_content_type(reply_headers, &type, &charset);
+    octstr_destroy(charset);
+    http_destroy_headers(reply_headers);
 
-    newnro->key = numhash_get_char_key(nro);
-    newnro->next = NULL;
+    if (octstr_str_compare(type, "text/plain") != 0) {
+        octstr_destroy(reply_body);
+        error(0, "Strange content type <%s> for numhash - expecting 'text/plain'"
+                 ", operatiom fails", octstr_get_cstr(type));
+        octstr_destroy(type);
+        return NULL;
+    }
+    octstr_destroy(type);
 
-    add_item(table, newnro);
+    numbers = numbers_parse(octstr_get_cstr(reply_body), octstr_len(reply_body),
+                            octstr_get_cstr(url));
+    octstr_destroy(reply_body);
 
-    return 0;
+    return numbers;
 }
 
 
-/* Init the number table and hash table with given sizes
- */
-static Numhash *numhash_init(int max_numbers, int hash_size)
+static struct numhash_numbers *numbers_load(Octstr *url)
 {
-    Numhash	*ntable = NULL;
+    struct numhash_numbers *numbers;
 
-    ntable = gw_malloc(sizeof(Numhash));
+    if (octstr_ncompare(url, octstr_imm("file://"), 7) == 0)
+	numbers = numbers_load_file(octstr_get_cstr(url) + 7);
+    else if (octstr_get_char(url, 0) == '/')
+	numbers = numbers_load_file(octstr_get_cstr(url));
+    else
+	numbers = numbers_load_url(url);
 
-    if (hash_size > 0)
-	ntable->hash_size = hash_size;
-    else if (hash_size == NUMHASH_AUTO_HASH) {
-	int i;
-	for(i=0 ; primes[i] > 0; i++) {
-	    ntable->hash_size = primes[i];
-	    if (ntable->hash_size > max_numbers)
-		break;
-	}
-    } else {
-	gw_free(ntable);
-	return NULL;
+    if (numbers != NULL)
+	info(0, "Read from <%s> total of %ld numbers", octstr_get_cstr(url),
+	     numbers->total);
+    return numbers;
+}
+
+
+static int numbers_find(struct numhash_numbers *numbers, long long key)
+{
+    unsigned long long high;
+    unsigned int low;
+    long lo, hi, mid, end;
+
+    if (key < 0)
+	return 0;
+    high = (unsigned long long) key >> 32;
+    low = (unsigned int) key;
+
+    lo = 0;
+    hi = numbers->nhigh;
+    while (lo < hi) {
+	mid = (lo + hi) / 2;
+	if (numbers->high[mid] < high)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    if (lo == numbers->nhigh || numbers->high[lo] != high)
+	return 0;
+
+    end = numbers->start[lo + 1];
+    lo = numbers->start[lo];
+    hi = end;
+    while (lo < hi) {
+	mid = (lo + hi) / 2;
+	if (numbers->low[mid] < low)
+	    lo = mid + 1;
+	else
+	    hi = mid;
     }
-    ntable->hash = gw_malloc(ntable->hash_size * sizeof(struct numhash_number *));
-    memset(ntable->hash, 0, sizeof(struct numhash_number *) * ntable->hash_size);
+    return lo < end && numbers->low[lo] == low;
+}
 
-    ntable->table_size = max_numbers;
-    ntable->numbers = gw_malloc(ntable->table_size * sizeof(struct numhash_number));
 
-    ntable->number_total = 0;
+/*
+ * Run `find' on the current set of `table'. A thread publishes the set
+ * it uses in its readers slot and checks that the set was not replaced
+ * meanwhile; numhash_reload() frees a replaced set only once no slot
+ * holds it. Threads not created by gwthread have no slot and search
+ * under the table lock, which numhash_reload() takes to replace the set.
+ */
+static long find_key(Numhash *table, long long key, int count)
+{
+    struct numhash_numbers *numbers;
+    void *volatile *slot;
+    long thread, ret;
+
+    if ((thread = gwthread_self()) < 0) {
+	mutex_lock(table->lock);
+	numbers = table->numbers;
+	ret = count ? numbers->total : numbers_find(numbers, key);
+	mutex_unlock(table->lock);
+	return ret;
+    }
 
-    /* set our accuracy according to the size of long int
-     * Ok, we call this many times if we use multiple tables, but
-     * that is not a problem...
-     */
-    if (sizeof(long long) >= 16)
-        precision = 38;
-    else if (sizeof(long long) >= 8)
-        precision = 19;
+    slot = &readers[thread % GWTHREAD_TABLE_SIZE].numbers;
+    do {
+	numbers = gw_atomic_get_ptr(&table->numbers);
+	gw_atomic_set_ptr(slot, numbers);
+	gw_atomic_fence();
+    } while (numbers != gw_atomic_get_ptr(&table->numbers));
 
-    return ntable;
-}
+    ret = count ? numbers->total : numbers_find(numbers, key);
+    gw_atomic_set_ptr(slot, NULL);
 
+    return ret;
+}
 
 
 /*------------------------------------------------------
@@ -227,14 +405,7 @@ int numhash_find_number(Numhash *table, Octstr *nro)
 
 int numhash_find_key(Numhash *table, long long key)
 {
-    struct numhash_number *ptr;
-
-    ptr = table->hash[key % table->hash_size];
-    while (ptr) {
-	if (ptr->key == key) return 1;
-	ptr = ptr->next;
-    }
-    return 0;	/* not found */
+    return find_key(table, key, 0);
 }
 
 
@@ -276,118 +447,59 @@ void numhash_destroy(Numhash *table)
 {
     if (table == NULL)
 	return;
-    gw_free(table->numbers);
-    gw_free(table->hash);
+    numbers_destroy(table->numbers);
+    mutex_destroy(table->lock);
+    octstr_destroy(table->url);
     gw_free(table);
 }
 
 
-double numhash_hash_fill(Numhash *table, int *longest)
-{
-    int i, l, max = 0, tot = 0;
-    struct numhash_number *ptr;
-
-    for (i=0; i < table->hash_size; i++)
-	if (table->hash[i]) {
-	    tot++;
-	    ptr = table->hash[i];
-	    for (l=0; ptr->next; ptr = ptr->next)
-		l++;
-	    if (l > max)
-		max = l;
-	}
-
-    if (longest != NULL)
-	*longest = max;
-
-    return (double)(tot*100.0/(table->hash_size));
-}
-
-
 int numhash_size(Numhash *table)
 {
-    return table->number_total;
+    return find_key(table, 0, 1);
 }
 
 
 Numhash *numhash_create(const char *seek_url)
 {
-    int		loc, lines = 0;
-    List	*request_headers, *reply_headers;
-    Octstr	*url, *final_url, *reply_body;
-    Octstr	*type, *charset;
-
-    char *data, *ptr, numbuf[100];
-    int		status;
+    struct numhash_numbers *numbers;
     Numhash	*table;
+    Octstr	*url;
 
     url = octstr_create(seek_url);
-    request_headers = http_create_empty_headers();
-    status = http_get_real(HTTP_METHOD_GET, url, request_headers, &final_url,
-			    &reply_headers, &reply_body);
-    octstr_destroy(url);
-    octstr_destroy(final_url);
-    http_destroy_headers(request_headers);
-
-    if (status != HTTP_OK) {
-	http_destroy_headers(reply_headers);
-	octstr_destroy(reply_body);
-	error(0, "Cannot load numhash!");
+    if ((numbers = numbers_load(url)) == NULL) {
+	octstr_destroy(url);
 	return NULL;
     }
-    http_header_get_content_type(reply_headers, &type, &charset);
-    octstr_destroy(charset);
-    http_destroy_headers(reply_headers);
-
-    if (octstr_str_compare(type, "text/plain") != 0) {
-        octstr_destroy(reply_body);
-        error(0, "Strange content type <%s> for numhash - expecting 'text/plain'"
-                 ", operatiom fails", octstr_get_cstr(type));
-        octstr_destroy(type);
-        return NULL;
-    }
-    octstr_destroy(type);
 
-    ptr = data = octstr_get_cstr(reply_body);
-    while(*ptr) {
-	if (*ptr == '\n') lines++;
-	ptr++;
-    }
-    debug("numhash", 0, "Total %d lines in %s", lines, seek_url);
-
-    table = numhash_init(lines+10, NUMHASH_AUTO_HASH);  	/* automatic hash */
-
-    /* now, parse the number information */
-
-    lines = 0;
-
-    while((ptr = strchr(data, '\n'))) {	/* each line is ended with linefeed */
-	*ptr = '\0';
-	while(*data != '\0' && isspace(*data))
-	    data++;
-	if (*data != '#') {
-	    loc = 0;
-	    while (*data != '\0') {
-		if (isdigit(*data))
-		    numbuf[loc++] = *data;
-		else if (*data == ' ' || *data == '+' || *data == '-')
-			;
-		else break;
-		data++;
-	    }
-	    if (loc) {
-		numbuf[loc] = '\0';
-		numhash_add_number(table, numbuf);
-		lines++;
-	    }
-	    else
-		warning(0, "Corrupted line '%s'", data);
-	}
-	data = ptr+1;	/* next row... */
-    }
-    octstr_destroy(reply_body);
+    table = gw_malloc(sizeof(*table));
+    table->url = url;
+    table->numbers = numbers;
+    table->lock = mutex_create();
 
-    info(0, "Read from <%s> total of %ld numbers", seek_url, table->number_total);
     return table;
 }
 
+
+int numhash_reload(Numhash *table)
+{
+    struct numhash_numbers *numbers, *old;
+    long i;
+
+    if ((numbers = numbers_load(table->url)) == NULL)
+	return -1;
+
+    mutex_lock(table->lock);
+    old = gw_atomic_swap_ptr(&table->numbers, numbers);
+    mutex_unlock(table->lock);
+
+    /* wait until no thread searches the old set */
+    gw_atomic_fence();
+    for (i = 0; i < GWTHREAD_TABLE_SIZE; i++) {
+	while (gw_atomic_get_ptr(&readers[i].numbers) == old)
+	    gwthread_sleep(0.001);
+    }
+    numbers_destroy(old);
+
+    return 0;
+}
@@ -68,13 +68,15 @@
  * might map to same hash entry, and thus some caution is needed
  * specially with telephone number black lists
  *
- * USAGE:
- *  the system is not very dynamic; if you want to resize the table
- *  or hash, you must first nuke all old data and then recreate it
- *
- * MEMORY NEEDED:  (approximated)
+ * The numbers are kept as a sorted set: the keys are grouped by their
+ * upper 32 bits, and only the lower 32 bits of each key are stored,
+ * so a set takes a little over 4 bytes per number.
  *
- * 2* (sizeof(long long)+sizeof(void *)) bytes per number
+ * USAGE:
+ *  a table is never changed once created, so any number of threads
+ *  may search it without locking. numhash_reload() replaces all the
+ *  numbers at once from the original source, and searches running
+ *  during the reload see either the old or the new numbers.
  */
 
 #ifndef NUMHASH_H
@@ -84,11 +86,6 @@
 
 /* number hashing/seeking functions
  * all return -1 on error and write to general Kannel log
- *
- * these 2 first are only required if you want to add the numbers
- * by hand - otherwise use the last function instead
- *
- * use prime_hash if you want an automatically generated hash size
  */
 
 typedef struct numhash_table Numhash;	
@@ -97,6 +94,10 @@ typedef struct numhash_table Numhash;
 /* get numbers from 'url' and create a new database out of them
  * Return NULL if cannot open database or other error, error is logged
  *
+ * 'url' is either an HTTP URL, or a local file given as a file:// URL
+ * or an absolute path. Local files are mapped to memory rather than
+ * read, so that lists of millions of numbers load quickly.
+ *
  * Numbers to datafile are saved as follows:
  *  - one number per line
  *  - number might have white spaces, '+' and '-' signs
@@ -110,6 +111,11 @@ typedef struct numhash_table Numhash;
  */
 Numhash *numhash_create(const char *url); 
 
+/* load the numbers again from the url the table was created from and
+ * replace the old ones atomically. Return 0 if all went ok, -1 if the
+ * numbers could not be loaded, in which case the old ones are kept. */
+int numhash_reload(Numhash *table);
+
 /* destroy hash and all numbers in it */
 void numhash_destroy(Numhash *table);
 
@@ -125,10 +131,6 @@ long long numhash_get_key(Octstr *nro);
 long long numhash_get_char_key(char *nro);
 
 
-/* Return hash fill percent. If 'longest' != NULL, set as longest
- * trail in hash */
-double numhash_hash_fill(Numhash *table, int *longest);
-
 /* return number of numbers in hash */
 int numhash_size(Numhash *table);
 
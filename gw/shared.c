@@ -79,6 +79,233 @@ volatile enum program_status program_status = starting_up;
  * established from a foobarbox to bearerbox. */
 static Connection *bb_conn;
 
+/*
+ * Batch frame state of bb_conn, see accept_batch_from_bearerbox(). The
+ * sequence numbers of the messages not acked yet are kept in an open
+ * addressing table by message id, so acking them allocates nothing. Acks
+ * wait up to BATCH_ACK_DELAY for others to share their frame, unless
+ * BATCH_ACK_MAX of them are waiting already.
+ */
+#define BATCH_ACK_DELAY 0.01
+#define BATCH_ACK_MAX 256
+
+typedef struct {
+    uuid_t id;
+    long seq;           /* -1 for a free slot */
+} BatchSeq;
+
+struct BatchSeqs {
+    BatchSeq *slots;
+    long size;          /* power of 2 */
+    long len;
+};
+
+static void *volatile batch_lock;     /* a Mutex once batch frames are accepted */
+static List *batch_unread;      /* messages of the last batch frame */
+static BatchSeqs *batch_seqs;
+static long *batch_acks;        /* sequence numbers to ack */
+static long batch_acks_len;
+static long batch_acks_size;
+static int batch_writing;       /* some thread writes the ack frames */
+static long batch_thread = -1;
+static volatile int batch_running;
+
+
+static long batch_slot(BatchSeqs *table, uuid_t id)
+{
+    unsigned long h = 2166136261UL;
+    int i;
+
+    for (i = 0; i < 16; i++)
+        h = (h ^ id[i]) * 16777619UL;
+    return h & (table->size - 1);
+}
+
+
+BatchSeqs *batch_seqs_create(void)
+{
+    BatchSeqs *table;
+
+    table = gw_malloc(sizeof(*table));
+    table->slots = NULL;
+    table->size = table->len = 0;
+
+    return table;
+}
+
+
+void batch_seqs_destroy(BatchSeqs *table)
+{
+    if (table == NULL)
+        return;
+
+    gw_free(table->slots);
+    gw_free(table);
+}
+
+
+void batch_seq_put(BatchSeqs *table, uuid_t id, long seq)
+{
+    BatchSeq *old;
+    long i, j, size;
+
+    if ((table->len + 1) * 2 > table->size) {
+        old = table->slots;
+        size = table->size;
+        table->size = size > 0 ? size * 2 : 256;
+        table->slots = gw_malloc(table->size * sizeof(*table->slots));
+        for (i = 0; i < table->size; i++)
+            table->slots[i].seq = -1;
+        for (i = 0; i < size; i++) {
+            if (old[i].seq == -1)
+                continue;
+            for (j = batch_slot(table, old[i].id); table->slots[j].seq != -1;
+                 j = (j + 1) & (table->size - 1))
+                ;
+            table->slots[j] = old[i];
+        }
+        gw_free(old);
+    }
+
+    for (i = batch_slot(table, id); table->slots[i].seq != -1;
+         i = (i + 1) & (table->size - 1))
+        ;
+    uuid_copy(table->slots[i].id, id);
+    table->slots[i].seq = seq;
+    table->len++;
+}
+
+
+long batch_seq_take(BatchSeqs *table, uuid_t id)
+{
+    BatchSeq *slots = table->slots;
+    long i, j, k, seq, mask;
+
+    if (table->len == 0)
+        return -1;
+
+    mask = table->size - 1;
+    for (i = batch_slot(table, id); slots[i].seq != -1; i = (i + 1) & mask)
+        if (uuid_compare(slots[i].id, id) == 0)
+            break;
+    if ((seq = slots[i].seq) == -1)
+        return -1;
+
+    /* move later entries of the probe sequence into the hole */
+    for (j = (i + 1) & mask; slots[j].seq != -1; j = (j + 1) & mask) {
+        k = batch_slot(table, slots[j].id);
+        if ((j > i && (k <= i || k > j)) || (j < i && (k <= i && k > j))) {
+            slots[i] = slots[j];
+            i = j;
+        }
+    }
+    slots[i].seq = -1;
+    table->len--;
+
+    return seq;
+}
+
+
+long batch_seqs_len(BatchSeqs *table)
+{
+    return table->len;
+}
+
+
+/*
+ * Write the queued acks, unless another thread is at it already. Called
+ * with batch_lock held, which is released while writing.
+ */
+static void batch_flush(void)
+{
+    Octstr *frame;
+
+    if (batch_writing)
+        return;
+
+    batch_writing = 1;
+    while (batch_acks_len > 0) {
+        frame = msg_acks_pack(batch_acks, batch_acks_len);
+        batch_acks_len = 0;
+        mutex_unlock(batch_lock);
+        if (conn_write_withlen_owned(bb_conn, frame) == -1)
+            error(0, "Couldn't write acks to bearerbox.");
+        mutex_lock(batch_lock);
+    }
+    batch_writing = 0;
+}
+
+
+static void batch_ack_thread(void *arg)
+{
+    mutex_lock(batch_lock);
+    while (batch_running) {
+        if (batch_acks_len == 0) {
+            mutex_unlock(batch_lock);
+            gwthread_sleep(-1);
+        } else {
+            mutex_unlock(batch_lock);
+            gwthread_sleep(BATCH_ACK_DELAY);
+            mutex_lock(batch_lock);
+            batch_flush();
+            mutex_unlock(batch_lock);
+        }
+        mutex_lock(batch_lock);
+    }
+    batch_flush();
+    mutex_unlock(batch_lock);
+}
+
+
+/*
+ * Queue the ack for a message of a batch frame. Return 0 if the ack was
+ * not for such a message or no success, so it has to go as an ack Msg.
+ */
+static int batch_ack(Msg *ack)
+{
+    long seq;
+
+    mutex_lock(batch_lock);
+    if ((seq = batch_seq_take(batch_seqs, ack->ack.id)) == -1 || ack->ack.nack != ack_success) {
+        mutex_unlock(batch_lock);
+        return 0;
+    }
+
+    if (batch_acks_len == batch_acks_size) {
+        batch_acks_size = batch_acks_size * 2 + 64;
+        batch_acks = gw_realloc(batch_acks, batch_acks_size * sizeof(*batch_acks));
+    }
+    batch_acks[batch_acks_len++] = seq;
+
+    if (batch_acks_len >= BATCH_ACK_MAX)
+        batch_flush();
+    else if (batch_acks_len == 1)
+        gwthread_wakeup(batch_thread);
+    mutex_unlock(batch_lock);
+
+    msg_destroy(ack);
+    return 1;
+}
+
+
+void accept_batch_from_bearerbox(void)
+{
+    Msg *msg;
+
+    if (batch_lock == NULL) {
+        batch_unread = gwlist_create();
+        batch_seqs = batch_seqs_create();
+        batch_running = 1;
+        gw_atomic_set_ptr(&batch_lock, mutex_create());
+        if ((batch_thread = gwthread_create(batch_ack_thread, NULL)) == -1)
+            panic(0, "Failed to start a new thread for acks to bearerbox.");
+    }
+
+    msg = msg_create(admin);
+    msg->admin.command = cmd_batch;
+    write_to_bearerbox(msg);
+}
+
 
 Connection *connect_to_bearerbox_real(Octstr *host, int port, int ssl, Octstr *our_host)
 {
@@ -121,8 +348,28 @@ void close_connection_to_bearerbox_real(Connection *conn)
 
 void close_connection_to_bearerbox(void)
 {
+    if (batch_lock != NULL) {
+        /* the last acks go out before the connection closes */
+        batch_running = 0;
+        gwthread_wakeup(batch_thread);
+        gwthread_join(batch_thread);
+        batch_thread = -1;
+    }
+
     close_connection_to_bearerbox_real(bb_conn);
     bb_conn = NULL;
+
+    if (batch_lock != NULL) {
+        mutex_destroy(batch_lock);
+        batch_lock = NULL;
+        gwlist_destroy(batch_unread, msg_destroy_item);
+        batch_unread = NULL;
+        batch_seqs_destroy(batch_seqs);
+        batch_seqs = NULL;
+        gw_free(batch_acks);
+        batch_acks = NULL;
+        batch_acks_size = batch_acks_len = 0;
+    }
 }
 
 
@@ -131,16 +378,18 @@ void write_to_bearerbox_real(Connection *conn, Msg *pmsg)
     Octstr *pack;
 
     pack = msg_pack(pmsg);
-    if (conn_write_withlen(conn, pack) == -1)
+    if (conn_write_withlen_owned(conn, pack) == -1)
     	error(0, "Couldn't write Msg to bearerbox.");
 
     msg_destroy(pmsg);
-    octstr_destroy(pack);
 }
 
 
 void write_to_bearerbox(Msg *pmsg)
 {
+    if (msg_type(pmsg) == ack && gw_atomic_get_ptr(&batch_lock) != NULL &&
+        batch_ack(pmsg))
+        return;
     write_to_bearerbox_real(bb_conn, pmsg);
 }
 
@@ -151,13 +400,11 @@ int deliver_to_bearerbox_real(Connection *conn, Msg *msg)
     Octstr *pack;
     
     pack = msg_pack(msg);
-    if (conn_write_withlen(conn, pack) == -1) {
+    if (conn_write_withlen_owned(conn, pack) == -1) {
     	error(0, "Couldn't deliver Msg to bearerbox.");
-        octstr_destroy(pack);
         return -1;
     }
-                                   
-    octstr_destroy(pack);
+
     msg_destroy(msg);
     return 0;
 }
@@ -173,9 +420,15 @@ int read_from_bearerbox_real(Connection *conn, Msg **msg, double seconds)
 {
     int ret;
     Octstr *pack;
+    Msg *m;
+    long i, n, seq;
 
     pack = NULL;
     *msg = NULL;
+
+    if (batch_unread != NULL && (*msg = gwlist_extract_first(batch_unread)) != NULL)
+        return 0;
+
     while (program_status != shutting_down) {
         pack = conn_read_withlen(conn);
         gw_claim_area(pack);
@@ -205,6 +458,24 @@ int read_from_bearerbox_real(Connection *conn, Msg **msg, double seconds)
     if (pack == NULL)
         return -1;
 
+    if (msg_frame_type(pack) == MSG_FRAME_BATCH && batch_lock != NULL) {
+        n = msg_batch_unpack(pack, batch_unread, &seq);
+        octstr_destroy(pack);
+        if (n == -1) {
+            error(0, "Failed to unpack batch frame!");
+            return -1;
+        }
+        mutex_lock(batch_lock);
+        for (i = 0; i < n; i++) {
+            m = gwlist_get(batch_unread, i);
+            if (msg_type(m) == sms)
+                batch_seq_put(batch_seqs, m->sms.id, (seq + i) & 0xffffffffL);
+        }
+        mutex_unlock(batch_lock);
+        *msg = gwlist_extract_first(batch_unread);
+        return (*msg == NULL ? 1 : 0);
+    }
+
     *msg = msg_unpack(pack);
     octstr_destroy(pack);
 
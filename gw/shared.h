@@ -123,6 +123,28 @@ void write_to_bearerbox(Msg *msg);
 int deliver_to_bearerbox_real(Connection *conn, Msg *msg);
 int deliver_to_bearerbox(Msg *msg);
 
+
+/*
+ * Accept the batch frames bearerbox offered with cmd_batch. From now on
+ * read_from_bearerbox() returns the messages of batch frames one by one,
+ * and write_to_bearerbox() turns a successful ack for one of them into a
+ * bit of an ack frame, written together with the acks of other threads.
+ */
+void accept_batch_from_bearerbox(void);
+
+/*
+ * The sequence numbers of the messages of batch frames that are not
+ * acked yet, by message id. batch_seq_take() removes `id' and returns its
+ * sequence number, or -1 if it is not in the table.
+ */
+typedef struct BatchSeqs BatchSeqs;
+
+BatchSeqs *batch_seqs_create(void);
+void batch_seqs_destroy(BatchSeqs *table);
+void batch_seq_put(BatchSeqs *table, uuid_t id, long seq);
+long batch_seq_take(BatchSeqs *table, uuid_t id);
+long batch_seqs_len(BatchSeqs *table);
+
      
 /*
  * Validates an OSI date.
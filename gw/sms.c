@@ -408,3 +408,15 @@ int sms_priority_compare(const void *a, const void *b)
     return ret;
 }
 
+
+long sms_priority_level(const void *a)
+{
+    Msg *msg = (Msg*) a;
+
+    gw_assert(msg_type(msg) == sms);
+
+    if (msg->sms.priority == SMS_PARAM_UNDEFINED)
+        return 0;
+    return msg->sms.priority + 1;
+}
+
@@ -197,4 +197,11 @@ List *sms_split(Msg *orig, Octstr *header, Octstr *footer,
  */
 int sms_priority_compare(const void *a, const void *b);
 
+/*
+ * Priority of an sms as a level for gw_prioqueue_create_levels. Messages
+ * without priority get the lowest level, below priority 0.
+ */
+#define SMS_PRIORITY_LEVELS 5
+long sms_priority_level(const void *a);
+
 #endif
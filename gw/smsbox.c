@@ -109,6 +109,8 @@ static long bb_port;
 static int bb_ssl = 0;
 static long sendsms_port = 0;
 static Octstr *sendsms_interface = NULL;
+static long sendsms_poll_threads = 1;
+static long sendsms_threads = 1;
 static Octstr *smsbox_id = NULL;
 static Octstr *sendsms_url = NULL;
 static Octstr *sendota_url = NULL;
@@ -135,6 +137,7 @@ static Octstr *ppg_service_name = NULL;
 
 static List *smsbox_requests = NULL;      /* the inbound request queue */
 static List *smsbox_http_requests = NULL; /* the outbound HTTP request queue */
+static TimerWheel *smsbox_http_retries = NULL; /* failed requests, until due */
 
 /* Maximum requests that we handle in parallel */
 static Semaphore *max_pending_requests;
@@ -260,6 +263,9 @@ static void read_messages_from_bearerbox(void)
 		info(0, "Bearerbox told us to restart");
 		restart = 1;
 		program_status = shutting_down;
+	    } else if (msg->admin.command == cmd_batch) {
+		info(0, "Bearerbox offered batch frames, accepting");
+		accept_batch_from_bearerbox();
 	    }
 	    /*
 	     * XXXX here should be suspend/resume, add RSN
@@ -975,9 +981,15 @@ static void fill_message(Msg *msg, URLTranslation *trans,
  * Thread to handle failed HTTP requests and retries to deliver the
  * information to the HTTP server. The thread uses the smsbox_http_requests
  * queue that is spooled by url_result_thread in case the HTTP requests
- * fails.
+ * fails, after http-queue-delay seconds in smsbox_http_retries.
  */
 
+static void http_retry_due(void *id)
+{
+    gwlist_produce(smsbox_http_requests, id);
+}
+
+
 static void http_queue_thread(void *arg)
 {
     void *id;
@@ -990,14 +1002,6 @@ static void http_queue_thread(void *arg)
     int method;
 
     while ((id = gwlist_consume(smsbox_http_requests)) != NULL) {
-        /*
-         * Sleep for a while in order not to block other operting requests.
-         * Defaults to 10 sec. if not given via http-queue-delay directive in
-         * smsbox group.
-         */
-        if (http_queue_delay > 0)
-            gwthread_sleep(http_queue_delay);
-
         debug("sms.http",0,"HTTP: Queue contains %ld outstanding requests",
               gwlist_len(smsbox_http_requests));
 
@@ -1123,7 +1127,15 @@ static void url_result_thread(void *arg)
             octstr_destroy(type);
         } else if (max_http_retries > retries) {
             id = remember_receiver(msg, trans, method, req_url, req_headers, req_body, retries);
-            gwlist_produce(smsbox_http_requests, id);
+            /*
+             * Wait http-queue-delay seconds before retrying, without
+             * holding up the retries of other requests.
+             */
+            if (http_queue_delay > 0)
+                gw_timerwheel_add(smsbox_http_retries, http_queue_delay,
+                                  http_retry_due, id);
+            else
+                gwlist_produce(smsbox_http_requests, id);
             queued++;
             goto requeued;
         } else
@@ -1773,13 +1785,20 @@ static void obey_request_thread(void *arg)
 
 typedef const struct pam_message pam_message_type;
 
-static const char *PAM_username;
-static const char *PAM_password;
+/*
+ * The credentials being checked, passed to PAM_conv() as appdata_ptr,
+ * as several sendsms threads may authenticate at the same time.
+ */
+typedef struct {
+    const char *username;
+    const char *password;
+} PAM_credentials;
 
 static int PAM_conv (int num_msg, pam_message_type **msg,
 		     struct pam_response **resp,
 		     void *appdata_ptr)
 {
+    PAM_credentials *cred = appdata_ptr;
     int count = 0, replies = 0;
     struct pam_response *repl = NULL;
     int size = sizeof(struct pam_response);
@@ -1794,14 +1813,14 @@ static int PAM_conv (int num_msg, pam_message_type **msg,
 	case PAM_PROMPT_ECHO_ON:
 	    GET_MEM;
 	    repl[replies].resp_retcode = PAM_SUCCESS;
-	    repl[replies++].resp = COPY_STRING(PAM_username);
+	    repl[replies++].resp = COPY_STRING(cred->username);
 	    /* PAM frees resp */
 	    break;
 
 	case PAM_PROMPT_ECHO_OFF:
 	    GET_MEM;
 	    repl[replies].resp_retcode = PAM_SUCCESS;
-	    repl[replies++].resp = COPY_STRING(PAM_password);
+	    repl[replies++].resp = COPY_STRING(cred->password);
 	    /* PAM frees resp */
 	    break;
 
@@ -1822,21 +1841,19 @@ static int PAM_conv (int num_msg, pam_message_type **msg,
     return PAM_SUCCESS;
 }
 
-static struct pam_conv PAM_conversation = {
-    &PAM_conv,
-    NULL
-};
-
-
 static int authenticate(const char *login, const char *passwd)
 {
     pam_handle_t *pamh;
     int pam_error;
+    PAM_credentials cred;
+    struct pam_conv conversation;
     
-    PAM_username = login;
-    PAM_password = passwd;
+    cred.username = login;
+    cred.password = passwd;
+    conversation.conv = &PAM_conv;
+    conversation.appdata_ptr = &cred;
     
-    pam_error = pam_start("kannel", login, &PAM_conversation, &pamh);
+    pam_error = pam_start("kannel", login, &conversation, &pamh);
     if (pam_error != PAM_SUCCESS ||
         (pam_error = pam_authenticate(pamh, 0)) != PAM_SUCCESS) {
 	pam_end(pamh, pam_error);
@@ -3110,6 +3127,12 @@ error:
 }
 
 
+/*
+ * One of sendsms-threads workers taking requests off the sendsms port.
+ * They share the URL translations, which are only read after startup,
+ * and http_send_reply() just queues the reply, so a request that is slow
+ * to authorise doesn't hold up the others.
+ */
 static void sendsms_thread(void *arg)
  {
     HTTPClient *client;
@@ -3254,7 +3277,7 @@ static Cfg *init_smsbox(Cfg *cfg)
     Octstr *http_proxy_exceptions_regex = NULL;
     int ssl = 0;
     int lf, m;
-    long max_req;
+    long max_req, i;
 
     bb_port = BB_DEFAULT_SMSBOX_PORT;
     bb_ssl = 0;
@@ -3368,6 +3391,13 @@ static Cfg *init_smsbox(Cfg *cfg)
     /* check if want to bind to a specific interface */
     sendsms_interface = cfg_get(grp, octstr_imm("sendsms-interface"));    
 
+    /* number of threads reading requests from sendsms clients */
+    cfg_get_integer(&sendsms_poll_threads, grp, octstr_imm("sendsms-poll-threads"));
+    /* and number of threads handling them */
+    cfg_get_integer(&sendsms_threads, grp, octstr_imm("sendsms-threads"));
+    if (sendsms_threads < 1)
+        sendsms_threads = 1;
+
     cfg_get_integer(&sms_max_length, grp, octstr_imm("sms-length"));
 
 #ifdef HAVE_LIBSSL
@@ -3444,14 +3474,16 @@ static Cfg *init_smsbox(Cfg *cfg)
     cfg_get_integer(&http_queue_delay, grp, octstr_imm("http-queue-delay"));
 
     if (sendsms_port > 0) {
-        if (http_open_port_if(sendsms_port, ssl, sendsms_interface) == -1) {	
+        if (http_open_port_threads(sendsms_port, ssl, sendsms_interface,
+                                   sendsms_poll_threads) == -1) {
             if (only_try_http)
                 error(0, "Failed to open HTTP socket, ignoring it");
             else
                 panic(0, "Failed to open HTTP socket");
         } else {
             info(0, "Set up send sms service at port %ld", sendsms_port);
-            gwthread_create(sendsms_thread, NULL);
+            for (i = 0; i < sendsms_threads; i++)
+                gwthread_create(sendsms_thread, NULL);
         }
     }
 
@@ -3462,6 +3494,20 @@ static Cfg *init_smsbox(Cfg *cfg)
 
     if (cfg_get_integer(&value, grp, octstr_imm("http-timeout")) == 0)
        http_set_client_timeout(value);
+    if (cfg_get_integer(&value, grp, octstr_imm("http-client-threads")) == 0)
+       http_set_client_threads(value);
+    if (cfg_get_integer(&value, grp, octstr_imm("http-max-host-connections")) == 0)
+       http_set_client_max_host_connections(value);
+    if (cfg_get_integer(&value, grp, octstr_imm("http-pipeline-depth")) == 0)
+       http_set_client_pipeline_depth(value);
+    if (cfg_get_integer(&value, grp, octstr_imm("dns-resolver-threads")) == 0)
+       gw_dns_set_resolver_threads(value);
+    {
+        long ttl = 300, negative_ttl = 30;
+        cfg_get_integer(&ttl, grp, octstr_imm("dns-cache-ttl"));
+        cfg_get_integer(&negative_ttl, grp, octstr_imm("dns-negative-cache-ttl"));
+        gw_dns_set_ttl(ttl, negative_ttl);
+    }
 
     /*
      * Reading the name we are using for ppg services from ppg core group
@@ -3547,6 +3593,7 @@ int main(int argc, char **argv)
     caller = http_caller_create();
     smsbox_requests = gwlist_create();
     smsbox_http_requests = gwlist_create();
+    smsbox_http_retries = gw_timerwheel_create(0.1, 256);
     gwlist_add_producer(smsbox_requests);
     gwlist_add_producer(smsbox_http_requests);
     num_outstanding_requests = counter_create();
@@ -3572,11 +3619,14 @@ int main(int argc, char **argv)
     http_close_all_ports();
     gwthread_join_every(sendsms_thread);
     gwlist_remove_producer(smsbox_requests);
+    /* don't wait for the retries that are not due yet */
+    gw_timerwheel_flush(smsbox_http_retries);
     gwlist_remove_producer(smsbox_http_requests);
     gwthread_join_every(obey_request_thread);
     http_caller_signal_shutdown(caller);
     gwthread_join_every(url_result_thread);
     gwthread_join_every(http_queue_thread);
+    gw_timerwheel_destroy(smsbox_http_retries);
 
     close_connection_to_bearerbox();
     alog_close();
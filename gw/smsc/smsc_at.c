@@ -1517,7 +1517,7 @@ int smsc_at2_create(SMSCConn *conn, CfgGroup *cfg)
 
     privdata = gw_malloc(sizeof(PrivAT2data));
     memset(privdata, 0, sizeof(PrivAT2data));
-    privdata->outgoing_queue = gw_prioqueue_create(sms_priority_compare);
+    privdata->outgoing_queue = gw_prioqueue_create_levels(SMS_PRIORITY_LEVELS, sms_priority_level);
     privdata->pending_incoming_messages = gwlist_create();
 
     privdata->configfile = cfg_get_configfile(cfg);
@@ -1622,7 +1622,7 @@ int smsc_emi2_create(SMSCConn *conn, CfgGroup *cfg)
     allow_ip = deny_ip = host = alt_host = NULL; 
 
     privdata = gw_malloc(sizeof(PrivData));
-    privdata->outgoing_queue = gw_prioqueue_create(sms_priority_compare);
+    privdata->outgoing_queue = gw_prioqueue_create_levels(SMS_PRIORITY_LEVELS, sms_priority_level);
     privdata->listening_socket = -1;
     privdata->can_write = 1;
     privdata->priv_nexttrn = 0;
@@ -230,7 +230,7 @@ static SMPP *smpp_create(SMSCConn *conn, Octstr *host, int transmit_port,
     smpp = gw_malloc(sizeof(*smpp));
     smpp->transmitter = -1;
     smpp->receiver = -1;
-    smpp->msgs_to_send = gw_prioqueue_create(sms_priority_compare);
+    smpp->msgs_to_send = gw_prioqueue_create_levels(SMS_PRIORITY_LEVELS, sms_priority_level);
     smpp->sent_msgs = dict_create(max_pending_submits, NULL);
     gw_prioqueue_add_producer(smpp->msgs_to_send);
     smpp->received_msgs = gwlist_create();
@@ -991,10 +991,9 @@ static int send_enquire_link(SMPP *smpp, Connection *conn, long *last_sent)
     dump_pdu("Sending enquire link:", smpp->conn->id, pdu);
     os = smpp_pdu_pack(smpp->conn->id, pdu);
     if (os != NULL)
-        ret = conn_write(conn, os); /* Write errors checked by caller. */
+        ret = conn_write_owned(conn, os); /* Write errors checked by caller. */
     else
         ret = -1;
-    octstr_destroy(os);
     smpp_pdu_destroy(pdu);
 
     return ret;
@@ -1011,10 +1010,9 @@ static int send_gnack(SMPP *smpp, Connection *conn, long reason, unsigned long s
     dump_pdu("Sending generic_nack:", smpp->conn->id, pdu);
     os = smpp_pdu_pack(smpp->conn->id, pdu);
     if (os != NULL)
-        ret = conn_write(conn, os);
+        ret = conn_write_owned(conn, os);
     else
         ret = -1;
-    octstr_destroy(os);
     smpp_pdu_destroy(pdu);
 
     return ret;
@@ -1030,10 +1028,9 @@ static int send_unbind(SMPP *smpp, Connection *conn)
     dump_pdu("Sending unbind:", smpp->conn->id, pdu);
     os = smpp_pdu_pack(smpp->conn->id, pdu);
     if (os != NULL)
-        ret = conn_write(conn, os);
+        ret = conn_write_owned(conn, os);
     else
         ret = -1;
-    octstr_destroy(os);
     smpp_pdu_destroy(pdu);
 
     return ret;
@@ -1049,12 +1046,11 @@ static int send_pdu(Connection *conn, Octstr *id, SMPP_PDU *pdu)
     os = smpp_pdu_pack(id, pdu);
     if (os) {
         /* Caller checks for write errors later */
-        ret = conn_write(conn, os);
+        ret = conn_write_owned(conn, os);
         /* it's not a error if we still have data buffered */
         ret = (ret == 1) ? 0 : ret;
     } else
         ret = -1;
-    octstr_destroy(os);
     return ret;
 }
 
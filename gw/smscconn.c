@@ -174,6 +174,7 @@ SMSCConn *smscconn_create(CfgGroup *grp, int start_as_stopped)
     conn->sent = counter_create();
     conn->sent_dlr = counter_create();
     conn->failed = counter_create();
+    conn->pending = gwlist_create();
     conn->flow_mutex = mutex_create();
 
     conn->outgoing_sms_load = load_create();
@@ -217,6 +218,9 @@ SMSCConn *smscconn_create(CfgGroup *grp, int start_as_stopped)
     GET_OPTIONAL_VAL(conn->allowed_prefix, "allowed-prefix");
     GET_OPTIONAL_VAL(conn->denied_prefix, "denied-prefix");
     GET_OPTIONAL_VAL(conn->preferred_prefix, "preferred-prefix");
+    conn->allowed_prefix_trie = gw_trie_create_prefixes(conn->allowed_prefix);
+    conn->denied_prefix_trie = gw_trie_create_prefixes(conn->denied_prefix);
+    conn->preferred_prefix_trie = gw_trie_create_prefixes(conn->preferred_prefix);
     GET_OPTIONAL_VAL(conn->unified_prefix, "unified-prefix");
     GET_OPTIONAL_VAL(conn->our_host, "our-host");
     GET_OPTIONAL_VAL(conn->log_file, "log-file");
@@ -365,6 +369,7 @@ int smscconn_destroy(SMSCConn *conn)
     counter_destroy(conn->sent);
     counter_destroy(conn->sent_dlr);
     counter_destroy(conn->failed);
+    gwlist_destroy(conn->pending, msg_destroy_item);
 
     load_destroy(conn->incoming_sms_load);
     load_destroy(conn->incoming_dlr_load);
@@ -380,6 +385,9 @@ int smscconn_destroy(SMSCConn *conn)
     octstr_destroy(conn->denied_prefix);
     octstr_destroy(conn->allowed_prefix);
     octstr_destroy(conn->preferred_prefix);
+    gw_trie_destroy(conn->denied_prefix_trie, NULL);
+    gw_trie_destroy(conn->allowed_prefix_trie, NULL);
+    gw_trie_destroy(conn->preferred_prefix_trie, NULL);
     octstr_destroy(conn->unified_prefix);
     octstr_destroy(conn->our_host);
     octstr_destroy(conn->log_file);
@@ -494,7 +502,7 @@ int smscconn_usable(SMSCConn *conn, Msg *msg)
 
     /* Have allowed */
     if (conn->allowed_prefix && ! conn->denied_prefix && 
-       (does_prefix_match(conn->allowed_prefix, msg->sms.receiver) != 1))
+       (gw_trie_prefix_match(conn->allowed_prefix_trie, msg->sms.receiver) != 1))
 	return -1;
     
     if (conn->allowed_prefix_regex && ! conn->denied_prefix_regex) {
@@ -504,7 +512,7 @@ int smscconn_usable(SMSCConn *conn, Msg *msg)
 
     /* Have denied */
     if (conn->denied_prefix && ! conn->allowed_prefix &&
-       (does_prefix_match(conn->denied_prefix, msg->sms.receiver) == 1))
+       (gw_trie_prefix_match(conn->denied_prefix_trie, msg->sms.receiver) == 1))
 	return -1;
 
     if (conn->denied_prefix_regex && ! conn->allowed_prefix_regex) {
@@ -514,8 +522,8 @@ int smscconn_usable(SMSCConn *conn, Msg *msg)
 
     /* Have allowed and denied */
     if (conn->denied_prefix && conn->allowed_prefix &&
-       (does_prefix_match(conn->allowed_prefix, msg->sms.receiver) != 1) &&
-       (does_prefix_match(conn->denied_prefix, msg->sms.receiver) == 1) )
+       (gw_trie_prefix_match(conn->allowed_prefix_trie, msg->sms.receiver) != 1) &&
+       (gw_trie_prefix_match(conn->denied_prefix_trie, msg->sms.receiver) == 1) )
 	return -1;
 
     if (conn->allowed_prefix_regex && conn->denied_prefix_regex) {
@@ -531,7 +539,7 @@ int smscconn_usable(SMSCConn *conn, Msg *msg)
     }
 
     if (conn->preferred_prefix)
-	if (does_prefix_match(conn->preferred_prefix, msg->sms.receiver) == 1)
+	if (gw_trie_prefix_match(conn->preferred_prefix_trie, msg->sms.receiver) == 1)
 	    return 1;
 
     if (conn->preferred_prefix_regex &&
@@ -543,6 +551,295 @@ int smscconn_usable(SMSCConn *conn, Msg *msg)
 }
 
 
+/*
+ * An SMSCRoute keeps sets of connections as bitmaps of `words' words, bit
+ * i standing for the i'th connection of the list it was created from.
+ * The prefixes of allowed-prefix, denied-prefix and preferred-prefix
+ * share one trie, whose values are three sets: the connections having
+ * the prefix in each of the lists. The smsc-ids named in allowed-smsc-id,
+ * denied-smsc-id and preferred-smsc-id map to two sets, the connections
+ * accepting and preferring the id; other ids use id_default.
+ */
+#define ROUTE_BITS ((long) sizeof(unsigned long) * 8)
+#define ROUTE_SET(set, i) ((set)[(i) / ROUTE_BITS] |= 1UL << ((i) % ROUTE_BITS))
+#define ROUTE_ISSET(set, i) (((set)[(i) / ROUTE_BITS] >> ((i) % ROUTE_BITS)) & 1)
+
+/* the sets of a prefix */
+enum { route_allowed, route_denied, route_preferred };
+
+struct SMSCRoute {
+    long len;
+    long words;
+    SMSCConn **conns;
+    unsigned long *slow;            /* left to smscconn_usable */
+    unsigned long *allowed_only;    /* have allowed-prefix only */
+    unsigned long *denied_only;     /* have denied-prefix only */
+    unsigned long *both;            /* have both */
+    unsigned long *id_default;
+    DigitTrie *prefixes;
+    Dict *ids;
+};
+
+
+static unsigned long *route_sets(SMSCRoute *route, long n)
+{
+    return gw_malloc(n * route->words * sizeof(unsigned long));
+}
+
+
+static void route_sets_destroy(void *sets)
+{
+    gw_free(sets);
+}
+
+
+static unsigned long *route_id_sets(SMSCRoute *route, Octstr *id)
+{
+    unsigned long *sets;
+
+    if ((sets = dict_get(route->ids, id)) == NULL) {
+        sets = route_sets(route, 3);
+        memset(sets, 0, 3 * route->words * sizeof(*sets));
+        dict_put(route->ids, id, sets);
+    }
+    return sets;
+}
+
+
+/*
+ * Add connection `i' to set `which' of each prefix in `list'. The list is
+ * split as does_prefix_match() reads it, where only a leading ';' makes
+ * an empty prefix.
+ */
+typedef struct {
+    SMSCRoute *route;
+    int which;
+    long i;
+} RoutePrefix;
+
+static void route_add_prefix(void **value, void *data)
+{
+    RoutePrefix *rp = data;
+
+    if (*value == NULL) {
+        *value = route_sets(rp->route, 3);
+        memset(*value, 0, 3 * rp->route->words * sizeof(unsigned long));
+    }
+    ROUTE_SET((unsigned long *) *value + rp->which * rp->route->words, rp->i);
+}
+
+
+static void route_add_prefixes(SMSCRoute *route, Octstr *list, int which, long i)
+{
+    RoutePrefix rp;
+
+    rp.route = route;
+    rp.which = which;
+    rp.i = i;
+    gw_trie_add_prefixes(route->prefixes, list, route_add_prefix, &rp);
+}
+
+
+static void route_add_ids(SMSCRoute *route, List *ids, int which, long i)
+{
+    long j;
+
+    for (j = 0; j < gwlist_len(ids); j++)
+        ROUTE_SET(route_id_sets(route, gwlist_get(ids, j)) + which * route->words, i);
+}
+
+
+SMSCRoute *smscconn_route_create(List *conns)
+{
+    SMSCRoute *route;
+    SMSCConn *conn;
+    unsigned long *has_allowed_id, *fast, *sets;
+    List *keys;
+    Octstr *id;
+    long i, w, words;
+
+    route = gw_malloc(sizeof(*route));
+    route->len = gwlist_len(conns);
+    route->words = words = route->len / ROUTE_BITS + 1;
+    route->conns = gw_malloc((route->len + 1) * sizeof(*route->conns));
+    route->slow = route_sets(route, 7);
+    memset(route->slow, 0, 7 * words * sizeof(unsigned long));
+    route->allowed_only = route->slow + words;
+    route->denied_only = route->allowed_only + words;
+    route->both = route->denied_only + words;
+    route->id_default = route->both + words;
+    has_allowed_id = route->id_default + words;
+    fast = has_allowed_id + words;
+    route->prefixes = gw_trie_create();
+    route->ids = dict_create(32, route_sets_destroy);
+
+    for (i = 0; i < route->len; i++) {
+        conn = route->conns[i] = gwlist_get(conns, i);
+        if (conn->allowed_smsc_id_regex || conn->denied_smsc_id_regex ||
+            conn->allowed_prefix_regex || conn->denied_prefix_regex ||
+            conn->preferred_prefix_regex) {
+            ROUTE_SET(route->slow, i);
+            continue;
+        }
+        ROUTE_SET(fast, i);
+
+        if (conn->allowed_smsc_id) {
+            ROUTE_SET(has_allowed_id, i);
+            route_add_ids(route, conn->allowed_smsc_id, route_allowed, i);
+        }
+        if (conn->denied_smsc_id)
+            route_add_ids(route, conn->denied_smsc_id, route_denied, i);
+        if (conn->preferred_smsc_id)
+            route_add_ids(route, conn->preferred_smsc_id, route_preferred, i);
+
+        if (conn->allowed_prefix && conn->denied_prefix)
+            ROUTE_SET(route->both, i);
+        else if (conn->allowed_prefix)
+            ROUTE_SET(route->allowed_only, i);
+        else if (conn->denied_prefix)
+            ROUTE_SET(route->denied_only, i);
+        if (conn->allowed_prefix)
+            route_add_prefixes(route, conn->allowed_prefix, route_allowed, i);
+        if (conn->denied_prefix)
+            route_add_prefixes(route, conn->denied_prefix, route_denied, i);
+        if (conn->preferred_prefix)
+            route_add_prefixes(route, conn->preferred_prefix, route_preferred, i);
+    }
+
+    /*
+     * turn the lists an smsc-id is on into the sets accepting and preferring
+     * it. smscconn_usable tests denied-smsc-id whenever allowed-smsc-id did
+     * not reject, so an id on both lists is denied.
+     */
+    for (w = 0; w < words; w++)
+        route->id_default[w] = fast[w] & ~has_allowed_id[w];
+    keys = dict_keys(route->ids);
+    while ((id = gwlist_extract_first(keys)) != NULL) {
+        sets = dict_get(route->ids, id);
+        for (w = 0; w < words; w++) {
+            sets[w] = fast[w] & (~has_allowed_id[w] | sets[route_allowed * words + w]) &
+                      ~sets[route_denied * words + w];
+            sets[words + w] = sets[route_preferred * words + w];
+        }
+        octstr_destroy(id);
+    }
+    gwlist_destroy(keys, NULL);
+
+    return route;
+}
+
+
+void smscconn_route_destroy(SMSCRoute *route)
+{
+    if (route == NULL)
+        return;
+
+    gw_trie_destroy(route->prefixes, route_sets_destroy);
+    dict_destroy(route->ids);
+    gw_free(route->slow);
+    gw_free(route->conns);
+    gw_free(route);
+}
+
+
+/* Return the first bit set in `set' from `from' up to `to', or -1. */
+static long route_next(unsigned long *set, long from, long to)
+{
+    unsigned long w;
+
+    while (from < to) {
+        if ((w = set[from / ROUTE_BITS] >> (from % ROUTE_BITS)) == 0) {
+            from = (from / ROUTE_BITS + 1) * ROUTE_BITS;
+            continue;
+        }
+        for (; (w & 1) == 0; w >>= 1)
+            from++;
+        return from < to ? from : -1;
+    }
+    return -1;
+}
+
+
+#define ROUTE_STACK_WORDS 8
+#define ROUTE_STACK_PREFIXES 32
+
+long smscconn_route_find(SMSCRoute *route, Msg *msg, long start,
+                         SMSCConn **conns, int *preferred, long max)
+{
+    unsigned long stack[4 * ROUTE_STACK_WORDS];
+    unsigned long *allowed, *denied, *prefer, *usable, *accept, *sets;
+    void *stack_values[ROUTE_STACK_PREFIXES], **values;
+    SMSCConn *conn;
+    char *receiver;
+    long words = route->words, found, from, to, i, n, w;
+    int pass, ret;
+
+    gw_assert(msg != NULL && msg_type(msg) == sms);
+
+    allowed = words <= ROUTE_STACK_WORDS ? stack : route_sets(route, 4);
+    denied = allowed + words;
+    prefer = denied + words;
+    usable = prefer + words;
+    memset(allowed, 0, 3 * words * sizeof(*allowed));
+
+    /* the sets of all prefixes of the receiver */
+    receiver = msg->sms.receiver ? octstr_get_cstr(msg->sms.receiver) : "";
+    values = stack_values;
+    n = gw_trie_match(route->prefixes, receiver, values, ROUTE_STACK_PREFIXES);
+    if (n > ROUTE_STACK_PREFIXES) {
+        values = gw_malloc(n * sizeof(*values));
+        gw_trie_match(route->prefixes, receiver, values, n);
+    }
+    for (i = 0; i < n; i++) {
+        sets = values[i];
+        for (w = 0; w < words; w++) {
+            allowed[w] |= sets[route_allowed * words + w];
+            denied[w] |= sets[route_denied * words + w];
+            prefer[w] |= sets[route_preferred * words + w];
+        }
+    }
+    if (values != stack_values)
+        gw_free(values);
+
+    sets = msg->sms.smsc_id ? dict_get(route->ids, msg->sms.smsc_id) : NULL;
+    accept = sets ? sets : route->id_default;
+    for (w = 0; w < words; w++) {
+        usable[w] = (accept[w] & ~((route->allowed_only[w] & ~allowed[w]) |
+                                   (route->denied_only[w] & denied[w]) |
+                                   (route->both[w] & ~allowed[w] & denied[w]))) |
+                    route->slow[w];
+        if (sets)
+            prefer[w] |= sets[words + w];
+    }
+
+    found = 0;
+    for (pass = 0; pass < 2; pass++) {
+        from = pass == 0 ? start : 0;
+        to = pass == 0 ? route->len : start;
+        while (found < max && (i = route_next(usable, from, to)) != -1) {
+            from = i + 1;
+            conn = route->conns[i];
+            if (ROUTE_ISSET(route->slow, i)) {
+                if ((ret = smscconn_usable(conn, msg)) == -1)
+                    continue;
+            } else {
+                if (conn->status == SMSCCONN_DEAD || conn->why_killed != SMSCCONN_ALIVE)
+                    continue;
+                ret = ROUTE_ISSET(prefer, i);
+            }
+            conns[found] = conn;
+            preferred[found] = ret;
+            found++;
+        }
+    }
+
+    if (allowed != stack)
+        gw_free(allowed);
+
+    return found;
+}
+
+
 int smscconn_send(SMSCConn *conn, Msg *msg)
 {
     int ret = -1;
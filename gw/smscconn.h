@@ -181,6 +181,28 @@ const Octstr *smscconn_admin_id(SMSCConn *conn);
  */
 int smscconn_usable(SMSCConn *conn, Msg *msg);
 
+/* Routing index over a list of SMSC Connections, see below. */
+typedef struct SMSCRoute SMSCRoute;
+
+/*
+ * Precompile what smscconn_usable needs to know about the connections
+ * in `conns' into a receiver prefix trie and an smsc-id hash, so that
+ * the usable connections for a message are found without testing each
+ * of them. Connections with regular expressions are left to
+ * smscconn_usable. Must be rebuilt whenever the list changes.
+ */
+SMSCRoute *smscconn_route_create(List *conns);
+void smscconn_route_destroy(SMSCRoute *route);
+
+/*
+ * Store the connections of the route that are usable for `msg' in
+ * `conns', up to `max' of them, beginning at index `start' of the list
+ * and wrapping around, with what smscconn_usable would return for each
+ * in `preferred'. Returns the number of usable connections.
+ */
+long smscconn_route_find(SMSCRoute *route, Msg *msg, long start,
+                         SMSCConn **conns, int *preferred, long max);
+
 /* Call SMSC specific function to handle sending of 'msg'
  * Returns immediately, with 0 if successful and -1 if failed.
  * In any case the caller is still responsible for 'msg' after this
@@ -165,6 +165,10 @@ struct smscconn {
     Counter *sent_dlr;
     Counter *failed;
 
+    /* messages the router parked here while we were full or offline,
+     *  see smsc2_rout in bb_smscconn.c */
+    List *pending;
+
     /* SMSCConn variables set in smscconn.c */
     volatile sig_atomic_t 	is_stopped;
 
@@ -180,10 +184,13 @@ struct smscconn {
     regex_t *preferred_smsc_id_regex;
 
     Octstr *allowed_prefix;
+    DigitTrie *allowed_prefix_trie;     /* the above lists, compiled */
     regex_t *allowed_prefix_regex;
     Octstr *denied_prefix;
+    DigitTrie *denied_prefix_trie;
     regex_t *denied_prefix_regex;
     Octstr *preferred_prefix;
+    DigitTrie *preferred_prefix_trie;
     regex_t *preferred_prefix_regex;
     Octstr *unified_prefix;
 
@@ -114,6 +114,10 @@ struct URLTranslation {
     Octstr *denied_prefix;	/* ...denied prefixes */
     Octstr *allowed_recv_prefix; /* Prefixes (of receiver) allowed in this translation, or... */
     Octstr *denied_recv_prefix;	/* ...denied prefixes */
+    DigitTrie *allowed_prefix_trie;	/* the above lists, compiled */
+    DigitTrie *denied_prefix_trie;
+    DigitTrie *allowed_recv_prefix_trie;
+    DigitTrie *denied_recv_prefix_trie;
     Numhash *white_list;	/* To numbers allowed, or ... */
     Numhash *black_list; /* ...denied numbers */
 
@@ -1116,6 +1120,10 @@ static URLTranslation *create_onetrans(CfgGroup *grp)
             panic(0, "Could not compile pattern '%s'", octstr_get_cstr(denied_prefix_regex));
         octstr_destroy(denied_prefix_regex);
     }
+    ot->allowed_prefix_trie = gw_trie_create_prefixes(ot->allowed_prefix);
+    ot->denied_prefix_trie = gw_trie_create_prefixes(ot->denied_prefix);
+    ot->allowed_recv_prefix_trie = gw_trie_create_prefixes(ot->allowed_recv_prefix);
+    ot->denied_recv_prefix_trie = gw_trie_create_prefixes(ot->denied_recv_prefix);
     
     os = cfg_get(grp, octstr_imm("white-list"));
     if (os != NULL) {
@@ -1204,6 +1212,10 @@ static void destroy_onetrans(void *p)
 	octstr_destroy(ot->denied_prefix);
 	octstr_destroy(ot->allowed_recv_prefix);
 	octstr_destroy(ot->denied_recv_prefix);
+	gw_trie_destroy(ot->allowed_prefix_trie, NULL);
+	gw_trie_destroy(ot->denied_prefix_trie, NULL);
+	gw_trie_destroy(ot->allowed_recv_prefix_trie, NULL);
+	gw_trie_destroy(ot->denied_recv_prefix_trie, NULL);
 	numhash_destroy(ot->white_list);
 	numhash_destroy(ot->black_list);
         if (ot->keyword_regex != NULL) gw_regex_destroy(ot->keyword_regex);
@@ -1274,21 +1286,21 @@ static int check_allowed_translation(URLTranslation *t,
         return NOT_ALLOWED;
 
     /* Have allowed for sender */
-    if (t->allowed_prefix && !t->denied_prefix && does_prefix_match(t->allowed_prefix, sender) != 1)
+    if (t->allowed_prefix && !t->denied_prefix && gw_trie_prefix_match(t->allowed_prefix_trie, sender) != 1)
         return NOT_ALLOWED;
 
     if (t->allowed_prefix_regex && !t->denied_prefix_regex && gw_regex_match_pre(t->allowed_prefix_regex, sender) == 0)
         return NOT_ALLOWED;
 
     /* Have denied for sender */
-    if (t->denied_prefix && !t->allowed_prefix && does_prefix_match(t->denied_prefix, sender) == 1)
+    if (t->denied_prefix && !t->allowed_prefix && gw_trie_prefix_match(t->denied_prefix_trie, sender) == 1)
         return NOT_ALLOWED;
 
     if (t->denied_prefix_regex && !t->allowed_prefix_regex && gw_regex_match_pre(t->denied_prefix_regex, sender) == 1)
         return NOT_ALLOWED;
 
     /* Have allowed for receiver */
-    if (t->allowed_recv_prefix && !t->denied_recv_prefix && does_prefix_match(t->allowed_recv_prefix, receiver) != 1)
+    if (t->allowed_recv_prefix && !t->denied_recv_prefix && gw_trie_prefix_match(t->allowed_recv_prefix_trie, receiver) != 1)
         return NOT_ALLOWED;
 
     if (t->allowed_receiver_prefix_regex && !t->denied_receiver_prefix_regex &&
@@ -1296,7 +1308,7 @@ static int check_allowed_translation(URLTranslation *t,
         return NOT_ALLOWED;
 
     /* Have denied for receiver */
-    if (t->denied_recv_prefix && !t->allowed_recv_prefix && does_prefix_match(t->denied_recv_prefix, receiver) == 1)
+    if (t->denied_recv_prefix && !t->allowed_recv_prefix && gw_trie_prefix_match(t->denied_recv_prefix_trie, receiver) == 1)
         return NOT_ALLOWED;
 
     if (t->denied_receiver_prefix_regex && !t->allowed_receiver_prefix_regex &&
@@ -1320,8 +1332,8 @@ static int check_allowed_translation(URLTranslation *t,
     }   
 
     /* Have allowed and denied */
-    if (t->denied_prefix && t->allowed_prefix && does_prefix_match(t->allowed_prefix, sender) != 1 &&
-        does_prefix_match(t->denied_prefix, sender) == 1)
+    if (t->denied_prefix && t->allowed_prefix && gw_trie_prefix_match(t->allowed_prefix_trie, sender) != 1 &&
+        gw_trie_prefix_match(t->denied_prefix_trie, sender) == 1)
         return NOT_ALLOWED;
 
     if (t->denied_prefix_regex && t->allowed_prefix_regex &&
@@ -208,6 +208,20 @@ static Cfg *init_wapbox(Cfg *cfg)
 
     if (cfg_get_integer(&value, grp, octstr_imm("http-timeout")) == 0)
        http_set_client_timeout(value);
+    if (cfg_get_integer(&value, grp, octstr_imm("http-client-threads")) == 0)
+       http_set_client_threads(value);
+    if (cfg_get_integer(&value, grp, octstr_imm("http-max-host-connections")) == 0)
+       http_set_client_max_host_connections(value);
+    if (cfg_get_integer(&value, grp, octstr_imm("http-pipeline-depth")) == 0)
+       http_set_client_pipeline_depth(value);
+    if (cfg_get_integer(&value, grp, octstr_imm("dns-resolver-threads")) == 0)
+       gw_dns_set_resolver_threads(value);
+    {
+        long ttl = 300, negative_ttl = 30;
+        cfg_get_integer(&ttl, grp, octstr_imm("dns-cache-ttl"));
+        cfg_get_integer(&negative_ttl, grp, octstr_imm("dns-negative-cache-ttl"));
+        gw_dns_set_ttl(ttl, negative_ttl);
+    }
 
     /* configure the 'wtls' group */
 #if (HAVE_WTLS_OPENSSL)
@@ -736,6 +736,42 @@ List *cfg_get_list(CfgGroup *grp, Octstr *varname)
 }
 
 
+long *cfg_get_cpu_list(CfgGroup *grp, Octstr *varname, long *len)
+{
+    Octstr *os, *item;
+    List *items;
+    long *cpus;
+    long i;
+
+    *len = 0;
+    os = cfg_get(grp, varname);
+    if (os == NULL)
+    	return NULL;
+
+    items = octstr_split(os, octstr_imm(";"));
+    octstr_destroy(os);
+    cpus = NULL;
+    if (gwlist_len(items) > 0)
+        cpus = gw_malloc(gwlist_len(items) * sizeof(*cpus));
+    for (i = 0; i < gwlist_len(items); i++) {
+        item = gwlist_get(items, i);
+        octstr_strip_blanks(item);
+        if (octstr_parse_long(&cpus[i], item, 0, 10) != octstr_len(item) ||
+                cpus[i] < 0) {
+            error(0, "Invalid CPU <%s> in '%s'.", octstr_get_cstr(item),
+                  octstr_get_cstr(varname));
+            gw_free(cpus);
+            gwlist_destroy(items, octstr_destroy_item);
+            *len = -1;
+            return NULL;
+        }
+    }
+    *len = gwlist_len(items);
+    gwlist_destroy(items, octstr_destroy_item);
+    return cpus;
+}
+
+
 void cfg_set(CfgGroup *grp, Octstr *varname, Octstr *value)
 {
     dict_put(grp->vars, varname, octstr_duplicate(value));
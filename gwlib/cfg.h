@@ -92,6 +92,13 @@ int cfg_get_integer(long *n, CfgGroup *grp, Octstr *varname);
  */
 int cfg_get_bool(int *n, CfgGroup *grp, Octstr *varname);
 List *cfg_get_list(CfgGroup *grp, Octstr *varname);
+
+/*
+ * Return the ';' separated CPU numbers of varname in a new array, and
+ * their count in len, or NULL and 0 if varname is not set. Return NULL
+ * and set len to -1 if one of them is not a CPU number.
+ */
+long *cfg_get_cpu_list(CfgGroup *grp, Octstr *varname, long *len);
 void cfg_set(CfgGroup *grp, Octstr *varname, Octstr *value);
 
 void grp_dump(CfgGroup *grp);
@@ -77,6 +77,7 @@
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <string.h>
 
 #include "gwlib/gwlib.h"
@@ -87,6 +88,15 @@
 
 static SSL_CTX *global_ssl_context = NULL;
 static SSL_CTX *global_server_ssl_context = NULL;
+
+/*
+ * Client side SSL sessions of closed connections, keyed by
+ * host:port:certkeyfile. A new connection to the same peer offers the
+ * stored session (or ticket) and skips the full handshake if the
+ * server accepts it.
+ */
+static Dict *client_ssl_sessions = NULL;
+static Mutex *client_ssl_sessions_lock = NULL;
 #endif /* HAVE_LIBSSL */
 
 typedef unsigned long (*CRYPTO_CALLBACK_PTR)(void);
@@ -99,7 +109,28 @@ typedef unsigned long (*CRYPTO_CALLBACK_PTR)(void);
  * conn_register.
  */
 #define DEFAULT_OUTPUT_BUFFERING 0
+
+/*
+ * Output is queued as a chain of segments that are handed to writev()
+ * together. Copied data is appended to the last segment while it is
+ * shorter than OUTSEG_COALESCE octets, so many small writes still end
+ * up in a few segments. At most CONN_IOV_MAX segments go out per call.
+ */
+#define OUTSEG_COALESCE          4096
+#define CONN_IOV_MAX             64
+
+/*
+ * Reads go straight into inbuf. The read size starts at CONN_READ_MIN,
+ * doubles while reads keep filling it, up to CONN_READ_MAX, and shrinks
+ * again when the peer slows down. Consumed input is only cut from the
+ * front of inbuf once it is at least half of it, so the memmove cost
+ * stays proportional to the data read.
+ */
+#define CONN_READ_MIN            4096
+#define CONN_READ_MAX            (256 * 1024)
 #define SSL_CONN_TIMEOUT         30
+#define SSL_SESSION_TIMEOUT      3600
+#define SSL_SESSION_CACHE_SIZE   1024
 
 struct Connection
 {
@@ -120,8 +151,12 @@ struct Connection
     enum {yes,no} connected;
 
     /* Protected by outlock */
-    Octstr *outbuf;
-    long outbufpos;   /* start of unwritten data in outbuf */
+    Octstr **outsegs; /* ring of queued output segments, all owned by us */
+    long outsegs_size;
+    long outsegs_first;
+    long outsegs_count;
+    long outbufpos;   /* start of unwritten data in the first segment */
+    long outbuf_len;  /* unwritten octets in all segments */
 
     /* Try to buffer writes until there are this many octets to send.
      * Set it to 0 to get an unbuffered connection. */
@@ -130,6 +165,7 @@ struct Connection
     /* Protected by inlock */
     Octstr *inbuf;
     long inbufpos;    /* start of unread data in inbuf */
+    long read_size;   /* octets to ask for on the next read */
 
     int read_eof;     /* we encountered eof on read */
     int io_error;   /* we encountered error on IO operation */
@@ -148,6 +184,8 @@ struct Connection
 #ifdef HAVE_LIBSSL
     SSL *ssl;
     X509 *peer_certificate;
+    /* key into client_ssl_sessions, NULL for server side connections */
+    Octstr *ssl_session_key;
 #endif /* HAVE_LIBSSL */
 };
 
@@ -219,7 +257,77 @@ static void inline unlock_out_real(Connection *conn, char *file, int line, const
 /* Return the number of bytes in the Connection's output buffer */
 static long inline unlocked_outbuf_len(Connection *conn)
 {
-    return octstr_len(conn->outbuf) - conn->outbufpos;
+    return conn->outbuf_len;
+}
+
+/* Queue seg, which we now own, at the end of the output chain. */
+static void unlocked_outseg_push(Connection *conn, Octstr *seg)
+{
+    long i;
+    Octstr **segs;
+
+    if (octstr_len(seg) == 0) {
+        octstr_destroy(seg);
+        return;
+    }
+
+    if (conn->outsegs_count == conn->outsegs_size) {
+        segs = gw_malloc(sizeof(*segs) * (conn->outsegs_size * 2 + 8));
+        for (i = 0; i < conn->outsegs_count; i++)
+            segs[i] = conn->outsegs[(conn->outsegs_first + i) % conn->outsegs_size];
+        gw_free(conn->outsegs);
+        conn->outsegs = segs;
+        conn->outsegs_size = conn->outsegs_size * 2 + 8;
+        conn->outsegs_first = 0;
+    }
+
+    conn->outsegs[(conn->outsegs_first + conn->outsegs_count) % conn->outsegs_size] = seg;
+    conn->outsegs_count++;
+    conn->outbuf_len += octstr_len(seg);
+}
+
+/* Queue a copy of data, coalescing it with the last segment if that
+ * one is still small. */
+static void unlocked_outseg_append(Connection *conn, const char *data, long len)
+{
+    Octstr *last;
+
+    if (len == 0)
+        return;
+
+    if (conn->outsegs_count > 0) {
+        last = conn->outsegs[(conn->outsegs_first + conn->outsegs_count - 1) %
+                             conn->outsegs_size];
+        if (octstr_len(last) < OUTSEG_COALESCE) {
+            octstr_append_data(last, data, len);
+            conn->outbuf_len += len;
+            return;
+        }
+    }
+
+    unlocked_outseg_push(conn, octstr_create_from_data(data, len));
+}
+
+/* Drop len written octets from the front of the output chain. */
+static void unlocked_outseg_consume(Connection *conn, long len)
+{
+    Octstr *seg;
+    long avail;
+
+    conn->outbuf_len -= len;
+    while (len > 0) {
+        seg = conn->outsegs[conn->outsegs_first];
+        avail = octstr_len(seg) - conn->outbufpos;
+        if (len < avail) {
+            conn->outbufpos += len;
+            return;
+        }
+        len -= avail;
+        octstr_destroy(seg);
+        conn->outsegs_first = (conn->outsegs_first + 1) % conn->outsegs_size;
+        conn->outsegs_count--;
+        conn->outbufpos = 0;
+    }
 }
 
 /* Return the number of bytes in the Connection's input buffer */
@@ -228,53 +336,118 @@ static long inline unlocked_inbuf_len(Connection *conn)
     return octstr_len(conn->inbuf) - conn->inbufpos;
 }
 
+#ifdef HAVE_LIBSSL
+/* Advance the SSL handshake as far as possible without blocking.
+ * Return 0 if the handshake is complete, 1 if it is waiting for the
+ * peer, and -1 in case of error. While waiting, the fdset is told which
+ * direction the handshake needs, so it is driven from poll_callback
+ * rather than by a thread waiting on the socket.
+ * We must already have the outlock.
+ */
+static int unlocked_handshake(Connection *conn)
+{
+    int ret, SSL_error;
+
+    if (SSL_is_init_finished(conn->ssl))
+        return 0;
+
+    ERR_clear_error();
+    ret = SSL_do_handshake(conn->ssl);
+    if (ret == 1) {
+        debug("gwlib.conn", 0, "SSL handshake on fd %d done, session %s",
+              conn->fd, SSL_session_reused(conn->ssl) ? "resumed" : "new");
+        if (conn->registered)
+            unlocked_register_pollout(conn, unlocked_outbuf_len(conn) > 0);
+        return 0;
+    }
+
+    SSL_error = SSL_get_error(conn->ssl, ret);
+    if (SSL_error == SSL_ERROR_WANT_READ) {
+        /* pending output has to wait for the handshake */
+        if (conn->registered)
+            unlocked_register_pollout(conn, 0);
+        return 1;
+    }
+    if (SSL_error == SSL_ERROR_WANT_WRITE) {
+        if (conn->registered)
+            unlocked_register_pollout(conn, 1);
+        return 1;
+    }
+
+    error(errno, "SSL handshake failed: OpenSSL error %d: %s",
+          SSL_error, ERR_error_string(ERR_get_error(), NULL));
+    conn->io_error = 1;
+    if (conn->registered)
+        unlocked_register_pollout(conn, 0);
+    return -1;
+}
+#endif /* HAVE_LIBSSL */
+
 /* Send as much data as can be sent without blocking.  Return the number
  * of bytes written, or -1 in case of error. */
 static long unlocked_write(Connection *conn)
 {
-    long ret = 0;
+    long ret = 0, len, total = 0;
+    struct iovec iov[CONN_IOV_MAX];
+    Octstr *seg;
+    int i, n;
 
 #ifdef HAVE_LIBSSL
     if (conn->ssl != NULL) {
-        if (octstr_len(conn->outbuf) - conn->outbufpos > 0)
-            ret = SSL_write(conn->ssl,
-                        octstr_get_cstr(conn->outbuf) + conn->outbufpos,
-                        octstr_len(conn->outbuf) - conn->outbufpos);
+        if ((ret = unlocked_handshake(conn)) != 0)
+            return ret < 0 ? -1 : 0;
 
-        if (ret < 0) {
-            int SSL_error = SSL_get_error(conn->ssl, ret);
+        /* SSL_write takes one buffer, write segment by segment */
+        while (unlocked_outbuf_len(conn) > 0) {
+            seg = conn->outsegs[conn->outsegs_first];
+            len = octstr_len(seg) - conn->outbufpos;
+            ret = SSL_write(conn->ssl, octstr_get_cstr(seg) + conn->outbufpos, len);
+
+            if (ret <= 0) {
+                int SSL_error = SSL_get_error(conn->ssl, ret);
 
-            if (SSL_error == SSL_ERROR_WANT_READ || SSL_error == SSL_ERROR_WANT_WRITE) {
-                  ret = 0; /* no error */
-            } else {
+                if (SSL_error == SSL_ERROR_WANT_READ || SSL_error == SSL_ERROR_WANT_WRITE)
+                    break; /* no error */
                 error(errno, "SSL write failed: OpenSSL error %d: %s",
                       SSL_error, ERR_error_string(SSL_error, NULL));
+                conn->io_error = 1;
                 return -1;
             }
+            unlocked_outseg_consume(conn, ret);
+            total += ret;
+            if (ret < len)
+                break;
         }
     } else
 #endif /* HAVE_LIBSSL */
-        ret = octstr_write_data(conn->outbuf, conn->fd, conn->outbufpos);
-
-    if (ret < 0) {
-        conn->io_error = 1;
-        return -1;
-    }
-
-    conn->outbufpos += ret;
+    while (unlocked_outbuf_len(conn) > 0) {
+        n = conn->outsegs_count < CONN_IOV_MAX ? conn->outsegs_count : CONN_IOV_MAX;
+        len = 0;
+        for (i = 0; i < n; i++) {
+            seg = conn->outsegs[(conn->outsegs_first + i) % conn->outsegs_size];
+            iov[i].iov_base = octstr_get_cstr(seg) + (i == 0 ? conn->outbufpos : 0);
+            iov[i].iov_len = octstr_len(seg) - (i == 0 ? conn->outbufpos : 0);
+            len += iov[i].iov_len;
+        }
 
-    /* Heuristic: Discard the already-written data if it's more than
-     * half of the total.  This should keep the buffer size small
-     * without wasting too many cycles on moving data around. */
-    if (conn->outbufpos > octstr_len(conn->outbuf) / 2) {
-        octstr_delete(conn->outbuf, 0, conn->outbufpos);
-        conn->outbufpos = 0;
+        ret = writev(conn->fd, iov, n);
+        if (ret < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            error(errno, "Error writing %ld octets to fd %d:", len, conn->fd);
+            conn->io_error = 1;
+            return -1;
+        }
+        unlocked_outseg_consume(conn, ret);
+        total += ret;
+        if (ret < len)
+            break;
     }
 
     if (conn->registered)
         unlocked_register_pollout(conn, unlocked_outbuf_len(conn) > 0);
 
-    return ret;
+    return total;
 }
 
 /* Try to empty the output buffer without blocking.  Return 0 for success,
@@ -302,20 +475,27 @@ static int unlocked_try_write(Connection *conn)
 /* Read whatever data is currently available, up to an internal maximum. */
 static void unlocked_read(Connection *conn)
 {
-    unsigned char buf[4096];
+    char *buf;
     long len;
 
-    if (conn->inbufpos > 0) {
+#ifdef HAVE_LIBSSL
+    /* a failed handshake has been reported already */
+    if (conn->ssl != NULL && conn->io_error && !SSL_is_init_finished(conn->ssl))
+        return;
+#endif /* HAVE_LIBSSL */
+
+    if (conn->inbufpos > 0 && conn->inbufpos >= octstr_len(conn->inbuf) / 2) {
         octstr_delete(conn->inbuf, 0, conn->inbufpos);
         conn->inbufpos = 0;
     }
 
+    buf = octstr_append_reserve(conn->inbuf, conn->read_size);
 #ifdef HAVE_LIBSSL
     if (conn->ssl != NULL) {
-        len = SSL_read(conn->ssl, buf, sizeof(buf));
+        len = SSL_read(conn->ssl, buf, conn->read_size);
     } else
 #endif /* HAVE_LIBSSL */
-        len = read(conn->fd, buf, sizeof(buf));
+        len = read(conn->fd, buf, conn->read_size);
 
     if (len < 0) {
         if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)
@@ -340,7 +520,11 @@ static void unlocked_read(Connection *conn)
         if (conn->registered)
             unlocked_register_pollin(conn, 0);
     } else {
-        octstr_append_data(conn->inbuf, buf, len);
+        octstr_append_commit(conn->inbuf, len);
+        if (len == conn->read_size && conn->read_size < CONN_READ_MAX)
+            conn->read_size *= 2;
+        else if (len < conn->read_size / 4 && conn->read_size > CONN_READ_MIN)
+            conn->read_size /= 2;
     }
 }
 
@@ -356,6 +540,33 @@ static Octstr *unlocked_get(Connection *conn, long length)
     return result;
 }
 
+/* Cut a frame prefixed by its length as a network long from the input
+ * buffer, or return NULL if there is no complete frame. */
+static Octstr *unlocked_get_withlen(Connection *conn)
+{
+    unsigned char lengthbuf[4];
+    long length;
+
+    for (;;) {
+        if (unlocked_inbuf_len(conn) < 4)
+            return NULL;
+
+        octstr_get_many_chars((char *) lengthbuf, conn->inbuf, conn->inbufpos, 4);
+        length = decode_network_long(lengthbuf);
+        if (length >= 0)
+            break;
+
+        warning(0, "conn_read_withlen: got negative length, skipping");
+        conn->inbufpos += 4;
+    }
+
+    if (unlocked_inbuf_len(conn) - 4 < length)
+        return NULL;
+
+    conn->inbufpos += 4;
+    return unlocked_get(conn, length);
+}
+
 /* Tell the fdset whether we are interested in POLLIN events, but only
  * if the status changed.  (Calling fdset_listen can be expensive if
  * it requires synchronization with the polling thread.)
@@ -397,8 +608,11 @@ static void unlocked_register_pollout(Connection *conn, int onoff)
 }
 
 #ifdef HAVE_LIBSSL
-static int conn_init_client_ssl(Connection *ret, Octstr *certkeyfile)
+static int conn_init_client_ssl(Connection *ret, Octstr *host, int port,
+                                Octstr *certkeyfile)
 {
+    SSL_SESSION *session;
+
     ret->ssl = SSL_new(global_ssl_context);
 
     /*
@@ -438,10 +652,43 @@ static int conn_init_client_ssl(Connection *ret, Octstr *certkeyfile)
     BIO_set_nbio(SSL_get_wbio(ret->ssl), 1);
 
     SSL_set_connect_state(ret->ssl);
-    
+
+    /* offer the session of a previous connection to this peer */
+    ret->ssl_session_key = octstr_format("%S:%d:%S", host, port,
+        certkeyfile ? certkeyfile : octstr_imm(""));
+    mutex_lock(client_ssl_sessions_lock);
+    session = dict_get(client_ssl_sessions, ret->ssl_session_key);
+    if (session != NULL)
+        SSL_set_session(ret->ssl, session);
+    mutex_unlock(client_ssl_sessions_lock);
+
     return 0;
 }
 
+/* Remember the session of a client connection for later reuse. */
+static void client_ssl_session_put(Connection *conn)
+{
+    SSL_SESSION *session;
+
+    if (conn->ssl_session_key == NULL || !SSL_is_init_finished(conn->ssl))
+        return;
+    if ((session = SSL_get1_session(conn->ssl)) == NULL)
+        return;
+
+    mutex_lock(client_ssl_sessions_lock);
+    if (dict_key_count(client_ssl_sessions) < SSL_SESSION_CACHE_SIZE ||
+        dict_get(client_ssl_sessions, conn->ssl_session_key) != NULL)
+        dict_put(client_ssl_sessions, conn->ssl_session_key, session);
+    else
+        SSL_SESSION_free(session);
+    mutex_unlock(client_ssl_sessions_lock);
+}
+
+static void client_ssl_session_destroy(void *session)
+{
+    SSL_SESSION_free(session);
+}
+
 Connection *conn_open_ssl_nb(Octstr *host, int port, Octstr *certkeyfile,
                           Octstr *our_host)
 {
@@ -452,7 +699,7 @@ Connection *conn_open_ssl_nb(Octstr *host, int port, Octstr *certkeyfile,
         return NULL;
     }
     
-    if (conn_init_client_ssl(ret, certkeyfile) == -1) {
+    if (conn_init_client_ssl(ret, host, port, certkeyfile) == -1) {
         conn_destroy(ret);
         return NULL;
     }
@@ -470,7 +717,7 @@ Connection *conn_open_ssl(Octstr *host, int port, Octstr *certkeyfile,
         return NULL;
     }
 
-    if (conn_init_client_ssl(ret, certkeyfile) == -1) {
+    if (conn_init_client_ssl(ret, host, port, certkeyfile) == -1) {
         conn_destroy(ret);
         return NULL;
     }
@@ -562,10 +809,15 @@ Connection *conn_wrap_fd(int fd, int ssl)
     conn->outlock = mutex_create();
     conn->claimed = 0;
 
-    conn->outbuf = octstr_create("");
+    conn->outsegs = NULL;
+    conn->outsegs_size = 0;
+    conn->outsegs_first = 0;
+    conn->outsegs_count = 0;
     conn->outbufpos = 0;
+    conn->outbuf_len = 0;
     conn->inbuf = octstr_create("");
     conn->inbufpos = 0;
+    conn->read_size = CONN_READ_MIN;
 
     conn->fd = fd;
     conn->connected = yes;
@@ -586,6 +838,7 @@ Connection *conn_wrap_fd(int fd, int ssl)
     if (ssl) {
         conn->ssl = SSL_new(global_server_ssl_context);
         conn->peer_certificate = NULL;
+        conn->ssl_session_key = NULL;
 
         /* SSL_set_fd can fail, so check it */
         if (SSL_set_fd(conn->ssl, conn->fd) == 0) {
@@ -600,11 +853,13 @@ Connection *conn_wrap_fd(int fd, int ssl)
         BIO_set_nbio(SSL_get_rbio(conn->ssl), 1);
         BIO_set_nbio(SSL_get_wbio(conn->ssl), 1);
 
-        /* set accept state , SSL-Handshake will be handled transparent while SSL_[read|write] */
-         SSL_set_accept_state(conn->ssl);
+        /* set accept state, the handshake is driven from the fdset
+         * once the connection is registered, see unlocked_handshake() */
+        SSL_set_accept_state(conn->ssl);
     } else {
         conn->ssl = NULL;
         conn->peer_certificate = NULL;
+        conn->ssl_session_key = NULL;
     }
 #endif /* HAVE_LIBSSL */
 
@@ -634,11 +889,13 @@ void conn_destroy(Connection *conn)
 
 #ifdef HAVE_LIBSSL
         if (conn->ssl != NULL) {
+            client_ssl_session_put(conn);
             SSL_smart_shutdown(conn->ssl);
             SSL_free(conn->ssl);
             if (conn->peer_certificate != NULL)
                 X509_free(conn->peer_certificate);
 	}
+        octstr_destroy(conn->ssl_session_key);
 #endif /* HAVE_LIBSSL */
 
         ret = close(conn->fd);
@@ -647,7 +904,12 @@ void conn_destroy(Connection *conn)
         conn->fd = -1;
     }
 
-    octstr_destroy(conn->outbuf);
+    while (conn->outsegs_count > 0) {
+        octstr_destroy(conn->outsegs[conn->outsegs_first]);
+        conn->outsegs_first = (conn->outsegs_first + 1) % conn->outsegs_size;
+        conn->outsegs_count--;
+    }
+    gw_free(conn->outsegs);
     octstr_destroy(conn->inbuf);
     mutex_destroy(conn->inlock);
     mutex_destroy(conn->outlock);
@@ -763,6 +1025,27 @@ static void poll_callback(int fd, int revents, void *data)
         do_callback = 1;
     }
 
+#ifdef HAVE_LIBSSL
+    /* Until the SSL handshake is done there is nothing to read or write
+     * for the upper layer; only wake it up if the handshake failed. */
+    if (conn->ssl != NULL && !SSL_is_init_finished(conn->ssl) && !do_callback) {
+        int ret;
+
+        lock_out(conn);
+        lock_in(conn);
+        ret = unlocked_handshake(conn);
+        unlock_in(conn);
+        unlock_out(conn);
+        if (ret == 1)
+            return;
+        if (ret == -1) {
+            if (conn->callback)
+                conn->callback(conn, conn->callback_data);
+            return;
+        }
+    }
+#endif /* HAVE_LIBSSL */
+
     /* If unlocked_write manages to write all pending data, it will
      * tell the fdset to stop listening for POLLOUT. */
     if (revents & POLLOUT) {
@@ -1040,7 +1323,19 @@ int conn_write(Connection *conn, Octstr *data)
     int ret;
 
     lock_out(conn);
-    octstr_append(conn->outbuf, data);
+    unlocked_outseg_append(conn, octstr_get_cstr(data), octstr_len(data));
+    ret = unlocked_try_write(conn);
+    unlock_out(conn);
+
+    return ret;
+}
+
+int conn_write_owned(Connection *conn, Octstr *data)
+{
+    int ret;
+
+    lock_out(conn);
+    unlocked_outseg_push(conn, data);
     ret = unlocked_try_write(conn);
     unlock_out(conn);
 
@@ -1052,7 +1347,7 @@ int conn_write_data(Connection *conn, unsigned char *data, long length)
     int ret;
 
     lock_out(conn);
-    octstr_append_data(conn->outbuf, data, length);
+    unlocked_outseg_append(conn, (char *) data, length);
     ret = unlocked_try_write(conn);
     unlock_out(conn);
 
@@ -1066,8 +1361,23 @@ int conn_write_withlen(Connection *conn, Octstr *data)
 
     encode_network_long(lengthbuf, octstr_len(data));
     lock_out(conn);
-    octstr_append_data(conn->outbuf, lengthbuf, 4);
-    octstr_append(conn->outbuf, data);
+    unlocked_outseg_append(conn, (char *) lengthbuf, 4);
+    unlocked_outseg_append(conn, octstr_get_cstr(data), octstr_len(data));
+    ret = unlocked_try_write(conn);
+    unlock_out(conn);
+
+    return ret;
+}
+
+int conn_write_withlen_owned(Connection *conn, Octstr *data)
+{
+    int ret;
+    unsigned char lengthbuf[4];
+
+    encode_network_long(lengthbuf, octstr_len(data));
+    lock_out(conn);
+    unlocked_outseg_append(conn, (char *) lengthbuf, 4);
+    unlocked_outseg_push(conn, data);
     ret = unlocked_try_write(conn);
     unlock_out(conn);
 
@@ -1153,49 +1463,90 @@ Octstr *conn_read_line(Connection *conn)
     return result;
 }
 
-Octstr *conn_read_withlen(Connection *conn)
+/*
+ * Find the end of a block of lines ended by an empty line at the start
+ * of the input buffer. Returns its length including the empty line, or
+ * -1 with `*scanned' set to the start of the last, incomplete line.
+ */
+static long unlocked_head_len(Connection *conn, long *scanned)
 {
-    Octstr *result = NULL;
-    unsigned char lengthbuf[4];
-    long length = 0; /* for compiler please */
-    int try, retry;
+    long start, pos;
+
+    start = conn->inbufpos + *scanned;
+    while ((pos = octstr_search_char(conn->inbuf, 10, start)) >= 0) {
+        /* an empty line, or one with just the CR of a CR LF */
+        if (pos == start || (pos == start + 1 &&
+                             octstr_get_char(conn->inbuf, start) == 13))
+            return pos + 1 - conn->inbufpos;
+        start = pos + 1;
+    }
+    *scanned = start - conn->inbufpos;
 
-    lock_in(conn);
+    return -1;
+}
 
-    for (try = 1; try <= 2; try++) {
-        if (try > 1)
-            unlocked_read(conn);
 
-        do {
-            retry = 0;
-            /* First get the length. */
-            if (unlocked_inbuf_len(conn) < 4)
-                continue;
+Octstr *conn_read_head(Connection *conn, long *scanned)
+{
+    Octstr *result;
+    long len;
 
-            octstr_get_many_chars(lengthbuf, conn->inbuf, conn->inbufpos, 4);
-            length = decode_network_long(lengthbuf);
+    lock_in(conn);
+    len = unlocked_head_len(conn, scanned);
+    if (len < 0) {
+        unlocked_read(conn);
+        len = unlocked_head_len(conn, scanned);
+        if (len < 0) {
+            unlock_in(conn);
+            return NULL;
+        }
+    }
 
-            if (length < 0) {
-                warning(0, "conn_read_withlen: got negative length, skipping");
-                conn->inbufpos += 4;
-                retry = 1;
-             }
-        } while(retry == 1);
+    result = unlocked_get(conn, len);
+    gw_claim_area(result);
+    *scanned = 0;
 
-        /* Then get the data. */
-        if (unlocked_inbuf_len(conn) - 4 < length)
-            continue;
+    unlock_in(conn);
+    return result;
+}
 
-        conn->inbufpos += 4;
-        result = unlocked_get(conn, length);
-        gw_claim_area(result);
-        break;
-    }
 
+Octstr *conn_read_withlen(Connection *conn)
+{
+    Octstr *result;
+
+    lock_in(conn);
+    if ((result = unlocked_get_withlen(conn)) == NULL) {
+        unlocked_read(conn);
+        result = unlocked_get_withlen(conn);
+    }
+    gw_claim_area(result);
     unlock_in(conn);
+
     return result;
 }
 
+long conn_read_withlen_many(Connection *conn, List *frames)
+{
+    Octstr *frame;
+    long count = 0;
+    int try;
+
+    lock_in(conn);
+    for (try = 1; try <= 2 && count == 0; try++) {
+        if (try > 1)
+            unlocked_read(conn);
+        while ((frame = unlocked_get_withlen(conn)) != NULL) {
+            gw_claim_area(frame);
+            gwlist_append(frames, frame);
+            count++;
+        }
+    }
+    unlock_in(conn);
+
+    return count;
+}
+
 Octstr *conn_read_packet(Connection *conn, int startmark, int endmark)
 {
     int startpos, endpos;
@@ -1313,6 +1664,9 @@ void conn_init_ssl(void)
     global_ssl_context = SSL_CTX_new(SSLv23_client_method());
     SSL_CTX_set_mode(global_ssl_context, 
         SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+    SSL_CTX_set_session_cache_mode(global_ssl_context, SSL_SESS_CACHE_CLIENT);
+    client_ssl_sessions = dict_create(SSL_SESSION_CACHE_SIZE, client_ssl_session_destroy);
+    client_ssl_sessions_lock = mutex_create();
 }
 
 void server_ssl_init(void) 
@@ -1322,6 +1676,11 @@ void server_ssl_init(void)
     global_server_ssl_context = SSL_CTX_new(SSLv23_server_method());
     SSL_CTX_set_mode(global_server_ssl_context, 
         SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+    /* let reconnecting clients resume by session id or ticket */
+    SSL_CTX_set_session_cache_mode(global_server_ssl_context, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_set_session_id_context(global_server_ssl_context,
+        (const unsigned char *) "kannel", 6);
+    SSL_CTX_set_timeout(global_server_ssl_context, SSL_SESSION_TIMEOUT);
     if (!SSL_CTX_set_default_verify_paths(global_server_ssl_context)) {
 	   panic(0, "can not set default path for server");
     }
@@ -1331,6 +1690,10 @@ void conn_shutdown_ssl(void)
 {
     if (global_ssl_context)
         SSL_CTX_free(global_ssl_context);
+    dict_destroy(client_ssl_sessions);
+    client_ssl_sessions = NULL;
+    mutex_destroy(client_ssl_sessions_lock);
+    client_ssl_sessions_lock = NULL;
     
     ERR_free_strings();
     EVP_cleanup();
@@ -1386,8 +1749,8 @@ static int verify_callback(int preverify_ok, X509_STORE_CTX *ctx)
     char    issuer [256];
     char   *status;
 
-    X509_NAME_oneline(X509_get_subject_name(ctx->current_cert), subject, sizeof(subject));
-    X509_NAME_oneline(X509_get_issuer_name(ctx->current_cert), issuer, sizeof (issuer));
+    X509_NAME_oneline(X509_get_subject_name(X509_STORE_CTX_get_current_cert(ctx)), subject, sizeof(subject));
+    X509_NAME_oneline(X509_get_issuer_name(X509_STORE_CTX_get_current_cert(ctx)), issuer, sizeof (issuer));
 
     status = preverify_ok ? "Accepting" : "Rejecting";
     
@@ -253,6 +253,12 @@ int conn_write_data(Connection *conn, unsigned char *data, long length);
  * write the octstr itself. */
 int conn_write_withlen(Connection *conn, Octstr *data);
 
+/* Same as conn_write and conn_write_withlen, but the Connection takes
+ * over data and queues it without copying. The caller must not use or
+ * destroy data afterwards, and data must not be an octstr_imm. */
+int conn_write_owned(Connection *conn, Octstr *data);
+int conn_write_withlen_owned(Connection *conn, Octstr *data);
+
 /* Input functions.  Each of these takes an open connection and
  * returns data if it's available, or NULL if it's not.  They will
  * not block.  They will try to read in more data if there's not
@@ -272,12 +278,27 @@ Octstr *conn_read_fixed(Connection *conn, long length);
  */
 Octstr *conn_read_line(Connection *conn);
 
+/* If the input buffer starts with a block of lines ended by an empty
+ * line, like the head of a HTTP message, then return the block up to
+ * and including the empty line and remove it from the input buffer.
+ * Otherwise return NULL. `*scanned' must be 0 for a new block; it
+ * remembers how much of the buffer was already searched in vain, so
+ * a head arriving in many pieces is only searched once.
+ */
+Octstr *conn_read_head(Connection *conn, long *scanned);
+
 /* Read a standard network long giving the length of the following
  * data, then read the data itself, and pack it into an Octstr and
  * remove it from the input buffer.  Otherwise return NULL.
  */
 Octstr *conn_read_withlen(Connection *conn);
 
+/* Same as conn_read_withlen, but append all complete frames in the
+ * input buffer to the list `frames' in one go. Return the number of
+ * frames appended, 0 if there was none.
+ */
+long conn_read_withlen_many(Connection *conn, List *frames);
+
 /* If the input buffer contains a packet delimited by the "startmark"
  * and "endmark" characters, then return that packet (including the marks)
  * and delete everything up to the end of that packet from the input buffer.
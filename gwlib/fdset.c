@@ -56,6 +56,17 @@
 
 /*
  * fdset.c - module for managing a large collection of file descriptors
+ *
+ * There are two implementations. Where epoll is available, the kernel
+ * keeps the set of descriptors and the polling thread only looks at
+ * those that have events, and descriptors are kept on a list in the
+ * order of their last activity, so idle timeouts are found from the
+ * front of that list. Otherwise, or if epoll_create fails, the set is
+ * an array that is passed to poll() and scanned after every wakeup.
+ *
+ * A group made by fdset_create_group is a set of such sets, each with
+ * its own thread; every call for a fd goes to the member set picked by
+ * the fd number.
  */
 
 #include "gw-config.h"
@@ -64,9 +75,39 @@
 #include <unistd.h>
 #include <errno.h>
 
+#ifdef HAVE_SYS_EPOLL_H
+#include <stdint.h>
+#include <sys/epoll.h>
+#endif
+
 #include "gwlib/gwlib.h"
 
 
+#ifdef HAVE_SYS_EPOLL_H
+
+/* Number of events fetched from the kernel at once. */
+#define EPOLL_EVENTS 256
+
+/* A registered fd of an epoll based set. The fd is the index in
+ * set->fds. */
+struct fdentry
+{
+    int used;
+    /* Increased on every registration, to recognize events for a fd
+     * that was unregistered and registered again while events for it
+     * were being handled. */
+    unsigned int generation;
+    int events;
+    fdset_callback_t *callback;
+    void *data;
+    /* Time of last activity and neighbours on the activity list */
+    time_t time;
+    int older, newer;
+};
+
+#endif
+
+
 struct FDSet
 {
     /* Thread ID of the set's internal thread, which will spend most
@@ -124,6 +165,29 @@ struct FDSet
     /* List of struct action.  Used by other threads to make requests
      * of the polling thread. */
     List *actions;
+
+    /* For a group, the member sets. The fields above are not used
+     * for a group. NULL for other sets. */
+    FDSet **members;
+    int num_members;
+
+#ifdef HAVE_SYS_EPOLL_H
+    /* The following fields are for the epoll based set and, like the
+     * poll() ones, for use by the polling thread only. epfd is -1 if
+     * poll() is used. */
+    int epfd;
+
+    /* Registered fds, indexed by fd. Elements 0 through fds_size-1
+     * are allocated. */
+    struct fdentry *fds;
+    int fds_size;
+    int registered;
+
+    /* Activity list: least recently active fd first. -1 if empty. */
+    int oldest, newest;
+
+    struct epoll_event events[EPOLL_EVENTS];
+#endif
 };
 
 /* Datatype to describe changes to the fdset fields that only the polling
@@ -309,6 +373,257 @@ static void remove_deleted_entries(FDSet *set)
     }
 }
 
+#ifdef HAVE_SYS_EPOLL_H
+
+/*
+ * Activity list of the epoll based set. Touching a fd moves it to the
+ * end of the list with the current time, so the list stays sorted by
+ * time and the fds to time out are at its front.
+ */
+
+static void activity_unlink(FDSet *set, int fd)
+{
+    struct fdentry *e = &set->fds[fd];
+
+    if (e->older >= 0)
+        set->fds[e->older].newer = e->newer;
+    else
+        set->oldest = e->newer;
+    if (e->newer >= 0)
+        set->fds[e->newer].older = e->older;
+    else
+        set->newest = e->older;
+    e->older = e->newer = -1;
+}
+
+
+static void activity_touch(FDSet *set, int fd, time_t now)
+{
+    struct fdentry *e = &set->fds[fd];
+
+    if (set->newest != fd) {
+        activity_unlink(set, fd);
+        e->older = set->newest;
+        if (set->newest >= 0)
+            set->fds[set->newest].newer = fd;
+        else
+            set->oldest = fd;
+        set->newest = fd;
+    }
+    e->time = now;
+}
+
+
+static int epoll_mask(int events)
+{
+    int ret = 0;
+
+    if (events & POLLIN)
+        ret |= EPOLLIN;
+    if (events & POLLPRI)
+        ret |= EPOLLPRI;
+    if (events & POLLOUT)
+        ret |= EPOLLOUT;
+    return ret;
+}
+
+
+static int poll_mask(unsigned int events)
+{
+    int ret = 0;
+
+    if (events & EPOLLIN)
+        ret |= POLLIN;
+    if (events & EPOLLPRI)
+        ret |= POLLPRI;
+    if (events & EPOLLOUT)
+        ret |= POLLOUT;
+    if (events & EPOLLERR)
+        ret |= POLLERR;
+    if (events & EPOLLHUP)
+        ret |= POLLHUP;
+    return ret;
+}
+
+
+static int epoll_update(FDSet *set, int op, int fd)
+{
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = epoll_mask(set->fds[fd].events);
+    ev.data.u64 = ((uint64_t) set->fds[fd].generation << 32) | (unsigned int) fd;
+    return epoll_ctl(set->epfd, op, fd, &ev);
+}
+
+
+static void epoll_register(FDSet *set, int fd, int events,
+                           fdset_callback_t callback, void *data)
+{
+    struct fdentry *e;
+    int i, newsize;
+
+    if (fd < 0) {
+        warning(0, "fdset_register called with fd %d.", fd);
+        return;
+    }
+
+    if (fd >= set->fds_size) {
+        newsize = set->fds_size * 2;
+        while (newsize <= fd)
+            newsize *= 2;
+        set->fds = gw_realloc(set->fds, sizeof(set->fds[0]) * newsize);
+        for (i = set->fds_size; i < newsize; i++) {
+            set->fds[i].used = 0;
+            set->fds[i].generation = 0;
+            set->fds[i].older = set->fds[i].newer = -1;
+        }
+        set->fds_size = newsize;
+    }
+
+    e = &set->fds[fd];
+    if (e->used) {
+        warning(0, "fdset_register called on registered fd %d.", fd);
+        activity_unlink(set, fd);
+        set->registered--;
+    }
+    e->used = 1;
+    e->generation++;
+    e->events = events;
+    e->callback = callback;
+    e->data = data;
+    activity_touch(set, fd, time(NULL));
+    set->registered++;
+
+    if (epoll_update(set, EPOLL_CTL_ADD, fd) < 0 &&
+        (errno != EEXIST || epoll_update(set, EPOLL_CTL_MOD, fd) < 0))
+        error(errno, "fdset: epoll_ctl failed to add fd %d.", fd);
+}
+
+
+static void epoll_listen(FDSet *set, int fd, int mask, int events)
+{
+    struct fdentry *e;
+
+    if (fd < 0 || fd >= set->fds_size || !set->fds[fd].used) {
+        warning(0, "fdset_listen called on unregistered fd %d.", fd);
+        return;
+    }
+
+    /* Events handled after this check the new mask, see epoll_poller. */
+    e = &set->fds[fd];
+    e->events = (e->events & ~mask) | (events & mask);
+    if (epoll_update(set, EPOLL_CTL_MOD, fd) < 0)
+        error(errno, "fdset: epoll_ctl failed to modify fd %d.", fd);
+
+    activity_touch(set, fd, time(NULL));
+}
+
+
+static void epoll_unregister(FDSet *set, int fd)
+{
+    struct epoll_event ev;
+
+    if (fd < 0 || fd >= set->fds_size || !set->fds[fd].used) {
+        warning(0, "fdset_unregister called on unregistered fd %d.", fd);
+        return;
+    }
+
+    /* This fails if the fd has been closed already, which also removed
+     * it from the epoll set. */
+    epoll_ctl(set->epfd, EPOLL_CTL_DEL, fd, &ev);
+
+    activity_unlink(set, fd);
+    set->fds[fd].used = 0;
+    set->registered--;
+}
+
+
+/*
+ * Main function of the polling thread of an epoll based set. The epoll
+ * fd becomes readable when any registered fd has events, so waiting on
+ * it with gwthread_pollfd also lets other threads wake us up to handle
+ * actions. Readiness is level triggered: a callback that does not
+ * consume all input is called again on the next round, as with poll().
+ */
+static void epoll_poller(FDSet *set)
+{
+    struct action *action;
+    struct fdentry *e;
+    double timeout;
+    time_t now;
+    int i, n, fd, revents;
+    unsigned int generation;
+
+    for (;;) {
+        while ((action = gwlist_extract_first(set->actions)) != NULL) {
+            /* handle_action returns -1 if the set was destroyed. */
+            if (handle_action(set, action) < 0)
+                return;
+        }
+
+        /* Sleep until the oldest fd times out, if nothing happens */
+        timeout = -1;
+        if (set->timeout > 0 && set->oldest >= 0) {
+            timeout = difftime(set->fds[set->oldest].time + set->timeout,
+                               time(NULL));
+            if (timeout < 0)
+                timeout = 0;
+        }
+
+        if (gwthread_pollfd(set->epfd, POLLIN, timeout) < 0) {
+            if (errno != EINTR) {
+                error(errno, "Poller: can't handle error; sleeping 1 second.");
+                gwthread_sleep(1.0);
+            }
+            continue;
+        }
+
+        n = epoll_wait(set->epfd, set->events, EPOLL_EVENTS, 0);
+        if (n < 0) {
+            if (errno != EINTR) {
+                error(errno, "Poller: epoll_wait failed; sleeping 1 second.");
+                gwthread_sleep(1.0);
+            }
+            continue;
+        }
+
+        time(&now);
+        for (i = 0; i < n; i++) {
+            fd = (int) (set->events[i].data.u64 & 0xffffffff);
+            generation = (unsigned int) (set->events[i].data.u64 >> 32);
+            /* Callbacks may have unregistered this fd meanwhile, or
+             * stopped listening for some of the events. */
+            if (fd >= set->fds_size || !set->fds[fd].used ||
+                set->fds[fd].generation != generation)
+                continue;
+            e = &set->fds[fd];
+            revents = poll_mask(set->events[i].events) &
+                      (e->events | POLLERR | POLLHUP);
+            if (revents == 0)
+                continue;
+            e->callback(fd, revents, e->data);
+            /* update event time; set->fds may have been reallocated */
+            if (set->fds[fd].used && set->fds[fd].generation == generation)
+                activity_touch(set, fd, now);
+        }
+
+        if (set->timeout <= 0)
+            continue;
+        while (set->oldest >= 0 &&
+               difftime(set->fds[set->oldest].time + set->timeout, now) <= 0) {
+            fd = set->oldest;
+            /* move it away first, the callback may not unregister it */
+            activity_touch(set, fd, now);
+            debug("gwlib.fdset", 0, "Timeout for fd:%d appears.", fd);
+            set->fds[fd].callback(fd, POLLERR, set->fds[fd].data);
+        }
+    }
+}
+
+#endif
+
+
 /* Main function for polling thread.  Most its time is spent blocking
  * in poll().  No-one else is allowed to change the fields it uses,
  * so other threads just put something on the actions list and wake
@@ -325,6 +640,13 @@ static void poller(void *arg)
 
     gw_assert(set != NULL);
 
+#ifdef HAVE_SYS_EPOLL_H
+    if (set->epfd >= 0) {
+        epoll_poller(set);
+        return;
+    }
+#endif
+
     for (;;) {
         while ((action = gwlist_extract_first(set->actions)) != NULL) {
             /* handle_action returns -1 if the set was destroyed. */
@@ -368,6 +690,9 @@ static void poller(void *arg)
 FDSet *fdset_create_real(long timeout)
 {
     FDSet *new;
+#ifdef HAVE_SYS_EPOLL_H
+    int i;
+#endif
 
     new = gw_malloc(sizeof(*new));
 
@@ -382,9 +707,26 @@ FDSet *fdset_create_real(long timeout)
     new->timeout = timeout > 0 ? timeout : -1;
     new->scanning = 0;
     new->deleted_entries = 0;
+    new->members = NULL;
+    new->num_members = 0;
 
     new->actions = gwlist_create();
 
+#ifdef HAVE_SYS_EPOLL_H
+    new->epfd = epoll_create(1024);
+    if (new->epfd < 0)
+        warning(errno, "fdset: epoll_create failed, using poll().");
+    new->fds_size = 16;
+    new->fds = gw_malloc(sizeof(new->fds[0]) * new->fds_size);
+    for (i = 0; i < new->fds_size; i++) {
+        new->fds[i].used = 0;
+        new->fds[i].generation = 0;
+        new->fds[i].older = new->fds[i].newer = -1;
+    }
+    new->registered = 0;
+    new->oldest = new->newest = -1;
+#endif
+
     new->poll_thread = gwthread_create(poller, new);
     if (new->poll_thread < 0) {
         error(0, "Could not start internal thread for fdset.");
@@ -395,16 +737,63 @@ FDSet *fdset_create_real(long timeout)
     return new;
 }
 
+FDSet *fdset_create_group(long timeout, int threads)
+{
+    FDSet *new;
+    int i;
+
+    if (threads <= 1)
+        return fdset_create_real(timeout);
+
+    new = gw_malloc(sizeof(*new));
+    new->poll_thread = -1;
+    new->members = gw_malloc(sizeof(new->members[0]) * threads);
+    for (i = 0; i < threads; i++) {
+        new->members[i] = fdset_create_real(timeout);
+        if (new->members[i] == NULL) {
+            new->num_members = i;
+            fdset_destroy(new);
+            return NULL;
+        }
+    }
+    new->num_members = threads;
+
+    return new;
+}
+
+/* Return the member set of a group that handles this fd. */
+#define member_for(set, fd) \
+    ((set)->members[(unsigned int) (fd) % (set)->num_members])
+
 void fdset_destroy(FDSet *set)
 {
+    int i;
+
     if (set == NULL)
         return;
 
+    if (set->members != NULL) {
+        for (i = 0; i < set->num_members; i++)
+            fdset_destroy(set->members[i]);
+        gw_free(set->members);
+        gw_free(set);
+        return;
+    }
+
     if (set->poll_thread < 0 || gwthread_self() == set->poll_thread) {
         if (set->entries > 0) {
             warning(0, "Destroying fdset with %d active entries.",
                     set->entries);
         }
+#ifdef HAVE_SYS_EPOLL_H
+        if (set->registered > 0) {
+            warning(0, "Destroying fdset with %d active entries.",
+                    set->registered);
+        }
+        if (set->epfd >= 0)
+            close(set->epfd);
+        gw_free(set->fds);
+#endif
         gw_free(set->pollinfo);
         gw_free(set->callbacks);
         gw_free(set->datafields);
@@ -429,6 +818,11 @@ void fdset_register(FDSet *set, int fd, int events,
 
     gw_assert(set != NULL);
 
+    if (set->members != NULL) {
+        fdset_register(member_for(set, fd), fd, events, callback, data);
+        return;
+    }
+
     if (gwthread_self() != set->poll_thread) {
         struct action *action;
 
@@ -441,6 +835,13 @@ void fdset_register(FDSet *set, int fd, int events,
         return;
     }
 
+#ifdef HAVE_SYS_EPOLL_H
+    if (set->epfd >= 0) {
+        epoll_register(set, fd, events, callback, data);
+        return;
+    }
+#endif
+
     gw_assert(set->entries <= set->size);
 
     if (set->entries >= set->size) {
@@ -473,6 +874,11 @@ void fdset_listen(FDSet *set, int fd, int mask, int events)
 
     gw_assert(set != NULL);
 
+    if (set->members != NULL) {
+        fdset_listen(member_for(set, fd), fd, mask, events);
+        return;
+    }
+
     if (gwthread_self() != set->poll_thread) {
         struct action *action;
 
@@ -484,6 +890,13 @@ void fdset_listen(FDSet *set, int fd, int mask, int events)
         return;
     }
 
+#ifdef HAVE_SYS_EPOLL_H
+    if (set->epfd >= 0) {
+        epoll_listen(set, fd, mask, events);
+        return;
+    }
+#endif
+
     entry = find_entry(set, fd);   
     if (entry < 0) {
         warning(0, "fdset_listen called on unregistered fd %d.", fd);
@@ -513,6 +926,11 @@ void fdset_unregister(FDSet *set, int fd)
 
     gw_assert(set != NULL);
 
+    if (set->members != NULL) {
+        fdset_unregister(member_for(set, fd), fd);
+        return;
+    }
+
     if (gwthread_self() != set->poll_thread) {
         struct action *action;
 
@@ -522,6 +940,13 @@ void fdset_unregister(FDSet *set, int fd)
         return;
     }
 
+#ifdef HAVE_SYS_EPOLL_H
+    if (set->epfd >= 0) {
+        epoll_unregister(set, fd);
+        return;
+    }
+#endif
+
     /* Remove the entry from the pollinfo array */
 
     entry = find_entry(set, fd);
@@ -546,8 +971,16 @@ void fdset_unregister(FDSet *set, int fd)
 
 void fdset_set_timeout(FDSet *set, long timeout)
 {
+    int i;
+
     gw_assert(set != NULL);
 
+    if (set->members != NULL) {
+        for (i = 0; i < set->num_members; i++)
+            fdset_set_timeout(set->members[i], timeout);
+        return;
+    }
+
     if (gwthread_self() != set->poll_thread) {
         struct action *action;
 
@@ -80,6 +80,15 @@ typedef void fdset_callback_t(int fd, int revents, void *data);
 #define fdset_create() fdset_create_real(-1)
 FDSet *fdset_create_real(long timeout);
 
+/*
+ * Create a group of `threads' file descriptor sets, each with its own
+ * thread, that is used like a single set. File descriptors are spread
+ * over the threads by their number, so callbacks for different file
+ * descriptors may run at the same time in different threads. With
+ * `threads' 1 or less, this is the same as fdset_create_real.
+ */
+FDSet *fdset_create_group(long timeout, int threads);
+
 /*
  * Destroy a file descriptor set.  Will emit a warning if any file
  * descriptors are still registered with it.
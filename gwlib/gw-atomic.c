@@ -0,0 +1,154 @@
+/* ==================================================================== 
+ * The Kannel Software License, Version 1.0 
+ * 
+ * Copyright (c) 2001-2010 Kannel Group  
+ * Copyright (c) 1998-2001 WapIT Ltd.   
+ * All rights reserved. 
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions 
+ * are met: 
+ * 
+ * 1. Redistributions of source code must retain the above copyright 
+ *    notice, this list of conditions and the following disclaimer. 
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in 
+ *    the documentation and/or other materials provided with the 
+ *    distribution. 
+ * 
+ * 3. The end-user documentation included with the redistribution, 
+ *    if any, must include the following acknowledgment: 
+ *       "This product includes software developed by the 
+ *        Kannel Group (http://www.kannel.org/)." 
+ *    Alternately, this acknowledgment may appear in the software itself, 
+ *    if and wherever such third-party acknowledgments normally appear. 
+ * 
+ * 4. The names "Kannel" and "Kannel Group" must not be used to 
+ *    endorse or promote products derived from this software without 
+ *    prior written permission. For written permission, please  
+ *    contact org@kannel.org. 
+ * 
+ * 5. Products derived from this software may not be called "Kannel", 
+ *    nor may "Kannel" appear in their name, without prior written 
+ *    permission of the Kannel Group. 
+ * 
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESSED OR IMPLIED 
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES 
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+ * DISCLAIMED.  IN NO EVENT SHALL THE KANNEL GROUP OR ITS CONTRIBUTORS 
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,  
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT  
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR  
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,  
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE  
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,  
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. 
+ * ==================================================================== 
+ * 
+ * This software consists of voluntary contributions made by many 
+ * individuals on behalf of the Kannel Group.  For more information on  
+ * the Kannel Group, please see <http://www.kannel.org/>. 
+ * 
+ * Portions of this software are based upon software originally written at  
+ * WapIT Ltd., Helsinki, Finland for the Kannel project.  
+ */ 
+
+/*
+ * gw-atomic.c: Mutex based fallback for the operations in gw-atomic.h
+ * on compilers without atomic builtins.
+ */
+
+#include "gwlib.h"
+
+#ifndef GW_ATOMIC_BUILTINS
+
+static pthread_mutex_t atomic_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#define lock() pthread_mutex_lock(&atomic_lock)
+#define unlock() pthread_mutex_unlock(&atomic_lock)
+
+
+long gw_atomic_get(volatile long *p)
+{
+    long ret;
+
+    lock();
+    ret = *p;
+    unlock();
+    return ret;
+}
+
+
+void gw_atomic_set(volatile long *p, long value)
+{
+    lock();
+    *p = value;
+    unlock();
+}
+
+
+long gw_atomic_add(volatile long *p, long value)
+{
+    long ret;
+
+    lock();
+    ret = (*p += value);
+    unlock();
+    return ret;
+}
+
+
+int gw_atomic_cas(volatile long *p, long expected, long value)
+{
+    int ret = 0;
+
+    lock();
+    if (*p == expected) {
+        *p = value;
+        ret = 1;
+    }
+    unlock();
+    return ret;
+}
+
+
+void *gw_atomic_get_ptr(void *volatile *p)
+{
+    void *ret;
+
+    lock();
+    ret = *p;
+    unlock();
+    return ret;
+}
+
+
+void gw_atomic_set_ptr(void *volatile *p, void *value)
+{
+    lock();
+    *p = value;
+    unlock();
+}
+
+
+void *gw_atomic_swap_ptr(void *volatile *p, void *value)
+{
+    void *ret;
+
+    lock();
+    ret = *p;
+    *p = value;
+    unlock();
+    return ret;
+}
+
+
+/* All operations are serialized by the one mutex, which is enough. */
+void gw_atomic_fence(void)
+{
+    lock();
+    unlock();
+}
+
+#endif
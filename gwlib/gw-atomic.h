@@ -0,0 +1,147 @@
+/* ==================================================================== 
+ * The Kannel Software License, Version 1.0 
+ * 
+ * Copyright (c) 2001-2010 Kannel Group  
+ * Copyright (c) 1998-2001 WapIT Ltd.   
+ * All rights reserved. 
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions 
+ * are met: 
+ * 
+ * 1. Redistributions of source code must retain the above copyright 
+ *    notice, this list of conditions and the following disclaimer. 
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in 
+ *    the documentation and/or other materials provided with the 
+ *    distribution. 
+ * 
+ * 3. The end-user documentation included with the redistribution, 
+ *    if any, must include the following acknowledgment: 
+ *       "This product includes software developed by the 
+ *        Kannel Group (http://www.kannel.org/)." 
+ *    Alternately, this acknowledgment may appear in the software itself, 
+ *    if and wherever such third-party acknowledgments normally appear. 
+ * 
+ * 4. The names "Kannel" and "Kannel Group" must not be used to 
+ *    endorse or promote products derived from this software without 
+ *    prior written permission. For written permission, please  
+ *    contact org@kannel.org. 
+ * 
+ * 5. Products derived from this software may not be called "Kannel", 
+ *    nor may "Kannel" appear in their name, without prior written 
+ *    permission of the Kannel Group. 
+ * 
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESSED OR IMPLIED 
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES 
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+ * DISCLAIMED.  IN NO EVENT SHALL THE KANNEL GROUP OR ITS CONTRIBUTORS 
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,  
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT  
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR  
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,  
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE  
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,  
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. 
+ * ==================================================================== 
+ * 
+ * This software consists of voluntary contributions made by many 
+ * individuals on behalf of the Kannel Group.  For more information on  
+ * the Kannel Group, please see <http://www.kannel.org/>. 
+ * 
+ * Portions of this software are based upon software originally written at  
+ * WapIT Ltd., Helsinki, Finland for the Kannel project.  
+ */ 
+
+/*
+ * gw-atomic.h: Minimal set of atomic operations on longs and pointers.
+ *
+ * These are used where a mutex would make a hot read path contend on
+ * a single cache line: statistics counters and pointers that are
+ * published once and then read by many threads. With a GCC compatible
+ * compiler the operations map to the compiler builtins; otherwise they
+ * fall back to functions in gw-atomic.c serialized by one mutex.
+ *
+ * Loads have acquire and stores have release semantics, so everything
+ * written before a gw_atomic_set_ptr() is visible to a thread that
+ * sees the new pointer through gw_atomic_get_ptr().
+ */
+
+#ifndef GW_ATOMIC_H
+#define GW_ATOMIC_H
+
+#include "gw-config.h"
+
+#if defined(__GNUC__) && \
+    (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 7) || defined(__clang__))
+#define GW_ATOMIC_BUILTINS 1
+#endif
+
+#ifdef GW_ATOMIC_BUILTINS
+
+static inline long gw_atomic_get(volatile long *p)
+{
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void gw_atomic_set(volatile long *p, long value)
+{
+    __atomic_store_n(p, value, __ATOMIC_RELEASE);
+}
+
+/* Add `value' to `*p' and return the new value. */
+static inline long gw_atomic_add(volatile long *p, long value)
+{
+    return __atomic_add_fetch(p, value, __ATOMIC_ACQ_REL);
+}
+
+/* Set `*p' to `value' if it is `expected'. Return 1 if it was set. */
+static inline int gw_atomic_cas(volatile long *p, long expected, long value)
+{
+    return __atomic_compare_exchange_n(p, &expected, value, 0,
+                                       __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+static inline void *gw_atomic_get_ptr(void *volatile *p)
+{
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void gw_atomic_set_ptr(void *volatile *p, void *value)
+{
+    __atomic_store_n(p, value, __ATOMIC_RELEASE);
+}
+
+/* Set `*p' to `value' and return the previous pointer. */
+static inline void *gw_atomic_swap_ptr(void *volatile *p, void *value)
+{
+    return __atomic_exchange_n(p, value, __ATOMIC_ACQ_REL);
+}
+
+/*
+ * Full memory barrier: no load after it is done before a store in
+ * front of it is visible to other threads.
+ */
+static inline void gw_atomic_fence(void)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+#else
+
+long gw_atomic_get(volatile long *p);
+void gw_atomic_set(volatile long *p, long value);
+long gw_atomic_add(volatile long *p, long value);
+int gw_atomic_cas(volatile long *p, long expected, long value);
+void *gw_atomic_get_ptr(void *volatile *p);
+void gw_atomic_set_ptr(void *volatile *p, void *value);
+void *gw_atomic_swap_ptr(void *volatile *p, void *value);
+void gw_atomic_fence(void);
+
+#endif
+
+#define gw_atomic_inc(p) gw_atomic_add((p), 1)
+#define gw_atomic_dec(p) gw_atomic_add((p), -1)
+
+#endif
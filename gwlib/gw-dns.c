@@ -0,0 +1,502 @@
+/* ==================================================================== 
+ * The Kannel Software License, Version 1.0 
+ * 
+ * Copyright (c) 2001-2010 Kannel Group  
+ * Copyright (c) 1998-2001 WapIT Ltd.   
+ * All rights reserved. 
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions 
+ * are met: 
+ * 
+ * 1. Redistributions of source code must retain the above copyright 
+ *    notice, this list of conditions and the following disclaimer. 
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in 
+ *    the documentation and/or other materials provided with the 
+ *    distribution. 
+ * 
+ * 3. The end-user documentation included with the redistribution, 
+ *    if any, must include the following acknowledgment: 
+ *       "This product includes software developed by the 
+ *        Kannel Group (http://www.kannel.org/)." 
+ *    Alternately, this acknowledgment may appear in the software itself, 
+ *    if and wherever such third-party acknowledgments normally appear. 
+ * 
+ * 4. The names "Kannel" and "Kannel Group" must not be used to 
+ *    endorse or promote products derived from this software without 
+ *    prior written permission. For written permission, please  
+ *    contact org@kannel.org. 
+ * 
+ * 5. Products derived from this software may not be called "Kannel", 
+ *    nor may "Kannel" appear in their name, without prior written 
+ *    permission of the Kannel Group. 
+ * 
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESSED OR IMPLIED 
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES 
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+ * DISCLAIMED.  IN NO EVENT SHALL THE KANNEL GROUP OR ITS CONTRIBUTORS 
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,  
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT  
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR  
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,  
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE  
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,  
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. 
+ * ==================================================================== 
+ * 
+ * This software consists of voluntary contributions made by many 
+ * individuals on behalf of the Kannel Group.  For more information on  
+ * the Kannel Group, please see <http://www.kannel.org/>. 
+ * 
+ * Portions of this software are based upon software originally written at  
+ * WapIT Ltd., Helsinki, Finland for the Kannel project.  
+ */ 
+
+/*
+ * gw-dns.c: Cached and asynchronous host name resolution.
+ *
+ * The cache is a Dict of DNSEntry keyed by name, guarded by one mutex
+ * which is never held across a resolver call. An entry being looked up
+ * by a resolver thread collects the callbacks of everybody asking for
+ * the name in the meantime and runs them once the answer is stored.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <time.h>
+
+#include "gwlib.h"
+#include "gw-dns.h"
+
+/*
+ * Most names in the cache. Once it is full, expired entries are dropped,
+ * and if that leaves more than DNS_CACHE_LOW, the ones closest to expiry.
+ */
+#define DNS_CACHE_MAX 4096
+#define DNS_CACHE_LOW (DNS_CACHE_MAX / 4 * 3)
+
+/* Most addresses we keep per name. */
+#define DNS_MAX_ADDRS 16
+
+typedef struct {
+    gw_dns_callback_t *callback;
+    void *data;
+} DNSWaiter;
+
+typedef struct {
+    int resolving;
+    int naddrs;                 /* -1 for a name that didn't resolve */
+    struct in_addr *addrs;
+    time_t expires;
+    List *waiters;              /* of DNSWaiter, while resolving */
+} DNSEntry;
+
+static Mutex *dns_lock = NULL;
+static Dict *dns_cache = NULL;
+static List *dns_queue = NULL;
+static int resolvers_running = 0;
+
+static long dns_ttl = 300;
+static long dns_negative_ttl = 30;
+static long dns_resolver_threads = 2;
+
+static unsigned long dns_hits = 0;
+static unsigned long dns_negative_hits = 0;
+static unsigned long dns_misses = 0;
+static long dns_pending = 0;
+
+
+static void waiter_destroy(void *p)
+{
+    gw_free(p);
+}
+
+
+static void entry_destroy(void *p)
+{
+    DNSEntry *e = p;
+
+    if (e == NULL)
+        return;
+    /* only left over if we shut down in the middle of a lookup */
+    gwlist_destroy(e->waiters, waiter_destroy);
+    gw_free(e->addrs);
+    gw_free(e);
+}
+
+
+/*
+ * Ask the system resolver. Returns the number of addresses stored in a
+ * new array in `*addrs', or -1.
+ */
+static int lookup(const char *name, struct in_addr **addrs)
+{
+    struct hostent h;
+    char *buff = NULL;
+    int n;
+
+    *addrs = NULL;
+    if (gw_gethostbyname(&h, name, &buff) == -1 ||
+        h.h_addrtype != AF_INET || h.h_addr_list[0] == NULL) {
+        gw_free(buff);
+        return -1;
+    }
+
+    for (n = 0; n < DNS_MAX_ADDRS && h.h_addr_list[n] != NULL; n++)
+        ;
+    *addrs = gw_malloc(n * sizeof(**addrs));
+    for (n = 0; n < DNS_MAX_ADDRS && h.h_addr_list[n] != NULL; n++)
+        memcpy(&(*addrs)[n], h.h_addr_list[n], sizeof(**addrs));
+    gw_free(buff);
+
+    return n;
+}
+
+
+/* Numeric addresses are answered without the cache. */
+static int literal(const char *name, struct in_addr **addrs)
+{
+    struct in_addr a;
+
+    if (inet_aton(name, &a) == 0)
+        return 0;
+    if (addrs != NULL) {
+        *addrs = gw_malloc(sizeof(a));
+        **addrs = a;
+    }
+    return 1;
+}
+
+
+/*
+ * Return the entry for `name' if it holds a usable answer, counting the
+ * hit if `count' is set. Must be called with dns_lock held.
+ */
+static DNSEntry *fresh_entry(Octstr *name, time_t now, int count)
+{
+    DNSEntry *e;
+
+    e = dict_get(dns_cache, name);
+    if (e == NULL || e->resolving || e->expires <= now)
+        return NULL;
+
+    if (count) {
+        dns_hits++;
+        if (e->naddrs < 0)
+            dns_negative_hits++;
+    }
+    return e;
+}
+
+
+typedef struct {
+    Octstr *name;
+    time_t expires;
+} DNSExpiry;
+
+static int expiry_cmp(const void *a, const void *b)
+{
+    time_t x = ((const DNSExpiry *) a)->expires;
+    time_t y = ((const DNSExpiry *) b)->expires;
+
+    return x < y ? -1 : x > y;
+}
+
+
+/*
+ * Make room for a new name if the cache is full, so that it is walked
+ * at most once per DNS_CACHE_MAX - DNS_CACHE_LOW new names. Names being
+ * looked up stay. Must be called with dns_lock held.
+ */
+static void make_room(time_t now)
+{
+    DNSEntry *e;
+    DNSExpiry *old;
+    List *keys;
+    Octstr *key;
+    long i, n, len;
+
+    if ((len = dict_key_count(dns_cache)) < DNS_CACHE_MAX)
+        return;
+
+    keys = dict_keys(dns_cache);
+    old = gw_malloc(gwlist_len(keys) * sizeof(*old));
+    n = 0;
+    while ((key = gwlist_extract_first(keys)) != NULL) {
+        e = dict_get(dns_cache, key);
+        if (e != NULL && !e->resolving && e->expires <= now) {
+            dict_put(dns_cache, key, NULL);
+            len--;
+        } else if (e != NULL && !e->resolving) {
+            old[n].name = key;
+            old[n++].expires = e->expires;
+            continue;
+        }
+        octstr_destroy(key);
+    }
+    gwlist_destroy(keys, NULL);
+
+    qsort(old, n, sizeof(*old), expiry_cmp);
+    for (i = 0; i < n; i++) {
+        if (len > DNS_CACHE_LOW) {
+            dict_put(dns_cache, old[i].name, NULL);
+            len--;
+        }
+        octstr_destroy(old[i].name);
+    }
+    gw_free(old);
+}
+
+
+/*
+ * Store the answer for `name' and return the waiters of the lookup, if
+ * there were any. Must be called with dns_lock held.
+ */
+static List *store_entry(Octstr *name, int naddrs, struct in_addr *addrs)
+{
+    DNSEntry *e;
+    List *waiters;
+    time_t now;
+
+    now = time(NULL);
+    e = dict_get(dns_cache, name);
+    if (e == NULL) {
+        make_room(now);
+        e = gw_malloc(sizeof(*e));
+        e->resolving = 0;
+        e->addrs = NULL;
+        e->waiters = NULL;
+        dict_put(dns_cache, name, e);
+    }
+
+    gw_free(e->addrs);
+    e->naddrs = naddrs;
+    e->addrs = addrs;
+    e->expires = now + (naddrs < 0 ? dns_negative_ttl : dns_ttl);
+    e->resolving = 0;
+    waiters = e->waiters;
+    e->waiters = NULL;
+
+    return waiters;
+}
+
+
+static void run_waiters(List *waiters, Octstr *name, int ok)
+{
+    DNSWaiter *w;
+
+    if (waiters == NULL)
+        return;
+    while ((w = gwlist_extract_first(waiters)) != NULL) {
+        w->callback(name, ok, w->data);
+        gw_free(w);
+    }
+    gwlist_destroy(waiters, NULL);
+}
+
+
+static void resolver_thread(void *arg)
+{
+    Octstr *name;
+    struct in_addr *addrs;
+    List *waiters;
+    int n;
+
+    while ((name = gwlist_consume(dns_queue)) != NULL) {
+        n = lookup(octstr_get_cstr(name), &addrs);
+
+        mutex_lock(dns_lock);
+        waiters = store_entry(name, n, addrs);
+        dns_pending--;
+        mutex_unlock(dns_lock);
+
+        run_waiters(waiters, name, n > 0);
+        octstr_destroy(name);
+    }
+}
+
+
+/* Must be called with dns_lock held. */
+static void start_resolvers(void)
+{
+    long i;
+
+    if (resolvers_running)
+        return;
+    gwlist_add_producer(dns_queue);
+    for (i = 0; i < dns_resolver_threads; i++) {
+        if (gwthread_create(resolver_thread, NULL) == -1) {
+            error(0, "DNS: Could not start resolver thread.");
+            break;
+        }
+    }
+    if (i == 0)
+        gwlist_remove_producer(dns_queue);
+    else
+        resolvers_running = 1;
+}
+
+
+void gw_dns_init(void)
+{
+    dns_lock = mutex_create();
+    dns_cache = dict_create(256, entry_destroy);
+    dns_queue = gwlist_create();
+}
+
+
+void gw_dns_shutdown(void)
+{
+    if (resolvers_running) {
+        gwlist_remove_producer(dns_queue);
+        gwthread_join_every(resolver_thread);
+        resolvers_running = 0;
+    }
+    gwlist_destroy(dns_queue, octstr_destroy_item);
+    dns_queue = NULL;
+    dict_destroy(dns_cache);
+    dns_cache = NULL;
+    mutex_destroy(dns_lock);
+    dns_lock = NULL;
+}
+
+
+void gw_dns_set_ttl(long ttl, long negative_ttl)
+{
+    mutex_lock(dns_lock);
+    dns_ttl = ttl > 0 ? ttl : 0;
+    dns_negative_ttl = negative_ttl > 0 ? negative_ttl : 0;
+    mutex_unlock(dns_lock);
+}
+
+
+void gw_dns_set_resolver_threads(long threads)
+{
+    mutex_lock(dns_lock);
+    if (!resolvers_running)
+        dns_resolver_threads = threads > 0 ? threads : 0;
+    mutex_unlock(dns_lock);
+}
+
+
+int gw_dns_resolve(const char *name, struct in_addr **addrs)
+{
+    DNSEntry *e;
+    Octstr *key;
+    List *waiters = NULL;
+    int n;
+
+    gw_assert(name != NULL);
+
+    *addrs = NULL;
+    if (literal(name, addrs))
+        return 1;
+
+    key = octstr_create(name);
+    mutex_lock(dns_lock);
+    if (dns_ttl > 0 && (e = fresh_entry(key, time(NULL), 1)) != NULL) {
+        n = e->naddrs;
+        if (n > 0) {
+            *addrs = gw_malloc(n * sizeof(**addrs));
+            memcpy(*addrs, e->addrs, n * sizeof(**addrs));
+        }
+        mutex_unlock(dns_lock);
+        octstr_destroy(key);
+        return n;
+    }
+    dns_misses++;
+    mutex_unlock(dns_lock);
+
+    n = lookup(name, addrs);
+
+    mutex_lock(dns_lock);
+    e = dict_get(dns_cache, key);
+    /* leave an entry a resolver thread is filling in to that thread */
+    if (dns_ttl > 0 && (e == NULL || !e->resolving)) {
+        struct in_addr *copy = NULL;
+        if (n > 0) {
+            copy = gw_malloc(n * sizeof(*copy));
+            memcpy(copy, *addrs, n * sizeof(*copy));
+        }
+        waiters = store_entry(key, n, copy);
+    }
+    mutex_unlock(dns_lock);
+
+    gw_assert(waiters == NULL);
+    octstr_destroy(key);
+
+    return n;
+}
+
+
+int gw_dns_resolve_async(Octstr *name, gw_dns_callback_t *callback, void *data)
+{
+    DNSEntry *e;
+    DNSWaiter *w;
+    struct in_addr *addrs;
+
+    gw_assert(name != NULL);
+    gw_assert(callback != NULL);
+
+    if (literal(octstr_get_cstr(name), NULL))
+        return 1;
+
+    mutex_lock(dns_lock);
+    /* the connect that follows counts the hit */
+    if (dns_ttl == 0 || fresh_entry(name, time(NULL), 0) != NULL) {
+        mutex_unlock(dns_lock);
+        return 1;
+    }
+
+    start_resolvers();
+    if (!resolvers_running) {
+        /* no threads to hand it to, warm the cache ourselves */
+        mutex_unlock(dns_lock);
+        gw_dns_resolve(octstr_get_cstr(name), &addrs);
+        gw_free(addrs);
+        return 1;
+    }
+
+    w = gw_malloc(sizeof(*w));
+    w->callback = callback;
+    w->data = data;
+
+    e = dict_get(dns_cache, name);
+    if (e != NULL && e->resolving) {
+        gwlist_append(e->waiters, w);
+    } else {
+        if (e == NULL) {
+            make_room(time(NULL));
+            e = gw_malloc(sizeof(*e));
+            e->naddrs = -1;
+            e->addrs = NULL;
+            e->expires = 0;
+            dict_put(dns_cache, name, e);
+        }
+        e->resolving = 1;
+        e->waiters = gwlist_create();
+        gwlist_append(e->waiters, w);
+        dns_misses++;
+        dns_pending++;
+        gwlist_produce(dns_queue, octstr_duplicate(name));
+    }
+    mutex_unlock(dns_lock);
+
+    return 0;
+}
+
+
+void gw_dns_stats(DNSStats *stats)
+{
+    mutex_lock(dns_lock);
+    stats->entries = dict_key_count(dns_cache);
+    stats->pending = dns_pending;
+    stats->hits = dns_hits;
+    stats->negative_hits = dns_negative_hits;
+    stats->misses = dns_misses;
+    mutex_unlock(dns_lock);
+}
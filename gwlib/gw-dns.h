@@ -0,0 +1,138 @@
+/* ==================================================================== 
+ * The Kannel Software License, Version 1.0 
+ * 
+ * Copyright (c) 2001-2010 Kannel Group  
+ * Copyright (c) 1998-2001 WapIT Ltd.   
+ * All rights reserved. 
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions 
+ * are met: 
+ * 
+ * 1. Redistributions of source code must retain the above copyright 
+ *    notice, this list of conditions and the following disclaimer. 
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in 
+ *    the documentation and/or other materials provided with the 
+ *    distribution. 
+ * 
+ * 3. The end-user documentation included with the redistribution, 
+ *    if any, must include the following acknowledgment: 
+ *       "This product includes software developed by the 
+ *        Kannel Group (http://www.kannel.org/)." 
+ *    Alternately, this acknowledgment may appear in the software itself, 
+ *    if and wherever such third-party acknowledgments normally appear. 
+ * 
+ * 4. The names "Kannel" and "Kannel Group" must not be used to 
+ *    endorse or promote products derived from this software without 
+ *    prior written permission. For written permission, please  
+ *    contact org@kannel.org. 
+ * 
+ * 5. Products derived from this software may not be called "Kannel", 
+ *    nor may "Kannel" appear in their name, without prior written 
+ *    permission of the Kannel Group. 
+ * 
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESSED OR IMPLIED 
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES 
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+ * DISCLAIMED.  IN NO EVENT SHALL THE KANNEL GROUP OR ITS CONTRIBUTORS 
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,  
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT  
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR  
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,  
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE  
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,  
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. 
+ * ==================================================================== 
+ * 
+ * This software consists of voluntary contributions made by many 
+ * individuals on behalf of the Kannel Group.  For more information on  
+ * the Kannel Group, please see <http://www.kannel.org/>. 
+ * 
+ * Portions of this software are based upon software originally written at  
+ * WapIT Ltd., Helsinki, Finland for the Kannel project.  
+ */ 
+
+/*
+ * gw-dns.h: Cached and asynchronous host name resolution.
+ *
+ * Outgoing connections resolve their peer's name on every connect, and
+ * the resolver can block for seconds. This module keeps the answers in
+ * a process wide cache for dns-cache-ttl seconds, and remembers names
+ * that failed to resolve for dns-negative-cache-ttl seconds so a broken
+ * name doesn't cost a resolver round trip per message.
+ *
+ * Lookups that miss the cache can be handed to a small pool of resolver
+ * threads with gw_dns_resolve_async(); the caller gets a callback when
+ * the answer is in the cache and is free to serve other work until then.
+ * Concurrent lookups of the same name share one resolver query.
+ *
+ * The resolver does not tell us the record TTLs, so the configured TTLs
+ * apply to all names. The cache holds up to 4096 names, dropping the
+ * ones closest to expiry when full. Numeric addresses bypass the cache.
+ */
+
+#ifndef GW_DNS_H
+#define GW_DNS_H
+
+#include <netinet/in.h>
+
+#include "octstr.h"
+
+/* Cache counters, as shown on the status pages. */
+typedef struct {
+    long entries;                 /* names in the cache */
+    long pending;                 /* names being looked up right now */
+    unsigned long hits;           /* answered from the cache */
+    unsigned long negative_hits;  /* of the hits, cached failures */
+    unsigned long misses;         /* needed a resolver query */
+} DNSStats;
+
+/*
+ * Called from a resolver thread once `name' is in the cache. `ok' is 1
+ * if it resolved and 0 if it failed to.
+ */
+typedef void gw_dns_callback_t(Octstr *name, int ok, void *data);
+
+/* Called by gwlib_init and gwlib_shutdown. */
+void gw_dns_init(void);
+void gw_dns_shutdown(void);
+
+/*
+ * Set how many seconds answers and failures stay in the cache. A `ttl'
+ * of 0 disables the cache, every lookup then goes to the resolver on the
+ * calling thread. A `negative_ttl' of 0 doesn't remember failures: the
+ * callbacks of gw_dns_resolve_async() still get the answer, but the next
+ * lookup asks the resolver again. Defaults are 300 and 30 seconds.
+ */
+void gw_dns_set_ttl(long ttl, long negative_ttl);
+
+/*
+ * Set the number of resolver threads started by the first asynchronous
+ * lookup. 0 makes gw_dns_resolve_async() resolve on the calling thread.
+ * Default is 2.
+ */
+void gw_dns_set_resolver_threads(long threads);
+
+/*
+ * Resolve `name' to its IPv4 addresses, from the cache if possible.
+ * Returns the number of addresses, which are stored in a new array in
+ * `*addrs' that the caller must gw_free(), or -1 if `name' does not
+ * resolve.
+ */
+int gw_dns_resolve(const char *name, struct in_addr **addrs);
+
+/*
+ * Make sure `name' is in the cache without blocking the caller. Returns
+ * 1 if it already is, so that a following gw_dns_resolve() won't block,
+ * and 0 if it is being looked up; `callback' is then called with `data'
+ * when that is done. The entry may expire right after that, so callers
+ * should act on `ok' rather than ask again.
+ */
+int gw_dns_resolve_async(Octstr *name, gw_dns_callback_t *callback, void *data);
+
+/* Fill `stats' with the current cache counters. */
+void gw_dns_stats(DNSStats *stats);
+
+#endif
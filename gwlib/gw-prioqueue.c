@@ -59,6 +59,10 @@
  *
  * Algorithm ala Robert Sedgewick.
  *
+ * Queues created with gw_prioqueue_create_levels do not use the heap,
+ * but keep one FIFO ring of items per priority level and a bitmap of
+ * the levels that have items in them.
+ *
  * Alexander Malysh <amalysh at kannel.org>, 2004, 2008
  */
 
@@ -76,6 +80,13 @@ struct element {
     long long seq;
 };
 
+struct bucket {
+    void **items;
+    long head;      /* index of the oldest item */
+    long len;
+    long size;
+};
+
 struct gw_prioqueue {
     Mutex *mutex;
     struct element **tab;
@@ -85,6 +96,11 @@ struct gw_prioqueue {
     long long seq;
     pthread_cond_t nonempty;
     int (*cmp)(const void*, const void *);
+    /* only for queues with priority levels, levels is 0 otherwise */
+    struct bucket *buckets;
+    long levels;
+    long (*level)(const void *);
+    unsigned long used;     /* bit n set if buckets[n] is not empty */
 };
 
 
@@ -171,6 +187,75 @@ static void downheap(gw_prioqueue_t *queue, register long index)
 }
 
 
+static void bucket_push(struct bucket *bucket, void *item)
+{
+    void **items;
+    long i, size;
+
+    if (bucket->len == bucket->size) {
+        size = bucket->size > 0 ? bucket->size * 2 : 16;
+        items = gw_malloc(sizeof(*items) * size);
+        for (i = 0; i < bucket->len; i++)
+            items[i] = bucket->items[(bucket->head + i) % bucket->size];
+        gw_free(bucket->items);
+        bucket->items = items;
+        bucket->size = size;
+        bucket->head = 0;
+    }
+    bucket->items[(bucket->head + bucket->len) % bucket->size] = item;
+    bucket->len++;
+}
+
+
+static void *bucket_shift(struct bucket *bucket)
+{
+    void *item;
+
+    item = bucket->items[bucket->head];
+    bucket->head = (bucket->head + 1) % bucket->size;
+    bucket->len--;
+    return item;
+}
+
+
+/* Index of the highest level that has items; `used' must not be 0. */
+static long top_level(gw_prioqueue_t *queue)
+{
+#if defined(__GNUC__)
+    return sizeof(queue->used) * 8 - 1 - __builtin_clzl(queue->used);
+#else
+    long i = queue->levels - 1;
+
+    while (!(queue->used & (1UL << i)))
+        i--;
+    return i;
+#endif
+}
+
+
+/* Take the biggest item out of a queue that is not empty. */
+static void *take_first(gw_prioqueue_t *queue)
+{
+    void *ret;
+    long i;
+
+    if (queue->levels > 0) {
+        i = top_level(queue);
+        ret = bucket_shift(&queue->buckets[i]);
+        if (queue->buckets[i].len == 0)
+            queue->used &= ~(1UL << i);
+        queue->len--;
+        return ret;
+    }
+
+    ret = queue->tab[1]->item;
+    gw_free(queue->tab[1]);
+    queue->tab[1] = queue->tab[--queue->len];
+    downheap(queue, 1);
+    return ret;
+}
+
+
 gw_prioqueue_t *gw_prioqueue_create(int(*cmp)(const void*, const void *))
 {
     gw_prioqueue_t *ret;
@@ -186,6 +271,10 @@ gw_prioqueue_t *gw_prioqueue_create(int(*cmp)(const void*, const void *))
     ret->len = 0;
     ret->seq = 0;
     ret->cmp = cmp;
+    ret->buckets = NULL;
+    ret->levels = 0;
+    ret->level = NULL;
+    ret->used = 0;
     
     /* put NULL item at pos 0 that is our stop marker */
     make_bigger(ret, 1);
@@ -198,14 +287,57 @@ gw_prioqueue_t *gw_prioqueue_create(int(*cmp)(const void*, const void *))
 }
 
 
+gw_prioqueue_t *gw_prioqueue_create_levels(long levels, long(*level)(const void *))
+{
+    gw_prioqueue_t *ret;
+    long i;
+
+    gw_assert(level != NULL);
+    gw_assert(levels > 0 && levels <= GW_PRIOQUEUE_MAX_LEVELS);
+
+    ret = gw_malloc(sizeof(*ret));
+    ret->producers = 0;
+    pthread_cond_init(&ret->nonempty, NULL);
+    ret->mutex = mutex_create();
+    ret->tab = NULL;
+    ret->size = 0;
+    /* as with the heap, len counts one more than there are items */
+    ret->len = 1;
+    ret->seq = 0;
+    ret->cmp = NULL;
+    ret->buckets = gw_malloc(sizeof(*ret->buckets) * levels);
+    for (i = 0; i < levels; i++) {
+        ret->buckets[i].items = NULL;
+        ret->buckets[i].head = 0;
+        ret->buckets[i].len = 0;
+        ret->buckets[i].size = 0;
+    }
+    ret->levels = levels;
+    ret->level = level;
+    ret->used = 0;
+
+    return ret;
+}
+
+
 void gw_prioqueue_destroy(gw_prioqueue_t *queue, void(*item_destroy)(void*))
 {
     long i;
 
     if (queue == NULL)
         return;
+
+    for (i = 0; i < queue->levels; i++) {
+        while (queue->buckets[i].len > 0) {
+            void *item = bucket_shift(&queue->buckets[i]);
+            if (item_destroy != NULL)
+                item_destroy(item);
+        }
+        gw_free(queue->buckets[i].items);
+    }
+    gw_free(queue->buckets);
     
-    for (i = 0; i < queue->len; i++) {
+    for (i = 0; queue->levels == 0 && i < queue->len; i++) {
         if (item_destroy != NULL && queue->tab[i]->item != NULL)
             item_destroy(queue->tab[i]->item);
         gw_free(queue->tab[i]);
@@ -234,8 +366,25 @@ long gw_prioqueue_len(gw_prioqueue_t *queue)
 
 void gw_prioqueue_insert(gw_prioqueue_t *queue, void *item)
 {
+    long i;
+
     gw_assert(queue != NULL);
     gw_assert(item != NULL);
+
+    if (queue->levels > 0) {
+        i = queue->level(item);
+        if (i < 0)
+            i = 0;
+        else if (i >= queue->levels)
+            i = queue->levels - 1;
+        queue_lock(queue);
+        bucket_push(&queue->buckets[i], item);
+        queue->used |= 1UL << i;
+        queue->len++;
+        pthread_cond_signal(&queue->nonempty);
+        queue_unlock(queue);
+        return;
+    }
     
     queue_lock(queue);
     make_bigger(queue, 1);
@@ -252,11 +401,18 @@ void gw_prioqueue_insert(gw_prioqueue_t *queue, void *item)
 void gw_prioqueue_foreach(gw_prioqueue_t *queue, void(*fn)(const void *, long))
 {
     register long i;
+    long j, n;
+    struct bucket *bucket;
 
     gw_assert(queue != NULL && fn != NULL);
     
     queue_lock(queue);
-    for (i = 1; i < queue->len; i++)
+    for (n = 0, i = queue->levels - 1; i >= 0; i--) {
+        bucket = &queue->buckets[i];
+        for (j = 0; j < bucket->len; j++)
+            fn(bucket->items[(bucket->head + j) % bucket->size], n++);
+    }
+    for (i = 1; queue->levels == 0 && i < queue->len; i++)
         fn(queue->tab[i]->item, i - 1);
     queue_unlock(queue);
 }
@@ -273,10 +429,7 @@ void *gw_prioqueue_remove(gw_prioqueue_t *queue)
         queue_unlock(queue);
         return NULL;
     }
-    ret = queue->tab[1]->item;
-    gw_free(queue->tab[1]);
-    queue->tab[1] = queue->tab[--queue->len];
-    downheap(queue, 1);
+    ret = take_first(queue);
     queue_unlock(queue);
     
     return ret;
@@ -286,11 +439,15 @@ void *gw_prioqueue_remove(gw_prioqueue_t *queue)
 void *gw_prioqueue_get(gw_prioqueue_t *queue)
 {
     void *ret;
+    struct bucket *bucket;
     
     gw_assert(queue != NULL);
     
     queue_lock(queue);
-    if (queue->len > 1)
+    if (queue->len > 1 && queue->levels > 0) {
+        bucket = &queue->buckets[top_level(queue)];
+        ret = bucket->items[bucket->head];
+    } else if (queue->len > 1)
         ret = queue->tab[1]->item;
     else
         ret = NULL;
@@ -313,10 +470,7 @@ void *gw_prioqueue_consume(gw_prioqueue_t *queue)
         queue->mutex->owner = gwthread_self();
     }
     if (queue->len > 1) {
-        ret = queue->tab[1]->item;
-        gw_free(queue->tab[1]);
-        queue->tab[1] = queue->tab[--queue->len];
-        downheap(queue, 1);
+        ret = take_first(queue);
     } else {
         ret = NULL;
     }
@@ -74,6 +74,19 @@ typedef struct gw_prioqueue gw_prioqueue_t;
  */
 gw_prioqueue_t *gw_prioqueue_create(int(*cmp)(const void*, const void *));
 
+#define GW_PRIOQUEUE_MAX_LEVELS 32
+
+/**
+ * Create priority queue for items with a small number of priority levels.
+ * Items of the same level are returned in insertion order. Insert and
+ * remove take constant time and do not allocate memory per item.
+ * @levels - number of levels, 1..GW_PRIOQUEUE_MAX_LEVELS
+ * @level - returns level of an item, the highest level is removed first;
+ *          levels out of range are taken as the nearest valid one
+ * @return newly created priority queue
+ */
+gw_prioqueue_t *gw_prioqueue_create_levels(long levels, long(*level)(const void *));
+
 /**
  * Destroy priority queue
  * @queue - queue to destroy
@@ -58,6 +58,8 @@
  * gw-rwlock.c: Implements Reader/Writer Lock.
  * If pthread_rwlock_XXX functions are present then those will be used;
  * otherwise emulation with mutexes/condition should be done.
+ * Reader biased locks use that lock only to serialize writers and to
+ * make readers wait for a writer, see gw-rwlock.h.
  *
  * Alexander Malysh <amalysh@kannel.org>, initial version 2004
  */
@@ -74,41 +76,72 @@
 #endif
 
 
-RWLock *gw_rwlock_create(void)
+static void init_lock(RWLock *lock)
 {
-    RWLock *ret = gw_malloc(sizeof(*ret));
 #ifdef HAVE_PTHREAD_RWLOCK
-    int rc = pthread_rwlock_init(&ret->rwlock, NULL);
+    int rc = pthread_rwlock_init(&lock->rwlock, NULL);
     if (rc != 0)
         panic(rc, "Initialization of RWLock failed.");
 #else
-    ret->writer = -1;
-    ret->rwlock = gwlist_create();
-    if (ret->rwlock == NULL)
+    lock->writer = -1;
+    lock->rwlock = gwlist_create();
+    if (lock->rwlock == NULL)
         panic(0, "Initialization of RWLock failed.");
 #endif
+    lock->slots = NULL;
+    lock->writing = 0;
+    lock->writing_thread = -1;
+}
+
+
+static void init_slots(RWLock *lock)
+{
+    long i;
+
+    lock->slots = gw_malloc(sizeof(*lock->slots) * GW_RWLOCK_READER_SLOTS);
+    for (i = 0; i < GW_RWLOCK_READER_SLOTS; i++)
+        lock->slots[i].readers = 0;
+    if (pthread_key_create(&lock->depth, NULL) != 0 ||
+        pthread_mutex_init(&lock->drain_lock, NULL) != 0 ||
+        pthread_cond_init(&lock->drained, NULL) != 0)
+        panic(0, "Initialization of biased RWLock failed.");
+}
+
+
+RWLock *gw_rwlock_create(void)
+{
+    RWLock *ret = gw_malloc(sizeof(*ret));
+
+    init_lock(ret);
     ret->dynamic = 1;
 
     return ret;
 }
 
 
+RWLock *gw_rwlock_create_biased(void)
+{
+    RWLock *ret = gw_rwlock_create();
+
+    init_slots(ret);
+    return ret;
+}
+
+
 void gw_rwlock_init_static(RWLock *lock)
 {
-#ifdef HAVE_PTHREAD_RWLOCK
-    int rc = pthread_rwlock_init(&lock->rwlock, NULL);
-    if (rc != 0)
-        panic(rc, "Initialization of RWLock failed.");
-#else
-    lock->writer = -1;
-    lock->rwlock = gwlist_create();
-    if (lock->rwlock == NULL)
-        panic(0, "Initialization of RWLock failed.");
-#endif
+    init_lock(lock);
     lock->dynamic = 0;
 }
 
 
+void gw_rwlock_init_static_biased(RWLock *lock)
+{
+    gw_rwlock_init_static(lock);
+    init_slots(lock);
+}
+
+
 void gw_rwlock_destroy(RWLock *lock)
 {
 #ifdef HAVE_PTHREAD_RWLOCK
@@ -125,16 +158,21 @@ void gw_rwlock_destroy(RWLock *lock)
 #else
     gwlist_destroy(lock->rwlock, NULL);
 #endif
+    if (lock->slots != NULL) {
+        pthread_key_delete(lock->depth);
+        pthread_mutex_destroy(&lock->drain_lock);
+        pthread_cond_destroy(&lock->drained);
+        gw_free(lock->slots);
+    }
 
     if (lock->dynamic)
         gw_free(lock);
 }
 
 
-int gw_rwlock_rdlock(RWLock *lock)
+static int lock_rdlock(RWLock *lock)
 {
     int ret = 0;
-    gw_assert(lock != NULL);
 
 #ifdef HAVE_PTHREAD_RWLOCK
     ret = pthread_rwlock_rdlock(&lock->rwlock);
@@ -152,10 +190,9 @@ int gw_rwlock_rdlock(RWLock *lock)
 }
 
 
-int gw_rwlock_unlock(RWLock *lock)
+static int lock_unlock(RWLock *lock)
 {
     int ret = 0;
-    gw_assert(lock != NULL);
 
 #ifdef HAVE_PTHREAD_RWLOCK
     ret = pthread_rwlock_unlock(&lock->rwlock);
@@ -174,10 +211,9 @@ int gw_rwlock_unlock(RWLock *lock)
 }
 
 
-int gw_rwlock_wrlock(RWLock *lock)
+static int lock_wrlock(RWLock *lock)
 {
     int ret = 0;
-    gw_assert(lock != NULL);
 
 #ifdef HAVE_PTHREAD_RWLOCK
     ret = pthread_rwlock_wrlock(&lock->rwlock);
@@ -194,3 +230,118 @@ int gw_rwlock_wrlock(RWLock *lock)
 
     return ret;
 }
+
+
+static inline volatile long *reader_slot(RWLock *lock)
+{
+    return &lock->slots[(unsigned long) gwthread_self() % GW_RWLOCK_READER_SLOTS].readers;
+}
+
+
+static inline long get_depth(RWLock *lock)
+{
+    return (long) pthread_getspecific(lock->depth);
+}
+
+
+static inline void set_depth(RWLock *lock, long depth)
+{
+    pthread_setspecific(lock->depth, (void *) depth);
+}
+
+
+/*
+ * Drop one reader from a slot. The writer sets `writing' before it reads
+ * the counters, so if it may be waiting for this one we see the flag.
+ */
+static void reader_leave(RWLock *lock, volatile long *readers)
+{
+    if (gw_atomic_dec(readers) == 0 && gw_atomic_get(&lock->writing) != 0) {
+        pthread_mutex_lock(&lock->drain_lock);
+        pthread_cond_signal(&lock->drained);
+        pthread_mutex_unlock(&lock->drain_lock);
+    }
+}
+
+
+int gw_rwlock_rdlock(RWLock *lock)
+{
+    volatile long *readers;
+    long depth;
+
+    gw_assert(lock != NULL);
+
+    if (lock->slots == NULL)
+        return lock_rdlock(lock);
+
+    readers = reader_slot(lock);
+    depth = get_depth(lock);
+    if (depth > 0) {
+        /*
+         * Our count is already in the slot, so no writer can get past
+         * it; backing off here would wait for a writer that waits for us.
+         */
+        gw_atomic_inc(readers);
+        set_depth(lock, depth + 1);
+        return 0;
+    }
+    for (;;) {
+        gw_atomic_inc(readers);
+        /* the writer sets `writing' and then reads our counter */
+        gw_atomic_fence();
+        if (gw_atomic_get(&lock->writing) == 0) {
+            set_depth(lock, 1);
+            return 0;
+        }
+        /* back off and wait until the writer is done */
+        reader_leave(lock, readers);
+        lock_rdlock(lock);
+        lock_unlock(lock);
+    }
+}
+
+
+int gw_rwlock_unlock(RWLock *lock)
+{
+    gw_assert(lock != NULL);
+
+    if (lock->slots == NULL)
+        return lock_unlock(lock);
+
+    if (gw_atomic_get(&lock->writing) != 0 &&
+        lock->writing_thread == gwthread_self()) {
+        gw_atomic_set(&lock->writing, 0);
+        return lock_unlock(lock);
+    }
+    gw_assert(get_depth(lock) > 0);
+    set_depth(lock, get_depth(lock) - 1);
+    reader_leave(lock, reader_slot(lock));
+    return 0;
+}
+
+
+int gw_rwlock_wrlock(RWLock *lock)
+{
+    long i;
+
+    gw_assert(lock != NULL);
+
+    if (lock->slots == NULL)
+        return lock_wrlock(lock);
+
+    /* keeps other writers out, and readers that back off wait on it */
+    lock_wrlock(lock);
+    lock->writing_thread = gwthread_self();
+    gw_atomic_set(&lock->writing, 1);
+    gw_atomic_fence();
+    for (i = 0; i < GW_RWLOCK_READER_SLOTS; i++) {
+        if (gw_atomic_get(&lock->slots[i].readers) == 0)
+            continue;
+        pthread_mutex_lock(&lock->drain_lock);
+        while (gw_atomic_get(&lock->slots[i].readers) != 0)
+            pthread_cond_wait(&lock->drained, &lock->drain_lock);
+        pthread_mutex_unlock(&lock->drain_lock);
+    }
+
+    return 0;
+}
@@ -57,6 +57,15 @@
 /*
  * gw-rwlock.h:  Prototypes for Reader/Writer Lock.
  *
+ * A lock created with gw_rwlock_create_biased or initialized with
+ * gw_rwlock_init_static_biased is biased towards readers: a reader only
+ * increments a counter that it shares with few other threads, so read
+ * locking does not make all readers write to one cache line. Writers
+ * have to wait for all the counters to drop to zero, which makes write
+ * locking expensive. Use it for data that is read for every message and
+ * changed almost never. A thread that already holds the read lock may
+ * take it again; it does not wait for a writer then.
+ *
  * Alexander Malysh <amalysh@kannel.org>, initial version 2004
  */
 
@@ -64,12 +73,19 @@
 #define GW_RWLOCK_H
 
 #include "gw-config.h"
+#include <pthread.h>
 #ifndef HAVE_PTHREAD_RWLOCK
   #include "list.h"
-#else
-  #include <pthread.h>
 #endif
 
+#define GW_RWLOCK_READER_SLOTS 64
+
+/* One reader counter, padded to a cache line of its own. */
+struct gw_rwlock_slot {
+    volatile long readers;
+    char pad[64 - sizeof(long)];
+};
+
 typedef struct {
 #ifdef HAVE_PTHREAD_RWLOCK
     pthread_rwlock_t rwlock;
@@ -78,10 +94,21 @@ typedef struct {
     long writer;
 #endif
     int dynamic;
+    /* reader biased locks only, slots is NULL otherwise */
+    struct gw_rwlock_slot *slots;
+    volatile long writing;
+    long writing_thread;
+    /* read lock depth of the calling thread */
+    pthread_key_t depth;
+    /* the last reader of a slot wakes up a waiting writer */
+    pthread_mutex_t drain_lock;
+    pthread_cond_t drained;
 } RWLock;
 
 RWLock *gw_rwlock_create(void);
+RWLock *gw_rwlock_create_biased(void);
 void gw_rwlock_init_static(RWLock *lock);
+void gw_rwlock_init_static_biased(RWLock *lock);
 void gw_rwlock_destroy(RWLock *lock);
 int gw_rwlock_rdlock(RWLock *lock);
 int gw_rwlock_unlock(RWLock *lock);
@@ -0,0 +1,513 @@
+/* ==================================================================== 
+ * The Kannel Software License, Version 1.0 
+ * 
+ * Copyright (c) 2001-2010 Kannel Group  
+ * Copyright (c) 1998-2001 WapIT Ltd.   
+ * All rights reserved. 
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions 
+ * are met: 
+ * 
+ * 1. Redistributions of source code must retain the above copyright 
+ *    notice, this list of conditions and the following disclaimer. 
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in 
+ *    the documentation and/or other materials provided with the 
+ *    distribution. 
+ * 
+ * 3. The end-user documentation included with the redistribution, 
+ *    if any, must include the following acknowledgment: 
+ *       "This product includes software developed by the 
+ *        Kannel Group (http://www.kannel.org/)." 
+ *    Alternately, this acknowledgment may appear in the software itself, 
+ *    if and wherever such third-party acknowledgments normally appear. 
+ * 
+ * 4. The names "Kannel" and "Kannel Group" must not be used to 
+ *    endorse or promote products derived from this software without 
+ *    prior written permission. For written permission, please  
+ *    contact org@kannel.org. 
+ * 
+ * 5. Products derived from this software may not be called "Kannel", 
+ *    nor may "Kannel" appear in their name, without prior written 
+ *    permission of the Kannel Group. 
+ * 
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESSED OR IMPLIED 
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES 
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+ * DISCLAIMED.  IN NO EVENT SHALL THE KANNEL GROUP OR ITS CONTRIBUTORS 
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,  
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT  
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR  
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,  
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE  
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,  
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. 
+ * ==================================================================== 
+ * 
+ * This software consists of voluntary contributions made by many 
+ * individuals on behalf of the Kannel Group.  For more information on  
+ * the Kannel Group, please see <http://www.kannel.org/>. 
+ * 
+ * Portions of this software are based upon software originally written at  
+ * WapIT Ltd., Helsinki, Finland for the Kannel project.  
+ */ 
+
+/*
+ * gw-timerwheel.c: Hashed timer wheel.
+ *
+ * Every slot, and the list of timers that are due, is a circular doubly
+ * linked list with a dummy head, so timers are unlinked in O(1) when they
+ * are stopped. One mutex guards the whole wheel; it is not held while
+ * callbacks run, and the state of a timer tells gw_wheel_timer_stop()
+ * whether it has to wait for a callback to return. That wait needs a
+ * condition variable on the same mutex, so the wheel uses a plain
+ * pthread mutex rather than a gwlib Mutex.
+ */
+
+#include "gw-config.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <time.h>
+#include <math.h>
+
+#include "gwlib.h"
+#include "gw-timerwheel.h"
+
+enum {
+    timer_idle,
+    timer_pending,      /* in a slot or in the due list */
+    timer_running,      /* callback is being called */
+    timer_destroyed     /* destroyed by its own callback */
+};
+
+struct WheelTimer {
+    WheelTimer *prev;
+    WheelTimer *next;
+    TimerWheel *wheel;
+    gw_timer_callback_t *callback;
+    void *data;
+    long rounds;        /* turns of the wheel left before it is due */
+    long runner;        /* thread calling the callback */
+    int state;
+    int oneshot;
+};
+
+struct TimerWheel {
+    pthread_mutex_t lock;
+    pthread_cond_t done;    /* a callback has returned */
+    WheelTimer *slots;      /* list heads */
+    WheelTimer due;
+    long nslots;
+    double tick;
+    double start;           /* when tick 0 began */
+    long current;           /* last tick visited */
+    long len;               /* pending timers */
+    long thread;
+    volatile sig_atomic_t stopping;
+};
+
+
+static double wheel_now(void)
+{
+#ifdef CLOCK_MONOTONIC
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+    {
+        struct timeval tv;
+
+        gettimeofday(&tv, NULL);
+        return tv.tv_sec + tv.tv_usec / 1e6;
+    }
+}
+
+
+static long wheel_ticks(TimerWheel *wheel)
+{
+    return (long) ((wheel_now() - wheel->start) / wheel->tick);
+}
+
+
+static void list_init(WheelTimer *head)
+{
+    head->prev = head->next = head;
+}
+
+
+static void list_append(WheelTimer *head, WheelTimer *t)
+{
+    t->prev = head->prev;
+    t->next = head;
+    head->prev->next = t;
+    head->prev = t;
+}
+
+
+static void list_unlink(WheelTimer *t)
+{
+    t->prev->next = t->next;
+    t->next->prev = t->prev;
+    t->prev = t->next = NULL;
+}
+
+
+static void wheel_lock(TimerWheel *wheel)
+{
+    if (pthread_mutex_lock(&wheel->lock) != 0)
+        panic(0, "Could not lock timer wheel.");
+}
+
+
+static void wheel_unlock(TimerWheel *wheel)
+{
+    if (pthread_mutex_unlock(&wheel->lock) != 0)
+        panic(0, "Could not unlock timer wheel.");
+}
+
+
+/* Wait until the callback of `t' has returned, unless we are calling it. */
+static void wait_for_callback(WheelTimer *t)
+{
+    TimerWheel *wheel = t->wheel;
+
+    while (t->state == timer_running && t->runner != gwthread_self())
+        pthread_cond_wait(&wheel->done, &wheel->lock);
+}
+
+
+static int unlocked_stop(WheelTimer *t)
+{
+    wait_for_callback(t);
+    if (t->state != timer_pending)
+        return 0;
+    list_unlink(t);
+    t->wheel->len--;
+    t->state = timer_idle;
+    return 1;
+}
+
+
+static void unlocked_start(WheelTimer *t, double seconds)
+{
+    TimerWheel *wheel = t->wheel;
+    double elapsed;
+    long expires;
+
+    if (t->state == timer_pending) {
+        list_unlink(t);
+        wheel->len--;
+    }
+
+    elapsed = (wheel_now() - wheel->start) / wheel->tick;
+    /* an empty wheel doesn't tick, see wheel_thread() */
+    if (wheel->len == 0)
+        wheel->current = (long) elapsed;
+
+    /* the first tick that begins at or after the due time */
+    expires = (long) ceil(elapsed + seconds / wheel->tick);
+    if (expires <= wheel->current)
+        expires = wheel->current + 1;
+
+    t->rounds = (expires - wheel->current - 1) / wheel->nslots;
+    t->state = timer_pending;
+    list_append(&wheel->slots[expires % wheel->nslots], t);
+    if (wheel->len++ == 0)
+        gwthread_wakeup(wheel->thread);
+}
+
+
+/* Move the timers of `slot' that are due to the due list. */
+static void collect_due(TimerWheel *wheel, long slot)
+{
+    WheelTimer *head, *t, *next;
+
+    head = &wheel->slots[slot];
+    for (t = head->next; t != head; t = next) {
+        next = t->next;
+        if (t->rounds > 0) {
+            t->rounds--;
+        } else {
+            list_unlink(t);
+            list_append(&wheel->due, t);
+        }
+    }
+}
+
+
+/* Call the callbacks of the due timers. Called and returns locked. */
+static void run_due(TimerWheel *wheel)
+{
+    WheelTimer *t;
+
+    while ((t = wheel->due.next) != &wheel->due) {
+        list_unlink(t);
+        wheel->len--;
+        t->state = timer_running;
+        t->runner = gwthread_self();
+        wheel_unlock(wheel);
+
+        t->callback(t->data);
+
+        wheel_lock(wheel);
+        if (t->oneshot || t->state == timer_destroyed)
+            gw_free(t);
+        else if (t->state == timer_running)
+            t->state = timer_idle;
+        pthread_cond_broadcast(&wheel->done);
+    }
+}
+
+
+static void wheel_thread(void *arg)
+{
+    TimerWheel *wheel = arg;
+    double next;
+    long now;
+
+    wheel_lock(wheel);
+    while (!wheel->stopping) {
+        now = wheel_ticks(wheel);
+        if (wheel->len == 0)
+            wheel->current = now;
+        while (wheel->current < now) {
+            wheel->current++;
+            collect_due(wheel, wheel->current % wheel->nslots);
+        }
+        run_due(wheel);
+
+        /* sleep until the next tick, or until a timer is started */
+        if (wheel->len == 0)
+            next = -1;
+        else if ((next = wheel->start + (wheel->current + 1) * wheel->tick -
+                         wheel_now()) < 0)
+            next = 0;
+        wheel_unlock(wheel);
+        if (next != 0)
+            gwthread_sleep(next);
+        wheel_lock(wheel);
+    }
+    wheel_unlock(wheel);
+}
+
+
+TimerWheel *gw_timerwheel_create(double tick, long slots)
+{
+    TimerWheel *wheel;
+    long i;
+
+    gw_assert(tick > 0 && slots > 0);
+
+    wheel = gw_malloc(sizeof(*wheel));
+    pthread_mutex_init(&wheel->lock, NULL);
+    pthread_cond_init(&wheel->done, NULL);
+    wheel->slots = gw_malloc(slots * sizeof(*wheel->slots));
+    for (i = 0; i < slots; i++)
+        list_init(&wheel->slots[i]);
+    list_init(&wheel->due);
+    wheel->nslots = slots;
+    wheel->tick = tick;
+    wheel->start = wheel_now();
+    wheel->current = 0;
+    wheel->len = 0;
+    wheel->stopping = 0;
+
+    /* the thread waits for the lock until we know its id */
+    wheel_lock(wheel);
+    if ((wheel->thread = gwthread_create(wheel_thread, wheel)) == -1)
+        panic(0, "Could not start timer wheel thread.");
+    wheel_unlock(wheel);
+
+    return wheel;
+}
+
+
+void gw_timerwheel_destroy(TimerWheel *wheel)
+{
+    WheelTimer *t, *next;
+    long i;
+
+    if (wheel == NULL)
+        return;
+
+    wheel->stopping = 1;
+    gwthread_wakeup(wheel->thread);
+    gwthread_join(wheel->thread);
+
+    /* the others belong to their users */
+    for (i = 0; i < wheel->nslots; i++) {
+        for (t = wheel->slots[i].next; t != &wheel->slots[i]; t = next) {
+            next = t->next;
+            if (t->oneshot)
+                gw_free(t);
+        }
+    }
+    for (t = wheel->due.next; t != &wheel->due; t = next) {
+        next = t->next;
+        if (t->oneshot)
+            gw_free(t);
+    }
+
+    gw_free(wheel->slots);
+    pthread_cond_destroy(&wheel->done);
+    pthread_mutex_destroy(&wheel->lock);
+    gw_free(wheel);
+}
+
+
+void gw_timerwheel_flush(TimerWheel *wheel)
+{
+    long i;
+
+    wheel_lock(wheel);
+    for (i = 0; i < wheel->nslots; i++) {
+        while (wheel->slots[i].next != &wheel->slots[i]) {
+            WheelTimer *t = wheel->slots[i].next;
+
+            list_unlink(t);
+            list_append(&wheel->due, t);
+        }
+    }
+    run_due(wheel);
+    wheel_unlock(wheel);
+}
+
+
+long gw_timerwheel_len(TimerWheel *wheel)
+{
+    long len;
+
+    wheel_lock(wheel);
+    len = wheel->len;
+    wheel_unlock(wheel);
+
+    return len;
+}
+
+
+double gw_timerwheel_next(TimerWheel *wheel)
+{
+    WheelTimer *head, *t;
+    long i, ticks, first;
+    double next;
+
+    wheel_lock(wheel);
+    if (wheel->len == 0) {
+        wheel_unlock(wheel);
+        return -1;
+    }
+    if (wheel->due.next != &wheel->due) {
+        wheel_unlock(wheel);
+        return 0;
+    }
+
+    /*
+     * Walk the slots in the order the wheel visits them. A timer in the
+     * i-th one is due after i ticks plus its rounds, so the first timer
+     * without rounds left ends the search.
+     */
+    first = -1;
+    for (i = 1; i <= wheel->nslots; i++) {
+        head = &wheel->slots[(wheel->current + i) % wheel->nslots];
+        for (t = head->next; t != head; t = t->next) {
+            ticks = t->rounds * wheel->nslots + i;
+            if (first == -1 || ticks < first)
+                first = ticks;
+        }
+        if (first != -1 && first <= i)
+            break;
+    }
+    next = wheel->start + (wheel->current + first) * wheel->tick - wheel_now();
+    wheel_unlock(wheel);
+
+    return next > 0 ? next : 0;
+}
+
+
+void gw_timerwheel_add(TimerWheel *wheel, double seconds,
+                       gw_timer_callback_t *callback, void *data)
+{
+    WheelTimer *t;
+
+    t = gw_wheel_timer_create(wheel, callback, data);
+    t->oneshot = 1;
+    wheel_lock(wheel);
+    unlocked_start(t, seconds);
+    wheel_unlock(wheel);
+}
+
+
+WheelTimer *gw_wheel_timer_create(TimerWheel *wheel,
+                                  gw_timer_callback_t *callback, void *data)
+{
+    WheelTimer *t;
+
+    t = gw_malloc(sizeof(*t));
+    t->prev = t->next = NULL;
+    t->wheel = wheel;
+    t->callback = callback;
+    t->data = data;
+    t->rounds = 0;
+    t->runner = -1;
+    t->state = timer_idle;
+    t->oneshot = 0;
+
+    return t;
+}
+
+
+void gw_wheel_timer_destroy(WheelTimer *t)
+{
+    TimerWheel *wheel;
+
+    if (t == NULL)
+        return;
+
+    wheel = t->wheel;
+    wheel_lock(wheel);
+    unlocked_stop(t);
+    if (t->state == timer_running) {
+        /* from our own callback, run_due() frees us when it returns */
+        t->state = timer_destroyed;
+        t = NULL;
+    }
+    wheel_unlock(wheel);
+    gw_free(t);
+}
+
+
+void gw_wheel_timer_start(WheelTimer *t, double seconds)
+{
+    wheel_lock(t->wheel);
+    unlocked_start(t, seconds);
+    wheel_unlock(t->wheel);
+}
+
+
+int gw_wheel_timer_stop(WheelTimer *t)
+{
+    int ret;
+
+    wheel_lock(t->wheel);
+    ret = unlocked_stop(t);
+    wheel_unlock(t->wheel);
+
+    return ret;
+}
+
+
+int gw_wheel_timer_pending(WheelTimer *t)
+{
+    int ret;
+
+    wheel_lock(t->wheel);
+    ret = t->state == timer_pending;
+    wheel_unlock(t->wheel);
+
+    return ret;
+}
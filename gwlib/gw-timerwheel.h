@@ -0,0 +1,139 @@
+/* ==================================================================== 
+ * The Kannel Software License, Version 1.0 
+ * 
+ * Copyright (c) 2001-2010 Kannel Group  
+ * Copyright (c) 1998-2001 WapIT Ltd.   
+ * All rights reserved. 
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions 
+ * are met: 
+ * 
+ * 1. Redistributions of source code must retain the above copyright 
+ *    notice, this list of conditions and the following disclaimer. 
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in 
+ *    the documentation and/or other materials provided with the 
+ *    distribution. 
+ * 
+ * 3. The end-user documentation included with the redistribution, 
+ *    if any, must include the following acknowledgment: 
+ *       "This product includes software developed by the 
+ *        Kannel Group (http://www.kannel.org/)." 
+ *    Alternately, this acknowledgment may appear in the software itself, 
+ *    if and wherever such third-party acknowledgments normally appear. 
+ * 
+ * 4. The names "Kannel" and "Kannel Group" must not be used to 
+ *    endorse or promote products derived from this software without 
+ *    prior written permission. For written permission, please  
+ *    contact org@kannel.org. 
+ * 
+ * 5. Products derived from this software may not be called "Kannel", 
+ *    nor may "Kannel" appear in their name, without prior written 
+ *    permission of the Kannel Group. 
+ * 
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESSED OR IMPLIED 
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES 
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+ * DISCLAIMED.  IN NO EVENT SHALL THE KANNEL GROUP OR ITS CONTRIBUTORS 
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,  
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT  
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR  
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,  
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE  
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,  
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. 
+ * ==================================================================== 
+ * 
+ * This software consists of voluntary contributions made by many 
+ * individuals on behalf of the Kannel Group.  For more information on  
+ * the Kannel Group, please see <http://www.kannel.org/>. 
+ * 
+ * Portions of this software are based upon software originally written at  
+ * WapIT Ltd., Helsinki, Finland for the Kannel project.  
+ */ 
+
+/*
+ * gw-timerwheel.h: Hashed timer wheel.
+ *
+ * A wheel keeps many timers of about the same length, such as request
+ * deadlines or retry delays, with O(1) start and stop. Time is cut in
+ * ticks; the wheel has a ring of slots and a timer due at tick T sits in
+ * slot T modulo the number of slots, with the count of full turns still
+ * to go. A thread per wheel visits one slot per tick and calls the
+ * callbacks of the timers that are due, so timers fire up to one tick
+ * late and callbacks should be short.
+ *
+ * Timers are owned by their user and can be started and stopped again
+ * as often as needed. One-shot timers started with gw_timerwheel_add()
+ * are owned by the wheel and freed after they fired.
+ */
+
+#ifndef GW_TIMERWHEEL_H
+#define GW_TIMERWHEEL_H
+
+typedef struct TimerWheel TimerWheel;
+typedef struct WheelTimer WheelTimer;
+
+/* Called from the wheel thread when a timer is due. */
+typedef void gw_timer_callback_t(void *data);
+
+/*
+ * Create a wheel of `slots' slots that ticks every `tick' seconds, and
+ * start its thread. Timers up to tick * slots seconds long cost nothing
+ * but their own slot visits.
+ */
+TimerWheel *gw_timerwheel_create(double tick, long slots);
+
+/*
+ * Stop the wheel thread and destroy the wheel. Timers still pending are
+ * dropped without calling their callbacks and must not be used anymore.
+ */
+void gw_timerwheel_destroy(TimerWheel *wheel);
+
+/*
+ * Call the callbacks of all pending timers now, on the calling thread,
+ * as if they were due. Used to drain a wheel before shutdown.
+ */
+void gw_timerwheel_flush(TimerWheel *wheel);
+
+/* Return the number of pending timers. */
+long gw_timerwheel_len(TimerWheel *wheel);
+
+/*
+ * Return the number of seconds until the first pending timer is due, 0
+ * if it is due already, or -1 if no timer is pending. Looks at every
+ * slot, so it is meant for status pages rather than for every timer.
+ */
+double gw_timerwheel_next(TimerWheel *wheel);
+
+/*
+ * Call `callback' with `data' in `seconds' seconds. The timer can't be
+ * stopped.
+ */
+void gw_timerwheel_add(TimerWheel *wheel, double seconds,
+                       gw_timer_callback_t *callback, void *data);
+
+/* Create a stopped timer on `wheel'. */
+WheelTimer *gw_wheel_timer_create(TimerWheel *wheel,
+                                  gw_timer_callback_t *callback, void *data);
+
+/* Stop and destroy a timer. May be called from its own callback. */
+void gw_wheel_timer_destroy(WheelTimer *timer);
+
+/* Start, or restart, the timer to fire in `seconds' seconds. */
+void gw_wheel_timer_start(WheelTimer *timer, double seconds);
+
+/*
+ * Stop the timer. Returns 1 if it was pending, so its callback won't be
+ * called, and 0 if it was not started or has fired already. If the
+ * callback is running on the wheel thread, waits for it to return first,
+ * unless called from that callback.
+ */
+int gw_wheel_timer_stop(WheelTimer *timer);
+
+/* Return 1 if the timer is started and has not fired yet. */
+int gw_wheel_timer_pending(WheelTimer *timer);
+
+#endif
@@ -0,0 +1,259 @@
+/* ==================================================================== 
+ * The Kannel Software License, Version 1.0 
+ * 
+ * Copyright (c) 2001-2010 Kannel Group  
+ * Copyright (c) 1998-2001 WapIT Ltd.   
+ * All rights reserved. 
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions 
+ * are met: 
+ * 
+ * 1. Redistributions of source code must retain the above copyright 
+ *    notice, this list of conditions and the following disclaimer. 
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in 
+ *    the documentation and/or other materials provided with the 
+ *    distribution. 
+ * 
+ * 3. The end-user documentation included with the redistribution, 
+ *    if any, must include the following acknowledgment: 
+ *       "This product includes software developed by the 
+ *        Kannel Group (http://www.kannel.org/)." 
+ *    Alternately, this acknowledgment may appear in the software itself, 
+ *    if and wherever such third-party acknowledgments normally appear. 
+ * 
+ * 4. The names "Kannel" and "Kannel Group" must not be used to 
+ *    endorse or promote products derived from this software without 
+ *    prior written permission. For written permission, please  
+ *    contact org@kannel.org. 
+ * 
+ * 5. Products derived from this software may not be called "Kannel", 
+ *    nor may "Kannel" appear in their name, without prior written 
+ *    permission of the Kannel Group. 
+ * 
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESSED OR IMPLIED 
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES 
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+ * DISCLAIMED.  IN NO EVENT SHALL THE KANNEL GROUP OR ITS CONTRIBUTORS 
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,  
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT  
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR  
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,  
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE  
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,  
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. 
+ * ==================================================================== 
+ * 
+ * This software consists of voluntary contributions made by many 
+ * individuals on behalf of the Kannel Group.  For more information on  
+ * the Kannel Group, please see <http://www.kannel.org/>. 
+ * 
+ * Portions of this software are based upon software originally written at  
+ * WapIT Ltd., Helsinki, Finland for the Kannel project.  
+ */ 
+
+/*
+ * gw-trie.c: Prefix trie for telephone numbers.
+ *
+ * The nodes live in one growing array and refer to each other by index,
+ * index 0 being the root, which is nobody's child, so 0 also means "no
+ * child".
+ */
+
+#include "gw-config.h"
+
+#include "gwlib.h"
+#include "gw-trie.h"
+
+typedef struct {
+    int digit[10];      /* child for '0' to '9' */
+    int other;          /* first child for any other character */
+    int sibling;        /* next child of our parent for other characters */
+    unsigned char ch;   /* our character, if we are one of those */
+    unsigned char is_prefix;
+    void *value;
+} TrieNode;
+
+struct DigitTrie {
+    TrieNode *nodes;
+    long len;
+    long size;
+    long prefixes;
+};
+
+
+static int new_node(DigitTrie *trie, unsigned char ch)
+{
+    TrieNode *node;
+
+    if (trie->len == trie->size) {
+        trie->size = trie->size * 2 + 16;
+        trie->nodes = gw_realloc(trie->nodes, trie->size * sizeof(*trie->nodes));
+    }
+    node = &trie->nodes[trie->len];
+    memset(node, 0, sizeof(*node));
+    node->ch = ch;
+
+    return trie->len++;
+}
+
+
+static int child(DigitTrie *trie, int node, unsigned char ch)
+{
+    int i;
+
+    if (ch >= '0' && ch <= '9')
+        return trie->nodes[node].digit[ch - '0'];
+    for (i = trie->nodes[node].other; i != 0; i = trie->nodes[i].sibling)
+        if (trie->nodes[i].ch == ch)
+            return i;
+    return 0;
+}
+
+
+DigitTrie *gw_trie_create(void)
+{
+    DigitTrie *trie;
+
+    trie = gw_malloc(sizeof(*trie));
+    trie->nodes = NULL;
+    trie->len = trie->size = 0;
+    trie->prefixes = 0;
+    new_node(trie, 0);
+
+    return trie;
+}
+
+
+void gw_trie_destroy(DigitTrie *trie, void (*destroy)(void *value))
+{
+    long i;
+
+    if (trie == NULL)
+        return;
+
+    if (destroy != NULL) {
+        for (i = 0; i < trie->len; i++)
+            if (trie->nodes[i].is_prefix && trie->nodes[i].value != NULL)
+                destroy(trie->nodes[i].value);
+    }
+    gw_free(trie->nodes);
+    gw_free(trie);
+}
+
+
+void **gw_trie_add(DigitTrie *trie, const char *prefix, long len)
+{
+    const unsigned char *p = (const unsigned char *) prefix;
+    int node, next;
+    long i;
+
+    node = 0;
+    for (i = 0; i < len; i++) {
+        if ((next = child(trie, node, p[i])) == 0) {
+            next = new_node(trie, p[i]);
+            if (p[i] >= '0' && p[i] <= '9') {
+                trie->nodes[node].digit[p[i] - '0'] = next;
+            } else {
+                trie->nodes[next].sibling = trie->nodes[node].other;
+                trie->nodes[node].other = next;
+            }
+        }
+        node = next;
+    }
+    if (!trie->nodes[node].is_prefix) {
+        trie->nodes[node].is_prefix = 1;
+        trie->prefixes++;
+    }
+
+    return &trie->nodes[node].value;
+}
+
+
+long gw_trie_match(DigitTrie *trie, const char *number, void **values, long max)
+{
+    const unsigned char *p = (const unsigned char *) number;
+    long n = 0;
+    int node = 0;
+
+    for (;;) {
+        if (trie->nodes[node].is_prefix) {
+            if (n < max)
+                values[n] = trie->nodes[node].value;
+            n++;
+        }
+        if (*p == '\0' || (node = child(trie, node, *p++)) == 0)
+            break;
+    }
+
+    return n;
+}
+
+
+int gw_trie_has_prefix(DigitTrie *trie, const char *number)
+{
+    const unsigned char *p = (const unsigned char *) number;
+    int node = 0;
+
+    for (;;) {
+        if (trie->nodes[node].is_prefix)
+            return 1;
+        if (*p == '\0' || (node = child(trie, node, *p++)) == 0)
+            return 0;
+    }
+}
+
+
+void gw_trie_add_prefixes(DigitTrie *trie, Octstr *list,
+                          void (*visit)(void **value, void *data), void *data)
+{
+    void **value;
+    char *p, *start;
+
+    /*
+     * does_prefix_match() skips all the ';' after a prefix, so only a
+     * leading ';' gives the empty prefix, which matches any number.
+     */
+    p = octstr_get_cstr(list);
+    while (*p != '\0') {
+        start = p;
+        while (*p != '\0' && *p != ';')
+            p++;
+        value = gw_trie_add(trie, start, p - start);
+        if (visit != NULL)
+            visit(value, data);
+        while (*p == ';')
+            p++;
+    }
+}
+
+
+DigitTrie *gw_trie_create_prefixes(Octstr *list)
+{
+    DigitTrie *trie;
+
+    if (list == NULL)
+        return NULL;
+
+    trie = gw_trie_create();
+    gw_trie_add_prefixes(trie, list, NULL, NULL);
+
+    return trie;
+}
+
+
+int gw_trie_prefix_match(DigitTrie *trie, Octstr *number)
+{
+    gw_assert(trie != NULL);
+    gw_assert(number != NULL);
+
+    return gw_trie_has_prefix(trie, octstr_get_cstr(number));
+}
+
+
+long gw_trie_len(DigitTrie *trie)
+{
+    return trie->prefixes;
+}
@@ -0,0 +1,116 @@
+/* ==================================================================== 
+ * The Kannel Software License, Version 1.0 
+ * 
+ * Copyright (c) 2001-2010 Kannel Group  
+ * Copyright (c) 1998-2001 WapIT Ltd.   
+ * All rights reserved. 
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions 
+ * are met: 
+ * 
+ * 1. Redistributions of source code must retain the above copyright 
+ *    notice, this list of conditions and the following disclaimer. 
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in 
+ *    the documentation and/or other materials provided with the 
+ *    distribution. 
+ * 
+ * 3. The end-user documentation included with the redistribution, 
+ *    if any, must include the following acknowledgment: 
+ *       "This product includes software developed by the 
+ *        Kannel Group (http://www.kannel.org/)." 
+ *    Alternately, this acknowledgment may appear in the software itself, 
+ *    if and wherever such third-party acknowledgments normally appear. 
+ * 
+ * 4. The names "Kannel" and "Kannel Group" must not be used to 
+ *    endorse or promote products derived from this software without 
+ *    prior written permission. For written permission, please  
+ *    contact org@kannel.org. 
+ * 
+ * 5. Products derived from this software may not be called "Kannel", 
+ *    nor may "Kannel" appear in their name, without prior written 
+ *    permission of the Kannel Group. 
+ * 
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESSED OR IMPLIED 
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES 
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+ * DISCLAIMED.  IN NO EVENT SHALL THE KANNEL GROUP OR ITS CONTRIBUTORS 
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,  
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT  
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR  
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,  
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE  
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,  
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. 
+ * ==================================================================== 
+ * 
+ * This software consists of voluntary contributions made by many 
+ * individuals on behalf of the Kannel Group.  For more information on  
+ * the Kannel Group, please see <http://www.kannel.org/>. 
+ * 
+ * Portions of this software are based upon software originally written at  
+ * WapIT Ltd., Helsinki, Finland for the Kannel project.  
+ */ 
+
+/*
+ * gw-trie.h: Prefix trie for telephone numbers.
+ *
+ * A DigitTrie maps prefixes, such as number ranges from allowed-prefix,
+ * to values and finds all the prefixes of a number in one pass over its
+ * characters. Nodes have a direct child for each digit; other characters,
+ * like a leading '+', are rare and hang off a short list per node.
+ */
+
+#ifndef GW_TRIE_H
+#define GW_TRIE_H
+
+typedef struct DigitTrie DigitTrie;
+
+/* Create an empty trie. */
+DigitTrie *gw_trie_create(void);
+
+/* Destroy the trie, calling `destroy' for each value unless it is NULL. */
+void gw_trie_destroy(DigitTrie *trie, void (*destroy)(void *value));
+
+/*
+ * Add the `len' characters at `prefix' to the trie and return the address
+ * of their value, which is NULL if the prefix is new. The address is only
+ * valid until the next gw_trie_add().
+ */
+void **gw_trie_add(DigitTrie *trie, const char *prefix, long len);
+
+/*
+ * Find the prefixes of the NUL terminated `number', including the empty
+ * prefix and the whole number, in the trie. Stores the values of the
+ * first `max' of them, shortest first, in `values' and returns how many
+ * there are.
+ */
+long gw_trie_match(DigitTrie *trie, const char *number, void **values, long max);
+
+/* Return 1 if the NUL terminated `number' has a prefix in the trie, else 0. */
+int gw_trie_has_prefix(DigitTrie *trie, const char *number);
+
+/*
+ * Add the prefixes of a list, separated by ';' and read as
+ * does_prefix_match() reads it, to the trie. Calls `visit' with the
+ * address of each prefix's value, as gw_trie_add() returns it, unless
+ * `visit' is NULL.
+ */
+void gw_trie_add_prefixes(DigitTrie *trie, Octstr *list,
+                          void (*visit)(void **value, void *data), void *data);
+
+/*
+ * Compile a prefix list with gw_trie_add_prefixes() into a trie without
+ * values. Return NULL if `list' is NULL.
+ */
+DigitTrie *gw_trie_create_prefixes(Octstr *list);
+
+/* Same result as does_prefix_match() on the list `trie' was compiled from. */
+int gw_trie_prefix_match(DigitTrie *trie, Octstr *number);
+
+/* Return the number of prefixes in the trie. */
+long gw_trie_len(DigitTrie *trie);
+
+#endif
@@ -84,6 +84,7 @@ void gwlib_init(void)
     gwlib_protected_init();
     gwthread_init();
     log_init();
+    gw_dns_init();
     http_init();
     socket_init();
     charset_init();
@@ -96,6 +97,7 @@ void gwlib_shutdown(void)
     gwlib_assert_init();
     charset_shutdown();
     http_shutdown();
+    gw_dns_shutdown();
     socket_shutdown();
     gwthread_shutdown();
     octstr_shutdown();
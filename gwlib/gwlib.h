@@ -103,6 +103,10 @@
 #include "gw_uuid.h"
 #include "gw-rwlock.h"
 #include "gw-prioqueue.h"
+#include "gw-atomic.h"
+#include "gw-dns.h"
+#include "gw-timerwheel.h"
+#include "gw-trie.h"
 
 void gwlib_assert_init(void);
 void gwlib_init(void);
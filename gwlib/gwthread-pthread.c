@@ -60,9 +60,13 @@
  * Richard Braakman
  */
 
+/* for pthread_setaffinity_np and the CPU_SET macros */
+#define _GNU_SOURCE
+
 #include <unistd.h>
 #include <errno.h>
 #include <pthread.h>
+#include <sched.h>
 #include <signal.h>
 #include <string.h>
 
@@ -75,7 +79,7 @@
 /* Maximum number of live threads we can support at once.  Increasing
  * this will increase the size of the threadtable.  Use powers of two
  * for efficiency. */
-#define THREADTABLE_SIZE 1024
+#define THREADTABLE_SIZE GWTHREAD_TABLE_SIZE
 
 struct threadinfo
 {
@@ -831,6 +835,28 @@ int gwthread_cancel(long thread)
 }
 
 
+int gwthread_set_cpu(long cpu)
+{
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+    cpu_set_t set;
+    int ret;
+
+    if (cpu < 0 || cpu >= CPU_SETSIZE)
+        return -1;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if ((ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) != 0) {
+        error(ret, "gwthread_set_cpu: cannot pin thread %ld to CPU %ld",
+              gwthread_self(), cpu);
+        return -1;
+    }
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+
 #ifndef BROKEN_PTHREADS
 
 /* Working pthreads */
@@ -76,6 +76,10 @@
 /* gwthread_self() must return this value for the main thread. */
 #define MAIN_THREAD_ID 0
 
+/* Maximum number of live threads. gwthread_self() % GWTHREAD_TABLE_SIZE
+ * is different for all live threads, so it may index per thread data. */
+#define GWTHREAD_TABLE_SIZE 1024
+
 typedef void gwthread_func_t(void *arg);
 
 /* Called by the gwlib init code */
@@ -153,6 +157,10 @@ void gwthread_sleep_micro(double dseconds);
  * specific error code.
  */
 int gwthread_cancel(long thread); 
+
+/* Pin the calling thread to CPU number `cpu'. Returns 0 on success and
+ * -1 if that failed or threads can't be pinned on this platform. */
+int gwthread_set_cpu(long cpu);
  
 /*
  * Check wheather this thread should handle the given signal.
@@ -90,6 +90,15 @@
 /* define http client connections timeout in seconds (set to -1 for disable) */
 static int http_client_timeout = 240;
 
+/* Number of threads polling the client connections */
+static int http_client_threads = 1;
+
+/* Max connections handed out per host, 0 for no limit */
+static long http_max_host_connections = 0;
+
+/* Max requests pipelined behind the one in progress on a connection */
+static long http_pipeline_depth = 0;
+
 /* define http server connections timeout in seconds (set to -1 for disable) */
 #define HTTP_SERVER_TIMEOUT 60
 /* max accepted clients */
@@ -123,6 +132,16 @@ static enum {
 static Octstr *http_interface = NULL;
 
 
+/*
+ * Constant strings compared against on every request or response.
+ */
+OCTSTR_STATIC(os_close, "close");
+OCTSTR_STATIC(os_keep_alive, "keep-alive");
+OCTSTR_STATIC(os_method_get, "GET");
+OCTSTR_STATIC(os_method_post, "POST");
+OCTSTR_STATIC(os_method_head, "HEAD");
+
+
 /*
  * Read some headers, i.e., until the first empty line (read and discard
  * the empty line as well). Return -1 for error, 0 for all headers read,
@@ -217,6 +236,8 @@ static void proxy_add_authentication(List *headers)
     octstr_binary_to_base64(os);
     octstr_strip_blanks(os);
     octstr_insert(os, octstr_imm("Basic "), 0);
+    /* the request may be sent more than once, e.g. on redirects */
+    http_header_remove_all(headers, "Proxy-Authorization");
     http_header_add(headers, "Proxy-Authorization", octstr_get_cstr(os));
     octstr_destroy(os);
 }
@@ -632,6 +653,12 @@ static int entity_read(HTTPEntity *ent, Connection *conn)
  */
 static List *pending_requests = NULL;
 
+/*
+ * Requests parked in pending_requests' stead while their host name is
+ * looked up, so shutdown can wait for the resolver to hand them back.
+ */
+static Counter *resolving_requests = NULL;
+
 
 /*
  * Have background threads been started?
@@ -646,6 +673,14 @@ static volatile sig_atomic_t client_threads_are_running = 0;
  */
 static FDSet *client_fdset = NULL;
 
+/*
+ * Deadlines of the requests in flight, http_client_timeout seconds from
+ * http_start_request(), see request_expired().
+ */
+#define HTTP_DEADLINE_TICK 0.25
+#define HTTP_DEADLINE_SLOTS 1024
+static TimerWheel *client_deadlines = NULL;
+
 /*
  * Maximum number of HTTP redirections to follow. Making this infinite
  * could cause infinite looping if the redirections loop.
@@ -661,6 +696,17 @@ static char *http_methods[] = {
     "GET", "POST", "HEAD"
 };
 
+/*
+ * A connection handed out to a host whose connections are accounted,
+ * see host_slot_acquire(). Requests pipelined on the connection wait in
+ * `queue' for the response to the one being read.
+ */
+typedef struct {
+    Octstr *key;        /* conn_pool_key of the host */
+    Connection *conn;   /* NULL until the first request has been sent */
+    List *queue;        /* HTTPServer */
+} HTTPPipe;
+
 /*
  * Information about a server we've connected to.
  */
@@ -690,6 +736,9 @@ typedef struct {
     int ssl;
     Octstr *username;	/* For basic authentication */
     Octstr *password;
+    HTTPPipe *pipe;     /* NULL unless host connections are accounted */
+    WheelTimer *deadline; /* NULL if http_client_timeout is disabled */
+    int resolved;       /* answer of the resolver thread: 1 ok, -1 failed */
 } HTTPServer;
 
 
@@ -722,6 +771,9 @@ static HTTPServer *server_create(HTTPCaller *caller, int method, Octstr *url,
     trans->follow_remaining = follow_remaining;
     trans->certkeyfile = octstr_duplicate(certkeyfile);
     trans->ssl = 0;
+    trans->pipe = NULL;
+    trans->deadline = NULL;
+    trans->resolved = 0;
     return trans;
 }
 
@@ -741,26 +793,114 @@ static void server_destroy(void *p)
     octstr_destroy(trans->certkeyfile);
     octstr_destroy(trans->username);
     octstr_destroy(trans->password);
+    gw_wheel_timer_destroy(trans->deadline);
     gw_free(trans);
 }
 
 
+/*
+ * The deadline of trans has passed. Its caller gets a failed result in
+ * its stead right away; trans itself is left to whoever is working on
+ * it, and dropped by server_done() when they are finished.
+ */
+static void request_expired(void *data)
+{
+    HTTPServer *trans = data, *result;
+
+    error(0, "HTTP: Request timed out after %d seconds.", http_client_timeout);
+    result = server_create(trans->caller, trans->method, NULL, NULL, NULL, 0, NULL);
+    result->request_id = trans->request_id;
+    gwlist_produce(result->caller, result);
+}
+
+
+/* Has the caller of trans been told it timed out? */
+static int server_expired(HTTPServer *trans)
+{
+    return trans->deadline != NULL && !gw_wheel_timer_pending(trans->deadline);
+}
+
+
+/* Hand the result of trans to its caller, unless it has timed out. */
+static void server_done(HTTPServer *trans)
+{
+    if (trans->deadline != NULL) {
+        if (!gw_wheel_timer_stop(trans->deadline)) {
+            debug("gwlib.http", 0, "HTTP: Dropping late result for <%s>",
+                  octstr_get_cstr(trans->url));
+            server_destroy(trans);
+            return;
+        }
+        gw_wheel_timer_destroy(trans->deadline);
+        trans->deadline = NULL;
+    }
+    gwlist_produce(trans->caller, trans);
+}
+
+
 /*
  * Pool of open, but unused connections to servers or proxies. Key is
- * "servername:port", value is List with Connection objects.
+ * "servername:port", value is List with PoolConn objects, the most
+ * recently used last. Connections are reused newest first, so surplus
+ * ones age out; they are checked when taken from the pool and expire
+ * after the client timeout, instead of being polled while idle.
  */
+typedef struct {
+    Connection *conn;
+    time_t idle_since;
+} PoolConn;
+
 static Dict *conn_pool;
 static Mutex *conn_pool_lock;
 
+/*
+ * Per host accounting of the connections handed out, used to limit them
+ * and to pipeline requests on them. Keyed like conn_pool and protected
+ * by conn_pool_lock.
+ */
+typedef struct {
+    long active;        /* connections handed out, one HTTPPipe each */
+    List *waiting;      /* HTTPServer waiting for a connection */
+    List *pipes;        /* HTTPPipe */
+} HostState;
+
+static Dict *host_states;
+
 
 static void conn_pool_item_destroy(void *item)
 {
-    gwlist_destroy(item, (void(*)(void*))conn_destroy);
+    List *list = item;
+    PoolConn *pc;
+
+    while ((pc = gwlist_extract_first(list)) != NULL) {
+        conn_destroy(pc->conn);
+        gw_free(pc);
+    }
+    gwlist_destroy(list, NULL);
+}
+
+static void pipe_destroy(void *p)
+{
+    HTTPPipe *pipe = p;
+
+    octstr_destroy(pipe->key);
+    gwlist_destroy(pipe->queue, NULL);
+    gw_free(pipe);
+}
+
+static void host_state_destroy(void *p)
+{
+    HostState *hs = p;
+
+    gwlist_destroy(hs->waiting, server_destroy);
+    gwlist_destroy(hs->pipes, pipe_destroy);
+    gw_free(hs);
 }
 
 static void conn_pool_init(void)
 {
     conn_pool = dict_create(1024, conn_pool_item_destroy);
+    host_states = dict_create(1024, host_state_destroy);
     conn_pool_lock = mutex_create();
 }
 
@@ -768,6 +908,7 @@ static void conn_pool_init(void)
 static void conn_pool_shutdown(void)
 {
     dict_destroy(conn_pool);
+    dict_destroy(host_states);
     mutex_destroy(conn_pool_lock);
 }
 
@@ -784,33 +925,40 @@ static Connection *conn_pool_get(Octstr *host, int port, int ssl, Octstr *certke
 {
     Octstr *key;
     List *list = NULL;
+    PoolConn *pc;
     Connection *conn = NULL;
+    time_t idle = 0;
     int retry;
 
     do {
         retry = 0;
+        pc = NULL;
         key = conn_pool_key(host, port, ssl, certkeyfile, our_host);
         mutex_lock(conn_pool_lock);
         list = dict_get(conn_pool, key);
-        if (list != NULL)
-            conn = gwlist_extract_first(list);
+        if (list != NULL && gwlist_len(list) > 0) {
+            pc = gwlist_get(list, gwlist_len(list) - 1);
+            gwlist_delete(list, gwlist_len(list) - 1, 1);
+        }
         mutex_unlock(conn_pool_lock);
+        if (pc != NULL) {
+            conn = pc->conn;
+            idle = time(NULL) - pc->idle_since;
+            gw_free(pc);
+        }
         /*
-         * Note: we don't hold conn_pool_lock when we check/destroy/unregister
+         * Note: we don't hold conn_pool_lock when we check/destroy
          *       connection because otherwise we can deadlock! And it's even better
          *       not to delay other threads while we check connection.
          */
         if (conn != NULL) {
-#ifdef USE_KEEPALIVE
-            /* unregister our server disconnect callback */
-            conn_unregister(conn);
-#endif 
             /*
              * Check whether the server has closed the connection while
              * it has been in the pool.
              */
             conn_wait(conn, 0);
-            if (conn_eof(conn) || conn_error(conn)) {
+            if (conn_eof(conn) || conn_error(conn) ||
+                (http_client_timeout > 0 && idle >= http_client_timeout)) {
                 debug("gwlib.http", 0, "HTTP:conn_pool_get: Server closed connection, destroying it <%s><%p><fd:%d>.",
                       octstr_get_cstr(key), conn, conn_get_id(conn));
                 conn_destroy(conn);
@@ -839,44 +987,12 @@ static Connection *conn_pool_get(Octstr *host, int port, int ssl, Octstr *certke
 }
 
 #ifdef USE_KEEPALIVE
-static void check_pool_conn(Connection *conn, void *data)
-{
-    Octstr *key = data;
-    
-    if (run_status != running) {
-        conn_unregister(conn);
-        return;
-    }
-    /* check if connection still ok */
-    if (conn_error(conn) || conn_eof(conn)) {
-        List *list;
-        mutex_lock(conn_pool_lock);
-        list = dict_get(conn_pool, key);
-        if (gwlist_delete_equal(list, conn) > 0) {
-            /*
-             * ok, connection was still within pool. So it's
-             * safe to destroy this connection.
-             */
-            debug("gwlib.http", 0, "HTTP: Server closed connection, destroying it <%s><%p><fd:%d>.",
-                  octstr_get_cstr(key), conn, conn_get_id(conn));
-            conn_unregister(conn);
-            conn_destroy(conn);
-        }
-        /*
-         * it's perfectly valid if connection was not found in connection pool because
-         * in 'conn_pool_get' we first removed connection from pool with conn_pool_lock locked
-         * and then check connection for errors with conn_pool_lock unlocked. In the meantime
-         * fdset's poller may call us. So just ignore such "dummy" call.
-        */
-        mutex_unlock(conn_pool_lock);
-    }
-}
-
-
 static void conn_pool_put(Connection *conn, Octstr *host, int port, int ssl, Octstr *certfile, Octstr *our_host)
 {
     Octstr *key;
-    List *list;
+    List *list, *expired = NULL;
+    PoolConn *pc;
+    time_t now = time(NULL);
 
     key = conn_pool_key(host, port, ssl, certfile, our_host);
     mutex_lock(conn_pool_lock);
@@ -885,12 +1001,226 @@ static void conn_pool_put(Connection *conn, Octstr *host, int port, int ssl, Oct
     	list = gwlist_create();
         dict_put(conn_pool, key, list);
     }
-    gwlist_append(list, conn);
-    /* register connection to get server disconnect */
-    conn_register_real(conn, client_fdset, check_pool_conn, key, octstr_destroy_item);
+    /* the oldest connections are first, drop those idle for too long */
+    while (http_client_timeout > 0 && gwlist_len(list) > 0 &&
+           now - ((PoolConn *) gwlist_get(list, 0))->idle_since >= http_client_timeout) {
+        pc = gwlist_get(list, 0);
+        gwlist_delete(list, 0, 1);
+        if (expired == NULL)
+            expired = gwlist_create();
+        gwlist_append(expired, pc);
+    }
+    pc = gw_malloc(sizeof(*pc));
+    pc->conn = conn;
+    pc->idle_since = now;
+    gwlist_append(list, pc);
+    mutex_unlock(conn_pool_lock);
+
+    if (expired != NULL)
+        conn_pool_item_destroy(expired);
+    octstr_destroy(key);
+}
+#endif
+
+
+enum { slot_acquired, slot_pipelined, slot_queued, slot_resolving };
+
+/*
+ * Account a connection to the host of trans. Returns slot_acquired if
+ * trans may take a connection from the pool, slot_queued if the host
+ * has http_max_host_connections handed out and trans was queued until
+ * one is released, or slot_pipelined if trans was sent on a connection
+ * that is busy with another request.
+ */
+static int host_slot_acquire(HTTPServer *trans, Octstr *host, int port, int ssl)
+{
+    HostState *hs;
+    HTTPPipe *pipe, *best = NULL;
+    Octstr *key;
+    long i;
+    int ret;
+
+    /* handed over by host_slot_release() */
+    if (trans->pipe != NULL)
+        return slot_acquired;
+
+    key = conn_pool_key(host, port, ssl, trans->certkeyfile, http_interface);
+    mutex_lock(conn_pool_lock);
+    if ((hs = dict_get(host_states, key)) == NULL) {
+        hs = gw_malloc(sizeof(*hs));
+        hs->active = 0;
+        hs->waiting = gwlist_create();
+        hs->pipes = gwlist_create();
+        dict_put(host_states, key, hs);
+    }
+
+    if (http_max_host_connections <= 0 || hs->active < http_max_host_connections) {
+        pipe = gw_malloc(sizeof(*pipe));
+        pipe->key = key;
+        pipe->conn = NULL;
+        pipe->queue = gwlist_create();
+        gwlist_append(hs->pipes, pipe);
+        hs->active++;
+        trans->pipe = pipe;
+        mutex_unlock(conn_pool_lock);
+        return slot_acquired;
+    }
+
+    /* only idempotent requests are pipelined, RFC 2616 8.1.2.2 */
+    if (http_pipeline_depth > 0 &&
+        (trans->method == HTTP_METHOD_GET || trans->method == HTTP_METHOD_HEAD)) {
+        for (i = 0; i < gwlist_len(hs->pipes); i++) {
+            pipe = gwlist_get(hs->pipes, i);
+            if (pipe->conn != NULL && gwlist_len(pipe->queue) < http_pipeline_depth &&
+                (best == NULL || gwlist_len(pipe->queue) < gwlist_len(best->queue)))
+                best = pipe;
+        }
+    }
+
+    if (best != NULL) {
+        /*
+         * Write the request while holding the lock, so that the order of
+         * the requests on the connection is the order of the queue. Write
+         * errors show up when reading the responses ahead of us.
+         */
+        trans->conn = best->conn;
+        trans->pipe = best;
+        trans->state = reading_status;
+        gwlist_append(best->queue, trans);
+        send_request(trans);
+        ret = slot_pipelined;
+    } else {
+        gwlist_append(hs->waiting, trans);
+        ret = slot_queued;
+    }
+    mutex_unlock(conn_pool_lock);
+    octstr_destroy(key);
+
+    return ret;
+}
+
+/* The first request on the connection of trans has been sent. */
+static void host_slot_connected(HTTPServer *trans)
+{
+    if (trans->pipe == NULL)
+        return;
+
+    mutex_lock(conn_pool_lock);
+    trans->pipe->conn = trans->conn;
+    mutex_unlock(conn_pool_lock);
+}
+
+/*
+ * Take the connection away from pipe, so nothing gets pipelined on it
+ * anymore, and move the requests pipelined on it to orphans. Return the
+ * oldest request waiting for the host, which gets the slot, or NULL if
+ * the slot was given up. We must already have conn_pool_lock.
+ */
+static HTTPServer *unlocked_host_slot_release(HTTPPipe *pipe, List *orphans)
+{
+    HostState *hs;
+    HTTPServer *waiting, *t;
+
+    pipe->conn = NULL;
+    while ((t = gwlist_extract_first(pipe->queue)) != NULL)
+        gwlist_append(orphans, t);
+    hs = dict_get(host_states, pipe->key);
+    if ((waiting = gwlist_extract_first(hs->waiting)) != NULL)
+        waiting->pipe = pipe;
+    else {
+        hs->active--;
+        gwlist_delete_equal(hs->pipes, pipe);
+    }
+
+    return waiting;
+}
+
+/*
+ * Start the request that got the slot, if any, and either fail the
+ * orphans or start them over on another connection.
+ */
+static void host_slot_handover(HTTPPipe *pipe, HTTPServer *waiting,
+                               List *orphans, int fail_pipelined)
+{
+    HTTPServer *t;
+
+    if (waiting != NULL)
+        gwlist_insert(pending_requests, 0, waiting);
+    else
+        pipe_destroy(pipe);
+
+    while ((t = gwlist_extract_first(orphans)) != NULL) {
+        t->conn = NULL;
+        t->pipe = NULL;
+        if (fail_pipelined) {
+            error(0, "Couldn't fetch <%s>", octstr_get_cstr(t->url));
+            t->status = -1;
+            server_done(t);
+        } else {
+            t->state = request_not_sent;
+            gwlist_produce(pending_requests, t);
+        }
+    }
+    gwlist_destroy(orphans, NULL);
+}
+
+/*
+ * The connection of trans is about to be returned to the pool or
+ * destroyed. Hand the slot over to the oldest request waiting for the
+ * host. Requests that were pipelined on the connection are either failed
+ * or started over on another connection.
+ */
+static void host_slot_release(HTTPServer *trans, int fail_pipelined)
+{
+    HTTPPipe *pipe;
+    HTTPServer *waiting;
+    List *orphans;
+
+    if ((pipe = trans->pipe) == NULL)
+        return;
+    trans->pipe = NULL;
+
+    orphans = gwlist_create();
+    mutex_lock(conn_pool_lock);
+    waiting = unlocked_host_slot_release(pipe, orphans);
     mutex_unlock(conn_pool_lock);
+    host_slot_handover(pipe, waiting, orphans, fail_pipelined);
 }
+
+/*
+ * The response to trans has been read. Return the request pipelined
+ * behind it, which then owns the connection. Otherwise the slot is
+ * released in the same hold of conn_pool_lock, before the caller pools
+ * or destroys the connection, so that host_slot_acquire() can't send a
+ * request on it in between.
+ */
+static HTTPServer *host_slot_next(HTTPServer *trans)
+{
+    HTTPPipe *pipe;
+    HTTPServer *next = NULL, *waiting = NULL;
+    List *orphans;
+
+    if ((pipe = trans->pipe) == NULL)
+        return NULL;
+    trans->pipe = NULL;
+
+    orphans = gwlist_create();
+    mutex_lock(conn_pool_lock);
+#ifdef USE_KEEPALIVE
+    if (trans->persistent)
+        next = gwlist_extract_first(pipe->queue);
 #endif
+    if (next == NULL)
+        waiting = unlocked_host_slot_release(pipe, orphans);
+    mutex_unlock(conn_pool_lock);
+
+    if (next == NULL)
+        host_slot_handover(pipe, waiting, orphans, 0);
+    else
+        gwlist_destroy(orphans, NULL);
+
+    return next;
+}
 
 
 HTTPCaller *http_caller_create(void)
@@ -1036,7 +1366,7 @@ static int response_expectation(int method, int status)
 
 static void handle_transaction(Connection *conn, void *data)
 {
-    HTTPServer *trans;
+    HTTPServer *trans, *next = NULL;
     int ret;
     Octstr *h;
     int rc;
@@ -1059,6 +1389,7 @@ static void handle_transaction(Connection *conn, void *data)
 
             if ((rc = send_request(trans)) == 0) {
                 trans->state = reading_status;
+                host_slot_connected(trans);
             } else {
                 debug("gwlib.http", 0, "Failed while sending request");
                 goto error;
@@ -1124,22 +1455,25 @@ static void handle_transaction(Connection *conn, void *data)
      * we're still forcing persistancy of the connection.
      */
     h = http_header_find_first(trans->response->headers, "Connection");
-    if (h != NULL && octstr_case_compare(h, octstr_imm("close")) == 0)
+    if (h != NULL && octstr_case_compare(h, os_close) == 0)
         trans->persistent = 0;
-    if (h != NULL && octstr_case_compare(h, octstr_imm("keep-alive")) == 0)
+    if (h != NULL && octstr_case_compare(h, os_keep_alive) == 0)
         trans->persistent = 1;
     octstr_destroy(h);
     if (proxy_used_for_host(trans->host, trans->url)) {
         h = http_header_find_first(trans->response->headers, "Proxy-Connection");
-        if (h != NULL && octstr_case_compare(h, octstr_imm("close")) == 0)
+        if (h != NULL && octstr_case_compare(h, os_close) == 0)
             trans->persistent = 0;
-        if (h != NULL && octstr_case_compare(h, octstr_imm("keep-alive")) == 0)
+        if (h != NULL && octstr_case_compare(h, os_keep_alive) == 0)
             trans->persistent = 1;
         octstr_destroy(h);
     }
 
+    next = host_slot_next(trans);
 #ifdef USE_KEEPALIVE 
-    if (trans->persistent) {
+    if (next != NULL) {
+        /* the connection stays with the request pipelined behind us */
+    } else if (trans->persistent) {
         if (proxy_used_for_host(trans->host, trans->url))
             conn_pool_put(trans->conn, proxy_hostname, proxy_port, trans->ssl, trans->certkeyfile, http_interface);
         else 
@@ -1147,7 +1481,6 @@ static void handle_transaction(Connection *conn, void *data)
     } else
 #endif
         conn_destroy(trans->conn);
-
     trans->conn = NULL;
 
     /* 
@@ -1198,6 +1531,7 @@ static void handle_transaction(Connection *conn, void *data)
         trans->username = NULL;
         trans->password = NULL;
         trans->ssl = 0;
+        trans->resolved = 0;
         trans->url = h; /* apply new absolute URL to next request */
         trans->state = request_not_sent;
         trans->status = -1;
@@ -1212,17 +1546,24 @@ static void handle_transaction(Connection *conn, void *data)
 
     } else {
         /* handle this response as usual */
-        gwlist_produce(trans->caller, trans);
+        server_done(trans);
+    }
+
+    if (next != NULL) {
+        conn_register(conn, client_fdset, handle_transaction, next);
+        /* its response may already be buffered */
+        handle_transaction(conn, next);
     }
     return;
 
 error:
     conn_unregister(trans->conn);
+    host_slot_release(trans, 1);
     conn_destroy(trans->conn);
     trans->conn = NULL;
     error(0, "Couldn't fetch <%s>", octstr_get_cstr(trans->url));
     trans->status = -1;
-    gwlist_produce(trans->caller, trans);
+    server_done(trans);
 }
 
 
@@ -1535,12 +1876,38 @@ static void parse2trans(HTTPURLParse *p, HTTPServer *t)
               && !t->ssl) ? 1 : 0;
 }
 
-static Connection *get_connection(HTTPServer *trans) 
+/*
+ * A resolver thread has put the host name of a parked request into the
+ * DNS cache, so it can now connect without blocking the write thread.
+ * The answer is kept with the request: the cache entry may already have
+ * expired when it comes around, e.g. with dns-negative-cache-ttl 0, and
+ * asking again would park it once more.
+ */
+static void request_resolved(Octstr *name, int ok, void *data)
+{
+    HTTPServer *trans = data;
+
+    trans->resolved = ok ? 1 : -1;
+    gwlist_produce(pending_requests, trans);
+    counter_decrease(resolving_requests);
+}
+
+
+/*
+ * Get a connection for trans. Returns NULL with *slot set to slot_queued
+ * or slot_pipelined if trans doesn't need one of its own, see
+ * host_slot_acquire(), or to slot_resolving if the host name isn't in
+ * the DNS cache yet and trans comes back through pending_requests once
+ * it is.
+ */
+static Connection *get_connection(HTTPServer *trans, int *slot)
 {
     Connection *conn = NULL;
     Octstr *host;
     HTTPURLParse *p;
     int port, ssl;
+
+    *slot = slot_acquired;
     
     /* if the parsing has not yet been done, then do it now */
     if (!trans->host && trans->port == 0 && trans->url != NULL) {
@@ -1562,6 +1929,26 @@ static Connection *get_connection(HTTPServer *trans)
         ssl = trans->ssl;
     }
 
+    if (trans->resolved < 0) {
+        error(0, "HTTP: Could not resolve host `%s'", octstr_get_cstr(host));
+        goto error;
+    }
+
+    /* don't let a slow resolver hold up the requests queued behind us */
+    if (trans->resolved == 0) {
+        counter_increase(resolving_requests);
+        if (!gw_dns_resolve_async(host, request_resolved, trans)) {
+            *slot = slot_resolving;
+            return NULL;
+        }
+        counter_decrease(resolving_requests);
+    }
+
+    if (http_max_host_connections > 0 || http_pipeline_depth > 0) {
+        if ((*slot = host_slot_acquire(trans, host, port, ssl)) != slot_acquired)
+            return NULL;
+    }
+
     conn = conn_pool_get(host, port, ssl, trans->certkeyfile,
                          http_interface);
     if (conn == NULL)
@@ -1609,9 +1996,12 @@ static int send_request(HTTPServer *trans)
      * by parse_url() before calling this.
      */
 
-    if (trans->username != NULL)
+    if (trans->username != NULL) {
+        /* the request may be sent more than once, e.g. on redirects */
+        http_header_remove_all(trans->request_headers, "Authorization");
         http_add_basic_auth(trans->request_headers, trans->username,
                             trans->password);
+    }
 
     if (proxy_used_for_host(trans->host, trans->url)) {
         proxy_add_authentication(trans->request_headers);
@@ -1636,8 +2026,6 @@ static int send_request(HTTPServer *trans)
     return 0;
 
 error:
-    conn_destroy(trans->conn);
-    trans->conn = NULL;
     octstr_destroy(request);
     error(0, "Couldn't send request to <%s>", octstr_get_cstr(trans->url));
     return -1;
@@ -1652,7 +2040,8 @@ error:
 static void write_request_thread(void *arg)
 {
     HTTPServer *trans;
-    int rc;
+    Connection *conn;
+    int rc, slot;
 
     while (run_status == running) {
         trans = gwlist_consume(pending_requests);
@@ -1661,25 +2050,43 @@ static void write_request_thread(void *arg)
 
         gw_assert(trans->state == request_not_sent);
 
+        /* its caller has given up on it, don't bother the server */
+        if (server_expired(trans)) {
+            host_slot_release(trans, 0);
+            server_done(trans);
+            continue;
+        }
+
         debug("gwlib.http", 0, "Queue contains %ld pending requests.", gwlist_len(pending_requests));
 
         /* 
          * get the connection to use
          * also calls parse_url() to populate the trans values
          */
-        trans->conn = get_connection(trans);
+        conn = get_connection(trans, &slot);
 
-        if (trans->conn == NULL)
-            gwlist_produce(trans->caller, trans);
-        else if (conn_is_connected(trans->conn) == 0) {
+        if (slot != slot_acquired) {
+            /* resolving, queued or pipelined, somebody else owns it now */
+            continue;
+        }
+
+        trans->conn = conn;
+        if (trans->conn == NULL) {
+            host_slot_release(trans, 1);
+            server_done(trans);
+        } else if (conn_is_connected(trans->conn) == 0) {
             debug("gwlib.http", 0, "Socket connected at once");
 
             if ((rc = send_request(trans)) == 0) {
                 trans->state = reading_status;
+                host_slot_connected(trans);
                 conn_register(trans->conn, client_fdset, handle_transaction, 
                                 trans);
             } else {
-                gwlist_produce(trans->caller, trans);
+                conn_destroy(trans->conn);
+                trans->conn = NULL;
+                host_slot_release(trans, 1);
+                server_done(trans);
             }
 
         } else { /* Socket not connected, wait for connection */
@@ -1702,10 +2109,15 @@ static void start_client_threads(void)
 	 */
 	mutex_lock(client_thread_lock);
 	if (!client_threads_are_running) {
-	    client_fdset = fdset_create_real(http_client_timeout);
+	    client_fdset = fdset_create_group(http_client_timeout,
+                                              http_client_threads);
+	    client_deadlines = gw_timerwheel_create(HTTP_DEADLINE_TICK,
+                                                    HTTP_DEADLINE_SLOTS);
 	    if (gwthread_create(write_request_thread, NULL) == -1) {
                 error(0, "HTTP: Could not start client write_request thread.");
                 fdset_destroy(client_fdset);
+                gw_timerwheel_destroy(client_deadlines);
+                client_deadlines = NULL;
                 client_threads_are_running = 0;
             } else
                 client_threads_are_running = 1;
@@ -1728,6 +2140,26 @@ void http_set_client_timeout(long timeout)
     }
 }
 
+void http_set_client_max_host_connections(long max)
+{
+    http_max_host_connections = max;
+}
+
+void http_set_client_pipeline_depth(long depth)
+{
+    http_pipeline_depth = depth;
+}
+
+void http_set_client_threads(int threads)
+{
+    mutex_lock(client_thread_lock);
+    if (client_threads_are_running)
+        warning(0, "HTTP: Client already running, can't change number of its threads.");
+    else
+        http_client_threads = threads;
+    mutex_unlock(client_thread_lock);
+}
+
 void http_start_request(HTTPCaller *caller, int method, Octstr *url, List *headers,
     	    	    	Octstr *body, int follow, void *id, Octstr *certkeyfile)
 {
@@ -1748,9 +2180,14 @@ void http_start_request(HTTPCaller *caller, int method, Octstr *url, List *heade
         trans->request_id = http_start_request;
     else
         trans->request_id = id;
-        
-    gwlist_produce(pending_requests, trans);
+
     start_client_threads();
+    if (http_client_timeout > 0 && client_deadlines != NULL) {
+        trans->deadline = gw_wheel_timer_create(client_deadlines,
+                                                request_expired, trans);
+        gw_wheel_timer_start(trans->deadline, http_client_timeout);
+    }
+    gwlist_produce(pending_requests, trans);
 }
 
 
@@ -1812,6 +2249,7 @@ static void client_init(void)
 {
     pending_requests = gwlist_create();
     gwlist_add_producer(pending_requests);
+    resolving_requests = counter_create();
     client_thread_lock = mutex_create();
 }
 
@@ -1821,10 +2259,15 @@ static void client_shutdown(void)
     gwlist_remove_producer(pending_requests);
     gwthread_join_every(write_request_thread);
     client_threads_are_running = 0;
+    while (counter_value(resolving_requests) > 0)
+        gwthread_sleep(0.1);
+    counter_destroy(resolving_requests);
     gwlist_destroy(pending_requests, server_destroy);
     mutex_destroy(client_thread_lock);
     fdset_destroy(client_fdset);
     client_fdset = NULL;
+    gw_timerwheel_destroy(client_deadlines);
+    client_deadlines = NULL;
     octstr_destroy(http_interface);
     http_interface = NULL;
 }
@@ -1843,8 +2286,8 @@ struct HTTPClient {
     Connection *conn;
     Octstr *ip;
     enum {
-        reading_request_line,
-        reading_request,
+        reading_request_head,
+        reading_request_body,
         request_is_being_handled,
         sending_reply
     } state;
@@ -1854,8 +2297,24 @@ struct HTTPClient {
     int persistent_conn;
     unsigned long conn_time; /* store time for timeouting */
     HTTPEntity *request;
+    /*
+     * The request line and headers as read by conn_read_head(), and the
+     * start and length of each header line in it. The header list for
+     * the application is only built from these in http_accept_request().
+     */
+    Octstr *head;
+    long head_scanned;
+    long *lines;
+    long nlines;
+    long lines_size;
+    int connection;  /* CONNECTION_ bits of the Connection header */
 };
 
+/* What the server found in a request's Connection header. */
+#define CONNECTION_PRESENT      1
+#define CONNECTION_KEEP_ALIVE   2
+#define CONNECTION_CLOSE        4
+
 
 /*
  * Variables related to server side implementation.
@@ -1885,12 +2344,17 @@ static HTTPClient *client_create(int port, Connection *conn, Octstr *ip)
     p->port = port;
     p->conn = conn;
     p->ip = ip;
-    p->state = reading_request_line;
+    p->state = reading_request_head;
     p->url = NULL;
     p->use_version_1_0 = 0;
     p->persistent_conn = 1;
     p->conn_time = time(NULL);
     p->request = NULL;
+    p->head = NULL;
+    p->head_scanned = 0;
+    p->lines = NULL;
+    p->nlines = p->lines_size = 0;
+    p->connection = 0;
     debug("gwlib.http", 0, "HTTP: Created HTTPClient area %p.", p);
     
     /* add this client to active_connections */
@@ -1931,6 +2395,8 @@ static void client_destroy(void *client)
     octstr_destroy(p->ip);
     octstr_destroy(p->url);
     entity_destroy(p->request);
+    octstr_destroy(p->head);
+    gw_free(p->lines);
     gw_free(p);
 }
 
@@ -1939,42 +2405,14 @@ static void client_reset(HTTPClient *p)
 {
     debug("gwlib.http", 0, "HTTP: Resetting HTTPClient for `%s'.",
     	  octstr_get_cstr(p->ip));
-    p->state = reading_request_line;
+    p->state = reading_request_head;
     p->conn_time = time(NULL);
     gw_assert(p->request == NULL);
-}
-
-
-/*
- * Checks whether the client connection is meant to be persistent or not.
- * Returns 1 for true, 0 for false.
- */
-
-static int client_is_persistent(List *headers, int use_version_1_0)
-{
-    Octstr *h = http_header_find_first(headers, "Connection");
-
-    if (h == NULL) {
-        return !use_version_1_0;
-    } else {
-        List *values = octstr_split(h, octstr_imm(","));
-        octstr_destroy(h);
-        if (!use_version_1_0) {
-            if (gwlist_search(values, octstr_imm("keep-alive"), octstr_item_case_match) != NULL) {
-                gwlist_destroy(values, octstr_destroy_item);
-                return 1;
-            } else {
-                gwlist_destroy(values, octstr_destroy_item);
-                return 0;
-            }
-        } else if (gwlist_search(values, octstr_imm("close"), octstr_item_case_match) != NULL) {
-            gwlist_destroy(values, octstr_destroy_item);
-            return 0;
-        }
-        gwlist_destroy(values, octstr_destroy_item);
-    }
-
-    return 1;
+    octstr_destroy(p->head);
+    p->head = NULL;
+    p->head_scanned = 0;
+    p->nlines = 0;
+    p->connection = 0;
 }
 
 
@@ -2024,7 +2462,7 @@ static Octstr *port_key(int port)
 }
 
 
-static struct port *port_add(int port)
+static struct port *port_add(int port, int threads)
 {
     Octstr *key;
     struct port *p;
@@ -2036,7 +2474,7 @@ static struct port *port_add(int port)
         p->clients_with_requests = gwlist_create();
         gwlist_add_producer(p->clients_with_requests);
         p->active_consumers = counter_create();
-        p->server_fdset = fdset_create_real(HTTP_SERVER_TIMEOUT);
+        p->server_fdset = fdset_create_group(HTTP_SERVER_TIMEOUT, threads);
         dict_put(port_collection, key, p);
     } else {
         warning(0, "HTTP: port_add called for existing port (%d)", port);
@@ -2196,11 +2634,11 @@ static int parse_request_line(int *method, Octstr **url,
     version = gwlist_get(words, 2);
     gwlist_destroy(words, NULL);
 
-    if (octstr_compare(method_str, octstr_imm("GET")) == 0)
+    if (octstr_compare(method_str, os_method_get) == 0)
         *method = HTTP_METHOD_GET;
-    else if (octstr_compare(method_str, octstr_imm("POST")) == 0)
+    else if (octstr_compare(method_str, os_method_post) == 0)
         *method = HTTP_METHOD_POST;
-    else if (octstr_compare(method_str, octstr_imm("HEAD")) == 0)
+    else if (octstr_compare(method_str, os_method_head) == 0)
         *method = HTTP_METHOD_HEAD;
     else
         goto error;
@@ -2223,10 +2661,180 @@ error:
 }
 
 
+/* Is the header line at `pos' in `head' called `name'? */
+static int head_line_is_called(Octstr *head, long pos, long len, char *name)
+{
+    long name_len = strlen(name);
+
+    return len > name_len && octstr_get_char(head, pos + name_len) == ':' &&
+           strncasecmp(octstr_get_cstr(head) + pos, name, name_len) == 0;
+}
+
+
+/* Set the CONNECTION_ bits for the tokens of a Connection header value. */
+static int parse_connection_value(Octstr *head, long pos, long end)
+{
+    int ret = CONNECTION_PRESENT;
+    long next, len;
+    char *data;
+
+    data = octstr_get_cstr(head);
+    while (pos < end) {
+        next = octstr_search_char(head, ',', pos);
+        if (next < 0 || next > end)
+            next = end;
+        while (pos < next && isspace(data[pos]))
+            pos++;
+        for (len = next - pos; len > 0 && isspace(data[pos + len - 1]); len--)
+            ;
+        if (len == 10 && strncasecmp(data + pos, "keep-alive", 10) == 0)
+            ret |= CONNECTION_KEEP_ALIVE;
+        else if (len == 5 && strncasecmp(data + pos, "close", 5) == 0)
+            ret |= CONNECTION_CLOSE;
+        pos = next + 1;
+    }
+
+    return ret;
+}
+
+
+/*
+ * Parse the request head in client->head in one pass: the request line,
+ * where each header line is, and the headers the server acts on itself.
+ * Sets up client->request to read the body they announce. Returns -1
+ * for a bad request line.
+ */
+static int parse_request_head(HTTPClient *client)
+{
+    Octstr *head, *line, *te, *cl;
+    HTTPEntity *ent;
+    long pos, end, len;
+    int ret;
+
+    head = client->head;
+    te = cl = NULL;
+
+    end = octstr_search_char(head, 10, 0);
+    len = end;
+    if (len > 0 && octstr_get_char(head, len - 1) == 13)
+        len--;
+    line = octstr_copy(head, 0, len);
+    ret = parse_request_line(&client->method, &client->url,
+                             &client->use_version_1_0, line);
+    octstr_destroy(line);
+    if (ret == -1)
+        return -1;
+
+    client->nlines = 0;
+    for (pos = end + 1; (end = octstr_search_char(head, 10, pos)) >= 0;
+         pos = end + 1) {
+        len = end - pos;
+        if (len > 0 && octstr_get_char(head, end - 1) == 13)
+            len--;
+        if (len == 0)
+            break;
+
+        if (client->nlines == client->lines_size) {
+            client->lines_size = client->lines_size ? 2 * client->lines_size : 16;
+            client->lines = gw_realloc(client->lines,
+                                       2 * client->lines_size * sizeof(long));
+        }
+        client->lines[2 * client->nlines] = pos;
+        client->lines[2 * client->nlines + 1] = len;
+        client->nlines++;
+
+        /* only the first of each counts, as with http_header_find_first() */
+        if (te == NULL && head_line_is_called(head, pos, len, "Transfer-Encoding"))
+            te = octstr_copy(head, pos + 18, len - 18);
+        else if (cl == NULL && head_line_is_called(head, pos, len, "Content-Length"))
+            cl = octstr_copy(head, pos + 15, len - 15);
+        else if (client->connection == 0 &&
+                 head_line_is_called(head, pos, len, "Connection"))
+            client->connection = parse_connection_value(head, pos + 11, pos + len);
+    }
+
+    /*
+     * RFC2616 (4.3) says we should read a message body if there
+     * is one, even on GET requests. The rules are the ones of
+     * deduce_body_state().
+     */
+    client->request = ent = entity_create(expect_body_if_indicated);
+    if (te != NULL) {
+        octstr_strip_blanks(te);
+        if (octstr_str_compare(te, "chunked") != 0) {
+            error(0, "HTTP: Unknown Transfer-Encoding <%s>",
+                  octstr_get_cstr(te));
+            ent->state = body_error;
+        } else
+            ent->state = reading_chunked_body_len;
+    } else if (cl != NULL) {
+        octstr_strip_blanks(cl);
+        if (octstr_parse_long(&ent->expected_body_len, cl, 0, 10) == -1 ||
+            ent->expected_body_len < 0) {
+            error(0, "HTTP: Content-Length header wrong: <%s>",
+                  octstr_get_cstr(cl));
+            ent->state = body_error;
+        } else if (ent->expected_body_len == 0)
+            ent->state = entity_done;
+        else
+            ent->state = reading_body_with_length;
+    } else
+        ent->state = entity_done;
+
+    octstr_destroy(te);
+    octstr_destroy(cl);
+
+    return 0;
+}
+
+
+/*
+ * Build the header list of the request from the positions recorded by
+ * parse_request_head(), followed by any trailers of a chunked body.
+ */
+static List *client_headers(HTTPClient *client)
+{
+    List *headers;
+    Octstr *h, *prev = NULL;
+    long i, pos, len;
+
+    headers = http_create_empty_headers();
+    for (i = 0; i < client->nlines; i++) {
+        pos = client->lines[2 * i];
+        len = client->lines[2 * i + 1];
+        /* a continuation line, as in read_some_headers() */
+        if (prev != NULL && isspace(octstr_get_char(client->head, pos))) {
+            octstr_append_data(prev, octstr_get_cstr(client->head) + pos, len);
+            continue;
+        }
+        h = octstr_copy(client->head, pos, len);
+        gwlist_append(headers, h);
+        prev = h;
+    }
+    while ((h = gwlist_extract_first(client->request->headers)) != NULL)
+        gwlist_append(headers, h);
+
+    return headers;
+}
+
+
+static void receive_request(Connection *conn, void *data);
+
+/*
+ * Make sure we get called again when more of the request arrives. This is a
+ * cheap callback swap if the connection is already registered, and registers
+ * it if we were entered directly from http_send_reply() to serve a
+ * pipelined request that was already buffered.
+ */
+static void client_wait_request(HTTPClient *client)
+{
+    conn_register(client->conn, port_get_fdset(client->port), receive_request, client);
+}
+
+
 static void receive_request(Connection *conn, void *data)
 {
     HTTPClient *client;
-    Octstr *line;
     int ret;
 
     if (run_status != running) {
@@ -2238,16 +2846,15 @@ static void receive_request(Connection *conn, void *data)
     
     for (;;) {
         switch (client->state) {
-            case reading_request_line:
-                line = conn_read_line(conn);
-                if (line == NULL) {
+            case reading_request_head:
+                client->head = conn_read_head(conn, &client->head_scanned);
+                if (client->head == NULL) {
                     if (conn_eof(conn) || conn_error(conn))
                         goto error;
+                    client_wait_request(client);
                     return;
                 }
-                ret = parse_request_line(&client->method, &client->url,
-                                         &client->use_version_1_0, line);
-                octstr_destroy(line);
+                ret = parse_request_head(client);
                 /* client sent bad request? */
                 if (ret == -1) {
                     /*
@@ -2260,15 +2867,10 @@ static void receive_request(Connection *conn, void *data)
                     http_send_reply(client, HTTP_BAD_REQUEST, NULL, NULL);
                     return;
                 }
-                /*
-                 * RFC2616 (4.3) says we should read a message body if there
-                 * is one, even on GET requests.
-                 */
-                client->request = entity_create(expect_body_if_indicated);
-                client->state = reading_request;
+                client->state = reading_request_body;
                 break;
                 
-            case reading_request:
+            case reading_request_body:
                 ret = entity_read(client->request, conn);
                 if (ret < 0)
                     goto error;
@@ -2276,7 +2878,8 @@ static void receive_request(Connection *conn, void *data)
                     client->state = request_is_being_handled;
                     conn_unregister(conn);
                     port_put_request(client);
-                }
+                } else
+                    client_wait_request(client);
                 return;
                 
             case sending_reply:
@@ -2380,15 +2983,16 @@ static void server_thread(void *dummy)
                 } else {
                     Octstr *client_ip = host_ip(addr);
                     /*
-                     * Be aware that conn_wrap_fd() will return NULL if SSL 
-                     * handshake has failed, so we only client_create() if
-                     * there is an conn.
-                     */             
+                     * conn_wrap_fd() does not do the SSL handshake, it is
+                     * driven by the server fdset once the connection is
+                     * registered, so a slow client can't stall the accept
+                     * loop. It returns NULL if the SSL setup failed.
+                     */
                     if ((conn = conn_wrap_fd(fd, ports[i]->ssl))) {
                         client = client_create(ports[i]->port, conn, client_ip);
                         conn_register(conn, ports[i]->server_fdset, receive_request, client);
                     } else {
-                        error(0, "HTTP: unsuccessful SSL handshake for client `%s'",
+                        error(0, "HTTP: unsuccessful SSL setup for client `%s'",
                         octstr_get_cstr(client_ip));
                         octstr_destroy(client_ip);
                     }
@@ -2455,7 +3059,7 @@ void http_set_server_timeout(int port, long timeout)
 }
 
 
-int http_open_port_if(int port, int ssl, Octstr *interface)
+int http_open_port_threads(int port, int ssl, Octstr *interface, int threads)
 {
     struct port *p;
 
@@ -2463,7 +3067,7 @@ int http_open_port_if(int port, int ssl, Octstr *interface)
         info(0, "HTTP: Opening SSL server at port %d.", port);
     else 
         info(0, "HTTP: Opening server at port %d.", port);
-    p = port_add(port);
+    p = port_add(port, threads);
     p->port = port;
     p->ssl = ssl;
     p->fd = make_server_socket(port, (interface ? octstr_get_cstr(interface) : NULL));
@@ -2481,6 +3085,12 @@ int http_open_port_if(int port, int ssl, Octstr *interface)
 }
 
 
+int http_open_port_if(int port, int ssl, Octstr *interface)
+{
+    return http_open_port_threads(port, ssl, interface, 1);
+}
+
+
 int http_open_port(int port, int ssl)
 {
     return http_open_port_if(port, ssl, NULL);
@@ -2579,7 +3189,7 @@ HTTPClient *http_accept_request(int port, Octstr **client_ip, Octstr **url,
     
     *client_ip = octstr_duplicate(client->ip);
     *url = client->url;
-    *headers = client->request->headers;
+    *headers = client_headers(client);
     *body = client->request->body;
     *cgivars = parse_cgivars(client->url);
     
@@ -2588,14 +3198,23 @@ HTTPClient *http_accept_request(int port, Octstr **client_ip, Octstr **url,
         *body = NULL;
     }
     
-    client->persistent_conn = client_is_persistent(client->request->headers,
-                                                   client->use_version_1_0);
+    /*
+     * HTTP/1.1 connections persist unless a Connection header leaves out
+     * keep-alive, HTTP/1.0 ones only if there is one without close.
+     */
+    if (!(client->connection & CONNECTION_PRESENT))
+        client->persistent_conn = !client->use_version_1_0;
+    else if (!client->use_version_1_0)
+        client->persistent_conn = (client->connection & CONNECTION_KEEP_ALIVE) != 0;
+    else
+        client->persistent_conn = (client->connection & CONNECTION_CLOSE) == 0;
     
     client->url = NULL;
-    client->request->headers = NULL;
     client->request->body = NULL;
     entity_destroy(client->request);
     client->request = NULL;
+    octstr_destroy(client->head);
+    client->head = NULL;
     
     return client;
 }
@@ -2703,7 +3322,15 @@ void http_send_reply(HTTPClient *client, int status, List *headers,
         } else {
             /* XXX mark this HTTPClient in the keep-alive cleaner thread */
             client_reset(client);
-            conn_register(client->conn, port_get_fdset(client->port), receive_request, client);
+            /*
+             * A pipelining client may already have sent its next request;
+             * it sits in our inbuf and no POLLIN will announce it, so parse
+             * it now. We are unregistered, so the poller can't race us.
+             */
+            if (conn_inbuf_len(client->conn) > 0)
+                receive_request(client->conn, client);
+            else
+                conn_register(client->conn, port_get_fdset(client->port), receive_request, client);
         }
     }
     /* queued for sending, we don't want to block */
@@ -302,6 +302,27 @@ void http_set_interface(const Octstr *our_host);
  */
 void http_set_client_timeout(long timeout);
 
+/**
+ * Define number of threads that read responses from HTTP servers, so
+ * that responses on different connections are handled in parallel.
+ * Only has an effect before the first request is started. Default 1.
+ */
+void http_set_client_threads(int threads);
+
+/**
+ * Define the maximum number of connections the HTTP client keeps open
+ * to any one host (or proxy). Further requests to the host are queued
+ * until a connection is free. 0, the default, means no limit.
+ */
+void http_set_client_max_host_connections(long max);
+
+/**
+ * Define how many GET and HEAD requests may be pipelined behind the one
+ * in progress on a keep-alive connection, once a host has reached its
+ * connection limit. 0, the default, disables pipelining.
+ */
+void http_set_client_pipeline_depth(long depth);
+
 /*
  * Functions for doing a GET request. The difference is that _real follows
  * redirections, plain http_get does not. Return value is the status
@@ -417,6 +438,13 @@ int http_open_port(int port, int ssl);
 int http_open_port_if(int port, int ssl, Octstr *interface);
 
 
+/*
+ * Same as above, but read and parse the requests of the clients of this
+ * port in `threads' threads instead of one.
+ */
+int http_open_port_threads(int port, int ssl, Octstr *interface, int threads);
+
+
 /*
  * Accept a request from a client to the specified open port. Return NULL
  * if the port is closed, otherwise a pointer to a client descriptor.
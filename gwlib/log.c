@@ -703,6 +703,27 @@ void debug(const char *place, int err, const char *fmt, ...)
 }
 
 
+int log_debug_enabled(const char *place)
+{
+    int i, ret;
+
+    if (!place_should_be_logged(place) || place_is_not_logged(place))
+        return 0;
+    if (dosyslog && GW_DEBUG >= sysloglevel)
+        return 1;
+
+    ret = 0;
+    gw_rwlock_rdlock(&rwlock);
+    for (i = 0; i < num_logfiles && ret == 0; ++i) {
+        if (logfiles[i].file != NULL && GW_DEBUG >= logfiles[i].minimum_output_level)
+            ret = 1;
+    }
+    gw_rwlock_unlock(&rwlock);
+
+    return ret;
+}
+
+
 void log_set_debug_places(const char *places) 
 {
     char *p;
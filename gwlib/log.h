@@ -135,6 +135,12 @@ void debug(const char *, int, const char *, ...) PRINTFLIKE(3,4);
  */
 void log_set_debug_places(const char *places);
 
+/*
+ * Return 1 if a debug message from `place' would be written anywhere, so
+ * that callers can skip building expensive debug output, else 0.
+ */
+int log_debug_enabled(const char *place);
+
 /* Set minimum level for output messages to stderr. Messages with a lower 
    level are not printed to standard error, but may be printed to files
    (see below). */
@@ -0,0 +1,732 @@
+/* ==================================================================== 
+ * The Kannel Software License, Version 1.0 
+ * 
+ * Copyright (c) 2001-2010 Kannel Group  
+ * Copyright (c) 1998-2001 WapIT Ltd.   
+ * All rights reserved. 
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions 
+ * are met: 
+ * 
+ * 1. Redistributions of source code must retain the above copyright 
+ *    notice, this list of conditions and the following disclaimer. 
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in 
+ *    the documentation and/or other materials provided with the 
+ *    distribution. 
+ * 
+ * 3. The end-user documentation included with the redistribution, 
+ *    if any, must include the following acknowledgment: 
+ *       "This product includes software developed by the 
+ *        Kannel Group (http://www.kannel.org/)." 
+ *    Alternately, this acknowledgment may appear in the software itself, 
+ *    if and wherever such third-party acknowledgments normally appear. 
+ * 
+ * 4. The names "Kannel" and "Kannel Group" must not be used to 
+ *    endorse or promote products derived from this software without 
+ *    prior written permission. For written permission, please  
+ *    contact org@kannel.org. 
+ * 
+ * 5. Products derived from this software may not be called "Kannel", 
+ *    nor may "Kannel" appear in their name, without prior written 
+ *    permission of the Kannel Group. 
+ * 
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESSED OR IMPLIED 
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES 
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+ * DISCLAIMED.  IN NO EVENT SHALL THE KANNEL GROUP OR ITS CONTRIBUTORS 
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,  
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT  
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR  
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,  
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE  
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,  
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. 
+ * ==================================================================== 
+ * 
+ * This software consists of voluntary contributions made by many 
+ * individuals on behalf of the Kannel Group.  For more information on  
+ * the Kannel Group, please see <http://www.kannel.org/>. 
+ * 
+ * Portions of this software are based upon software originally written at  
+ * WapIT Ltd., Helsinki, Finland for the Kannel project.  
+ */ 
+
+/*
+ * octstr-simd.c - plain C, SSE2 and AVX2 kernels for octstr.c
+ *
+ * The vector search kernels compare the first and the last octet of
+ * the needle against 16 or 32 positions of the haystack at once and
+ * only look at the rest of the needle where both match. The base64
+ * encoder follows Wojciech Mula's pshufb based method, which needs a
+ * byte shuffle, so the SSE2 set uses the plain C encoder.
+ */
+
+#include <ctype.h>
+#include <string.h>
+
+/* Before gwlib.h, which hides malloc and free from mm_malloc.h */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && \
+    (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9) || defined(__clang__))
+#define OCTSTR_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+#include "gwlib.h"
+#include "octstr-simd.h"
+
+
+/*
+ * Characters octstr_url_encode leaves as such, see RFC 2396. Space is
+ * not among them, it is counted separately since it becomes '+'.
+ */
+static const char url_safe_chars[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+    "abcdefghijklmnopqrstuvwxyz-_.!~*'()";
+
+static char url_safe[256];
+static signed char hex_value[256];
+
+static const unsigned char base64_chars[64] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+
+/***********************************************************************
+ * Plain C kernels.
+ */
+
+
+static long search_c(const unsigned char *hay, long hlen,
+                     const unsigned char *needle, long nlen)
+{
+    const unsigned char *p, *last;
+
+    if (nlen > hlen)
+        return -1;
+
+    p = hay;
+    last = hay + hlen - nlen;
+    while (p <= last) {
+        p = memchr(p, needle[0], last - p + 1);
+        if (p == NULL)
+            return -1;
+        if (memcmp(p + 1, needle + 1, nlen - 1) == 0)
+            return p - hay;
+        p++;
+    }
+    return -1;
+}
+
+
+static int case_equal(const unsigned char *a, const unsigned char *b, long n)
+{
+    long i;
+
+    for (i = 0; i < n; ++i)
+        if (toupper(a[i]) != toupper(b[i]))
+            return 0;
+    return 1;
+}
+
+
+static long case_search_c(const unsigned char *hay, long hlen,
+                          const unsigned char *needle, long nlen)
+{
+    long i;
+    int first;
+
+    first = toupper(needle[0]);
+    for (i = 0; i <= hlen - nlen; ++i)
+        if (toupper(hay[i]) == first && case_equal(hay + i, needle, nlen))
+            return i;
+    return -1;
+}
+
+
+static long url_unsafe_c(const unsigned char *s, long len, long *spaces)
+{
+    long i, n, sp;
+
+    n = sp = 0;
+    for (i = 0; i < len; ++i) {
+        if (s[i] == ' ')
+            sp++;
+        else if (!url_safe[s[i]])
+            n++;
+    }
+    *spaces = sp;
+    return n;
+}
+
+
+static long url_special_c(const unsigned char *s, long len)
+{
+    long i;
+
+    for (i = 0; i < len; ++i)
+        if (s[i] == '%' || s[i] == '+' || s[i] == '\0')
+            break;
+    return i;
+}
+
+
+static int hex_check_c(const unsigned char *src, long len)
+{
+    long i;
+
+    for (i = 0; i < len; ++i)
+        if (hex_value[src[i]] < 0)
+            return -1;
+    return 0;
+}
+
+
+static void hex_pack_c(unsigned char *dst, const unsigned char *src, long pairs)
+{
+    long i;
+
+    for (i = 0; i < pairs; ++i)
+        dst[i] = hex_value[src[2 * i]] << 4 | hex_value[src[2 * i + 1]];
+}
+
+
+static int hex_decode_c(unsigned char *dst, const unsigned char *src, long len)
+{
+    if (hex_check_c(src, len) == -1)
+        return -1;
+    hex_pack_c(dst, src, len / 2);
+    return 0;
+}
+
+
+static void base64_encode_c(unsigned char *dst, const unsigned char *src,
+                            long triplets, long avail)
+{
+    long i, t;
+
+    for (i = 0; i < triplets; ++i, src += 3, dst += 4) {
+        t = (src[0] << 16) | (src[1] << 8) | src[2];
+        dst[0] = base64_chars[(t >> 18) & 63];
+        dst[1] = base64_chars[(t >> 12) & 63];
+        dst[2] = base64_chars[(t >> 6) & 63];
+        dst[3] = base64_chars[t & 63];
+    }
+}
+
+
+static const OctstrKernels kernels_c = {
+    "c",
+    search_c,
+    case_search_c,
+    url_unsafe_c,
+    url_special_c,
+    hex_decode_c,
+    base64_encode_c
+};
+
+
+#ifdef OCTSTR_X86_SIMD
+
+/***********************************************************************
+ * SSE2 kernels. All loads are unaligned and stay within the buffers;
+ * whatever is left over at the end goes to the plain C kernels.
+ */
+
+#define SSE2 __attribute__((target("sse2")))
+
+
+/* Fold ASCII upper case letters to lower case. */
+SSE2 static inline __m128i fold_sse2(__m128i x)
+{
+    __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8('A' - 1)),
+                                  _mm_cmplt_epi8(x, _mm_set1_epi8('Z' + 1)));
+    return _mm_add_epi8(x, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+}
+
+
+/* Mask of octets in [lo, hi]; only for ASCII bounds. */
+SSE2 static inline __m128i range_sse2(__m128i x, char lo, char hi)
+{
+    return _mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8(lo - 1)),
+                         _mm_cmplt_epi8(x, _mm_set1_epi8(hi + 1)));
+}
+
+
+SSE2 static long search_sse2(const unsigned char *hay, long hlen,
+                             const unsigned char *needle, long nlen)
+{
+    __m128i first, last, a, b;
+    unsigned mask;
+    long i, r;
+
+    first = _mm_set1_epi8(needle[0]);
+    last = _mm_set1_epi8(needle[nlen - 1]);
+    for (i = 0; i + nlen - 1 + 16 <= hlen; i += 16) {
+        a = _mm_loadu_si128((const __m128i *) (hay + i));
+        b = _mm_loadu_si128((const __m128i *) (hay + i + nlen - 1));
+        mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first),
+                                               _mm_cmpeq_epi8(b, last)));
+        while (mask != 0) {
+            r = i + __builtin_ctz(mask);
+            if (memcmp(hay + r + 1, needle + 1, nlen - 2) == 0)
+                return r;
+            mask &= mask - 1;
+        }
+    }
+    r = search_c(hay + i, hlen - i, needle, nlen);
+    return r == -1 ? -1 : r + i;
+}
+
+
+SSE2 static long case_search_sse2(const unsigned char *hay, long hlen,
+                                  const unsigned char *needle, long nlen)
+{
+    __m128i first, last, a, b;
+    unsigned mask;
+    long i, r;
+
+    first = fold_sse2(_mm_set1_epi8(needle[0]));
+    last = fold_sse2(_mm_set1_epi8(needle[nlen - 1]));
+    for (i = 0; i + nlen - 1 + 16 <= hlen; i += 16) {
+        a = fold_sse2(_mm_loadu_si128((const __m128i *) (hay + i)));
+        b = fold_sse2(_mm_loadu_si128((const __m128i *) (hay + i + nlen - 1)));
+        mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first),
+                                               _mm_cmpeq_epi8(b, last)));
+        while (mask != 0) {
+            r = i + __builtin_ctz(mask);
+            if (case_equal(hay + r, needle, nlen))
+                return r;
+            mask &= mask - 1;
+        }
+    }
+    r = case_search_c(hay + i, hlen - i, needle, nlen);
+    return r == -1 ? -1 : r + i;
+}
+
+
+SSE2 static long url_unsafe_sse2(const unsigned char *s, long len, long *spaces)
+{
+    __m128i x, safe, space;
+    long i, n, sp, tail_sp;
+
+    n = sp = 0;
+    for (i = 0; i + 16 <= len; i += 16) {
+        x = _mm_loadu_si128((const __m128i *) (s + i));
+        space = _mm_cmpeq_epi8(x, _mm_set1_epi8(' '));
+        safe = _mm_or_si128(range_sse2(x, '0', '9'),
+                            range_sse2(_mm_or_si128(x, _mm_set1_epi8(0x20)),
+                                       'a', 'z'));
+        safe = _mm_or_si128(safe, range_sse2(x, '\'', '*'));
+        safe = _mm_or_si128(safe, range_sse2(x, '-', '.'));
+        safe = _mm_or_si128(safe, _mm_cmpeq_epi8(x, _mm_set1_epi8('!')));
+        safe = _mm_or_si128(safe, _mm_cmpeq_epi8(x, _mm_set1_epi8('_')));
+        safe = _mm_or_si128(safe, _mm_cmpeq_epi8(x, _mm_set1_epi8('~')));
+        sp += __builtin_popcount(_mm_movemask_epi8(space));
+        n += 16 - __builtin_popcount(_mm_movemask_epi8(_mm_or_si128(safe, space)));
+    }
+    n += url_unsafe_c(s + i, len - i, &tail_sp);
+    *spaces = sp + tail_sp;
+    return n;
+}
+
+
+SSE2 static long url_special_sse2(const unsigned char *s, long len)
+{
+    __m128i x, hit;
+    unsigned mask;
+    long i;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+        x = _mm_loadu_si128((const __m128i *) (s + i));
+        hit = _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('%')),
+                           _mm_cmpeq_epi8(x, _mm_set1_epi8('+')));
+        hit = _mm_or_si128(hit, _mm_cmpeq_epi8(x, _mm_setzero_si128()));
+        mask = _mm_movemask_epi8(hit);
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+    return i + url_special_c(s + i, len - i);
+}
+
+
+/*
+ * Turn hex digits into their values; `valid' gets all ones for the
+ * octets that are hex digits.
+ */
+SSE2 static inline __m128i hex_values_sse2(__m128i x, __m128i *valid)
+{
+    __m128i digit, lower, alpha;
+
+    digit = range_sse2(x, '0', '9');
+    lower = _mm_or_si128(x, _mm_set1_epi8(0x20));
+    alpha = range_sse2(lower, 'a', 'f');
+    *valid = _mm_or_si128(digit, alpha);
+    return _mm_or_si128(
+        _mm_and_si128(digit, _mm_sub_epi8(x, _mm_set1_epi8('0'))),
+        _mm_and_si128(alpha, _mm_sub_epi8(lower, _mm_set1_epi8('a' - 10))));
+}
+
+
+/* Combine pairs of nibble values in 16 bit words to octets. */
+SSE2 static inline __m128i hex_combine_sse2(__m128i v)
+{
+    return _mm_or_si128(
+        _mm_slli_epi16(_mm_and_si128(v, _mm_set1_epi16(0x00ff)), 4),
+        _mm_srli_epi16(v, 8));
+}
+
+
+SSE2 static int hex_decode_sse2(unsigned char *dst, const unsigned char *src, long len)
+{
+    __m128i v, valid;
+    long i, pairs;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+        hex_values_sse2(_mm_loadu_si128((const __m128i *) (src + i)), &valid);
+        if (_mm_movemask_epi8(valid) != 0xffff)
+            return -1;
+    }
+    if (hex_check_c(src + i, len - i) == -1)
+        return -1;
+
+    pairs = len / 2;
+    for (i = 0; i + 8 <= pairs; i += 8) {
+        v = hex_values_sse2(_mm_loadu_si128((const __m128i *) (src + 2 * i)),
+                            &valid);
+        v = hex_combine_sse2(v);
+        _mm_storel_epi64((__m128i *) (dst + i), _mm_packus_epi16(v, v));
+    }
+    hex_pack_c(dst + i, src + 2 * i, pairs - i);
+    return 0;
+}
+
+
+static const OctstrKernels kernels_sse2 = {
+    "sse2",
+    search_sse2,
+    case_search_sse2,
+    url_unsafe_sse2,
+    url_special_sse2,
+    hex_decode_sse2,
+    base64_encode_c
+};
+
+
+/***********************************************************************
+ * AVX2 kernels. The same algorithms as above, 32 octets at a time.
+ */
+
+#define AVX2 __attribute__((target("avx2")))
+
+
+AVX2 static inline __m256i fold_avx2(__m256i x)
+{
+    __m256i upper = _mm256_and_si256(
+        _mm256_cmpgt_epi8(x, _mm256_set1_epi8('A' - 1)),
+        _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), x));
+    return _mm256_add_epi8(x, _mm256_and_si256(upper, _mm256_set1_epi8(0x20)));
+}
+
+
+AVX2 static inline __m256i range_avx2(__m256i x, char lo, char hi)
+{
+    return _mm256_and_si256(_mm256_cmpgt_epi8(x, _mm256_set1_epi8(lo - 1)),
+                            _mm256_cmpgt_epi8(_mm256_set1_epi8(hi + 1), x));
+}
+
+
+AVX2 static long search_avx2(const unsigned char *hay, long hlen,
+                             const unsigned char *needle, long nlen)
+{
+    __m256i first, last, a, b;
+    unsigned mask;
+    long i, r;
+
+    first = _mm256_set1_epi8(needle[0]);
+    last = _mm256_set1_epi8(needle[nlen - 1]);
+    for (i = 0; i + nlen - 1 + 32 <= hlen; i += 32) {
+        a = _mm256_loadu_si256((const __m256i *) (hay + i));
+        b = _mm256_loadu_si256((const __m256i *) (hay + i + nlen - 1));
+        mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, first),
+                                                     _mm256_cmpeq_epi8(b, last)));
+        while (mask != 0) {
+            r = i + __builtin_ctz(mask);
+            if (memcmp(hay + r + 1, needle + 1, nlen - 2) == 0)
+                return r;
+            mask &= mask - 1;
+        }
+    }
+    r = search_sse2(hay + i, hlen - i, needle, nlen);
+    return r == -1 ? -1 : r + i;
+}
+
+
+AVX2 static long case_search_avx2(const unsigned char *hay, long hlen,
+                                  const unsigned char *needle, long nlen)
+{
+    __m256i first, last, a, b;
+    unsigned mask;
+    long i, r;
+
+    first = fold_avx2(_mm256_set1_epi8(needle[0]));
+    last = fold_avx2(_mm256_set1_epi8(needle[nlen - 1]));
+    for (i = 0; i + nlen - 1 + 32 <= hlen; i += 32) {
+        a = fold_avx2(_mm256_loadu_si256((const __m256i *) (hay + i)));
+        b = fold_avx2(_mm256_loadu_si256((const __m256i *) (hay + i + nlen - 1)));
+        mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, first),
+                                                     _mm256_cmpeq_epi8(b, last)));
+        while (mask != 0) {
+            r = i + __builtin_ctz(mask);
+            if (case_equal(hay + r, needle, nlen))
+                return r;
+            mask &= mask - 1;
+        }
+    }
+    r = case_search_sse2(hay + i, hlen - i, needle, nlen);
+    return r == -1 ? -1 : r + i;
+}
+
+
+AVX2 static long url_unsafe_avx2(const unsigned char *s, long len, long *spaces)
+{
+    __m256i x, safe, space;
+    long i, n, sp, tail_sp;
+
+    n = sp = 0;
+    for (i = 0; i + 32 <= len; i += 32) {
+        x = _mm256_loadu_si256((const __m256i *) (s + i));
+        space = _mm256_cmpeq_epi8(x, _mm256_set1_epi8(' '));
+        safe = _mm256_or_si256(range_avx2(x, '0', '9'),
+                               range_avx2(_mm256_or_si256(x, _mm256_set1_epi8(0x20)),
+                                          'a', 'z'));
+        safe = _mm256_or_si256(safe, range_avx2(x, '\'', '*'));
+        safe = _mm256_or_si256(safe, range_avx2(x, '-', '.'));
+        safe = _mm256_or_si256(safe, _mm256_cmpeq_epi8(x, _mm256_set1_epi8('!')));
+        safe = _mm256_or_si256(safe, _mm256_cmpeq_epi8(x, _mm256_set1_epi8('_')));
+        safe = _mm256_or_si256(safe, _mm256_cmpeq_epi8(x, _mm256_set1_epi8('~')));
+        sp += __builtin_popcount((unsigned) _mm256_movemask_epi8(space));
+        n += 32 - __builtin_popcount(
+            (unsigned) _mm256_movemask_epi8(_mm256_or_si256(safe, space)));
+    }
+    n += url_unsafe_sse2(s + i, len - i, &tail_sp);
+    *spaces = sp + tail_sp;
+    return n;
+}
+
+
+AVX2 static long url_special_avx2(const unsigned char *s, long len)
+{
+    __m256i x, hit;
+    unsigned mask;
+    long i;
+
+    for (i = 0; i + 32 <= len; i += 32) {
+        x = _mm256_loadu_si256((const __m256i *) (s + i));
+        hit = _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('%')),
+                              _mm256_cmpeq_epi8(x, _mm256_set1_epi8('+')));
+        hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(x, _mm256_setzero_si256()));
+        mask = _mm256_movemask_epi8(hit);
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+    return i + url_special_sse2(s + i, len - i);
+}
+
+
+AVX2 static inline __m256i hex_values_avx2(__m256i x, __m256i *valid)
+{
+    __m256i digit, lower, alpha;
+
+    digit = range_avx2(x, '0', '9');
+    lower = _mm256_or_si256(x, _mm256_set1_epi8(0x20));
+    alpha = range_avx2(lower, 'a', 'f');
+    *valid = _mm256_or_si256(digit, alpha);
+    return _mm256_or_si256(
+        _mm256_and_si256(digit, _mm256_sub_epi8(x, _mm256_set1_epi8('0'))),
+        _mm256_and_si256(alpha, _mm256_sub_epi8(lower, _mm256_set1_epi8('a' - 10))));
+}
+
+
+AVX2 static int hex_decode_avx2(unsigned char *dst, const unsigned char *src, long len)
+{
+    __m256i v, valid;
+    long i, pairs;
+
+    for (i = 0; i + 32 <= len; i += 32) {
+        hex_values_avx2(_mm256_loadu_si256((const __m256i *) (src + i)), &valid);
+        if ((unsigned) _mm256_movemask_epi8(valid) != 0xffffffffU)
+            return -1;
+    }
+    if (hex_check_c(src + i, len - i) == -1)
+        return -1;
+
+    pairs = len / 2;
+    for (i = 0; i + 16 <= pairs; i += 16) {
+        v = hex_values_avx2(_mm256_loadu_si256((const __m256i *) (src + 2 * i)),
+                            &valid);
+        v = _mm256_or_si256(
+            _mm256_slli_epi16(_mm256_and_si256(v, _mm256_set1_epi16(0x00ff)), 4),
+            _mm256_srli_epi16(v, 8));
+        /* packus works within lanes, gather the low quad words */
+        v = _mm256_permute4x64_epi64(_mm256_packus_epi16(v, v), 0x08);
+        _mm_storeu_si128((__m128i *) (dst + i), _mm256_castsi256_si128(v));
+    }
+    hex_pack_c(dst + i, src + 2 * i, pairs - i);
+    return 0;
+}
+
+
+/*
+ * Map 6 bit values to base64 characters: find which of the ranges
+ * A-Z, a-z, 0-9, '+' and '/' each value falls into and add the offset
+ * of that range, looked up with a byte shuffle.
+ */
+AVX2 static inline __m128i base64_chars_128(__m128i v)
+{
+    const __m128i shift = _mm_setr_epi8(
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+        '/' - 63, 'A', 0, 0);
+    __m128i r;
+
+    r = _mm_subs_epu8(v, _mm_set1_epi8(51));
+    r = _mm_or_si128(r, _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), v),
+                                      _mm_set1_epi8(13)));
+    return _mm_add_epi8(_mm_shuffle_epi8(shift, r), v);
+}
+
+
+/* Encode the 12 octets at src to 16 characters at dst; reads 16 octets. */
+AVX2 static inline void base64_block_128(unsigned char *dst, const unsigned char *src)
+{
+    __m128i in, hi, lo;
+
+    in = _mm_loadu_si128((const __m128i *) src);
+    in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7,
+                                           4, 5, 3, 4, 1, 2, 0, 1));
+    hi = _mm_mulhi_epu16(_mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00)),
+                         _mm_set1_epi32(0x04000040));
+    lo = _mm_mullo_epi16(_mm_and_si128(in, _mm_set1_epi32(0x003f03f0)),
+                         _mm_set1_epi32(0x01000010));
+    _mm_storeu_si128((__m128i *) dst, base64_chars_128(_mm_or_si128(hi, lo)));
+}
+
+
+AVX2 static inline __m256i base64_chars_256(__m256i v)
+{
+    const __m256i shift = _mm256_setr_epi8(
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+        '/' - 63, 'A', 0, 0,
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+        '/' - 63, 'A', 0, 0);
+    __m256i r;
+
+    r = _mm256_subs_epu8(v, _mm256_set1_epi8(51));
+    r = _mm256_or_si256(r, _mm256_and_si256(
+        _mm256_cmpgt_epi8(_mm256_set1_epi8(26), v), _mm256_set1_epi8(13)));
+    return _mm256_add_epi8(_mm256_shuffle_epi8(shift, r), v);
+}
+
+
+/*
+ * Encode the 24 octets at src to 32 characters at dst. Reads the 32
+ * octets starting at src - 4, so that each lane gets its 12 octets.
+ */
+AVX2 static inline void base64_block_256(unsigned char *dst, const unsigned char *src)
+{
+    __m256i in, hi, lo;
+
+    in = _mm256_loadu_si256((const __m256i *) (src - 4));
+    in = _mm256_shuffle_epi8(in, _mm256_set_epi8(
+        10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+        14, 15, 13, 14, 11, 12, 10, 11, 8, 9, 7, 8, 5, 6, 4, 5));
+    hi = _mm256_mulhi_epu16(_mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00)),
+                            _mm256_set1_epi32(0x04000040));
+    lo = _mm256_mullo_epi16(_mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0)),
+                            _mm256_set1_epi32(0x01000010));
+    _mm256_storeu_si256((__m256i *) dst, base64_chars_256(_mm256_or_si256(hi, lo)));
+}
+
+
+AVX2 static void base64_encode_avx2(unsigned char *dst, const unsigned char *src,
+                                    long triplets, long avail)
+{
+    long i = 0;
+
+    /* The first block is done narrow, since wide loads start before it. */
+    if (triplets >= 4 && avail >= 16) {
+        base64_block_128(dst, src);
+        i = 4;
+        while (i + 8 <= triplets && 3 * i + 28 <= avail) {
+            base64_block_256(dst + 4 * i, src + 3 * i);
+            i += 8;
+        }
+        while (i + 4 <= triplets && 3 * i + 16 <= avail) {
+            base64_block_128(dst + 4 * i, src + 3 * i);
+            i += 4;
+        }
+    }
+    base64_encode_c(dst + 4 * i, src + 3 * i, triplets - i, avail - 3 * i);
+}
+
+
+static const OctstrKernels kernels_avx2 = {
+    "avx2",
+    search_avx2,
+    case_search_avx2,
+    url_unsafe_avx2,
+    url_special_avx2,
+    hex_decode_avx2,
+    base64_encode_avx2
+};
+
+#endif
+
+
+/***********************************************************************
+ * Selection.
+ */
+
+const OctstrKernels *octstr_kernels = &kernels_c;
+
+static const OctstrKernels *supported[3];
+static int num_supported = 0;
+
+
+void octstr_kernels_init(void)
+{
+    int i;
+
+    memset(url_safe, 0, sizeof(url_safe));
+    for (i = 0; url_safe_chars[i] != '\0'; ++i)
+        url_safe[(unsigned char) url_safe_chars[i]] = 1;
+
+    for (i = 0; i < 256; ++i)
+        hex_value[i] = -1;
+    for (i = 0; i < 10; ++i)
+        hex_value['0' + i] = i;
+    for (i = 0; i < 6; ++i)
+        hex_value['a' + i] = hex_value['A' + i] = 10 + i;
+
+    num_supported = 0;
+    supported[num_supported++] = &kernels_c;
+#ifdef OCTSTR_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2"))
+        supported[num_supported++] = &kernels_sse2;
+    if (__builtin_cpu_supports("avx2"))
+        supported[num_supported++] = &kernels_avx2;
+#endif
+    octstr_kernels = supported[num_supported - 1];
+}
+
+
+const OctstrKernels *octstr_kernels_get(int n)
+{
+    if (n < 0 || n >= num_supported)
+        return NULL;
+    return supported[n];
+}
@@ -0,0 +1,127 @@
+/* ==================================================================== 
+ * The Kannel Software License, Version 1.0 
+ * 
+ * Copyright (c) 2001-2010 Kannel Group  
+ * Copyright (c) 1998-2001 WapIT Ltd.   
+ * All rights reserved. 
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions 
+ * are met: 
+ * 
+ * 1. Redistributions of source code must retain the above copyright 
+ *    notice, this list of conditions and the following disclaimer. 
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in 
+ *    the documentation and/or other materials provided with the 
+ *    distribution. 
+ * 
+ * 3. The end-user documentation included with the redistribution, 
+ *    if any, must include the following acknowledgment: 
+ *       "This product includes software developed by the 
+ *        Kannel Group (http://www.kannel.org/)." 
+ *    Alternately, this acknowledgment may appear in the software itself, 
+ *    if and wherever such third-party acknowledgments normally appear. 
+ * 
+ * 4. The names "Kannel" and "Kannel Group" must not be used to 
+ *    endorse or promote products derived from this software without 
+ *    prior written permission. For written permission, please  
+ *    contact org@kannel.org. 
+ * 
+ * 5. Products derived from this software may not be called "Kannel", 
+ *    nor may "Kannel" appear in their name, without prior written 
+ *    permission of the Kannel Group. 
+ * 
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESSED OR IMPLIED 
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES 
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+ * DISCLAIMED.  IN NO EVENT SHALL THE KANNEL GROUP OR ITS CONTRIBUTORS 
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,  
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT  
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR  
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,  
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE  
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,  
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. 
+ * ==================================================================== 
+ * 
+ * This software consists of voluntary contributions made by many 
+ * individuals on behalf of the Kannel Group.  For more information on  
+ * the Kannel Group, please see <http://www.kannel.org/>. 
+ * 
+ * Portions of this software are based upon software originally written at  
+ * WapIT Ltd., Helsinki, Finland for the Kannel project.  
+ */ 
+
+/*
+ * octstr-simd.h - byte loop kernels behind some of the Octstr functions
+ *
+ * Searching, URL escaping, hex decoding and base64 encoding spend their
+ * time in a few loops over the octets of a string. This module has a
+ * plain C version of each loop and, on x86 with a GCC compatible
+ * compiler, SSE2 and AVX2 versions. octstr_init picks the best set the
+ * CPU supports.
+ *
+ * This is an internal interface of octstr.c. It is in a header only so
+ * that checks/check_octstr_simd.c can compare the sets with each other.
+ */
+
+#ifndef OCTSTR_SIMD_H
+#define OCTSTR_SIMD_H
+
+typedef struct {
+    const char *name;
+
+    /*
+     * Return offset of the first occurrence of `needle' in `hay', or -1.
+     * `nlen' is at least 2.
+     */
+    long (*search)(const unsigned char *hay, long hlen,
+                   const unsigned char *needle, long nlen);
+
+    /*
+     * As search, but ASCII letters match regardless of case. `nlen' is
+     * at least 1.
+     */
+    long (*case_search)(const unsigned char *hay, long hlen,
+                        const unsigned char *needle, long nlen);
+
+    /*
+     * Return the number of octets octstr_url_encode has to %-escape and
+     * store the number of spaces in `*spaces'.
+     */
+    long (*url_unsafe)(const unsigned char *s, long len, long *spaces);
+
+    /* Return offset of the first '%', '+' or NUL, or `len' if none. */
+    long (*url_special)(const unsigned char *s, long len);
+
+    /*
+     * Decode len/2 pairs of hex digits from `src' to `dst', which may
+     * be `src'. If any of the `len' octets is not a hex digit, return
+     * -1 without writing anything, otherwise 0.
+     */
+    int (*hex_decode)(unsigned char *dst, const unsigned char *src, long len);
+
+    /*
+     * Encode `triplets' groups of 3 octets into 4 base64 characters
+     * each. `avail' octets, at least 3 * triplets, may be read at `src'.
+     */
+    void (*base64_encode)(unsigned char *dst, const unsigned char *src,
+                          long triplets, long avail);
+} OctstrKernels;
+
+
+/* The kernels octstr.c uses. */
+extern const OctstrKernels *octstr_kernels;
+
+/* Detect CPU features and set octstr_kernels. */
+void octstr_kernels_init(void);
+
+/*
+ * Return the n'th kernel set the CPU supports, starting with the plain
+ * C one at 0, or NULL if there is no such set.
+ */
+const OctstrKernels *octstr_kernels_get(int n);
+
+#endif
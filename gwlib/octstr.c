@@ -74,6 +74,7 @@
 #include <netinet/in.h>
 
 #include "gwlib.h"
+#include "octstr-simd.h"
 
 /* 
  * Unfortunately some platforms base va_list an an array type
@@ -98,39 +99,39 @@
  * octstr.h. This ensures they really are abstract.
  */
 
-/*
- * The octet string.
- *
- * `data' is a pointer to dynamically allocated memory are where the 
- * octets in the string. It may be bigger than the actual length of the
- * string.
- *
- * `len' is the length of the string.
- *
- * `size' is the size of the memory area `data' points at.
- *
- * When `size' is greater than zero, it is at least `len+1', and the
- * character at `len' is '\0'. This is so that octstr_get_cstr will
- * always work.
+/**********************************************************************
+ * Hash table of immutable octet strings.
  *
- * `immutable' defines whether the octet string is immutable or not.
+ * The table is keyed by the address of the C string literal and uses
+ * linear probing. Readers walk the current table without locking; new
+ * entries are inserted under `immutables_mutex' and published with a
+ * release store, so a reader either sees a fully initialized Octstr or
+ * an empty slot, in which case it retries under the mutex. When the
+ * table gets half full it is replaced by one twice the size. Replaced
+ * tables are kept until shutdown, since readers may still be probing
+ * them.
  */
-struct Octstr
-{
-    unsigned char *data;
-    long len;
-    long size;
-    int immutable;
-};
 
+#define IMMUTABLES_INITIAL_SIZE 1024
 
-/**********************************************************************
- * Hash table of immutable octet strings.
- */
+typedef struct ImmTable ImmTable;
+struct ImmTable {
+    unsigned long size;		/* always a power of two */
+    Octstr *volatile *slots;
+    ImmTable *older;
+};
 
-#define MAX_IMMUTABLES 1024
+/*
+ * The first table is static, as octstr_init is called before gwmem is
+ * usable.
+ */
+static Octstr *initial_slots[IMMUTABLES_INITIAL_SIZE];
+static ImmTable initial_table = {
+    IMMUTABLES_INITIAL_SIZE, initial_slots, NULL
+};
 
-static Octstr *immutables[MAX_IMMUTABLES];
+static ImmTable *volatile immutables = NULL;
+static long immutables_count = 0;
 static Mutex immutables_mutex;
 static int immutables_init = 0;
 
@@ -163,6 +164,15 @@ static char is_safe[UCHAR_MAX + 1];
 
 static void seems_valid_real(const Octstr *ostr, const char *filename, long lineno,
                              const char *function);
+
+/*
+ * Every function that modifies an octet string checks with this that it
+ * is allowed to.
+ */
+#define assert_mutable(ostr) gw_assert(!(ostr)->immutable)
+
+/* Does the string keep its octets in the struct itself? */
+#define is_inline(ostr) ((ostr)->data == (ostr)->inline_data)
 #ifdef NO_GWASSERT
 #define seems_valid(ostr)
 #else
@@ -180,7 +190,7 @@ static void seems_valid_real(const Octstr *ostr, const char *filename, long line
 /* Reserve space for at least 'size' octets */
 static void octstr_grow(Octstr *ostr, long size)
 {
-    gw_assert(!ostr->immutable);
+    assert_mutable(ostr);
     seems_valid(ostr);
     gw_assert(size >= 0);
 
@@ -189,7 +199,11 @@ static void octstr_grow(Octstr *ostr, long size)
     if (size > ostr->size) {
         /* always reallocate in 1kB chunks */
         size += 1024 - (size % 1024);
-        ostr->data = gw_realloc(ostr->data, size);
+        if (is_inline(ostr)) {
+            ostr->data = gw_malloc(size);
+            memcpy(ostr->data, ostr->inline_data, ostr->len + 1);
+        } else
+            ostr->data = gw_realloc(ostr->data, size);
         ostr->size = size;
     }
 }
@@ -213,27 +227,97 @@ static void urlcode_init(void)
 }
 
 
+static ImmTable *imm_table_create(unsigned long size)
+{
+    ImmTable *table;
+    unsigned long i;
+
+    table = gw_malloc(sizeof(*table));
+    table->size = size;
+    table->slots = gw_malloc(size * sizeof(table->slots[0]));
+    for (i = 0; i < size; ++i)
+        table->slots[i] = NULL;
+    table->older = NULL;
+    return table;
+}
+
+
+/*
+ * Find the immutable for `data' in `table', or the empty slot where it
+ * would go. May be called without holding `immutables_mutex'.
+ */
+static unsigned long imm_table_probe(ImmTable *table, unsigned char *data,
+                                     Octstr **found)
+{
+    unsigned long i, mask;
+    Octstr *os;
+
+    mask = table->size - 1;
+    i = CSTR_TO_LONG(data) & mask;
+    for (;;) {
+        os = gw_atomic_get_ptr((void *volatile *) &table->slots[i]);
+        if (os == NULL || os->data == data)
+            break;
+        i = (i + 1) & mask;
+    }
+    *found = os;
+    return i;
+}
+
+
+/* Replace the current table with one twice the size. Caller holds lock. */
+static ImmTable *imm_table_grow(ImmTable *old)
+{
+    ImmTable *table;
+    Octstr *os, *dummy;
+    unsigned long i;
+
+    table = imm_table_create(old->size * 2);
+    for (i = 0; i < old->size; ++i) {
+        os = old->slots[i];
+        if (os != NULL)
+            table->slots[imm_table_probe(table, os->data, &dummy)] = os;
+    }
+    table->older = old;
+    gw_atomic_set_ptr((void *volatile *) &immutables, table);
+    return table;
+}
+
+
 void octstr_init(void)
 {
     urlcode_init();
+    octstr_kernels_init();
     mutex_init_static(&immutables_mutex);
+    memset(initial_slots, 0, sizeof(initial_slots));
+    initial_table.older = NULL;
+    immutables = &initial_table;
+    immutables_count = 0;
     immutables_init = 1;
 }
 
 
 void octstr_shutdown(void)
 {
-    long i, n;
+    ImmTable *table, *older;
+    unsigned long i;
+    long n;
 
     n = 0;
-    for (i = 0; i < MAX_IMMUTABLES; ++i) {
-        if (immutables[i] != NULL) {
-	    gw_free(immutables[i]);
+    for (i = 0; i < immutables->size; ++i) {
+        if (immutables->slots[i] != NULL) {
+	    gw_free(immutables->slots[i]);
             ++n;
         }
     }
     if(n>0)
         debug("gwlib.octstr", 0, "Immutable octet strings: %ld.", n);
+    for (table = immutables; table != &initial_table; table = older) {
+        older = table->older;
+        gw_free((void *) table->slots);
+        gw_free(table);
+    }
+    immutables = NULL;
     mutex_destroy(&immutables_mutex);
 }
 
@@ -261,18 +345,19 @@ Octstr *octstr_create_from_data_real(const char *data, long len, const char *fil
         return NULL;
 
     ostr = gw_malloc_trace(sizeof(*ostr), file, line, func);
-    if (len == 0) {
-        ostr->len = 0;
-        ostr->size = 0;
-        ostr->data = NULL;
+    ostr->len = len;
+    if (len < OCTSTR_INLINE_SIZE) {
+        ostr->size = OCTSTR_INLINE_SIZE;
+        ostr->data = ostr->inline_data;
     } else {
-        ostr->len = len;
         ostr->size = len + 1;
         ostr->data = gw_malloc_trace(ostr->size, file, line, func);
-        memcpy(ostr->data, data, len);
-        ostr->data[len] = '\0';
     }
+    if (len > 0)
+        memcpy(ostr->data, data, len);
+    ostr->data[len] = '\0';
     ostr->immutable = 0;
+    ostr->hash = 0;
     seems_valid(ostr);
     return ostr;
 }
@@ -280,26 +365,25 @@ Octstr *octstr_create_from_data_real(const char *data, long len, const char *fil
 
 Octstr *octstr_imm(const char *cstr)
 {
-    Octstr *os;
-    long i, index;
+    Octstr *os, *dummy;
+    ImmTable *table;
+    unsigned long i;
     unsigned char *data;
 
     gw_assert(immutables_init);
     gw_assert(cstr != NULL);
 
-    index = CSTR_TO_LONG(cstr) % MAX_IMMUTABLES;
     data = (unsigned char *) cstr;
 
+    /* Fast path: the literal has been seen before. */
+    table = gw_atomic_get_ptr((void *volatile *) &immutables);
+    imm_table_probe(table, data, &os);
+    if (os != NULL)
+        return os;
+
     mutex_lock(&immutables_mutex);
-    i = index;
-    for (; ; ) {
-	if (immutables[i] == NULL || immutables[i]->data == data)
-            break;
-        i = (i + 1) % MAX_IMMUTABLES;
-        if (i == index)
-            panic(0, "Too many immutable strings.");
-    }
-    os = immutables[i];
+    table = immutables;
+    i = imm_table_probe(table, data, &os);
     if (os == NULL) {
 	/*
 	 * Can't use octstr_create() because it copies the string,
@@ -307,11 +391,18 @@ Octstr *octstr_imm(const char *cstr)
 	 */
 	os = gw_malloc(sizeof(*os));
         os->data = data;
-        os->len = strlen(data);
+        os->len = strlen(cstr);
         os->size = os->len + 1;
-        os->immutable = 1;
-	immutables[i] = os;
+        os->immutable = OCTSTR_IMM_INTERNED;
+        os->hash = 0;
+        os->hash = (long) octstr_hash_key(os);
 	seems_valid(os);
+        if ((unsigned long) (immutables_count + 1) * 2 > table->size) {
+            table = imm_table_grow(table);
+            i = imm_table_probe(table, data, &dummy);
+        }
+        gw_atomic_set_ptr((void *volatile *) &table->slots[i], os);
+        ++immutables_count;
     }
     mutex_unlock(&immutables_mutex);
 
@@ -324,7 +415,8 @@ void octstr_destroy(Octstr *ostr)
     if (ostr != NULL) {
         seems_valid(ostr);
 	if (!ostr->immutable) {
-            gw_free(ostr->data);
+            if (!is_inline(ostr))
+                gw_free(ostr->data);
             gw_free(ostr);
         }
     }
@@ -337,7 +429,7 @@ void octstr_destroy_item(void *os)
 }
 
 
-long octstr_len(const Octstr *ostr)
+long (octstr_len)(const Octstr *ostr)
 {
     if (ostr == NULL)
         return 0;
@@ -384,12 +476,11 @@ Octstr *octstr_cat(Octstr *ostr1, Octstr *ostr2)
 
     seems_valid(ostr1);
     seems_valid(ostr2);
-    gw_assert(!ostr1->immutable);
+    assert_mutable(ostr1);
 
     ostr = octstr_create("");
+    octstr_grow(ostr, ostr1->len + ostr2->len);
     ostr->len = ostr1->len + ostr2->len;
-    ostr->size = ostr->len + 1;
-    ostr->data = gw_malloc(ostr->size);
 
     if (ostr1->len > 0)
         memcpy(ostr->data, ostr1->data, ostr1->len);
@@ -402,7 +493,7 @@ Octstr *octstr_cat(Octstr *ostr1, Octstr *ostr2)
 }
 
 
-int octstr_get_char(const Octstr *ostr, long pos)
+int (octstr_get_char)(const Octstr *ostr, long pos)
 {
     seems_valid(ostr);
     if (pos >= ostr->len || pos < 0)
@@ -414,7 +505,7 @@ int octstr_get_char(const Octstr *ostr, long pos)
 void octstr_set_char(Octstr *ostr, long pos, int ch)
 {
     seems_valid(ostr);
-    gw_assert(!ostr->immutable);
+    assert_mutable(ostr);
     if (pos < ostr->len)
         ostr->data[pos] = ch;
     seems_valid(ostr);
@@ -452,7 +543,7 @@ void octstr_append_from_hex(Octstr *ostr, char *hex)
     Octstr *output;
 	
     seems_valid(ostr);
-    gw_assert(!ostr->immutable);
+    assert_mutable(ostr);
 	
     output = octstr_create(hex);
     octstr_hex_to_binary(output);
@@ -467,7 +558,7 @@ void octstr_binary_to_hex(Octstr *ostr, int uppercase)
     long i, tmp;
 
     seems_valid(ostr);
-    gw_assert(!ostr->immutable);
+    assert_mutable(ostr);
     if (ostr->len == 0)
         return;
 
@@ -492,44 +583,20 @@ void octstr_binary_to_hex(Octstr *ostr, int uppercase)
 
 int octstr_hex_to_binary(Octstr *ostr)
 {
-    long len, i;
-    unsigned char *p;
+    long len;
 
     seems_valid(ostr);
-    gw_assert(!ostr->immutable);
+    assert_mutable(ostr);
 
     if (ostr->len == 0)
         return 0;
 
-    /* Check if it's in the right format */
-    if (!octstr_check_range(ostr, 0, ostr->len, gw_isxdigit))
+    /* Checks the format first, so a bad string is left untouched */
+    if (octstr_kernels->hex_decode(ostr->data, ostr->data, ostr->len) == -1)
         return -1;
 
-    len = ostr->len;
-
-    /* Convert ascii data to binary values */
-    for (i = 0, p = ostr->data; i < len; i++, p++) {
-        if (*p >= '0' && *p <= '9')
-            *p -= '0';
-        else if (*p >= 'a' && *p <= 'f')
-            *p = *p - 'a' + 10;
-        else if (*p >= 'A' && *p <= 'F')
-            *p = *p - 'A' + 10;
-        else {
-            /* isxdigit checked the whole string, so we should
-             * not be able to get here. */
-            gw_assert(0);
-            *p = 0;
-        }
-    }
-
     /* De-hexing will compress data by factor of 2 */
     len = ostr->len / 2;
-
-    for (i = 0; i < len; i++) {
-        ostr->data[i] = ostr->data[i * 2] * 16 | ostr->data[i * 2 + 1];
-    }
-
     ostr->len = len;
     ostr->data[len] = '\0';
 
@@ -540,17 +607,15 @@ int octstr_hex_to_binary(Octstr *ostr)
 
 void octstr_binary_to_base64(Octstr *ostr)
 {
-    static const unsigned char base64[64] =
-        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
     long triplets;
     long lines;
     long orig_len;
-    unsigned char *data;
-    long from, to;
-    int left_on_line;
+    long avail;
+    unsigned char *src, *to;
+    long from, n;
 
     seems_valid(ostr);
-    gw_assert(!ostr->immutable);
+    assert_mutable(ostr);
 
     if (ostr->len == 0) {
         /* Always terminate with CR LF */
@@ -564,78 +629,35 @@ void octstr_binary_to_base64(Octstr *ostr)
      * which will add 2 octets per 19 triplets (rounded up). */
     triplets = (ostr->len + 2) / 3;   /* round up */
     lines = (triplets + 18) / 19;
-
-    octstr_grow(ostr, triplets * 4 + lines * 2);
     orig_len = ostr->len;
-    data = ostr->data;
-
-    ostr->len = triplets * 4 + lines * 2;
-    data[ostr->len] = '\0';
-
-    /* This function works back-to-front, so that encoded data will
-     * not overwrite source data.
-     * from points to the start of the last triplet (which may be
-     * an odd-sized one), and to points to the start of where the
-     * last quad should go.  */
-    from = (triplets - 1) * 3;
-    to = (triplets - 1) * 4 + (lines - 1) * 2;
-
-    /* First write the CR LF after the last quad */
-    data[to + 5] = 10;   /* LF */
-    data[to + 4] = 13;   /* CR */
-    left_on_line = triplets - ((lines - 1) * 19);
 
     /* base64 encoding is in 3-octet units.  To handle leftover
      * octets, conceptually we have to zero-pad up to the next
      * 6-bit unit, and pad with '=' characters for missing 6-bit
      * units.
-     * We do it by first completing the first triplet with 
-     * zero-octets, and after the loop replacing some of the
-     * result characters with '=' characters.
-     * There is enough room for this, because even with a 1 or 2
-     * octet source string, space for four octets of output
-     * will be reserved.
-     */
-    switch (orig_len % 3) {
-    case 0:
-        break;
-    case 1:
-        data[orig_len] = 0;
-        data[orig_len + 1] = 0;
-        break;
-    case 2:
-        data[orig_len + 1] = 0;
-        break;
-    }
-
-    /* Now we only have perfect triplets. */
-    while (from >= 0) {
-        long whole_triplet;
+     * We do it by encoding from a copy of the source that is
+     * completed with zero-octets, and after the loop replacing some
+     * of the result characters with '=' characters.  The copy has
+     * some slack at the end, since the encoder reads in blocks. */
+    avail = triplets * 3 + 32;
+    src = gw_malloc(avail);
+    memcpy(src, ostr->data, orig_len);
+    memset(src + orig_len, 0, avail - orig_len);
 
-        /* Add a newline, if necessary */
-        if (left_on_line == 0) {
-            to -= 2;
-            data[to + 5] = 10;  /* LF */
-            data[to + 4] = 13;  /* CR */
-            left_on_line = 19;
-        }
-
-        whole_triplet = (data[from] << 16) |
-                        (data[from + 1] << 8) |
-                        data[from + 2];
-        data[to + 3] = base64[whole_triplet % 64];
-        data[to + 2] = base64[(whole_triplet >> 6) % 64];
-        data[to + 1] = base64[(whole_triplet >> 12) % 64];
-        data[to] = base64[(whole_triplet >> 18) % 64];
+    octstr_grow(ostr, triplets * 4 + lines * 2);
+    ostr->len = triplets * 4 + lines * 2;
+    ostr->data[ostr->len] = '\0';
 
-        to -= 4;
-        from -= 3;
-        left_on_line--;
+    to = ostr->data;
+    for (from = 0; from < triplets; from += n) {
+        n = triplets - from < 19 ? triplets - from : 19;
+        octstr_kernels->base64_encode(to, src + from * 3, n, avail - from * 3);
+        to += n * 4;
+        *to++ = 13;  /* CR */
+        *to++ = 10;  /* LF */
     }
-
-    gw_assert(left_on_line == 0);
-    gw_assert(from == -3);
-    gw_assert(to == -4);
+    gw_assert(to == ostr->data + ostr->len);
+    gw_free(src);
 
     /* Insert padding characters in the last quad.  Remember that
      * there is a CR LF between the last quad and the end of the
@@ -644,14 +666,14 @@ void octstr_binary_to_base64(Octstr *ostr)
     case 0:
         break;
     case 1:
-        gw_assert(data[ostr->len - 3] == 'A');
-        gw_assert(data[ostr->len - 4] == 'A');
-        data[ostr->len - 3] = '=';
-        data[ostr->len - 4] = '=';
+        gw_assert(ostr->data[ostr->len - 3] == 'A');
+        gw_assert(ostr->data[ostr->len - 4] == 'A');
+        ostr->data[ostr->len - 3] = '=';
+        ostr->data[ostr->len - 4] = '=';
         break;
     case 2:
-        gw_assert(data[ostr->len - 3] == 'A');
-        data[ostr->len - 3] = '=';
+        gw_assert(ostr->data[ostr->len - 3] == 'A');
+        ostr->data[ostr->len - 3] = '=';
         break;
     }
 
@@ -669,7 +691,7 @@ void octstr_base64_to_binary(Octstr *ostr)
     unsigned char *data;
 
     seems_valid(ostr);
-    gw_assert(!ostr->immutable);
+    assert_mutable(ostr);
 
     len = ostr->len;
     data = ostr->data;
@@ -838,7 +860,7 @@ void octstr_convert_range(Octstr *ostr, long pos, long len,
     long end = pos + len;
 
     seems_valid(ostr);
-    gw_assert(!ostr->immutable);
+    assert_mutable(ostr);
     gw_assert(len >= 0);
 
     if (pos >= ostr->len)
@@ -867,7 +889,7 @@ void octstr_convert_printable(Octstr *ostr)
 
 
 
-int octstr_compare(const Octstr *ostr1, const Octstr *ostr2)
+int (octstr_compare)(const Octstr *ostr1, const Octstr *ostr2)
 {
     int ret;
     long len;
@@ -875,6 +897,9 @@ int octstr_compare(const Octstr *ostr1, const Octstr *ostr2)
     seems_valid(ostr1);
     seems_valid(ostr2);
 
+    if (ostr1 == ostr2)
+        return 0;
+
     if (ostr1->len < ostr2->len)
         len = ostr1->len;
     else
@@ -1047,7 +1072,7 @@ long octstr_search_chars(const Octstr *ostr, const Octstr *chars, long pos)
 
 long octstr_search(const Octstr *haystack, const Octstr *needle, long pos)
 {
-    int first;
+    long i;
 
     seems_valid(haystack);
     seems_valid(needle);
@@ -1060,27 +1085,18 @@ long octstr_search(const Octstr *haystack, const Octstr *needle, long pos)
     if (needle->len == 1)
         return octstr_search_char(haystack, needle->data[0], pos);
 
-    /* For each occurrence of needle's first character in ostr,
-     * check if the rest of needle follows.  Stop if there are no
-     * more occurrences, or if the rest of needle can't possibly
-     * fit in the haystack. */
-    first = needle->data[0];
-    pos = octstr_search_char(haystack, first, pos);
-    while (pos >= 0 && haystack->len - pos >= needle->len) {
-        if (memcmp(haystack->data + pos,
-                   needle->data, needle->len) == 0)
-            return pos;
-        pos = octstr_search_char(haystack, first, pos + 1);
-    }
+    if (pos > haystack->len - needle->len)
+        return -1;
 
-    return -1;
+    i = octstr_kernels->search(haystack->data + pos, haystack->len - pos,
+                               needle->data, needle->len);
+    return i == -1 ? -1 : pos + i;
 }
 
 
 long octstr_case_search(const Octstr *haystack, const Octstr *needle, long pos)
 {
-    long i, j;
-    int c1, c2;
+    long i;
 
     seems_valid(haystack);
     seems_valid(needle);
@@ -1090,18 +1106,12 @@ long octstr_case_search(const Octstr *haystack, const Octstr *needle, long pos)
     if (needle->len == 0)
         return 0;
 
-    for (i = pos; i <= haystack->len - needle->len; ++i) {
-	for (j = 0; j < needle->len; ++j) {
-	    c1 = toupper(haystack->data[i + j]);
-	    c2 = toupper(needle->data[j]);
-	    if (c1 != c2)
-	    	break;
-	}
-	if (j == needle->len)
-	    return i;
-    }
+    if (pos > haystack->len - needle->len)
+        return -1;
 
-    return -1;    
+    i = octstr_kernels->case_search(haystack->data + pos, haystack->len - pos,
+                                    needle->data, needle->len);
+    return i == -1 ? -1 : pos + i;
 }
 
 long octstr_case_nsearch(const Octstr *haystack, const Octstr *needle, long pos, long n)
@@ -1227,7 +1237,7 @@ int octstr_append_from_socket(Octstr *ostr, int socket)
     int len;
 
     seems_valid(ostr);
-    gw_assert(!ostr->immutable);
+    assert_mutable(ostr);
 
 again:
     len = recv(socket, buf, sizeof(buf), 0);
@@ -1252,7 +1262,7 @@ void octstr_insert(Octstr *ostr1, const Octstr *ostr2, long pos)
     seems_valid(ostr1);
     seems_valid(ostr2);
     gw_assert(pos <= ostr1->len);
-    gw_assert(!ostr1->immutable);
+    assert_mutable(ostr1);
 
     if (ostr2->len == 0)
         return;
@@ -1274,7 +1284,7 @@ void octstr_truncate(Octstr *ostr, int new_len)
         return;
         
     seems_valid(ostr);
-    gw_assert(!ostr->immutable);
+    assert_mutable(ostr);
     gw_assert(new_len >= 0);
 
     if (new_len >= ostr->len)
@@ -1292,7 +1302,7 @@ void octstr_strip_blanks(Octstr *text)
     int start = 0, end, len = 0;
 
     seems_valid(text);
-    gw_assert(!text->immutable);
+    assert_mutable(text);
 
     /* Remove white space from the beginning of the text */
     while (isspace(octstr_get_char(text, start)) && 
@@ -1324,7 +1334,7 @@ void octstr_strip_crlfs(Octstr *text)
     int start = 0, end, len = 0;
 
     seems_valid(text);
-    gw_assert(!text->immutable);
+    assert_mutable(text);
 
     /* Remove white space from the beginning of the text */
     while (iscrlf(octstr_get_char(text, start)) && 
@@ -1351,7 +1361,7 @@ void octstr_strip_nonalphanums(Octstr *text)
     int start = 0, end, len = 0;
 
     seems_valid(text);
-    gw_assert(!text->immutable);
+    assert_mutable(text);
 
     /* Remove white space from the beginning of the text */
     while (!isalnum(octstr_get_char(text, start)) && 
@@ -1379,7 +1389,7 @@ void octstr_shrink_blanks(Octstr *text)
     int i, j, end;
 
     seems_valid(text);
-    gw_assert(!text->immutable);
+    assert_mutable(text);
 
     end = octstr_len(text);
 
@@ -1405,7 +1415,7 @@ void octstr_shrink_blanks(Octstr *text)
 void octstr_insert_data(Octstr *ostr, long pos, const char *data, long len)
 {
     seems_valid(ostr);
-    gw_assert(!ostr->immutable);
+    assert_mutable(ostr);
     gw_assert(pos <= ostr->len);
 
     if (len == 0)
@@ -1425,7 +1435,7 @@ void octstr_insert_data(Octstr *ostr, long pos, const char *data, long len)
 void octstr_insert_char(Octstr *ostr, long pos, const char c)
 {
     seems_valid(ostr);
-    gw_assert(!ostr->immutable);
+    assert_mutable(ostr);
     gw_assert(pos <= ostr->len);
     
     octstr_grow(ostr, ostr->len + 1);
@@ -1445,6 +1455,29 @@ void octstr_append_data(Octstr *ostr, const char *data, long len)
 }
 
 
+char *octstr_append_reserve(Octstr *ostr, long len)
+{
+    gw_assert(ostr != NULL);
+    gw_assert(len >= 0);
+    seems_valid(ostr);
+
+    octstr_grow(ostr, ostr->len + len);
+    return ostr->data + ostr->len;
+}
+
+
+void octstr_append_commit(Octstr *ostr, long len)
+{
+    gw_assert(ostr != NULL);
+    assert_mutable(ostr);
+    gw_assert(len >= 0 && ostr->len + len < ostr->size);
+
+    ostr->len += len;
+    ostr->data[ostr->len] = '\0';
+    seems_valid(ostr);
+}
+
+
 void octstr_append(Octstr *ostr1, const Octstr *ostr2)
 {
     gw_assert(ostr1 != NULL);
@@ -1471,7 +1504,7 @@ void octstr_append_char(Octstr *ostr, int ch)
 void octstr_delete(Octstr *ostr1, long pos, long len)
 {
     seems_valid(ostr1);
-    gw_assert(!ostr1->immutable);
+    assert_mutable(ostr1);
 
     if (pos > ostr1->len)
         pos = ostr1->len;
@@ -1616,35 +1649,22 @@ int octstr_item_case_match(void *item, void *pattern)
 
 void octstr_url_encode(Octstr *ostr)
 {
-    long i, n, len = 0;
-    int all_safe;
+    long i, n, spaces, len = 0;
     unsigned char c, *str, *str2, *res, *hexits;
 
     if (ostr == NULL)
         return;
 
     seems_valid(ostr);
-    gw_assert(!ostr->immutable);
+    assert_mutable(ostr);
 
     if (ostr->len == 0)
         return;
 
     /* calculate new length */
-    for (i = n = 0, str = ostr->data, all_safe = 1; i < ostr->len; i++) {
-        c = *str++;
-	
-        if (c == ' ') {
-            all_safe = 0;
-            continue;
-        }
-
-        if (!is_safe[c]) {
-	    n++;
-            all_safe = 0;
-        }
-     }
+    n = octstr_kernels->url_unsafe(ostr->data, ostr->len, &spaces);
 
-    if (all_safe) /* we are done, all chars are safe */
+    if (n == 0 && spaces == 0) /* we are done, all chars are safe */
        return;
 
     hexits = "0123456789ABCDEF";
@@ -1677,7 +1697,8 @@ void octstr_url_encode(Octstr *ostr)
     
     /* we made replace in place */
     if (n) {
-        gw_free(ostr->data);
+        if (!is_inline(ostr))
+            gw_free(ostr->data);
         ostr->data = res;
         ostr->size = len;
         ostr->len = len - 1;
@@ -1691,13 +1712,14 @@ int octstr_url_decode(Octstr *ostr)
 {
     unsigned char *string;
     unsigned char *dptr;
+    long n;
     int code, code2, ret = 0;
 
     if (ostr == NULL)
         return 0;
 
     seems_valid(ostr);
-    gw_assert(!ostr->immutable);
+    assert_mutable(ostr);
 
     if (ostr->len == 0)
         return 0;
@@ -1705,36 +1727,50 @@ int octstr_url_decode(Octstr *ostr)
     string = ostr->data;
     dptr = ostr->data;
 
-    do {
-        if (*string == '%') {
-            if (*(string + 1) == '\0' || *(string + 2) == '\0') {
-                warning(0, "octstr_url_decode: corrupted end-of-string <%s>", string);
-                ret = -1;
-                break;
-            }
+    /* A NUL as the very first octet is copied, any later one
+     * terminates the encoded string. */
+    if (*string == '\0')
+        *dptr++ = *string++;
 
-            code = H2B(*(string + 1));
-            code2 = H2B(*(string + 2));
-
-            if (code == -1 || code2 == -1) {
-                warning(0, "octstr_url_decode: garbage detected (%c%c%c) skipping.",
-                            *string, *(string + 1), *(string + 2));
-                *dptr++ = *string++;
-                *dptr++ = *string++;
-                *dptr++ = *string++;
-                ret = -1;
-                continue;
-            }
+    for (;;) {
+        /* Copy the run of octets that need no decoding in one go */
+        n = octstr_kernels->url_special(string, ostr->data + ostr->len - string);
+        if (dptr != string)
+            memmove(dptr, string, n);
+        dptr += n;
+        string += n;
 
-            *dptr++ = code << 4 | code2;
-            string += 3;
-        }
-        else if (*string == '+') {
+        if (*string == '\0')
+            break;
+
+        if (*string == '+') {
             *dptr++ = ' ';
             string++;
-        } else
+            continue;
+        }
+
+        if (*(string + 1) == '\0' || *(string + 2) == '\0') {
+            warning(0, "octstr_url_decode: corrupted end-of-string <%s>", string);
+            ret = -1;
+            break;
+        }
+
+        code = H2B(*(string + 1));
+        code2 = H2B(*(string + 2));
+
+        if (code == -1 || code2 == -1) {
+            warning(0, "octstr_url_decode: garbage detected (%c%c%c) skipping.",
+                        *string, *(string + 1), *(string + 2));
+            *dptr++ = *string++;
             *dptr++ = *string++;
-    } while (*string); 	/* we stop here because it terimates encoded string */
+            *dptr++ = *string++;
+            ret = -1;
+            continue;
+        }
+
+        *dptr++ = code << 4 | code2;
+        string += 3;
+    }
 
     *dptr = '\0';
     ostr->len = (dptr - ostr->data);
@@ -1801,7 +1837,7 @@ void octstr_set_bits(Octstr *ostr, long bitpos, int numbits,
     int c;
 
     seems_valid(ostr);
-    gw_assert(!ostr->immutable);
+    assert_mutable(ostr);
     gw_assert(bitpos >= 0);
     gw_assert(numbits <= 32);
     gw_assert(numbits >= 0);
@@ -2469,8 +2505,19 @@ unsigned long octstr_hash_key(Octstr *ostr)
     if (ostr == NULL)
 	return 0;
 
-    for (i = 0; i < octstr_len(ostr); i++)
-	key = key + octstr_get_char(ostr, i);
+    seems_valid(ostr);
+    if (ostr->immutable && (key = gw_atomic_get(&ostr->hash)) != 0)
+        return key;
+
+    for (i = 0; i < ostr->len; i++)
+	key = key + ostr->data[i];
+
+    /*
+     * Only immutables keep the key: a mutable string may be read by
+     * several threads at once, and none of them may write to it.
+     */
+    if (ostr->immutable)
+        gw_atomic_set(&ostr->hash, (long) key);
 
     return key;
 }
@@ -2486,8 +2533,9 @@ static void seems_valid_real(const Octstr *ostr, const char *filename, long line
     gw_assert(immutables_init);
     gw_assert_place(ostr != NULL,
                     filename, lineno, function);
-    gw_assert_allocated(ostr,
-                        filename, lineno, function);
+    if (ostr->immutable != OCTSTR_IMM_STATIC)
+        gw_assert_allocated(ostr,
+                            filename, lineno, function);
     gw_assert_place(ostr->len >= 0,
                     filename, lineno, function);
     gw_assert_place(ostr->size >= 0,
@@ -2502,7 +2550,7 @@ static void seems_valid_real(const Octstr *ostr, const char *filename, long line
                         filename, lineno, function);
         gw_assert_place(ostr->data != NULL,
                         filename, lineno, function);
-	if (!ostr->immutable)
+	if (!ostr->immutable && !is_inline(ostr))
             gw_assert_allocated(ostr->data,
                                 filename, lineno, function);
         gw_assert_place(ostr->data[ostr->len] == '\0',
@@ -2556,7 +2604,7 @@ void octstr_strip_char(Octstr *text, char ch)
     int start = 0;
 
     seems_valid(text);
-    gw_assert(!text->immutable);
+    assert_mutable(text);
 
     /* Remove char from the beginning of the text */
     while ((ch == octstr_get_char(text, start)) &&
@@ -2604,7 +2652,7 @@ int octstr_symbolize(Octstr *ostr)
     long len, i;
 
     seems_valid(ostr);
-    gw_assert(!ostr->immutable);
+    assert_mutable(ostr);
 
     if (ostr->len == 0)
         return 0;
@@ -2629,7 +2677,7 @@ void octstr_delete_matching(Octstr *haystack, Octstr *needle)
 
     seems_valid(haystack);
     seems_valid(needle);
-    gw_assert(!haystack->immutable);
+    assert_mutable(haystack);
     len = octstr_len(needle);
 
     while ((p = octstr_search(haystack, needle, p)) != -1) {
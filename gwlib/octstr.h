@@ -98,12 +98,77 @@
 
 #include <stdio.h>
 #include <stdarg.h>
+#include <string.h>
 
+#include "gw-config.h"
 #include "list.h"
 
 typedef struct Octstr Octstr;
 
 
+/*
+ * The octet string. The layout is visible here only so that static
+ * immutables can be declared at compile time with OCTSTR_STATIC and so
+ * that the most frequently used accessors can be inlined; all other
+ * access to the fields must go through the functions below.
+ *
+ * `data' is a pointer to dynamically allocated memory are where the
+ * octets in the string. It may be bigger than the actual length of the
+ * string. Short strings keep their octets in `inline_data' instead,
+ * which saves the second allocation for the typical phone number or
+ * message id; `data' then points at `inline_data'.
+ *
+ * `len' is the length of the string.
+ *
+ * `size' is the size of the memory area `data' points at.
+ *
+ * When `size' is greater than zero, it is at least `len+1', and the
+ * character at `len' is '\0'. This is so that octstr_get_cstr will
+ * always work.
+ *
+ * `immutable' is 0 for mutable strings, OCTSTR_IMM_INTERNED for the
+ * strings returned by octstr_imm and OCTSTR_IMM_STATIC for the ones
+ * declared with OCTSTR_STATIC.
+ *
+ * `hash' caches octstr_hash_key for immutables, 0 if not known yet.
+ * Interned strings get it when they are created; static ones on first
+ * use, through gw_atomic_get/gw_atomic_set since any thread may be the
+ * first. Mutable strings never cache it.
+ */
+#define OCTSTR_INLINE_SIZE 24
+
+struct Octstr
+{
+    unsigned char *data;
+    long len;
+    long size;
+    int immutable;
+    volatile long hash;
+    unsigned char inline_data[OCTSTR_INLINE_SIZE];
+};
+
+#define OCTSTR_IMM_INTERNED 1
+#define OCTSTR_IMM_STATIC 2
+
+
+/*
+ * Declare `name' as a static immutable octet string wrapping the C string
+ * literal `cstr'. Unlike octstr_imm this needs no lookup at runtime, so it
+ * is the preferred way to name constant strings used on hot paths:
+ *
+ *	OCTSTR_STATIC(os_keep_alive, "keep-alive");
+ *	...
+ *	if (octstr_case_compare(h, os_keep_alive) == 0)
+ *
+ * `cstr' must be a string literal, since its length is taken with sizeof.
+ */
+#define OCTSTR_STATIC(name, cstr) \
+    static Octstr name##_octstr = { \
+        (unsigned char *) (cstr), sizeof(cstr) - 1, sizeof(cstr), \
+        OCTSTR_IMM_STATIC, 0, { 0 } }; \
+    static Octstr *const name = &name##_octstr
+
+
 /*
  * Initialize the Octstr subsystem.
  */
@@ -143,6 +208,9 @@ Octstr *octstr_create_from_data_real(const char *data, long len, const char *fil
  * octet string is destroyed. The immutable octet string need not be
  * destroyed - it is destroyed automatically when octstr_shutdown is
  * called. In fact, octstr_destroy is a no-op for immutables.
+ *
+ * Lookups of already known literals take no locks; the table of
+ * immutables grows as needed, so there is no limit on their number.
  */
 Octstr *octstr_imm(const char *cstr);
 
@@ -448,6 +516,16 @@ void octstr_insert_char(Octstr *ostr, long pos, const char c);
 void octstr_append_data(Octstr *ostr, const char *data, long len);
 
 
+/*
+ * Make room for at least `len' more octets at the tail of `ostr' and
+ * return a pointer to that room, so it can be filled directly, e.g. by
+ * read(). The octets become part of the string only when
+ * octstr_append_commit() is called with the number actually filled in.
+ */
+char *octstr_append_reserve(Octstr *ostr, long len);
+void octstr_append_commit(Octstr *ostr, long len);
+
+
 /*
  * Append a second octstr to the first.
  */
@@ -689,7 +767,8 @@ void octstr_format_append(Octstr *os, const char *fmt, ...);
 
 /*
  * Compute a hash key value for an octet string by adding all the 
- * octets together.
+ * octets together. The value is computed only once for immutables;
+ * for mutable strings it is computed on every call.
  */
 unsigned long octstr_hash_key(Octstr *ostr);
 
@@ -742,4 +821,63 @@ void octstr_convert_to_html_entities(Octstr* input);
  */
 void octstr_convert_from_html_entities(Octstr* input);
 
+
+/*
+ * Without assertion checking there is nothing left for the accessors
+ * below to do but to read the fields, so they are inlined to save the
+ * function call on every length check, character fetch or comparison.
+ * The out-of-line versions in octstr.c remain for everyone else.
+ */
+#ifdef NO_GWASSERT
+
+static inline long octstr_len_inline(const Octstr *ostr)
+{
+    return ostr == NULL ? 0 : ostr->len;
+}
+
+static inline int octstr_get_char_inline(const Octstr *ostr, long pos)
+{
+    if (pos >= ostr->len || pos < 0)
+        return -1;
+    return ostr->data[pos];
+}
+
+static inline char *octstr_get_cstr_inline(const Octstr *ostr)
+{
+    if (ostr == NULL)
+        return "(null)";
+    if (ostr->len == 0)
+        return "";
+    return (char *) ostr->data;
+}
+
+static inline int octstr_compare_inline(const Octstr *ostr1, const Octstr *ostr2)
+{
+    long len;
+    int ret;
+
+    if (ostr1 == ostr2)
+        return 0;
+    len = ostr1->len < ostr2->len ? ostr1->len : ostr2->len;
+    if (len > 0) {
+        /* most unequal strings already differ in the first octet */
+        if (ostr1->data[0] != ostr2->data[0])
+            return ostr1->data[0] < ostr2->data[0] ? -1 : 1;
+        ret = memcmp(ostr1->data, ostr2->data, len);
+        if (ret != 0)
+            return ret;
+    }
+    if (ostr1->len < ostr2->len)
+        return -1;
+    return ostr1->len > ostr2->len ? 1 : 0;
+}
+
+#define octstr_len(ostr) octstr_len_inline(ostr)
+#define octstr_get_char(ostr, pos) octstr_get_char_inline((ostr), (pos))
+#undef octstr_get_cstr
+#define octstr_get_cstr(ostr) octstr_get_cstr_inline(ostr)
+#define octstr_compare(ostr1, ostr2) octstr_compare_inline((ostr1), (ostr2))
+
+#endif
+
 #endif
@@ -68,10 +68,90 @@
  */
 
 #include <ctype.h>
+#include <time.h>
 
 #include "gwlib/gwlib.h"
 #include "regex.h"
 
+#ifdef HAVE_PCRE
+# include <pcre.h>
+#endif
+
+
+/********************************************************************
+ * Statistics.
+ *
+ * Each thread counts in one of REGEX_STAT_SLOTS counters, picked by its
+ * thread number and padded to a cache line of its own, so matching
+ * threads don't all write to the same line. The clock is only read on
+ * every REGEX_CLOCK_SAMPLE'th evaluation of a counter; when the second
+ * has changed then, the evaluations of the second that ended are the
+ * difference of the total to what it was when that second started.
+ */
+
+#define REGEX_STAT_SLOTS 64
+#define REGEX_CLOCK_SAMPLE 16
+
+static struct regex_stat_slot {
+    volatile long evaluations;
+    volatile long memo_hits;
+    char pad[64 - 2 * sizeof(long)];
+} stat_slots[REGEX_STAT_SLOTS];
+
+static volatile long this_second;
+static volatile long this_second_start;    /* evaluations when it began */
+static volatile long last_second_count;
+
+
+static long total_evaluations(void)
+{
+    long i, total = 0;
+
+    for (i = 0; i < REGEX_STAT_SLOTS; i++)
+        total += gw_atomic_get(&stat_slots[i].evaluations);
+    return total;
+}
+
+
+static void count_evaluation(int memo_hit)
+{
+    struct regex_stat_slot *slot;
+    long n, now, second, total;
+
+    slot = &stat_slots[(unsigned long) gwthread_self() % REGEX_STAT_SLOTS];
+    n = gw_atomic_inc(&slot->evaluations);
+    if (memo_hit)
+        gw_atomic_inc(&slot->memo_hits);
+    if (n % REGEX_CLOCK_SAMPLE != 0)
+        return;
+
+    now = (long) time(NULL);
+    second = gw_atomic_get(&this_second);
+    if (now != second && gw_atomic_cas(&this_second, second, now)) {
+        total = total_evaluations();
+        gw_atomic_set(&last_second_count, now == second + 1 ?
+                      total - gw_atomic_get(&this_second_start) : 0);
+        gw_atomic_set(&this_second_start, total);
+    }
+}
+
+
+void gw_regex_stats(RegexStats *stats)
+{
+    long i;
+
+    stats->evaluations = total_evaluations();
+    stats->memo_hits = 0;
+    for (i = 0; i < REGEX_STAT_SLOTS; i++)
+        stats->memo_hits += gw_atomic_get(&stat_slots[i].memo_hits);
+    /* nothing was counted in the last second if we are past it already */
+    if (gw_atomic_get(&this_second) >= (long) time(NULL) - 1)
+        stats->per_second = gw_atomic_get(&last_second_count);
+    else
+        stats->per_second = 0;
+}
+
+
 /* 
  * We allow to substitute the POSIX compliant regex routines via PCRE 
  * provided routines if no system own regex implementation is available.
@@ -79,6 +159,124 @@
 #if defined(HAVE_REGEX) || defined(HAVE_PCRE)
 
 
+/********************************************************************
+ * Compiled expressions.
+ *
+ * The regex_t handed out is the first member of a GWRegex, which also
+ * holds the memo of gw_regex_match_pre() and, with PCRE, the expression
+ * compiled by the native PCRE API.
+ *
+ * A memo entry is written by one thread at a time, which makes `seq'
+ * odd while writing. Readers check that `seq' was even and unchanged
+ * around reading the entry, and otherwise just match the subject.
+ */
+
+#define MEMO_ENTRIES 64
+#define MEMO_SUBJECT 32     /* longest subject remembered */
+
+typedef struct {
+    volatile long seq;
+    int len;
+    int result;
+    char subject[MEMO_SUBJECT];
+} MemoEntry;
+
+typedef struct {
+    regex_t preg;
+#ifdef HAVE_PCRE
+    pcre *code;
+    pcre_extra *extra;
+#endif
+    MemoEntry memo[MEMO_ENTRIES];
+} GWRegex;
+
+
+static unsigned long memo_hash(const char *s, long len)
+{
+    unsigned long h = 2166136261UL;
+    long i;
+
+    for (i = 0; i < len; i++)
+        h = (h ^ (unsigned char) s[i]) * 16777619UL;
+    return h;
+}
+
+
+/* Return 1 and set `result' if `s' is in the memo. */
+static int memo_get(MemoEntry *entry, const char *s, long len, int *result)
+{
+    long seq;
+    int ret;
+
+    seq = gw_atomic_get(&entry->seq);
+    if (seq & 1 || entry->len != len || memcmp(entry->subject, s, len) != 0)
+        return 0;
+    ret = entry->result;
+    gw_atomic_fence();
+    if (gw_atomic_get(&entry->seq) != seq)
+        return 0;
+
+    *result = ret;
+    return 1;
+}
+
+
+static void memo_put(MemoEntry *entry, const char *s, long len, int result)
+{
+    long seq;
+
+    seq = gw_atomic_get(&entry->seq);
+    if (seq & 1 || !gw_atomic_cas(&entry->seq, seq, seq + 1))
+        return;     /* somebody else is writing it */
+    entry->len = len;
+    entry->result = result;
+    memcpy(entry->subject, s, len);
+    gw_atomic_set(&entry->seq, seq + 2);
+}
+
+
+#ifdef HAVE_PCRE
+
+/* Compile `pattern' with the native PCRE API too, if it allows JIT. */
+static void compile_native(GWRegex *re, const char *pattern, int cflags)
+{
+#ifdef PCRE_STUDY_JIT_COMPILE
+    const char *err;
+    int options, offset;
+#endif
+
+    re->code = NULL;
+    re->extra = NULL;
+#ifdef PCRE_STUDY_JIT_COMPILE
+    options = 0;
+    if (cflags & REG_ICASE)
+        options |= PCRE_CASELESS;
+    if (cflags & REG_NEWLINE)
+        options |= PCRE_MULTILINE;
+    if ((re->code = pcre_compile(pattern, options, &err, &offset, NULL)) == NULL)
+        return;
+    re->extra = pcre_study(re->code, PCRE_STUDY_JIT_COMPILE, &err);
+    if (re->extra == NULL) {
+        pcre_free(re->code);
+        re->code = NULL;
+    }
+#endif
+}
+
+
+static void destroy_native(GWRegex *re)
+{
+#ifdef PCRE_STUDY_JIT_COMPILE
+    if (re->extra != NULL)
+        pcre_free_study(re->extra);
+    if (re->code != NULL)
+        pcre_free(re->code);
+#endif
+}
+
+#endif
+
+
 /********************************************************************
  * Generic regular expression functions.
  */
@@ -89,6 +287,9 @@ void gw_regex_destroy(regex_t *preg)
         return;
         
     regfree(preg);
+#ifdef HAVE_PCRE
+    destroy_native((GWRegex *) preg);
+#endif
     gw_free(preg);
 }
 
@@ -96,22 +297,30 @@ void gw_regex_destroy(regex_t *preg)
 regex_t *gw_regex_comp_real(const Octstr *pattern, int cflags, const char *file, 
                             long line, const char *func)
 {
-    int rc;
-    regex_t *preg;
+    int rc, i;
+    GWRegex *re;
     
-    preg = gw_malloc(sizeof(regex_t));
+    re = gw_malloc(sizeof(GWRegex));
 
-    if ((rc = regcomp(preg, pattern ? octstr_get_cstr(pattern) : NULL, cflags)) != 0) {
+    if ((rc = regcomp(&re->preg, pattern ? octstr_get_cstr(pattern) : NULL, cflags)) != 0) {
         char buffer[512];
-        regerror(rc, preg, buffer, sizeof(buffer)); 
+        regerror(rc, &re->preg, buffer, sizeof(buffer)); 
         error(0, "%s:%ld: %s: regex compilation `%s' failed: %s (Called from %s:%ld:%s.)",
               __FILE__, (long) __LINE__, __func__, octstr_get_cstr(pattern), buffer, 
               (file), (long) (line), (func));
-        gw_free(preg);
+        gw_free(re);
         return NULL;
     }
 
-    return preg;
+#ifdef HAVE_PCRE
+    compile_native(re, octstr_get_cstr(pattern), cflags);
+#endif
+    for (i = 0; i < MEMO_ENTRIES; i++) {
+        re->memo[i].seq = 0;
+        re->memo[i].len = -1;
+    }
+
+    return &re->preg;
 }
 
 
@@ -271,14 +480,48 @@ int gw_regex_match_real(const Octstr *re, const Octstr *os, const char *file,
 int gw_regex_match_pre_real(const regex_t *preg, const Octstr *os, const char *file, 
                             long line, const char *func)
 {
-    int rc;
+    GWRegex *re = (GWRegex *) preg;
+    MemoEntry *entry = NULL;
+    const char *s = NULL;
+    long len = 0;
+    int rc, result;
 
     gw_assert(preg != NULL);
 
+    if (os != NULL) {
+        s = octstr_get_cstr(os);
+        len = strlen(s);
+        if (len <= MEMO_SUBJECT) {
+            entry = &re->memo[memo_hash(s, len) % MEMO_ENTRIES];
+            if (memo_get(entry, s, len, &result)) {
+                count_evaluation(1);
+                return result;
+            }
+        }
+    }
+    count_evaluation(0);
+
+#ifdef HAVE_PCRE
+    if (re->extra != NULL && s != NULL) {
+        int ovector[3];
+
+        rc = pcre_exec(re->code, re->extra, s, len, 0, 0, ovector, 3);
+        if (rc >= 0 || rc == PCRE_ERROR_NOMATCH) {
+            result = rc >= 0;
+            if (entry != NULL)
+                memo_put(entry, s, len, result);
+            return result;
+        }
+    }
+#endif
+
     /* execute and match */
     rc = gw_regex_exec_real(preg, os, 0, NULL, 0, file, line, func);
+    result = (rc == 0) ? 1 : 0;
+    if (entry != NULL && (rc == 0 || rc == REG_NOMATCH))
+        memo_put(entry, s, len, result);
 
-    return (rc == 0) ? 1 : 0;
+    return result;
 }
 
 
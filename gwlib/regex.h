@@ -65,7 +65,13 @@
  * See regex(3) man page for more details on POSIX regular expressions.
  * 
  * PCRE allows wrapper functions for POSIX regex via an own API. So we
- * use PCRE in favor, before falling back to POSIX regex.
+ * use PCRE in favor, before falling back to POSIX regex. With PCRE, the
+ * expressions are also compiled with PCRE's JIT for gw_regex_match_pre(),
+ * if the library supports it.
+ *
+ * gw_regex_match_pre() remembers the results for the last short subjects
+ * each expression was matched against, as routing matches the same few
+ * smsc-ids and numbers against the same expressions again and again.
  *
  * Stipe Tolj <stolj@kannel.org>
  */
@@ -79,6 +85,19 @@
 # include <regex.h>
 #endif
 
+/*
+ * Counters of regular expression matching, for the status pages.
+ */
+typedef struct {
+    unsigned long evaluations;    /* matches done, including memo hits */
+    unsigned long memo_hits;      /* answered from a memo */
+    unsigned long per_second;     /* evaluations in the last full second,
+                                     measured on a sample */
+} RegexStats;
+
+void gw_regex_stats(RegexStats *stats);
+
+
 #if defined(HAVE_REGEX) || defined(HAVE_PCRE)
 
 
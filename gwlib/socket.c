@@ -129,7 +129,12 @@ int make_server_socket(int port, const char *interface_name )
         goto error;
     }
 
-    if (listen(s, 10) == -1) {
+    /*
+     * A backlog of only a few entries overflows as soon as a client opens
+     * a burst of connections, and the kernel then silently drops the
+     * handshakes, stalling the client for seconds in SYN retransmits.
+     */
+    if (listen(s, SOMAXCONN) == -1) {
         error(errno, "listen failed");
         goto error;
     }
@@ -157,12 +162,13 @@ int tcpip_connect_to_server_with_port(char *hostname, int port, int our_port, co
 {
     struct sockaddr_in addr;
     struct sockaddr_in o_addr;
-    struct hostent hostinfo;
+    struct in_addr *addrs;
     struct hostent o_hostinfo;
-    int s, rc = -1, i;
-    char *buff, *buff1;
+    int s, rc = -1, i, naddrs;
+    char *buff1;
 
-    buff = buff1 = NULL;
+    buff1 = NULL;
+    addrs = NULL;
 
     s = socket(PF_INET, SOCK_STREAM, 0);
     if (s == -1) {
@@ -170,8 +176,8 @@ int tcpip_connect_to_server_with_port(char *hostname, int port, int our_port, co
         goto error;
     }
 
-    if (gw_gethostbyname(&hostinfo, hostname, &buff) == -1) {
-        error(errno, "gethostbyname failed");
+    if ((naddrs = gw_dns_resolve(hostname, &addrs)) == -1) {
+        error(0, "Couldn't resolve host name `%s'", hostname);
         goto error;
     }
 
@@ -209,7 +215,7 @@ int tcpip_connect_to_server_with_port(char *hostname, int port, int our_port, co
         addr = empty_sockaddr_in;
         addr.sin_family = AF_INET;
         addr.sin_port = htons(port);
-        addr.sin_addr = *(struct in_addr *) hostinfo.h_addr_list[i];
+        addr.sin_addr = addrs[i];
 
         ip2 = gw_netaddr_to_octstr(AF_INET, &addr.sin_addr);
 
@@ -220,12 +226,12 @@ int tcpip_connect_to_server_with_port(char *hostname, int port, int our_port, co
             error(errno, "connect to <%s> failed", octstr_get_cstr(ip2));
         }
         octstr_destroy(ip2);
-    } while (rc == -1 && hostinfo.h_addr_list[++i] != NULL);
+    } while (rc == -1 && ++i < naddrs);
 
     if (rc == -1)
         goto error;
 
-    gw_free(buff);
+    gw_free(addrs);
     gw_free(buff1);
     return s;
 
@@ -233,7 +239,7 @@ error:
     error(0, "error connecting to server `%s' at port `%d'", hostname, port);
     if (s >= 0)
         close(s);
-    gw_free(buff);
+    gw_free(addrs);
     gw_free(buff1);
     return -1;
 }
@@ -247,13 +253,14 @@ int tcpip_connect_nb_to_server_with_port(char *hostname, int port, int our_port,
 {
     struct sockaddr_in addr;
     struct sockaddr_in o_addr;
-    struct hostent hostinfo;
+    struct in_addr *addrs;
     struct hostent o_hostinfo;
-    int s, flags, rc = -1, i;
-    char *buff, *buff1;
+    int s, flags, rc = -1, i, naddrs;
+    char *buff1;
 
     *done = 1;
-    buff = buff1 = NULL;
+    buff1 = NULL;
+    addrs = NULL;
 
     s = socket(PF_INET, SOCK_STREAM, 0);
     if (s == -1) {
@@ -261,8 +268,8 @@ int tcpip_connect_nb_to_server_with_port(char *hostname, int port, int our_port,
         goto error;
     }
 
-    if (gw_gethostbyname(&hostinfo, hostname, &buff) == -1) {
-        error(errno, "gethostbyname failed");
+    if ((naddrs = gw_dns_resolve(hostname, &addrs)) == -1) {
+        error(0, "Couldn't resolve host name `%s'", hostname);
         goto error;
     }
 
@@ -303,7 +310,7 @@ int tcpip_connect_nb_to_server_with_port(char *hostname, int port, int our_port,
         addr = empty_sockaddr_in;
         addr.sin_family = AF_INET;
         addr.sin_port = htons(port);
-        addr.sin_addr = *(struct in_addr *) hostinfo.h_addr_list[i];
+        addr.sin_addr = addrs[i];
 
         ip2 = gw_netaddr_to_octstr(AF_INET, &addr.sin_addr);
 
@@ -315,7 +322,7 @@ int tcpip_connect_nb_to_server_with_port(char *hostname, int port, int our_port,
             }
         }
         octstr_destroy(ip2);
-    } while (rc == -1 && errno != EINPROGRESS && hostinfo.h_addr_list[++i] != NULL);
+    } while (rc == -1 && errno != EINPROGRESS && ++i < naddrs);
 
     if (rc == -1 && errno != EINPROGRESS)
         goto error;
@@ -327,7 +334,7 @@ int tcpip_connect_nb_to_server_with_port(char *hostname, int port, int our_port,
         *done = 0;
     }
 
-    gw_free(buff);
+    gw_free(addrs);
     gw_free(buff1);
 
     return s;
@@ -336,7 +343,7 @@ error:
     error(0, "error connecting to server `%s' at port `%d'", hostname, port);
     if (s >= 0)
         close(s);
-    gw_free(buff);
+    gw_free(addrs);
     gw_free(buff1);
     return -1;
 }
@@ -517,8 +524,7 @@ int udp_bind(int port, const char *interface_name)
 Octstr *udp_create_address(Octstr *host_or_ip, int port)
 {
     struct sockaddr_in sa;
-    struct hostent h;
-    char *buff = NULL;
+    struct in_addr *addrs;
     Octstr *ret;
 
     sa = empty_sockaddr_in;
@@ -528,17 +534,16 @@ Octstr *udp_create_address(Octstr *host_or_ip, int port)
     if (strcmp(octstr_get_cstr(host_or_ip), "*") == 0) {
         sa.sin_addr.s_addr = INADDR_ANY;
     } else {
-        if (gw_gethostbyname(&h, octstr_get_cstr(host_or_ip), &buff) == -1) {
+        if (gw_dns_resolve(octstr_get_cstr(host_or_ip), &addrs) == -1) {
             error(0, "Couldn't find the IP number of `%s'",
                   octstr_get_cstr(host_or_ip));
-            gw_free(buff);
             return NULL;
         }
-        sa.sin_addr = *(struct in_addr *) h.h_addr;
+        sa.sin_addr = addrs[0];
+        gw_free(addrs);
     }
 
     ret = octstr_create_from_data((char *) &sa, sizeof(sa));
-    gw_free(buff);
 
     return ret;
 }
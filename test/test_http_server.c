@@ -260,6 +260,8 @@ static void help(void) {
     info(0, "where options are:");
     info(0, "-t number");
     info(0, "    set number of working threads to use (default: 1)");
+    info(0, "-P number");
+    info(0, "    set number of threads reading requests (default: 1)");
     info(0, "-v number");
     info(0, "    set log level for stderr logging (default: 0 - debug)");
     info(0, "-l logfile");
@@ -309,7 +311,7 @@ static void sigterm(int signo) {
 }
 
 int main(int argc, char **argv) {
-    int i, opt, use_threads;
+    int i, opt, use_threads, poll_threads;
     struct sigaction act;
     char *filename;
     Octstr *log_filename;
@@ -335,6 +337,7 @@ int main(int argc, char **argv) {
 
     port = 8080;
     use_threads = 1;
+    poll_threads = 1;
     verbose = 1;
     run = 1;
     filename = NULL;
@@ -346,7 +349,7 @@ int main(int argc, char **argv) {
 
     reply_text = octstr_create("Sent.");
 
-    while ((opt = getopt(argc, argv, "hqv:p:t:f:l:sc:k:b:w:r:H:")) != EOF) {
+    while ((opt = getopt(argc, argv, "hqv:p:t:P:f:l:sc:k:b:w:r:H:")) != EOF) {
 	switch (opt) {
 	case 'v':
 	    log_set_output_level(atoi(optarg));
@@ -370,6 +373,10 @@ int main(int argc, char **argv) {
             use_threads = MAX_THREADS;
 	    break;
 
+	case 'P':
+	    poll_threads = atoi(optarg);
+	    break;
+
         case 'c':
 #ifdef HAVE_LIBSSL
 	    octstr_destroy(ssl_server_cert_file);
@@ -481,7 +488,7 @@ int main(int argc, char **argv) {
     }
 #endif
      
-    if (http_open_port(port, ssl) == -1)
+    if (http_open_port_threads(port, ssl, NULL, poll_threads) == -1)
         panic(0, "http_open_server failed");
 
     /*
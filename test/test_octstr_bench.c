@@ -0,0 +1,335 @@
+/* ==================================================================== 
+ * The Kannel Software License, Version 1.0 
+ * 
+ * Copyright (c) 2001-2010 Kannel Group  
+ * Copyright (c) 1998-2001 WapIT Ltd.   
+ * All rights reserved. 
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions 
+ * are met: 
+ * 
+ * 1. Redistributions of source code must retain the above copyright 
+ *    notice, this list of conditions and the following disclaimer. 
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in 
+ *    the documentation and/or other materials provided with the 
+ *    distribution. 
+ * 
+ * 3. The end-user documentation included with the redistribution, 
+ *    if any, must include the following acknowledgment: 
+ *       "This product includes software developed by the 
+ *        Kannel Group (http://www.kannel.org/)." 
+ *    Alternately, this acknowledgment may appear in the software itself, 
+ *    if and wherever such third-party acknowledgments normally appear. 
+ * 
+ * 4. The names "Kannel" and "Kannel Group" must not be used to 
+ *    endorse or promote products derived from this software without 
+ *    prior written permission. For written permission, please  
+ *    contact org@kannel.org. 
+ * 
+ * 5. Products derived from this software may not be called "Kannel", 
+ *    nor may "Kannel" appear in their name, without prior written 
+ *    permission of the Kannel Group. 
+ * 
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESSED OR IMPLIED 
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES 
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+ * DISCLAIMED.  IN NO EVENT SHALL THE KANNEL GROUP OR ITS CONTRIBUTORS 
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,  
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT  
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR  
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,  
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE  
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,  
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. 
+ * ==================================================================== 
+ * 
+ * This software consists of voluntary contributions made by many 
+ * individuals on behalf of the Kannel Group.  For more information on  
+ * the Kannel Group, please see <http://www.kannel.org/>. 
+ * 
+ * Portions of this software are based upon software originally written at  
+ * WapIT Ltd., Helsinki, Finland for the Kannel project.  
+ */ 
+
+/*
+ * test_octstr_bench.c - measure allocation and throughput of octet strings
+ *
+ * Runs the operations the gateway does most with Octstr: creating and
+ * destroying short strings (phone numbers, smsc-ids, message ids) and
+ * message sized ones, building strings by appending, comparing, hashing
+ * and looking up immutables, and the byte loops of searching, URL
+ * encoding and base64 encoding message bodies. Prints one line per operation with the
+ * number of operations per second; benchmarks/bench_octstr.sh turns
+ * that into a report.
+ */
+
+#include <stdio.h>
+#include <sys/time.h>
+
+#include "gwlib/gwlib.h"
+
+static long rounds = 1000000;
+
+
+static double now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+
+static void report(const char *name, long ops, double start)
+{
+    double secs = now() - start;
+
+    if (secs <= 0)
+        secs = 1e-6;
+    printf("%-24s %12.0f ops/s\n", name, ops / secs);
+}
+
+
+static void bench_create_short(void)
+{
+    double start = now();
+    long i;
+
+    for (i = 0; i < rounds; ++i)
+        octstr_destroy(octstr_create("+358401234567"));
+    report("create-short", rounds, start);
+}
+
+
+static void bench_create_long(void)
+{
+    char text[161];
+    double start;
+    long i;
+
+    memset(text, 'x', 160);
+    text[160] = '\0';
+    start = now();
+    for (i = 0; i < rounds; ++i)
+        octstr_destroy(octstr_create(text));
+    report("create-long", rounds, start);
+}
+
+
+static void bench_append(void)
+{
+    Octstr *os;
+    double start = now();
+    long i;
+
+    for (i = 0; i < rounds; ++i) {
+        os = octstr_create("");
+        octstr_append_cstr(os, "smsc-");
+        octstr_append_decimal(os, i);
+        octstr_append_char(os, ':');
+        octstr_append_cstr(os, "+358401234567");
+        octstr_destroy(os);
+    }
+    report("append", rounds, start);
+}
+
+
+static void bench_compare(void)
+{
+    Octstr *a, *b, *c;
+    double start;
+    long i, n;
+
+    a = octstr_create("+358401234567");
+    b = octstr_create("+358401234567");
+    c = octstr_create("+358409876543");
+    n = 0;
+    start = now();
+    for (i = 0; i < rounds; ++i) {
+        n += octstr_compare(a, b) == 0;
+        n += octstr_compare(a, c) == 0;
+        n += octstr_len(a) + octstr_get_char(c, i % 13);
+    }
+    report("compare", rounds * 2, start);
+    octstr_destroy(a);
+    octstr_destroy(b);
+    octstr_destroy(c);
+    if (n == 0)
+        panic(0, "compare benchmark optimized away");
+}
+
+
+static void bench_hash(void)
+{
+    Octstr *os;
+    unsigned long sum = 0;
+    double start;
+    long i;
+
+    os = octstr_create("smsc-id-of-some-operator");
+    start = now();
+    for (i = 0; i < rounds; ++i)
+        sum += octstr_hash_key(os);
+    report("hash-key", rounds, start);
+    octstr_destroy(os);
+    if (sum == 0)
+        panic(0, "hash benchmark optimized away");
+}
+
+
+static void bench_immutables(void)
+{
+    double start = now();
+    long i, n = 0;
+
+    for (i = 0; i < rounds; ++i) {
+        n += octstr_len(octstr_imm("dlr-db"));
+        n += octstr_len(octstr_imm("smsc-id"));
+        n += octstr_len(octstr_imm("Content-Type"));
+        n += octstr_len(octstr_imm("keep-alive"));
+    }
+    report("octstr-imm", rounds * 4, start);
+    if (n == 0)
+        panic(0, "immutables benchmark optimized away");
+}
+
+
+static void bench_dict(void)
+{
+    Dict *dict;
+    Octstr *key;
+    double start;
+    long i, n = 0;
+
+    dict = dict_create(1024, octstr_destroy_item);
+    key = octstr_create("");
+    start = now();
+    for (i = 0; i < rounds / 10; ++i) {
+        octstr_truncate(key, 0);
+        octstr_format_append(key, "+35840%07ld", i % 1000);
+        if (dict_get(dict, key) == NULL)
+            dict_put(dict, key, octstr_duplicate(key));
+        else
+            ++n;
+    }
+    report("dict-msisdn", rounds / 10, start);
+    octstr_destroy(key);
+    dict_destroy(dict);
+}
+
+
+static void bench_search(void)
+{
+    Octstr *body, *needle;
+    double start;
+    long i, n = 0;
+
+    body = octstr_create("");
+    for (i = 0; i < 20; ++i)
+        octstr_append_cstr(body, "Content-Type: text/plain; charset=UTF-8\r\n");
+    octstr_append_cstr(body, "X-Kannel-SMSC: modem\r\n\r\n");
+    needle = octstr_create("\r\n\r\n");
+    start = now();
+    for (i = 0; i < rounds; ++i) {
+        n += octstr_search(body, needle, 0);
+        n += octstr_case_search(body, octstr_imm("x-kannel-smsc"), 0);
+    }
+    report("search", rounds * 2, start);
+    octstr_destroy(body);
+    octstr_destroy(needle);
+    if (n == 0)
+        panic(0, "search benchmark optimized away");
+}
+
+
+static void bench_url_encode(void)
+{
+    Octstr *text, *os;
+    double start;
+    long i;
+
+    text = octstr_create("Hello world, meet me at 5 pm (downtown) "
+                         "and bring the tickets! Thanks.");
+    octstr_append(text, text);
+    start = now();
+    for (i = 0; i < rounds; ++i) {
+        os = octstr_duplicate(text);
+        octstr_url_encode(os);
+        octstr_url_decode(os);
+        octstr_destroy(os);
+    }
+    report("url-encode-decode", rounds, start);
+    octstr_destroy(text);
+}
+
+
+static void bench_base64(void)
+{
+    Octstr *os;
+    double start;
+    long i;
+
+    start = now();
+    for (i = 0; i < rounds; ++i) {
+        os = octstr_create("");
+        octstr_append_data(os, "0123456789abcdefghijklmnopqrstuvwxyz"
+                           "0123456789abcdefghijklmnopqrstuvwxyz"
+                           "0123456789abcdefghijklmnopqrstuvwxyz"
+                           "0123456789abcdefghijklmnopqrstuvwxyz"
+                           "0123456789abcdef", 160);
+        octstr_binary_to_base64(os);
+        octstr_destroy(os);
+    }
+    report("base64-encode", rounds, start);
+}
+
+
+static void help(void)
+{
+    info(0, "Usage: test_octstr_bench [-r rounds]");
+}
+
+
+int main(int argc, char **argv)
+{
+    int opt;
+
+    gwlib_init();
+
+    while ((opt = getopt(argc, argv, "hr:")) != EOF) {
+        switch (opt) {
+        case 'r':
+            rounds = atol(optarg);
+            break;
+        case 'h':
+            help();
+            exit(0);
+        case '?':
+        default:
+            error(0, "Invalid option %c", opt);
+            help();
+            panic(0, "Stopping.");
+        }
+    }
+    if (rounds < 10)
+        rounds = 10;
+
+    log_set_output_level(GW_INFO);
+
+    bench_create_short();
+    bench_create_long();
+    bench_append();
+    bench_compare();
+    bench_hash();
+    bench_immutables();
+    bench_dict();
+    bench_search();
+    bench_url_encode();
+    bench_base64();
+
+    gwlib_shutdown();
+    return 0;
+}
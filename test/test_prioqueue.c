@@ -68,6 +68,11 @@ static int my_cmp(const void *a, const void *b)
     return octstr_compare((Octstr*) a, (Octstr*) b);
 } 
 
+static long my_level(const void *a)
+{
+    return octstr_get_char((Octstr*) a, 0) - '0';
+}
+
 static void my_dump(const void *a, long index)
 {    
     debug("", 0, "dump(%p, %ld) called", a, index);    
@@ -101,6 +106,19 @@ int main()
     }   
     
     debug("", 0, "gw_prioqueue_len=%ld", gw_prioqueue_len(queue));    
+    gw_prioqueue_destroy(queue, NULL);
+
+    /* levels 0..4, with "9" clamped to the highest one */
+    queue = gw_prioqueue_create_levels(5, my_level);
+    os = octstr_imm("1930421304");
+    for (i = 0; i < octstr_len(os); i++)
+        gw_prioqueue_insert(queue, octstr_copy(os, i, 1));
+    gw_prioqueue_foreach(queue, my_dump);
+    while ((os = gw_prioqueue_remove(queue))) {
+        debug("", 0, "%s", octstr_get_cstr(os));
+        octstr_destroy(os);
+    }
+    gw_prioqueue_destroy(queue, NULL);
     
     gwlib_shutdown();    
     return 0;